@@ -30,11 +30,15 @@
 #ifndef __WINH_OBJ_H__
 #define __WINH_OBJ_H__
 
+#include <atomic>
 #include <condition_variable>
 #include <mutex>
+#include <thread>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/tss.hpp>
 
 namespace epee
 {
@@ -140,39 +144,91 @@ namespace epee
   };
 
 
-#if defined(WINDWOS_PLATFORM)
+  /************************************************************************/
+  /* Reader/writer lock. Both modes are recursive: a thread may take the  */
+  /* lock shared or exclusive again while it holds it, and a thread which */
+  /* holds it exclusive may also take it shared. Taking it exclusive      */
+  /* while holding it only shared is not supported (it would deadlock).   */
+  /************************************************************************/
   class shared_critical_section
   {
-  public: 
-    shared_critical_section()
-    {
-      ::InitializeSRWLock(&m_srw_lock);
-    }
+  public:
+    shared_critical_section():m_exclusive_owner(std::thread::id()), m_exclusive_recursion(0)
+    {}
+
     ~shared_critical_section()
     {}
 
     bool lock_shared()
     {
-      AcquireSRWLockShared(&m_srw_lock);
+      if(owns_exclusive())
+      {
+        ++m_exclusive_recursion;
+        return true;
+      }
+      if(0 == shared_recursion()++)
+        m_section.lock_shared();
       return true;
     }
     bool unlock_shared()
     {
-      ReleaseSRWLockShared(&m_srw_lock);
+      if(owns_exclusive())
+      {
+        --m_exclusive_recursion;
+        return true;
+      }
+      if(0 == --shared_recursion())
+        m_section.unlock_shared();
       return true;
     }
     bool lock_exclusive()
     {
-      ::AcquireSRWLockExclusive(&m_srw_lock);
+      if(owns_exclusive())
+      {
+        ++m_exclusive_recursion;
+        return true;
+      }
+      m_section.lock();
+      m_exclusive_owner = std::this_thread::get_id();
+      m_exclusive_recursion = 1;
       return true;
     }
     bool unlock_exclusive()
     {
-      ::ReleaseSRWLockExclusive(&m_srw_lock);
+      if(0 == --m_exclusive_recursion)
+      {
+        m_exclusive_owner = std::thread::id();
+        m_section.unlock();
+      }
       return true;
     }
+
+    //so that CRITICAL_REGION_LOCAL still works on it, as an exclusive lock
+    void lock()
+    {
+      lock_exclusive();
+    }
+    void unlock()
+    {
+      unlock_exclusive();
+    }
+
   private:
-    SRWLOCK m_srw_lock;
+    bool owns_exclusive() const
+    {
+      return m_exclusive_owner.load() == std::this_thread::get_id();
+    }
+    unsigned& shared_recursion()
+    {
+      if(!m_shared_recursion.get())
+        m_shared_recursion.reset(new unsigned(0));
+      return *m_shared_recursion;
+    }
+
+    boost::shared_mutex m_section;
+    std::atomic<std::thread::id> m_exclusive_owner;
+    unsigned m_exclusive_recursion;
+    boost::thread_specific_ptr<unsigned> m_shared_recursion;
   };
 
 
@@ -210,10 +266,11 @@ namespace epee
   private:
     shared_critical_section& m_ref_sec;
   };
-#endif
 
-#define  SHARED_CRITICAL_REGION_BEGIN(x) { shared_guard   critical_region_var(x)
-#define  EXCLUSIVE_CRITICAL_REGION_BEGIN(x) { exclusive_guard   critical_region_var(x)
+#define  SHARED_CRITICAL_REGION_BEGIN(x) { epee::shared_guard   critical_region_var(x)
+#define  EXCLUSIVE_CRITICAL_REGION_BEGIN(x) { epee::exclusive_guard   critical_region_var(x)
+#define  SHARED_CRITICAL_REGION_LOCAL(x) epee::shared_guard   critical_region_var(x)
+#define  EXCLUSIVE_CRITICAL_REGION_LOCAL(x) epee::exclusive_guard   critical_region_var(x)
 
 #define  CRITICAL_REGION_LOCAL(x) epee::critical_region_t<decltype(x)>   critical_region_var(x)
 #define  CRITICAL_REGION_BEGIN(x) { epee::critical_region_t<decltype(x)>   critical_region_var(x)
@@ -30,6 +30,7 @@
 
 #pragma once
 
+#include <sstream>
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/archive/binary_iarchive.hpp>
 
@@ -92,6 +93,33 @@ namespace tools
     CATCH_ENTRY_L0("serialize_obj_to_file", false);
   }
 
+  template<class t_object>
+  bool serialize_obj_to_blob(t_object& obj, std::string& blob)
+  {
+    TRY_ENTRY();
+    std::ostringstream data;
+    {
+      boost::archive::binary_oarchive a(data);
+      a << obj;
+    }
+    if(data.fail())
+      return false;
+    blob = data.str();
+    return true;
+    CATCH_ENTRY_L0("serialize_obj_to_blob", false);
+  }
+
+  template<class t_object>
+  bool unserialize_obj_from_blob(t_object& obj, const std::string& blob)
+  {
+    TRY_ENTRY();
+    std::istringstream data(blob);
+    boost::archive::binary_iarchive a(data);
+    a >> obj;
+    return !data.fail();
+    CATCH_ENTRY_L0("unserialize_obj_from_blob", false);
+  }
+
   template<class t_object>
   bool unserialize_obj_from_file(t_object& obj, const std::string& file_path)
   {
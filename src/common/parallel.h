@@ -0,0 +1,99 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "thread_pool.h"
+
+namespace tools
+{
+  /*! \brief Runs job(0) .. job(count - 1) on the shared thread pool, the calling thread included.
+   *
+   * \details Jobs are handed out one index at a time, so uneven jobs balance out.
+   * The caller works through the jobs too and only waits for jobs already started elsewhere,
+   * so jobs may call run_in_parallel themselves even when the pool is busy.
+   * The call returns once every job has finished; the first exception a job threw is rethrown.
+   */
+  template<class t_job>
+  void run_in_parallel(size_t count, t_job job)
+  {
+    struct parallel_state
+    {
+      std::atomic<size_t> next;
+      std::atomic<size_t> done;
+      boost::mutex lock;
+      boost::condition_variable finished;
+      std::exception_ptr error;
+    };
+    //pool tasks may only get to run after the caller has returned, they then find nothing left to do
+    std::shared_ptr<parallel_state> state = std::make_shared<parallel_state>();
+    state->next = 0;
+    state->done = 0;
+    t_job* job_ptr = &job;
+    auto worker = [state, job_ptr, count]()
+    {
+      for(size_t i = state->next++; i < count; i = state->next++)
+      {
+        try
+        {
+          (*job_ptr)(i);
+        }
+        catch(...)
+        {
+          boost::unique_lock<boost::mutex> lock(state->lock);
+          if(!state->error)
+            state->error = std::current_exception();
+        }
+        if(++state->done == count)
+        {
+          boost::unique_lock<boost::mutex> lock(state->lock);
+          state->finished.notify_all();
+        }
+      }
+    };
+
+    thread_pool& pool = thread_pool::instance();
+    size_t helpers_count = std::min(pool.threads_count(), count ? count - 1 : 0);
+    for(size_t i = 0; i != helpers_count; i++)
+      pool.submit(worker);
+    worker();
+
+    boost::unique_lock<boost::mutex> lock(state->lock);
+    while(state->done != count)
+      state->finished.wait(lock);
+    if(state->error)
+      std::rethrow_exception(state->error);
+  }
+}
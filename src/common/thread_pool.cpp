@@ -0,0 +1,88 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <algorithm>
+#include <thread>
+#include <boost/bind.hpp>
+
+#include "include_base_utils.h"
+#include "thread_pool.h"
+
+namespace tools
+{
+  //------------------------------------------------------------------
+  thread_pool& thread_pool::instance()
+  {
+    //never destroyed, tasks may still be running while static objects go away at exit
+    static thread_pool* pool = new thread_pool(std::max(std::thread::hardware_concurrency(), 1u));
+    return *pool;
+  }
+  //------------------------------------------------------------------
+  thread_pool::thread_pool(size_t threads_count)
+    : m_threads_count(threads_count)
+  {
+    for(size_t i = 0; i != m_threads_count; i++)
+      m_threads.create_thread(boost::bind(&thread_pool::run, this));
+  }
+  //------------------------------------------------------------------
+  void thread_pool::submit(const std::function<void()>& task)
+  {
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      m_tasks.push_back(task);
+    }
+    m_has_tasks.notify_one();
+  }
+  //------------------------------------------------------------------
+  void thread_pool::run()
+  {
+    while(true)
+    {
+      std::function<void()> task;
+      {
+        boost::unique_lock<boost::mutex> lock(m_lock);
+        while(m_tasks.empty())
+          m_has_tasks.wait(lock);
+        task.swap(m_tasks.front());
+        m_tasks.pop_front();
+      }
+      try
+      {
+        task();
+      }
+      catch(const std::exception& e)
+      {
+        LOG_ERROR("Exception in thread pool task: " << e.what());
+      }
+      catch(...)
+      {
+        LOG_ERROR("Unknown exception in thread pool task");
+      }
+    }
+  }
+}
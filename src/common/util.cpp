@@ -40,8 +40,11 @@ using namespace epee;
 #include <windows.h>
 #include <shlobj.h>
 #include <strsafe.h>
+#include <io.h>
 #else 
 #include <sys/utsname.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 
@@ -389,4 +392,28 @@ std::string get_nix_version_display_string()
 #endif
     return std::error_code(code, std::system_category());
   }
+
+  bool sync_file(std::FILE* f)
+  {
+    if (0 != std::fflush(f))
+      return false;
+#if defined(WIN32)
+    return 0 == _commit(_fileno(f));
+#else
+    return 0 == fsync(fileno(f));
+#endif
+  }
+
+  bool sync_directory(const std::string& path)
+  {
+#if defined(WIN32)
+    return true;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    bool ok = 0 == fsync(fd);
+    return 0 == ::close(fd) && ok;
+#endif
+  }
 }
@@ -30,6 +30,7 @@
 
 #pragma once 
 
+#include <cstdio>
 #include <mutex>
 #include <system_error>
 #include <boost/filesystem.hpp>
@@ -87,6 +88,14 @@ namespace tools
   /*! \brief std::rename wrapper for nix and something strange for windows.
    */
   std::error_code replace_file(const std::string& replacement_name, const std::string& replaced_name);
+  /*! \brief flushes f and has the OS write the file to the disk
+   */
+  bool sync_file(std::FILE* f);
+  /*! \brief has the OS write the entries of a directory to the disk, so files created or renamed in it stay so
+   *
+   * \details does nothing on Windows, where directories can't be synced
+   */
+  bool sync_directory(const std::string& path);
 
   inline crypto::hash get_proof_of_trust_hash(const nodetool::proof_of_trust& pot)
   {
@@ -343,6 +343,133 @@ static int fe_isnonzero(const fe f) {
     s[27] | s[28] | s[29] | s[30] | s[31]) - 1) >> 8) + 1;
 }
 
+/* 64-bit field multiplication */
+
+/*
+Where the compiler has 128-bit integers, fe_mul, fe_sq and fe_sq2 regroup the
+ten limbs into five of 51 bits, F0 = f0 + 2^26 f1, F1 = f2 + 2^26 f3, etc.,
+and multiply those with 64x64->128 bit products: 25 of them instead of 100.
+The result is split back into ten limbs and carried exactly like the ref10
+code does, so it meets the same postconditions and the rest of the code,
+which only relies on those bounds, is unaffected.
+
+With the preconditions below |F| <= 1.65*2^51, so each product is below
+2^104 and each radix 2^51 coefficient, with the 19 (38 when squaring) folded
+in, stays below 2^112.
+
+Defining FE_NO_RADIX51 builds the ref10 code instead, the tests check both.
+*/
+
+#if defined(__SIZEOF_INT128__) && !defined(FE_NO_RADIX51)
+#define FE_RADIX51
+
+typedef __int128 fe_int128;
+
+static void fe_to_radix51(int64_t r[5], const fe f) {
+  r[0] = f[0] + (int64_t) f[1] * (1 << 26);
+  r[1] = f[2] + (int64_t) f[3] * (1 << 26);
+  r[2] = f[4] + (int64_t) f[5] * (1 << 26);
+  r[3] = f[6] + (int64_t) f[7] * (1 << 26);
+  r[4] = f[8] + (int64_t) f[9] * (1 << 26);
+}
+
+static void fe_from_radix51(fe h, fe_int128 c0, fe_int128 c1, fe_int128 c2, fe_int128 c3, fe_int128 c4) {
+  const int64_t mask51 = ((int64_t) 1 << 51) - 1;
+  const int64_t mask26 = (1 << 26) - 1;
+  int64_t r0, r1, r2, r3, r4;
+  int64_t h0, h1, h2, h3, h4, h5, h6, h7, h8, h9;
+  int64_t carry0, carry1, carry2, carry3, carry4, carry5, carry6, carry7, carry8, carry9;
+
+  c1 += c0 >> 51; r0 = (int64_t) c0 & mask51;
+  c2 += c1 >> 51; r1 = (int64_t) c1 & mask51;
+  c3 += c2 >> 51; r2 = (int64_t) c2 & mask51;
+  c4 += c3 >> 51; r3 = (int64_t) c3 & mask51;
+  c0 = r0 + (c4 >> 51) * 19; r4 = (int64_t) c4 & mask51;
+  r1 += (int64_t) (c0 >> 51); r0 = (int64_t) c0 & mask51;
+  /* 0 <= r0, r2, r3, r4 < 2^51 */
+  /* |r1| < 2^52 */
+
+  h0 = r0 & mask26; h1 = r0 >> 26;
+  h2 = r1 & mask26; h3 = r1 >> 26;
+  h4 = r2 & mask26; h5 = r2 >> 26;
+  h6 = r3 & mask26; h7 = r3 >> 26;
+  h8 = r4 & mask26; h9 = r4 >> 26;
+
+  carry0 = (h0 + (int64_t) (1<<25)) >> 26; h1 += carry0; h0 -= carry0 << 26;
+  carry1 = (h1 + (int64_t) (1<<24)) >> 25; h2 += carry1; h1 -= carry1 << 25;
+  carry2 = (h2 + (int64_t) (1<<25)) >> 26; h3 += carry2; h2 -= carry2 << 26;
+  carry3 = (h3 + (int64_t) (1<<24)) >> 25; h4 += carry3; h3 -= carry3 << 25;
+  carry4 = (h4 + (int64_t) (1<<25)) >> 26; h5 += carry4; h4 -= carry4 << 26;
+  carry5 = (h5 + (int64_t) (1<<24)) >> 25; h6 += carry5; h5 -= carry5 << 25;
+  carry6 = (h6 + (int64_t) (1<<25)) >> 26; h7 += carry6; h6 -= carry6 << 26;
+  carry7 = (h7 + (int64_t) (1<<24)) >> 25; h8 += carry7; h7 -= carry7 << 25;
+  carry8 = (h8 + (int64_t) (1<<25)) >> 26; h9 += carry8; h8 -= carry8 << 26;
+  carry9 = (h9 + (int64_t) (1<<24)) >> 25; h0 += carry9 * 19; h9 -= carry9 << 25;
+  carry0 = (h0 + (int64_t) (1<<25)) >> 26; h1 += carry0; h0 -= carry0 << 26;
+  /* |h0| <= 2^25, |h1| <= 1.01*2^24, |h2| <= 2^25, |h3| <= 2^24, etc. */
+
+  h[0] = (int32_t) h0;
+  h[1] = (int32_t) h1;
+  h[2] = (int32_t) h2;
+  h[3] = (int32_t) h3;
+  h[4] = (int32_t) h4;
+  h[5] = (int32_t) h5;
+  h[6] = (int32_t) h6;
+  h[7] = (int32_t) h7;
+  h[8] = (int32_t) h8;
+  h[9] = (int32_t) h9;
+}
+
+static void fe_mul(fe h, const fe f, const fe g) {
+  int64_t F[5], G[5];
+  int64_t G1_19, G2_19, G3_19, G4_19;
+  fe_to_radix51(F, f);
+  fe_to_radix51(G, g);
+  G1_19 = 19 * G[1];
+  G2_19 = 19 * G[2];
+  G3_19 = 19 * G[3];
+  G4_19 = 19 * G[4];
+  fe_from_radix51(h,
+    (fe_int128) F[0] * G[0] + (fe_int128) F[1] * G4_19 + (fe_int128) F[2] * G3_19 + (fe_int128) F[3] * G2_19 + (fe_int128) F[4] * G1_19,
+    (fe_int128) F[0] * G[1] + (fe_int128) F[1] * G[0]  + (fe_int128) F[2] * G4_19 + (fe_int128) F[3] * G3_19 + (fe_int128) F[4] * G2_19,
+    (fe_int128) F[0] * G[2] + (fe_int128) F[1] * G[1]  + (fe_int128) F[2] * G[0]  + (fe_int128) F[3] * G4_19 + (fe_int128) F[4] * G3_19,
+    (fe_int128) F[0] * G[3] + (fe_int128) F[1] * G[2]  + (fe_int128) F[2] * G[1]  + (fe_int128) F[3] * G[0]  + (fe_int128) F[4] * G4_19,
+    (fe_int128) F[0] * G[4] + (fe_int128) F[1] * G[3]  + (fe_int128) F[2] * G[2]  + (fe_int128) F[3] * G[1]  + (fe_int128) F[4] * G[0]);
+}
+
+/* h = f * f, doubled when dbl is 1 */
+static void fe_sq_radix51(fe h, const fe f, int dbl) {
+  int64_t F[5];
+  int64_t F0_2, F1_2, F1_38, F2_38, F3_19, F3_38, F4_19;
+  fe_int128 c0, c1, c2, c3, c4;
+  fe_to_radix51(F, f);
+  F0_2 = 2 * F[0];
+  F1_2 = 2 * F[1];
+  F1_38 = 38 * F[1];
+  F2_38 = 38 * F[2];
+  F3_19 = 19 * F[3];
+  F3_38 = 38 * F[3];
+  F4_19 = 19 * F[4];
+  c0 = (fe_int128) F[0] * F[0] + (fe_int128) F1_38 * F[4] + (fe_int128) F2_38 * F[3];
+  c1 = (fe_int128) F0_2 * F[1] + (fe_int128) F2_38 * F[4] + (fe_int128) F3_19 * F[3];
+  c2 = (fe_int128) F0_2 * F[2] + (fe_int128) F[1] * F[1] + (fe_int128) F3_38 * F[4];
+  c3 = (fe_int128) F0_2 * F[3] + (fe_int128) F1_2 * F[2] + (fe_int128) F4_19 * F[4];
+  c4 = (fe_int128) F0_2 * F[4] + (fe_int128) F1_2 * F[3] + (fe_int128) F[2] * F[2];
+  if (dbl) {
+    c0 += c0; c1 += c1; c2 += c2; c3 += c3; c4 += c4;
+  }
+  fe_from_radix51(h, c0, c1, c2, c3, c4);
+}
+
+static void fe_sq(fe h, const fe f) {
+  fe_sq_radix51(h, f, 0);
+}
+
+static void fe_sq2(fe h, const fe f) {
+  fe_sq_radix51(h, f, 1);
+}
+#endif
+
 /* From fe_mul.c */
 
 /*
@@ -377,6 +504,7 @@ Can get away with 11 carries, but then data flow is much deeper.
 With tighter constraints on inputs can squeeze carries into int32.
 */
 
+#if !defined(FE_RADIX51)
 static void fe_mul(fe h, const fe f, const fe g) {
   int32_t f0 = f[0];
   int32_t f1 = f[1];
@@ -594,6 +722,7 @@ static void fe_mul(fe h, const fe f, const fe g) {
   h[8] = h8;
   h[9] = h9;
 }
+#endif
 
 /* From fe_neg.c */
 
@@ -657,6 +786,7 @@ Postconditions:
 See fe_mul.c for discussion of implementation strategy.
 */
 
+#if !defined(FE_RADIX51)
 static void fe_sq(fe h, const fe f) {
   int32_t f0 = f[0];
   int32_t f1 = f[1];
@@ -946,6 +1076,7 @@ static void fe_sq2(fe h, const fe f) {
   h[8] = h8;
   h[9] = h9;
 }
+#endif
 
 /* From fe_sub.c */
 
@@ -2052,6 +2183,39 @@ void ge_mul8(ge_p1p1 *r, const ge_p2 *t) {
   ge_p2_dbl(r, &u);
 }
 
+/* Same as ge_tobytes on count points, with one field inversion per GE_TOBYTES_BATCH points */
+#define GE_TOBYTES_BATCH 32
+
+void ge_tobytes_batch(unsigned char *s, const ge_p2 *h, size_t count) {
+  fe acc[GE_TOBYTES_BATCH];
+  fe recip;
+  fe z_recip;
+  fe x;
+  fe y;
+  size_t i, n;
+
+  for (; count > 0; count -= n, h += n, s += 32 * n) {
+    n = count < GE_TOBYTES_BATCH ? count : GE_TOBYTES_BATCH;
+    fe_copy(acc[0], h[0].Z);
+    for (i = 1; i < n; i++) {
+      fe_mul(acc[i], acc[i - 1], h[i].Z);
+    }
+    fe_invert(recip, acc[n - 1]);
+    for (i = n - 1; i > 0; i--) {
+      fe_mul(z_recip, recip, acc[i - 1]);
+      fe_mul(recip, recip, h[i].Z);
+      fe_mul(x, h[i].X, z_recip);
+      fe_mul(y, h[i].Y, z_recip);
+      fe_tobytes(s + 32 * i, y);
+      s[32 * i + 31] ^= fe_isnegative(x) << 7;
+    }
+    fe_mul(x, h[0].X, recip);
+    fe_mul(y, h[0].Y, recip);
+    fe_tobytes(s, y);
+    s[31] ^= fe_isnegative(x) << 7;
+  }
+}
+
 void ge_fromfe_frombytes_vartime(ge_p2 *r, const unsigned char *s) {
   fe u, v, w, x, y, z;
   unsigned char sign;
@@ -152,16 +152,24 @@ namespace crypto {
     return true;
   }
 
-  static void derivation_to_scalar(const key_derivation &derivation, size_t output_index, ec_scalar &res) {
-    struct {
-      key_derivation derivation;
-      char output_index[(sizeof(size_t) * 8 + 6) / 7];
-    } buf;
+  struct derivation_buf {
+    key_derivation derivation;
+    char output_index[(sizeof(size_t) * 8 + 6) / 7];
+  };
+
+  /* fill buf with the hash input for the given output index and return its length */
+  static size_t make_derivation_buf(const key_derivation &derivation, size_t output_index, derivation_buf &buf) {
     char *end = buf.output_index;
     buf.derivation = derivation;
     tools::write_varint(end, output_index);
     assert(end <= buf.output_index + sizeof buf.output_index);
-    hash_to_scalar(&buf, end - reinterpret_cast<char *>(&buf), res);
+    return end - reinterpret_cast<char *>(&buf);
+  }
+
+  static void derivation_to_scalar(const key_derivation &derivation, size_t output_index, ec_scalar &res) {
+    derivation_buf buf;
+    size_t length = make_derivation_buf(derivation, output_index, buf);
+    hash_to_scalar(&buf, length, res);
   }
 
   bool crypto_ops::derive_public_key(const key_derivation &derivation, size_t output_index,
@@ -184,6 +192,42 @@ namespace crypto {
     return true;
   }
 
+  bool crypto_ops::derive_public_keys(const key_derivation &derivation, size_t count,
+    const public_key &base, public_key *derived_keys) {
+    ge_p3 point1;
+    ge_p3 point2;
+    ge_cached point3;
+    ge_p1p1 point4;
+    if (ge_frombytes_vartime(&point1, &base) != 0) {
+      return false;
+    }
+    std::vector<derivation_buf> bufs(count);
+    std::vector<size_t> lengths(count);
+    std::vector<const void *> data(count);
+    std::vector<ec_scalar> scalars(count);
+    std::vector<char *> hashes(count);
+    for (size_t i = 0; i < count; ++i) {
+      lengths[i] = make_derivation_buf(derivation, i, bufs[i]);
+      data[i] = &bufs[i];
+      hashes[i] = reinterpret_cast<char *>(&scalars[i]);
+    }
+    // the varint index only grows longer, so the inputs form a few runs of equal length
+    for (size_t first = 0, last; first < count; first = last) {
+      for (last = first + 1; last < count && lengths[last] == lengths[first]; ++last);
+      cn_fast_hash_multi(&data[first], lengths[first], &hashes[first], last - first);
+    }
+    std::vector<ge_p2> points(count);
+    for (size_t i = 0; i < count; ++i) {
+      sc_reduce32(&scalars[i]);
+      ge_scalarmult_base(&point2, &scalars[i]);
+      ge_p3_to_cached(&point3, &point2);
+      ge_add(&point4, &point1, &point3);
+      ge_p1p1_to_p2(&points[i], &point4);
+    }
+    ge_tobytes_batch(reinterpret_cast<unsigned char *>(derived_keys), points.data(), count);
+    return true;
+  }
+
   void crypto_ops::derive_secret_key(const key_derivation &derivation, size_t output_index,
     const secret_key &base, secret_key &derived_key) {
     ec_scalar scalar;
@@ -338,19 +382,30 @@ POP_WARNINGS
     sc_mulsub(&sig[sec_index].r, &sig[sec_index].c, &sec, &k);
   }
 
-  bool crypto_ops::check_ring_signature(const hash &prefix_hash, const key_image &image,
-    const public_key *const *pubs, size_t pubs_count,
-    const signature *sig) {
+  static_assert(sizeof(public_key_precomp().key) == sizeof(ge_p3) && sizeof(public_key_precomp().key_hash) == sizeof(ge_p3),
+    "public_key_precomp doesn't match ge_p3");
+
+  bool crypto_ops::precompute_public_key(const public_key &pub, public_key_precomp &precomp) {
+    ge_p3 point;
+    if (ge_frombytes_vartime(&point, &pub) != 0) {
+      return false;
+    }
+    memcpy(precomp.key, &point, sizeof(ge_p3));
+    hash_to_ec(pub, point);
+    memcpy(precomp.key_hash, &point, sizeof(ge_p3));
+    return true;
+  }
+
+  /* get_ring_member(i, key, key_hash) provides the decompressed public key of ring member i and its hash_to_ec point.
+   */
+  template<typename get_ring_member_t>
+  static bool check_ring_signature_common(const hash &prefix_hash, const key_image &image,
+    size_t pubs_count, const signature *sig, get_ring_member_t get_ring_member) {
     size_t i;
     ge_p3 image_unp;
     ge_dsmp image_pre;
     ec_scalar sum, h;
     rs_comm *const buf = reinterpret_cast<rs_comm *>(alloca(rs_comm_size(pubs_count)));
-#if !defined(NDEBUG)
-    for (i = 0; i < pubs_count; i++) {
-      assert(check_key(*pubs[i]));
-    }
-#endif
     if (ge_frombytes_vartime(&image_unp, &image) != 0) {
       return false;
     }
@@ -359,17 +414,14 @@ POP_WARNINGS
     buf->h = prefix_hash;
     for (i = 0; i < pubs_count; i++) {
       ge_p2 tmp2;
-      ge_p3 tmp3;
+      ge_p3 key, key_hash;
       if (sc_check(&sig[i].c) != 0 || sc_check(&sig[i].r) != 0) {
         return false;
       }
-      if (ge_frombytes_vartime(&tmp3, &*pubs[i]) != 0) {
-        abort();
-      }
-      ge_double_scalarmult_base_vartime(&tmp2, &sig[i].c, &tmp3, &sig[i].r);
+      get_ring_member(i, key, key_hash);
+      ge_double_scalarmult_base_vartime(&tmp2, &sig[i].c, &key, &sig[i].r);
       ge_tobytes(&buf->ab[i].a, &tmp2);
-      hash_to_ec(*pubs[i], tmp3);
-      ge_double_scalarmult_precomp_vartime(&tmp2, &sig[i].r, &tmp3, &sig[i].c, image_pre);
+      ge_double_scalarmult_precomp_vartime(&tmp2, &sig[i].r, &key_hash, &sig[i].c, image_pre);
       ge_tobytes(&buf->ab[i].b, &tmp2);
       sc_add(&sum, &sum, &sig[i].c);
     }
@@ -377,4 +429,29 @@ POP_WARNINGS
     sc_sub(&h, &h, &sum);
     return sc_isnonzero(&h) == 0;
   }
+
+  bool crypto_ops::check_ring_signature(const hash &prefix_hash, const key_image &image,
+    const public_key *const *pubs, size_t pubs_count,
+    const signature *sig) {
+#if !defined(NDEBUG)
+    for (size_t i = 0; i < pubs_count; i++) {
+      assert(check_key(*pubs[i]));
+    }
+#endif
+    return check_ring_signature_common(prefix_hash, image, pubs_count, sig, [pubs](size_t i, ge_p3 &key, ge_p3 &key_hash) {
+      if (ge_frombytes_vartime(&key, &*pubs[i]) != 0) {
+        abort();
+      }
+      hash_to_ec(*pubs[i], key_hash);
+    });
+  }
+
+  bool crypto_ops::check_ring_signature(const hash &prefix_hash, const key_image &image,
+    const public_key_precomp *const *pubs, size_t pubs_count,
+    const signature *sig) {
+    return check_ring_signature_common(prefix_hash, image, pubs_count, sig, [pubs](size_t i, ge_p3 &key, ge_p3 &key_hash) {
+      memcpy(&key, pubs[i]->key, sizeof(ge_p3));
+      memcpy(&key_hash, pubs[i]->key_hash, sizeof(ge_p3));
+    });
+  }
 }
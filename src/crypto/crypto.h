@@ -75,6 +75,15 @@ namespace crypto {
     ec_scalar c, r;
     friend class crypto_ops;
   };
+
+  /* A public key decompressed to a curve point, along with its hash_to_ec point, as used by
+   * check_ring_signature. Worth keeping for outputs which show up in many rings.
+   */
+  POD_CLASS public_key_precomp {
+    char key[160];
+    char key_hash[160];
+    friend class crypto_ops;
+  };
 #pragma pack(pop)
 
   static_assert(sizeof(ec_point) == 32 && sizeof(ec_scalar) == 32 &&
@@ -98,6 +107,8 @@ namespace crypto {
     friend bool generate_key_derivation(const public_key &, const secret_key &, key_derivation &);
     static bool derive_public_key(const key_derivation &, std::size_t, const public_key &, public_key &);
     friend bool derive_public_key(const key_derivation &, std::size_t, const public_key &, public_key &);
+    static bool derive_public_keys(const key_derivation &, std::size_t, const public_key &, public_key *);
+    friend bool derive_public_keys(const key_derivation &, std::size_t, const public_key &, public_key *);
     static void derive_secret_key(const key_derivation &, std::size_t, const secret_key &, secret_key &);
     friend void derive_secret_key(const key_derivation &, std::size_t, const secret_key &, secret_key &);
     static void generate_signature(const hash &, const public_key &, const secret_key &, signature &);
@@ -114,6 +125,12 @@ namespace crypto {
       const public_key *const *, std::size_t, const signature *);
     friend bool check_ring_signature(const hash &, const key_image &,
       const public_key *const *, std::size_t, const signature *);
+    static bool precompute_public_key(const public_key &, public_key_precomp &);
+    friend bool precompute_public_key(const public_key &, public_key_precomp &);
+    static bool check_ring_signature(const hash &, const key_image &,
+      const public_key_precomp *const *, std::size_t, const signature *);
+    friend bool check_ring_signature(const hash &, const key_image &,
+      const public_key_precomp *const *, std::size_t, const signature *);
   };
 
   /* Generate a value filled with random bytes.
@@ -157,6 +174,12 @@ namespace crypto {
     const public_key &base, public_key &derived_key) {
     return crypto_ops::derive_public_key(derivation, output_index, base, derived_key);
   }
+  /* Derive the public keys of outputs 0 .. count - 1 at once, batching the index hashes and the point encoding.
+   */
+  inline bool derive_public_keys(const key_derivation &derivation, std::size_t count,
+    const public_key &base, public_key *derived_keys) {
+    return crypto_ops::derive_public_keys(derivation, count, base, derived_keys);
+  }
   inline void derive_secret_key(const key_derivation &derivation, std::size_t output_index,
     const secret_key &base, secret_key &derived_key) {
     crypto_ops::derive_secret_key(derivation, output_index, base, derived_key);
@@ -192,6 +215,17 @@ namespace crypto {
     return crypto_ops::check_ring_signature(prefix_hash, image, pubs, pubs_count, sig);
   }
 
+  /* Decompress a public key and compute its hash_to_ec point. Returns false if the key is invalid.
+   */
+  inline bool precompute_public_key(const public_key &pub, public_key_precomp &precomp) {
+    return crypto_ops::precompute_public_key(pub, precomp);
+  }
+  inline bool check_ring_signature(const hash &prefix_hash, const key_image &image,
+    const public_key_precomp *const *pubs, std::size_t pubs_count,
+    const signature *sig) {
+    return crypto_ops::check_ring_signature(prefix_hash, image, pubs, pubs_count, sig);
+  }
+
   /* Variants with vector<const public_key *> parameters.
    */
   inline void generate_ring_signature(const hash &prefix_hash, const key_image &image,
@@ -205,8 +239,13 @@ namespace crypto {
     const signature *sig) {
     return check_ring_signature(prefix_hash, image, pubs.data(), pubs.size(), sig);
   }
+  inline bool check_ring_signature(const hash &prefix_hash, const key_image &image,
+    const std::vector<const public_key_precomp *> &pubs,
+    const signature *sig) {
+    return check_ring_signature(prefix_hash, image, pubs.data(), pubs.size(), sig);
+  }
 }
 
-CRYPTO_MAKE_COMPARABLE(public_key)
+CRYPTO_MAKE_HASHABLE(public_key)
 CRYPTO_MAKE_HASHABLE(key_image)
 CRYPTO_MAKE_COMPARABLE(signature)
@@ -78,8 +78,12 @@ enum {
   HASH_DATA_AREA = 136
 };
 
+#define CN_SLOW_HASH_MAX_WAYS 4
+
 void cn_fast_hash(const void *data, size_t length, char *hash);
+void cn_fast_hash_multi(const void *const *data, size_t length, char *const *hash, size_t count);
 void cn_slow_hash(const void *data, size_t length, char *hash);
+void cn_slow_hash_multi(const void *const *data, size_t length, char *const *hash, size_t count);
 
 void hash_extra_blake(const void *data, size_t length, char *hash);
 void hash_extra_groestl(const void *data, size_t length, char *hash);
@@ -48,3 +48,9 @@ void cn_fast_hash(const void *data, size_t length, char *hash) {
   hash_process(&state, data, length);
   memcpy(hash, &state, HASH_SIZE);
 }
+
+// hashes count messages of the same length; each digest is written after its
+// message is read, so it may overwrite that message or one earlier in data
+void cn_fast_hash_multi(const void *const *data, size_t length, char *const *hash, size_t count) {
+  keccak_multi((const uint8_t *const *) data, length, (uint8_t *const *) hash, HASH_SIZE, count);
+}
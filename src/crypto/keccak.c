@@ -5,6 +5,29 @@
 #include "hash-ops.h"
 #include "keccak.h"
 
+// keccakf_lanes runs the permutation on KECCAK_LANES independent states at once,
+// one state per 64-bit lane of a vector register
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define KECCAK_LANES 4
+typedef __m256i keccak_lanes_t;
+#define LANES_XOR(a, b) _mm256_xor_si256(a, b)
+#define LANES_ANDNOT(a, b) _mm256_andnot_si256(a, b)
+#define LANES_ROTL(x, y) _mm256_or_si256(_mm256_slli_epi64(x, y), _mm256_srli_epi64(x, 64 - (y)))
+#define LANES_SET1(x) _mm256_set1_epi64x((long long) (x))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define KECCAK_LANES 2
+typedef __m128i keccak_lanes_t;
+#define LANES_XOR(a, b) _mm_xor_si128(a, b)
+#define LANES_ANDNOT(a, b) _mm_andnot_si128(a, b)
+#define LANES_ROTL(x, y) _mm_or_si128(_mm_slli_epi64(x, y), _mm_srli_epi64(x, 64 - (y)))
+#define LANES_SET1(x) _mm_set1_epi64x((long long) (x))
+#else
+#define KECCAK_LANES 1
+#endif
+
 const uint64_t keccakf_rndc[24] = 
 {
     0x0000000000000001, 0x0000000000008082, 0x800000000000808a,
@@ -70,6 +93,52 @@ void keccakf(uint64_t st[25], int rounds)
     }
 }
 
+#if KECCAK_LANES > 1
+typedef union {
+    keccak_lanes_t v;
+    uint64_t w[KECCAK_LANES];
+} keccak_lane_words;
+
+static void keccakf_lanes(keccak_lanes_t st[25], int rounds)
+{
+    int i, j, round;
+    keccak_lanes_t t, bc[5];
+
+    for (round = 0; round < rounds; round++) {
+
+        // Theta
+        for (i = 0; i < 5; i++)
+            bc[i] = LANES_XOR(LANES_XOR(LANES_XOR(st[i], st[i + 5]), LANES_XOR(st[i + 10], st[i + 15])), st[i + 20]);
+
+        for (i = 0; i < 5; i++) {
+            t = LANES_XOR(bc[(i + 4) % 5], LANES_ROTL(bc[(i + 1) % 5], 1));
+            for (j = 0; j < 25; j += 5)
+                st[j + i] = LANES_XOR(st[j + i], t);
+        }
+
+        // Rho Pi
+        t = st[1];
+        for (i = 0; i < 24; i++) {
+            j = keccakf_piln[i];
+            bc[0] = st[j];
+            st[j] = LANES_ROTL(t, keccakf_rotc[i]);
+            t = bc[0];
+        }
+
+        //  Chi
+        for (j = 0; j < 25; j += 5) {
+            for (i = 0; i < 5; i++)
+                bc[i] = st[j + i];
+            for (i = 0; i < 5; i++)
+                st[j + i] = LANES_XOR(st[j + i], LANES_ANDNOT(bc[(i + 1) % 5], bc[(i + 2) % 5]));
+        }
+
+        //  Iota
+        st[0] = LANES_XOR(st[0], LANES_SET1(keccakf_rndc[round]));
+    }
+}
+#endif
+
 // compute a keccak hash (md) of given byte length from "in"
 typedef uint64_t state_t[25];
 
@@ -110,3 +179,58 @@ void keccak1600(const uint8_t *in, int inlen, uint8_t *md)
 {
     keccak(in, inlen, md, sizeof(state_t));
 }
+
+// compute the keccak hashes of count messages of the same length, KECCAK_LANES
+// at a time; each group is read completely before its hashes are written
+
+void keccak_multi(const uint8_t *const *in, int inlen, uint8_t *const *md, int mdlen, size_t count)
+{
+#if KECCAK_LANES > 1
+    keccak_lanes_t st[25];
+    keccak_lane_words lw;
+    uint8_t temp[KECCAK_LANES][144];
+    int i, n, offset, last, rsiz, rsizw;
+
+    rsiz = sizeof(state_t) == mdlen ? HASH_DATA_AREA : 200 - 2 * mdlen;
+    rsizw = rsiz / 8;
+
+    for ( ; count >= KECCAK_LANES; count -= KECCAK_LANES, in += KECCAK_LANES, md += KECCAK_LANES) {
+        memset(st, 0, sizeof(st));
+
+        for (offset = 0; inlen - offset >= rsiz; offset += rsiz) {
+            for (i = 0; i < rsizw; i++) {
+                for (n = 0; n < KECCAK_LANES; n++)
+                    memcpy(&lw.w[n], in[n] + offset + 8 * i, 8);
+                st[i] = LANES_XOR(st[i], lw.v);
+            }
+            keccakf_lanes(st, KECCAK_ROUNDS);
+        }
+
+        // last block and padding
+        last = inlen - offset;
+        for (n = 0; n < KECCAK_LANES; n++) {
+            memcpy(temp[n], in[n] + offset, last);
+            temp[n][last] = 1;
+            memset(temp[n] + last + 1, 0, rsiz - last - 1);
+            temp[n][rsiz - 1] |= 0x80;
+        }
+
+        for (i = 0; i < rsizw; i++) {
+            for (n = 0; n < KECCAK_LANES; n++)
+                memcpy(&lw.w[n], temp[n] + 8 * i, 8);
+            st[i] = LANES_XOR(st[i], lw.v);
+        }
+
+        keccakf_lanes(st, KECCAK_ROUNDS);
+
+        for (i = 0; 8 * i < mdlen; i++) {
+            lw.v = st[i];
+            for (n = 0; n < KECCAK_LANES; n++)
+                memcpy(md[n] + 8 * i, &lw.w[n], mdlen - 8 * i < 8 ? mdlen - 8 * i : 8);
+        }
+    }
+#endif
+
+    for ( ; count > 0; count--, in++, md++)
+        keccak(*in, inlen, *md, mdlen);
+}
@@ -23,4 +23,7 @@ void keccakf(uint64_t st[25], int norounds);
 
 void keccak1600(const uint8_t *in, int inlen, uint8_t *md);
 
+// compute the keccak hashes of count messages of byte length inlen, several at a time
+void keccak_multi(const uint8_t *const *in, int inlen, uint8_t *const *md, int mdlen, size_t count);
+
 #endif
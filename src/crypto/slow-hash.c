@@ -91,17 +91,18 @@
 #define state_index(x) (((*((uint64_t *)x) >> 4) & (TOTALBLOCKS - 1)) << 4)
 #if defined(_MSC_VER)
 #if !defined(_WIN64)
-#define __mul() lo = mul128(c[0], b[0], &hi);
+#define __umul(x, y) lo = mul128(x, y, &hi);
 #else
-#define __mul() lo = _umul128(c[0], b[0], &hi);
+#define __umul(x, y) lo = _umul128(x, y, &hi);
 #endif
 #else
 #if defined(__x86_64__)
-#define __mul() ASM("mulq %3\n\t" : "=d"(hi), "=a"(lo) : "%a" (c[0]), "rm" (b[0]) : "cc");
+#define __umul(x, y) ASM("mulq %3\n\t" : "=d"(hi), "=a"(lo) : "%a" (x), "rm" (y) : "cc");
 #else
-#define __mul() lo = mul128(c[0], b[0], &hi);
+#define __umul(x, y) lo = mul128(x, y, &hi);
 #endif
 #endif
+#define __mul() __umul(c[0], b[0])
 
 #define pre_aes() \
     j = state_index(a); \
@@ -130,7 +131,36 @@
 	p[0] = a[0];  p[1] = a[1]; \
 	a[0] ^= b[0]; a[1] ^= b[1]; \
 	_b = _c; \
- 
+
+/*
+ * The same two steps for hash number n of cn_slow_hash_multi, which keeps a separate
+ * scratchpad and a/b/c state per hash.  The chains of the hashes don't depend on each
+ * other, so the CPU can overlap the memory and multiply latencies of one with the others.
+ */
+#define pre_aes_n(n) \
+    jn[n] = state_index(an[n]); \
+	_cn[n] = _mm_load_si128(R128(&hpn[n][jn[n]])); \
+	_an[n] = _mm_load_si128(R128(an[n])); \
+
+#define post_aes_n(n) \
+	_mm_store_si128(R128(cn[n]), _cn[n]); \
+	_bn[n] = _mm_xor_si128(_bn[n], _cn[n]); \
+	_mm_store_si128(R128(&hpn[n][jn[n]]), _bn[n]); \
+	jn[n] = state_index(cn[n]); \
+	p = U64(&hpn[n][jn[n]]); \
+	bn[n][0] = p[0]; bn[n][1] = p[1]; \
+	__umul(cn[n][0], bn[n][0]); \
+	an[n][0] += hi; an[n][1] += lo; \
+	p = U64(&hpn[n][jn[n]]); \
+	p[0] = an[n][0];  p[1] = an[n][1]; \
+	an[n][0] ^= bn[n][0]; an[n][1] ^= bn[n][1]; \
+	_bn[n] = _cn[n]; \
+
+#define aes_round_n(n) \
+	pre_aes_n(n); \
+	_cn[n] = _mm_aesenc_si128(_cn[n], _an[n]); \
+	post_aes_n(n);
+
 #if defined(_MSC_VER)
 #define THREADV __declspec(thread)
 #else
@@ -154,6 +184,9 @@ union cn_slow_hash_state
 
 THREADV uint8_t *hp_state = NULL;
 THREADV int hp_allocated = 0;
+THREADV uint8_t *hp_state_multi = NULL;
+THREADV int hp_multi_allocated = 0;
+THREADV size_t hp_multi_ways = 0;
 
 #if defined(_MSC_VER)
 #define cpuid(info,x)    __cpuidex(info,x,0)
@@ -400,66 +433,96 @@ BOOL SetLockPagesPrivilege(HANDLE hProcess, BOOL bEnable)
 #endif
 
 /**
- * @brief allocate the 2MB scratch buffer using OS support for huge pages, if available
+ * @brief allocate a scratch buffer using OS support for huge pages, if available
  *
- * This function tries to allocate the 2MB scratch buffer using a single 
- * 2MB "huge page" (instead of the usual 4KB page sizes) to reduce TLB misses
- * during the random accesses to the scratch buffer.  This is one of the
- * important speed optimizations needed to make CryptoNight faster.
+ * Tries to back the buffer with 2MB "huge pages" (instead of the usual 4KB page
+ * sizes) to reduce TLB misses during the random accesses to the scratch buffer.
+ * This is one of the important speed optimizations needed to make CryptoNight faster.
  *
- * No parameters.  Updates a thread-local pointer, hp_state, to point to
- * the allocated buffer.
+ * @param size the size of the buffer, a multiple of MEMORY
+ * @param allocated set to 1 if huge pages were used, 0 if the buffer came from malloc
+ * @return the buffer, or NULL if no memory is left
  */
 
-void slow_hash_allocate_state(void)
+STATIC uint8_t *allocate_scratchpad(size_t size, int *allocated)
 {
-    int state = 0;
-    if(hp_state != NULL)
-        return;
+    uint8_t *scratchpad = NULL;
 
 #if defined(_MSC_VER) || defined(__MINGW32__)
     SetLockPagesPrivilege(GetCurrentProcess(), TRUE);
-    hp_state = (uint8_t *) VirtualAlloc(hp_state, MEMORY, MEM_LARGE_PAGES |
-                                        MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    scratchpad = (uint8_t *) VirtualAlloc(NULL, size, MEM_LARGE_PAGES |
+                                          MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
 #else
 #if defined(__APPLE__) || defined(__FreeBSD__)
-    hp_state = mmap(0, MEMORY, PROT_READ | PROT_WRITE,
-                    MAP_PRIVATE | MAP_ANON, 0, 0);    
+    scratchpad = mmap(0, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANON, 0, 0);    
 #else
-    hp_state = mmap(0, MEMORY, PROT_READ | PROT_WRITE,
-                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, 0, 0);
+    scratchpad = mmap(0, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, 0, 0);
 #endif
-    if(hp_state == MAP_FAILED)
-        hp_state = NULL;
+    if(scratchpad == MAP_FAILED)
+        scratchpad = NULL;
 #endif
-    hp_allocated = 1;
-    if(hp_state == NULL)
+    *allocated = 1;
+    if(scratchpad == NULL)
     {
-        hp_allocated = 0;
-        hp_state = (uint8_t *) malloc(MEMORY);
+        *allocated = 0;
+        scratchpad = (uint8_t *) malloc(size);
     }
+    return scratchpad;
 }
 
 /**
- *@brief frees the state allocated by slow_hash_allocate_state
+ * @brief frees a buffer allocated by allocate_scratchpad
  */
 
-void slow_hash_free_state(void)
+STATIC void free_scratchpad(uint8_t *scratchpad, size_t size, int allocated)
 {
-    if(hp_state == NULL)
-        return;
-
-    if(!hp_allocated)
-        free(hp_state);
+    if(!allocated)
+        free(scratchpad);
     else
     {
 #if defined(_MSC_VER) || defined(__MINGW32__)
-        VirtualFree(hp_state, MEMORY, MEM_RELEASE);
+        VirtualFree(scratchpad, 0, MEM_RELEASE);
 #else
-        munmap(hp_state, MEMORY);
+        munmap(scratchpad, size);
 #endif
     }
+}
+
+/**
+ * @brief allocate the 2MB scratch buffer using OS support for huge pages, if available
+ *
+ * No parameters.  Updates a thread-local pointer, hp_state, to point to
+ * the allocated buffer.
+ */
+
+void slow_hash_allocate_state(void)
+{
+    if(hp_state != NULL)
+        return;
+
+    hp_state = allocate_scratchpad(MEMORY, &hp_allocated);
+}
+
+/**
+ *@brief frees the state allocated by slow_hash_allocate_state, and the scratch buffers of cn_slow_hash_multi
+ */
+
+void slow_hash_free_state(void)
+{
+    if(hp_state_multi != NULL)
+    {
+        free_scratchpad(hp_state_multi, MEMORY * hp_multi_ways, hp_multi_allocated);
+        hp_state_multi = NULL;
+        hp_multi_allocated = 0;
+        hp_multi_ways = 0;
+    }
 
+    if(hp_state == NULL)
+        return;
+
+    free_scratchpad(hp_state, MEMORY, hp_allocated);
     hp_state = NULL;
     hp_allocated = 0;
 }
@@ -624,6 +687,151 @@ void cn_slow_hash(const void *data, size_t length, char *hash)
     extra_hashes[state.hs.b[0] & 3](&state, 200, hash);
 }
 
+/**
+ * @brief CryptoNight step 2 with AES-NI: fill <scratchpad> from the Keccak <state>
+ */
+
+STATIC INLINE void cn_slow_hash_explode(const union cn_slow_hash_state *state, uint8_t *scratchpad)
+{
+    RDATA_ALIGN16 uint8_t expandedKey[240];
+    uint8_t text[INIT_SIZE_BYTE];
+    size_t i;
+
+    memcpy(text, state->init, INIT_SIZE_BYTE);
+    aes_expand_key(state->hs.b, expandedKey);
+    for(i = 0; i < MEMORY / INIT_SIZE_BYTE; i++)
+    {
+        aes_pseudo_round(text, text, expandedKey, INIT_SIZE_BLK);
+        memcpy(&scratchpad[i * INIT_SIZE_BYTE], text, INIT_SIZE_BYTE);
+    }
+}
+
+/**
+ * @brief CryptoNight steps 4 and 5 with AES-NI: mix <scratchpad> back into <state> and squeeze it into <hash>
+ */
+
+STATIC INLINE void cn_slow_hash_implode(union cn_slow_hash_state *state, const uint8_t *scratchpad, char *hash)
+{
+    RDATA_ALIGN16 uint8_t expandedKey[240];
+    uint8_t text[INIT_SIZE_BYTE];
+    size_t i;
+
+    static void (*const extra_hashes[4])(const void *, size_t, char *) =
+    {
+        hash_extra_blake, hash_extra_groestl, hash_extra_jh, hash_extra_skein
+    };
+
+    memcpy(text, state->init, INIT_SIZE_BYTE);
+    aes_expand_key(&state->hs.b[32], expandedKey);
+    for(i = 0; i < MEMORY / INIT_SIZE_BYTE; i++)
+        aes_pseudo_round_xor(text, text, expandedKey, &scratchpad[i * INIT_SIZE_BYTE], INIT_SIZE_BLK);
+
+    memcpy(state->init, text, INIT_SIZE_BYTE);
+    hash_permutation(&state->hs);
+    extra_hashes[state->hs.b[0] & 3](state, 200, hash);
+}
+
+/**
+ * @brief computes <ways> (2 or 4) CryptoNight hashes at once, interleaving their step 3
+ *
+ * Each hash has its own 2MB scratchpad in hp_state_multi.  Step 3 is one long chain of
+ * dependent scratchpad reads, AES rounds and 64 bit multiplies, so a single hash leaves
+ * most of the core idle waiting on latency; running the independent chains of several
+ * hashes side by side fills that time.  Requires AES-NI.
+ */
+
+STATIC void cn_slow_hash_ways(const void *const *data, size_t length, char *const *hash, size_t ways)
+{
+    union cn_slow_hash_state state[CN_SLOW_HASH_MAX_WAYS];
+    RDATA_ALIGN16 uint64_t an[CN_SLOW_HASH_MAX_WAYS][2];
+    RDATA_ALIGN16 uint64_t bn[CN_SLOW_HASH_MAX_WAYS][2];
+    RDATA_ALIGN16 uint64_t cn[CN_SLOW_HASH_MAX_WAYS][2];
+    __m128i _an[CN_SLOW_HASH_MAX_WAYS], _bn[CN_SLOW_HASH_MAX_WAYS], _cn[CN_SLOW_HASH_MAX_WAYS];
+    uint8_t *hpn[CN_SLOW_HASH_MAX_WAYS];
+    size_t jn[CN_SLOW_HASH_MAX_WAYS];
+    uint64_t hi, lo;
+    uint64_t *p = NULL;
+    size_t i, n;
+
+    assert(ways == 2 || ways == 4);
+
+    for(n = 0; n < ways; n++)
+    {
+        hpn[n] = &hp_state_multi[n * MEMORY];
+        hash_process(&state[n].hs, data[n], length);
+        cn_slow_hash_explode(&state[n], hpn[n]);
+
+        U64(an[n])[0] = U64(&state[n].k[0])[0] ^ U64(&state[n].k[32])[0];
+        U64(an[n])[1] = U64(&state[n].k[0])[1] ^ U64(&state[n].k[32])[1];
+        U64(bn[n])[0] = U64(&state[n].k[16])[0] ^ U64(&state[n].k[48])[0];
+        U64(bn[n])[1] = U64(&state[n].k[16])[1] ^ U64(&state[n].k[48])[1];
+        _bn[n] = _mm_load_si128(R128(bn[n]));
+    }
+
+    if(ways == 4)
+    {
+        for(i = 0; i < ITER / 2; i++)
+        {
+            aes_round_n(0);
+            aes_round_n(1);
+            aes_round_n(2);
+            aes_round_n(3);
+        }
+    }
+    else
+    {
+        for(i = 0; i < ITER / 2; i++)
+        {
+            aes_round_n(0);
+            aes_round_n(1);
+        }
+    }
+
+    for(n = 0; n < ways; n++)
+        cn_slow_hash_implode(&state[n], hpn[n], hash[n]);
+}
+
+/**
+ * @brief computes the CryptoNight hashes of <count> inputs of the same <length>, several at a time
+ *
+ * Gives the same results as calling cn_slow_hash for each input.  Without hardware
+ * AES it does exactly that.  Uses a 2MB scratchpad per hash computed at once, up to
+ * CN_SLOW_HASH_MAX_WAYS per thread, which are released by slow_hash_free_state.
+ *
+ * @param data the inputs
+ * @param length the length in bytes of each input
+ * @param hash the buffers in which the 256 bit hashes will be stored
+ * @param count the number of inputs
+ */
+
+void cn_slow_hash_multi(const void *const *data, size_t length, char *const *hash, size_t count)
+{
+    size_t ways = count >= 4 ? 4 : 2;
+
+    if(check_aes_hw() && count >= 2 && hp_multi_ways < ways)
+    {
+        if(hp_state_multi != NULL)
+            free_scratchpad(hp_state_multi, MEMORY * hp_multi_ways, hp_multi_allocated);
+        hp_state_multi = allocate_scratchpad(MEMORY * ways, &hp_multi_allocated);
+        hp_multi_ways = hp_state_multi != NULL ? ways : 0;
+    }
+
+    if(check_aes_hw() && hp_state_multi != NULL)
+    {
+        while(count >= 2)
+        {
+            ways = count >= 4 ? 4 : 2;
+            cn_slow_hash_ways(data, length, hash, ways);
+            data += ways;
+            hash += ways;
+            count -= ways;
+        }
+    }
+
+    for(; count; count--)
+        cn_slow_hash(*data++, length, *hash++);
+}
+
 #else
 // Portable implementation as a fallback
 
@@ -782,4 +990,10 @@ void cn_slow_hash(const void *data, size_t length, char *hash) {
   oaes_free((OAES_CTX **) &aes_ctx);
 }
 
+void cn_slow_hash_multi(const void *const *data, size_t length, char *const *hash, size_t count) {
+  for (; count; count--) {
+    cn_slow_hash(*data++, length, *hash++);
+  }
+}
+
 #endif
\ No newline at end of file
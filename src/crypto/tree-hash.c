@@ -94,18 +94,27 @@ void tree_hash(const char (*hashes)[HASH_SIZE], size_t count, char *root_hash) {
     size_t ints_size = cnt * HASH_SIZE;
     ints = alloca(ints_size); 	memset( ints , 0 , ints_size);  // allocate, and zero out as extra protection for using uninitialized mem
 
+    // the pairs of a level are independent, so they are hashed as one batch; a digest only
+    // overwrites the pair it was computed from or an earlier one, which cn_fast_hash_multi allows
+    const void **pairs = alloca(cnt * sizeof(*pairs));
+    char **digests = alloca(cnt * sizeof(*digests));
+
     memcpy(ints, hashes, (2 * cnt - count) * HASH_SIZE);
 
     for (i = 2 * cnt - count, j = 2 * cnt - count; j < cnt; i += 2, ++j) {
-      cn_fast_hash(hashes[i], 64, ints[j]);
+      pairs[j] = hashes[i];
+      digests[j] = ints[j];
     }
     assert(i == count);
+    cn_fast_hash_multi(pairs + 2 * cnt - count, 64, digests + 2 * cnt - count, count - cnt);
 
     while (cnt > 2) {
       cnt >>= 1;
       for (i = 0, j = 0; j < cnt; i += 2, ++j) {
-        cn_fast_hash(ints[i], 64, ints[j]);
+        pairs[j] = ints[i];
+        digests[j] = ints[j];
       }
+      cn_fast_hash_multi(pairs, 64, digests, cnt);
     }
 
     cn_fast_hash(ints[0], 64, root_hash);
@@ -81,13 +81,24 @@
 
 #define BLOCKS_IDS_SYNCHRONIZING_DEFAULT_COUNT          10000  //by default, blocks ids count in synchronizing
 #define BLOCKS_SYNCHRONIZING_DEFAULT_COUNT              200    //by default, blocks count in blocks downloading
+#define BLOCKS_SYNCHRONIZING_MAX_SPANS                  20     //downloaded spans of blocks waiting for the blocks below them
+#define BLOCKS_SYNCHRONIZING_TIMEOUT                    120    //seconds, a connection holding requested blocks or a span nobody downloads the parent of longer is dropped
 #define CRYPTONOTE_PROTOCOL_HOP_RELAX_COUNT             3      //value of hop, after which we use only announce of new block
+#define CRYPTONOTE_PROTOCOL_MAX_QUEUED_TXS              5000   //transactions of NOTIFY_NEW_TRANSACTIONS waiting for verification, notifications past it are dropped
 
 #define CRYPTONOTE_MEMPOOL_TX_LIVETIME                    86400 //seconds, one day
 #define CRYPTONOTE_MEMPOOL_TX_FROM_ALT_BLOCK_LIVETIME     604800 //seconds, one week
 
 #define COMMAND_RPC_GET_BLOCKS_FAST_MAX_COUNT           1000
 
+#define BLOCKCHAIN_JOURNAL_SYNC_RECORDS                 20     //journal records written before the journal is fsynced
+#define BLOCKCHAIN_JOURNAL_SYNC_INTERVAL                5      //seconds, unsynced journal records are fsynced when idle at least this often
+#define BLOCKCHAIN_JOURNAL_SNAPSHOT_RECORDS             5000   //journal records after which blockchain data is flushed and the journal restarted
+
+#define BLOCKCHAIN_VERIFIED_TXS_CACHE_SIZE              20000  //pool transactions remembered as having valid ring signatures
+#define BLOCKCHAIN_RING_MEMBERS_CACHE_SIZE              100000 //output keys kept decompressed for ring signature checks, 320 bytes each
+#define BLOCKCHAIN_PRECOMPUTED_POW_CACHE_SIZE           10000  //proofs of work of downloaded blocks waiting to be added
+
 #define P2P_LOCAL_WHITE_PEERLIST_LIMIT                  1000
 #define P2P_LOCAL_GRAY_PEERLIST_LIMIT                   5000
 
@@ -105,8 +116,11 @@
 
 #define CRYPTONOTE_NAME                         "bitmonero"
 #define CRYPTONOTE_POOLDATA_FILENAME            "poolstate.bin"
-#define CRYPTONOTE_BLOCKCHAINDATA_FILENAME      "blockchain.bin"
-#define CRYPTONOTE_BLOCKCHAINDATA_TEMP_FILENAME "blockchain.bin.tmp"
+#define CRYPTONOTE_BLOCKCHAINDATA_FILENAME      "blockchain.bin" // legacy whole-archive format, converted on first start
+#define CRYPTONOTE_BLOCKCHAINDATA_LOG_FILENAME  "blocks"         // blocks.dat + blocks.idx
+#define CRYPTONOTE_BLOCKCHAINDATA_JOURNAL_FILENAME "blocks.journal"
+#define CRYPTONOTE_BLOCKCHAINDATA_INDEX_FILENAME "blocks.index"   // blocks.index.* lookup indexes of the block log, built again if lost
+#define CRYPTONOTE_BLOCKCHAINDATA_ALT_FILENAME  "blocks.alt"     // alternative and invalid blocks, not in the block log
 #define P2P_NET_DATA_FILENAME                   "p2pstate.bin"
 #define MINER_CONFIG_FILE_NAME                  "miner_conf.json"
 
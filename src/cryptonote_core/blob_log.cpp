@@ -0,0 +1,248 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <algorithm>
+#include <cstring>
+#include <boost/crc.hpp>
+
+#include "include_base_utils.h"
+#include "common/int-util.h"
+#include "blob_log.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  const uint64_t BLOB_LOG_MAGIC = 0x676f6c626f6c62ULL; // "blblog"
+  const uint64_t BLOB_LOG_VERSION = 1;
+  const uint64_t BLOB_LOG_INITIAL_DATA_SIZE = 1024 * 1024;
+  const uint64_t BLOB_LOG_INITIAL_INDEX_ENTRIES = 1024;
+
+  uint64_t record_checksum(const char* data, uint64_t size)
+  {
+    boost::crc_32_type crc;
+    crc.process_bytes(data, size);
+    return crc.checksum();
+  }
+}
+
+//------------------------------------------------------------------
+blob_log::blob_log():m_read_only(false), m_read_only_size(0)
+{
+}
+//------------------------------------------------------------------
+blob_log::~blob_log()
+{
+  close();
+}
+//------------------------------------------------------------------
+bool blob_log::open(const std::string& path_prefix, bool read_only, uint64_t initial_records, uint64_t initial_data_size)
+{
+  close();
+  m_read_only = read_only;
+  if(!initial_records)
+    initial_records = BLOB_LOG_INITIAL_INDEX_ENTRIES;
+  if(!initial_data_size)
+    initial_data_size = BLOB_LOG_INITIAL_DATA_SIZE;
+  bool r = m_index.open(path_prefix + ".idx", m_read_only ? sizeof(index_header) : sizeof(index_header) + initial_records * sizeof(record_entry), m_read_only);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to open blob log index " << path_prefix << ".idx");
+  r = m_data.open(path_prefix + ".dat", m_read_only ? 0 : initial_data_size, m_read_only);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to open blob log data " << path_prefix << ".dat");
+
+  index_header& hdr = header();
+  if(m_read_only)
+  {
+    CHECK_AND_ASSERT_MES(SWAP64LE(hdr.magic) == BLOB_LOG_MAGIC, false, "Wrong blob log index signature in " << path_prefix << ".idx");
+    CHECK_AND_ASSERT_MES(SWAP64LE(hdr.version) == BLOB_LOG_VERSION, false, "Unsupported blob log version " << SWAP64LE(hdr.version) << " in " << path_prefix << ".idx");
+    //the log may still be appended to by its writer, only what was there and complete when opened is visible
+    m_read_only_size = valid_count(SWAP64LE(hdr.count));
+    return true;
+  }
+  if(0 == hdr.magic)
+  {
+    hdr.magic = SWAP64LE(BLOB_LOG_MAGIC);
+    hdr.version = SWAP64LE(BLOB_LOG_VERSION);
+    hdr.count = 0;
+    hdr.flushed_count = 0;
+  }
+  CHECK_AND_ASSERT_MES(SWAP64LE(hdr.magic) == BLOB_LOG_MAGIC, false, "Wrong blob log index signature in " << path_prefix << ".idx");
+  CHECK_AND_ASSERT_MES(SWAP64LE(hdr.version) == BLOB_LOG_VERSION, false, "Unsupported blob log version " << SWAP64LE(hdr.version) << " in " << path_prefix << ".idx");
+
+  //drop records which were not completely written (interrupted append)
+  uint64_t count = valid_count(size());
+  if(count != size())
+  {
+    LOG_PRINT_RED_L0("Blob log " << path_prefix << " had " << size() - count << " incomplete records, truncated to " << count);
+    header().count = SWAP64LE(count);
+  }
+  return set_flushed_count(std::min(SWAP64LE(header().flushed_count), count));
+}
+//------------------------------------------------------------------
+void blob_log::close()
+{
+  if(is_open())
+    flush();
+  m_data.close();
+  m_index.close();
+}
+//------------------------------------------------------------------
+uint64_t blob_log::size() const
+{
+  if(m_read_only)
+    return m_read_only_size;
+  return SWAP64LE(header().count);
+}
+//------------------------------------------------------------------
+uint64_t blob_log::record_end(uint64_t i) const
+{
+  return SWAP64LE(records()[i].end);
+}
+//------------------------------------------------------------------
+void blob_log::set_record(uint64_t i, uint64_t end, uint64_t checksum)
+{
+  records()[i].end = SWAP64LE(end);
+  records()[i].checksum = SWAP64LE(checksum);
+}
+//------------------------------------------------------------------
+bool blob_log::is_record_valid(uint64_t i) const
+{
+  uint64_t begin = record_begin(i);
+  uint64_t end = record_end(i);
+  if(end > m_data.capacity() || end < begin)
+    return false;
+  return record_checksum(m_data.data() + begin, end - begin) == SWAP64LE(records()[i].checksum);
+}
+//------------------------------------------------------------------
+bool blob_log::append(const blobdata& blob)
+{
+  CHECK_AND_ASSERT_MES(!m_read_only, false, "append called on read-only blob log");
+  uint64_t i = size();
+  uint64_t begin = record_begin(i);
+  uint64_t end = begin + blob.size();
+  bool r = m_data.reserve(end);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to grow blob log data to " << end << " bytes");
+  r = m_index.reserve(sizeof(index_header) + (i + 1) * sizeof(record_entry));
+  CHECK_AND_ASSERT_MES(r, false, "Failed to grow blob log index to " << i + 1 << " records");
+
+  if(blob.size())
+    memcpy(m_data.data() + begin, blob.data(), blob.size());
+  set_record(i, end, record_checksum(blob.data(), blob.size()));
+  header().count = SWAP64LE(i + 1);
+  return true;
+}
+//------------------------------------------------------------------
+bool blob_log::get(uint64_t i, blobdata& blob) const
+{
+  CHECK_AND_ASSERT_MES(i < size(), false, "blob log record " << i << " requested, but log has only " << size() << " records");
+  CHECK_AND_ASSERT_MES(is_record_valid(i), false, "blob log record " << i << " doesn't match its checksum");
+  uint64_t begin = record_begin(i);
+  blob.assign(m_data.data() + begin, record_end(i) - begin);
+  return true;
+}
+//------------------------------------------------------------------
+bool blob_log::get(uint64_t i, uint64_t offset, uint64_t size, blobdata& blob) const
+{
+  CHECK_AND_ASSERT_MES(i < this->size(), false, "blob log record " << i << " requested, but log has only " << this->size() << " records");
+  uint64_t begin = record_begin(i);
+  uint64_t end = record_end(i);
+  CHECK_AND_ASSERT_MES(begin <= end && end <= m_data.capacity(), false, "blob log record " << i << " is out of the data file");
+  CHECK_AND_ASSERT_MES(offset <= end - begin && size <= end - begin - offset, false, "range [" << offset << ", " << offset + size << ") is out of blob log record " << i << " of " << end - begin << " bytes");
+  blob.assign(m_data.data() + begin + offset, size);
+  return true;
+}
+//------------------------------------------------------------------
+bool blob_log::pop_back()
+{
+  CHECK_AND_ASSERT_MES(!m_read_only, false, "pop_back called on read-only blob log");
+  CHECK_AND_ASSERT_MES(size(), false, "pop_back called on empty blob log");
+  return truncate(size() - 1);
+}
+//------------------------------------------------------------------
+bool blob_log::truncate(uint64_t count)
+{
+  CHECK_AND_ASSERT_MES(!m_read_only, false, "truncate called on read-only blob log");
+  if(count >= size())
+    return true;
+  header().count = SWAP64LE(count);
+  //the records from count on are going to be overwritten, they mustn't pass for flushed ones after a crash
+  if(count < SWAP64LE(header().flushed_count))
+    return set_flushed_count(count);
+  return true;
+}
+//------------------------------------------------------------------
+bool blob_log::restore(uint64_t count)
+{
+  CHECK_AND_ASSERT_MES(!m_read_only, false, "restore called on read-only blob log");
+  CHECK_AND_ASSERT_MES(count >= size(), false, "blob log can't be restored to " << count << " records, it already has " << size());
+  uint64_t max_count = (m_index.capacity() - sizeof(index_header)) / sizeof(record_entry);
+  CHECK_AND_ASSERT_MES(count <= max_count, false, "blob log can't be restored to " << count << " records, its index holds " << max_count);
+  for(uint64_t i = size(); i != count; ++i)
+    CHECK_AND_ASSERT_MES(is_record_valid(i), false, "blob log can't be restored to " << count << " records, record " << i << " was overwritten");
+  header().count = SWAP64LE(count);
+  return true;
+}
+//------------------------------------------------------------------
+uint64_t blob_log::restorable_count(uint64_t count) const
+{
+  uint64_t max_count = (m_index.capacity() - sizeof(index_header)) / sizeof(record_entry);
+  count = std::min(count, max_count);
+  uint64_t restorable = size();
+  while(restorable < count && is_record_valid(restorable))
+    ++restorable;
+  return restorable;
+}
+//------------------------------------------------------------------
+uint64_t blob_log::valid_count(uint64_t count) const
+{
+  uint64_t max_count = (m_index.capacity() - sizeof(index_header)) / sizeof(record_entry);
+  if(count > max_count)
+    count = max_count;
+  //the records appended since the last flush may be torn in any order, the pages they live in are written back by the OS
+  uint64_t valid = std::min(SWAP64LE(header().flushed_count), count);
+  while(valid != count && is_record_valid(valid))
+    ++valid;
+  return valid;
+}
+//------------------------------------------------------------------
+bool blob_log::set_flushed_count(uint64_t count)
+{
+  if(SWAP64LE(header().flushed_count) == count)
+    return true;
+  header().flushed_count = SWAP64LE(count);
+  return m_index.flush(0, sizeof(index_header));
+}
+//------------------------------------------------------------------
+bool blob_log::flush()
+{
+  if(m_read_only)
+    return true;
+  //data first, so that a flushed index never refers to unflushed records
+  bool r = m_data.flush() && m_index.flush();
+  CHECK_AND_ASSERT_MES(r, false, "Failed to flush blob log " << m_index.path());
+  return set_flushed_count(size());
+}
@@ -0,0 +1,102 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "cryptonote_protocol/blobdatatype.h"
+#include "mapped_file.h"
+
+namespace cryptonote
+{
+  /************************************************************************/
+  /* Append-only log of variable sized blobs, kept in two memory mapped   */
+  /* files: <name>.dat holds the records back to back, <name>.idx holds a */
+  /* small header and the end offset and checksum of every record. The    */
+  /* header also counts the records which were on disk at the last flush, */
+  /* the ones appended since are checked against their checksums on open. */
+  /************************************************************************/
+  class blob_log
+  {
+  public:
+    blob_log();
+    ~blob_log();
+
+    // a read-only log must exist; its size is fixed when it is opened and it can't be changed
+    // a new log is created with room for initial_records records of initial_data_size bytes in all, 0 takes the defaults
+    bool open(const std::string& path_prefix, bool read_only = false, uint64_t initial_records = 0, uint64_t initial_data_size = 0);
+    void close();
+    bool is_open() const { return m_index.is_open(); }
+
+    bool is_read_only() const { return m_read_only; }
+    uint64_t size() const;
+    bool append(const blobdata& blob);
+    // fails on a record which doesn't match its checksum
+    bool get(uint64_t i, blobdata& blob) const;
+    // size bytes at offset in record i, not checked against the record's checksum
+    bool get(uint64_t i, uint64_t offset, uint64_t size, blobdata& blob) const;
+    bool pop_back();
+    bool truncate(uint64_t count);
+    // brings back records removed by pop_back/truncate; fails if any of them was overwritten since
+    bool restore(uint64_t count);
+    // how many records restore can bring back up to count, in a single pass over the removed ones
+    uint64_t restorable_count(uint64_t count) const;
+    bool flush();
+
+  private:
+    struct index_header
+    {
+      uint64_t magic;
+      uint64_t version;
+      uint64_t count;
+      uint64_t flushed_count;
+    };
+
+    struct record_entry
+    {
+      uint64_t end;
+      uint64_t checksum;
+    };
+
+    index_header& header() const { return *reinterpret_cast<index_header*>(m_index.data()); }
+    record_entry* records() const { return reinterpret_cast<record_entry*>(m_index.data() + sizeof(index_header)); }
+    uint64_t record_end(uint64_t i) const;
+    uint64_t record_begin(uint64_t i) const { return i ? record_end(i - 1) : 0; }
+    void set_record(uint64_t i, uint64_t end, uint64_t checksum);
+    bool is_record_valid(uint64_t i) const;
+    uint64_t valid_count(uint64_t count) const;
+    bool set_flushed_count(uint64_t count);
+
+    mapped_file m_data;
+    mapped_file m_index;
+    bool m_read_only;
+    uint64_t m_read_only_size;
+  };
+}
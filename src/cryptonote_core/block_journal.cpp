@@ -0,0 +1,179 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <cstring>
+#include <boost/filesystem.hpp>
+
+#include "include_base_utils.h"
+#include "file_io_utils.h"
+#include "common/int-util.h"
+#include "common/util.h"
+#include "crypto/hash.h"
+#include "block_journal.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  const uint64_t BLOCK_JOURNAL_MAGIC = 0x6c6e72756f6a6b62ULL; // "bkjournl"
+  const uint64_t BLOCK_JOURNAL_VERSION = 1;
+  const size_t BLOCK_JOURNAL_HEADER_SIZE = 3 * sizeof(uint64_t);
+  const size_t BLOCK_JOURNAL_RECORD_HEADER_SIZE = 3 * sizeof(uint64_t);
+
+  void put_uint64(std::string& buf, uint64_t v)
+  {
+    v = SWAP64LE(v);
+    buf.append(reinterpret_cast<const char*>(&v), sizeof(v));
+  }
+
+  uint64_t get_uint64(const char* p)
+  {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return SWAP64LE(v);
+  }
+}
+
+//------------------------------------------------------------------
+block_journal::block_journal():m_file(nullptr), m_base_height(0), m_records(0), m_unsynced_records(0)
+{
+}
+//------------------------------------------------------------------
+block_journal::~block_journal()
+{
+  close();
+}
+//------------------------------------------------------------------
+bool block_journal::load(const std::string& path, uint64_t& base_height, std::vector<entry>& entries)
+{
+  entries.clear();
+  boost::system::error_code ec;
+  if(!boost::filesystem::exists(path, ec))
+    return false;
+
+  std::string buf;
+  bool r = epee::file_io_utils::load_file_to_string(path, buf);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to read block journal " << path);
+  CHECK_AND_ASSERT_MES(buf.size() >= BLOCK_JOURNAL_HEADER_SIZE, false, "Block journal " << path << " is too short");
+  CHECK_AND_ASSERT_MES(get_uint64(buf.data()) == BLOCK_JOURNAL_MAGIC, false, "Wrong block journal signature in " << path);
+  CHECK_AND_ASSERT_MES(get_uint64(buf.data() + sizeof(uint64_t)) == BLOCK_JOURNAL_VERSION, false, "Unsupported block journal version in " << path);
+  base_height = get_uint64(buf.data() + 2 * sizeof(uint64_t));
+
+  size_t pos = BLOCK_JOURNAL_HEADER_SIZE;
+  while(buf.size() - pos >= BLOCK_JOURNAL_RECORD_HEADER_SIZE + sizeof(crypto::hash))
+  {
+    const char* p = buf.data() + pos;
+    uint64_t op = get_uint64(p);
+    uint64_t height = get_uint64(p + sizeof(uint64_t));
+    uint64_t size = get_uint64(p + 2 * sizeof(uint64_t));
+    if(size > buf.size() - pos - BLOCK_JOURNAL_RECORD_HEADER_SIZE - sizeof(crypto::hash))
+      break;
+    crypto::hash h = crypto::cn_fast_hash(p, BLOCK_JOURNAL_RECORD_HEADER_SIZE + size);
+    if(memcmp(&h, p + BLOCK_JOURNAL_RECORD_HEADER_SIZE + size, sizeof(h)) || (op != op_push && op != op_pop))
+      break;
+
+    entry e;
+    e.op = static_cast<operation>(op);
+    e.height = height;
+    e.record.assign(p + BLOCK_JOURNAL_RECORD_HEADER_SIZE, size);
+    entries.push_back(e);
+    pos += BLOCK_JOURNAL_RECORD_HEADER_SIZE + size + sizeof(crypto::hash);
+  }
+  if(pos != buf.size())
+    LOG_PRINT_RED_L0("Block journal " << path << " has " << buf.size() - pos << " bytes of incomplete records after record " << entries.size() << ", ignored");
+  return true;
+}
+//------------------------------------------------------------------
+bool block_journal::open(const std::string& path, uint64_t base_height)
+{
+  close();
+  m_path = path;
+  m_file = std::fopen(m_path.c_str(), "wb");
+  CHECK_AND_ASSERT_MES(m_file, false, "Failed to create block journal " << m_path);
+  return write_header(base_height);
+}
+//------------------------------------------------------------------
+void block_journal::close()
+{
+  if(!m_file)
+    return;
+  sync();
+  std::fclose(m_file);
+  m_file = nullptr;
+}
+//------------------------------------------------------------------
+bool block_journal::write_header(uint64_t base_height)
+{
+  std::string buf;
+  put_uint64(buf, BLOCK_JOURNAL_MAGIC);
+  put_uint64(buf, BLOCK_JOURNAL_VERSION);
+  put_uint64(buf, base_height);
+  bool r = buf.size() == std::fwrite(buf.data(), 1, buf.size(), m_file);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to write block journal header to " << m_path);
+  m_base_height = base_height;
+  m_records = 0;
+  m_unsynced_records = 0;
+  return sync();
+}
+//------------------------------------------------------------------
+bool block_journal::append(operation op, uint64_t height, const blobdata& record)
+{
+  CHECK_AND_ASSERT_MES(m_file, false, "block journal is not open");
+  std::string buf;
+  buf.reserve(BLOCK_JOURNAL_RECORD_HEADER_SIZE + record.size() + sizeof(crypto::hash));
+  put_uint64(buf, op);
+  put_uint64(buf, height);
+  put_uint64(buf, record.size());
+  buf.append(record);
+  crypto::hash h = crypto::cn_fast_hash(buf.data(), buf.size());
+  buf.append(reinterpret_cast<const char*>(&h), sizeof(h));
+
+  //hand the record over to the OS right away, so only a system crash can lose it before sync()
+  bool r = buf.size() == std::fwrite(buf.data(), 1, buf.size(), m_file) && 0 == std::fflush(m_file);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to write to block journal " << m_path);
+  ++m_records;
+  ++m_unsynced_records;
+  return true;
+}
+//------------------------------------------------------------------
+bool block_journal::sync()
+{
+  if(!m_file)
+    return true;
+  bool r = tools::sync_file(m_file);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to sync block journal " << m_path);
+  m_unsynced_records = 0;
+  return true;
+}
+//------------------------------------------------------------------
+bool block_journal::reset(uint64_t base_height)
+{
+  CHECK_AND_ASSERT_MES(m_file, false, "block journal is not open");
+  std::string path = m_path;
+  return open(path, base_height);
+}
@@ -0,0 +1,90 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "cryptonote_protocol/blobdatatype.h"
+
+namespace cryptonote
+{
+  /************************************************************************/
+  /* Write-ahead journal of main chain changes. Every push/pop is written */
+  /* here before it is applied to the block log; records are flushed to   */
+  /* the OS right away and fsynced in groups, changes below the base      */
+  /* height at once. The journal is restarted from a new base height      */
+  /* every time the block log is flushed.                                 */
+  /************************************************************************/
+  class block_journal
+  {
+  public:
+    enum operation
+    {
+      op_push = 1,
+      op_pop = 2
+    };
+
+    struct entry
+    {
+      operation op;
+      uint64_t height;
+      blobdata record; // empty for op_pop
+    };
+
+    block_journal();
+    ~block_journal();
+
+    // reads an existing journal, stops at the first incomplete or corrupted record
+    static bool load(const std::string& path, uint64_t& base_height, std::vector<entry>& entries);
+
+    bool open(const std::string& path, uint64_t base_height);
+    void close();
+    bool is_open() const { return m_file != nullptr; }
+
+    bool append(operation op, uint64_t height, const blobdata& record);
+    bool sync();
+    bool reset(uint64_t base_height);
+
+    uint64_t base_height() const { return m_base_height; }
+    uint64_t records() const { return m_records; }
+    uint64_t unsynced_records() const { return m_unsynced_records; }
+
+  private:
+    bool write_header(uint64_t base_height);
+
+    std::string m_path;
+    std::FILE* m_file;
+    uint64_t m_base_height;
+    uint64_t m_records;
+    uint64_t m_unsynced_records;
+  };
+}
@@ -0,0 +1,206 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#include <algorithm>
+
+#include "include_base_utils.h"
+#include "blockchain_snapshot.h"
+#include "cryptonote_format_utils.h"
+#include "rpc/core_rpc_server_utils.h"
+#include "cryptonote_config.h"
+#include "common/parallel.h"
+#include "serialization/binary_utils.h"
+
+using namespace cryptonote;
+
+//------------------------------------------------------------------
+blockchain_snapshot::blockchain_snapshot():m_height(0), m_tail_id(null_hash), m_generation(0)
+{
+}
+//------------------------------------------------------------------
+bool blockchain_snapshot::open(const std::string& config_folder)
+{
+  close();
+  const std::string log_filename = config_folder + "/" CRYPTONOTE_BLOCKCHAINDATA_LOG_FILENAME;
+  if(!m_blocks_log.open(log_filename, true))
+  {
+    LOG_ERROR("Failed to open blockchain data files " << log_filename << ".*");
+    return false;
+  }
+
+  //the daemon rewrites its indexes while it runs, they are only usable as stored, until it changes them again
+  const std::string index_prefix = config_folder + "/" CRYPTONOTE_BLOCKCHAINDATA_INDEX_FILENAME;
+  uint64_t indexed_height = 0;
+  crypto::hash tail_id = null_hash;
+  bool r = blockchain_storage::load_indexes_state(config_folder, indexed_height, tail_id, m_generation)
+    && m_transactions.open_read_only(index_prefix + ".txs") && m_tx_global_output_indexes.open_read_only(index_prefix + ".tx_outs");
+  if(!r)
+  {
+    LOG_ERROR("Blockchain indexes " << index_prefix << ".* can't be read, stop the daemon using them first");
+    close();
+    return false;
+  }
+  crypto::hash id = null_hash;
+  r = indexed_height <= m_blocks_log.size() && (!indexed_height || (get_block_id(indexed_height - 1, id) && id == tail_id));
+  if(!r)
+  {
+    LOG_ERROR("Blockchain indexes " << index_prefix << ".* don't match the stored blocks");
+    close();
+    return false;
+  }
+  m_config_folder = config_folder;
+  m_height = indexed_height;
+  m_tail_id = tail_id;
+  if(!check_indexes_unchanged())
+  {
+    close();
+    return false;
+  }
+  LOG_PRINT_L1("Opened blockchain snapshot " << log_filename << ".*, height " << height());
+  return true;
+}
+//------------------------------------------------------------------
+void blockchain_snapshot::close()
+{
+  m_blocks_log.close();
+  m_transactions.close();
+  m_tx_global_output_indexes.close();
+  m_config_folder.clear();
+  m_height = 0;
+  m_tail_id = null_hash;
+  m_generation = 0;
+}
+//------------------------------------------------------------------
+bool blockchain_snapshot::get_block_id(uint64_t height, crypto::hash& id) const
+{
+  blobdata record;
+  blockchain_storage::stored_block sb = AUTO_VAL_INIT(sb);
+  bool r = m_blocks_log.get(height, record) && ::serialization::parse_binary(record, sb);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to read stored block on height " << height);
+  block bl;
+  r = parse_and_validate_block_from_blob(sb.block, bl);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to parse stored block on height " << height);
+  id = get_block_hash(bl);
+  return true;
+}
+//------------------------------------------------------------------
+bool blockchain_snapshot::parse_block(uint64_t height, parsed_block& pb) const
+{
+  blobdata record;
+  blockchain_storage::stored_block sb = AUTO_VAL_INIT(sb);
+  bool r = m_blocks_log.get(height, record) && ::serialization::parse_binary(record, sb);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to read stored block on height " << height);
+  block bl;
+  r = parse_and_validate_block_from_blob(sb.block, bl);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to parse stored block on height " << height);
+  CHECK_AND_ASSERT_MES(sb.txs.size() == bl.tx_hashes.size(), false, "Stored block on height " << height << " has " << sb.txs.size() << " transactions, expected " << bl.tx_hashes.size());
+
+  pb.id = get_block_hash(bl);
+  pb.header = bl;
+  pb.txs.resize(sb.txs.size() + 1);
+  pb.tx_ids.resize(sb.txs.size() + 1);
+  pb.txs[0] = bl.miner_tx;
+  pb.tx_ids[0] = get_transaction_hash(bl.miner_tx);
+  for(size_t i = 0; i != sb.txs.size(); i++)
+  {
+    crypto::hash tx_prefix_hash = null_hash;
+    r = parse_and_validate_tx_from_blob(sb.txs[i], pb.txs[i + 1], pb.tx_ids[i + 1], tx_prefix_hash);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to parse transaction " << i << " of stored block on height " << height);
+    CHECK_AND_ASSERT_MES(pb.tx_ids[i + 1] == bl.tx_hashes[i], false, "Stored transaction " << pb.tx_ids[i + 1] << " doesn't match block on height " << height);
+  }
+  return true;
+}
+//------------------------------------------------------------------
+bool blockchain_snapshot::parse_blocks(uint64_t start_height, size_t count, std::vector<parsed_block>& blocks) const
+{
+  blocks.clear();
+  blocks.resize(count);
+  std::vector<char> parsed(count, false);
+  tools::run_in_parallel(count, [&](size_t i)
+  {
+    parsed[i] = parse_block(start_height + i, blocks[i]);
+  });
+  return std::find(parsed.begin(), parsed.end(), false) == parsed.end();
+}
+//------------------------------------------------------------------
+bool blockchain_snapshot::get_global_output_indexes(const crypto::hash& tx_id, const transaction& tx, std::vector<uint64_t>& indexes) const
+{
+  const blockchain_storage::transaction_index_entry* e = m_transactions.find(tx_id);
+  CHECK_AND_ASSERT_MES(e, false, "Transaction " << tx_id << " is not indexed");
+  CHECK_AND_ASSERT_MES(e->m_outputs_count == tx.vout.size() && e->m_global_output_indexes_offset + e->m_outputs_count <= m_tx_global_output_indexes.size(), false,
+    "Global output indexes of transaction " << tx_id << " don't match its outputs");
+  indexes.clear();
+  indexes.reserve(e->m_outputs_count);
+  for(uint64_t i = 0; i != e->m_outputs_count; i++)
+    indexes.push_back(m_tx_global_output_indexes[e->m_global_output_indexes_offset + i]);
+  return true;
+}
+//------------------------------------------------------------------
+bool blockchain_snapshot::check_indexes_unchanged() const
+{
+  //every store of the state, as the daemon starts changing the indexes and once they are whole again, takes a new generation
+  uint64_t indexed_height = 0;
+  crypto::hash tail_id = null_hash;
+  uint64_t generation = 0;
+  bool r = blockchain_storage::load_indexes_state(m_config_folder, indexed_height, tail_id, generation)
+    && generation == m_generation && indexed_height == m_height && tail_id == m_tail_id;
+  CHECK_AND_ASSERT_MES(r, false, "Blockchain indexes in " << m_config_folder << " were changed while being read, stop the daemon using them first");
+  return true;
+}
+//------------------------------------------------------------------
+bool blockchain_snapshot::get_blocks(uint64_t start_height, size_t max_count, std::list<COMMAND_RPC_GET_BLOCKS_COMPACT::block_entry>& blocks, std::unordered_map<crypto::hash, transaction>& txs)
+{
+  CHECK_AND_ASSERT_MES(start_height <= height(), false, "Blocks from height " << start_height << " requested, but snapshot height is " << height());
+  size_t count = std::min<uint64_t>(max_count, height() - start_height);
+  std::vector<parsed_block> parsed;
+  bool r = parse_blocks(start_height, count, parsed);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to parse stored blocks from height " << start_height);
+  std::list<COMMAND_RPC_GET_BLOCKS_COMPACT::block_entry> read_blocks;
+  std::unordered_map<crypto::hash, transaction> read_txs;
+  BOOST_FOREACH(parsed_block& pb, parsed)
+  {
+    read_blocks.resize(read_blocks.size() + 1);
+    COMMAND_RPC_GET_BLOCKS_COMPACT::block_entry& e = read_blocks.back();
+    get_compact_block_header(pb.header, pb.id, e);
+    e.txs.resize(pb.txs.size());
+    for(size_t i = 0; i != pb.txs.size(); i++)
+    {
+      std::vector<uint64_t> global_output_indexes;
+      r = get_global_output_indexes(pb.tx_ids[i], pb.txs[i], global_output_indexes);
+      CHECK_AND_ASSERT_MES(r, false, "Failed to read global output indexes of transaction " << pb.tx_ids[i]);
+      get_compact_tx_entry(pb.txs[i], pb.tx_ids[i], global_output_indexes, e.txs[i]);
+      read_txs[pb.tx_ids[i]] = std::move(pb.txs[i]);
+    }
+  }
+  //what was read is only given out if the daemon didn't touch its indexes meanwhile
+  if(!check_indexes_unchanged())
+    return false;
+  blocks.splice(blocks.end(), read_blocks);
+  BOOST_FOREACH(auto& tx, read_txs)
+    txs[tx.first] = std::move(tx.second);
+  return true;
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "blob_log.h"
+#include "blockchain_storage.h"
+#include "cryptonote_basic.h"
+#include "mapped_index.h"
+#include "rpc/core_rpc_server_commands_defs.h"
+
+namespace cryptonote
+{
+  /************************************************************************/
+  /* Read-only view of the main chain stored in a daemon's data dir,      */
+  /* giving the same compact block entries as /getblocks_compact.bin      */
+  /* without a daemon. Global output indexes are read from the daemon's   */
+  /* index files, so the daemon must have stored them and be stopped:     */
+  /* reads fail once the daemon changed its indexes after open().         */
+  /************************************************************************/
+  class blockchain_snapshot
+  {
+  public:
+    blockchain_snapshot();
+
+    bool open(const std::string& config_folder);
+    void close();
+    uint64_t height() const { return m_height; }
+    bool get_block_id(uint64_t height, crypto::hash& id) const;
+    bool get_blocks(uint64_t start_height, size_t max_count, std::list<COMMAND_RPC_GET_BLOCKS_COMPACT::block_entry>& blocks, std::unordered_map<crypto::hash, transaction>& txs);
+
+  private:
+    struct parsed_block
+    {
+      crypto::hash id;
+      block_header header;
+      std::vector<transaction> txs;          //miner tx first
+      std::vector<crypto::hash> tx_ids;
+    };
+
+    bool parse_block(uint64_t height, parsed_block& pb) const;
+    bool parse_blocks(uint64_t start_height, size_t count, std::vector<parsed_block>& blocks) const;
+    bool get_global_output_indexes(const crypto::hash& tx_id, const transaction& tx, std::vector<uint64_t>& indexes) const;
+    bool check_indexes_unchanged() const;
+
+    blob_log m_blocks_log;
+    blockchain_storage::transactions_container m_transactions;
+    mapped_array<uint64_t> m_tx_global_output_indexes;
+    std::string m_config_folder;
+    uint64_t m_height;                       // the indexes cover the blocks below
+    crypto::hash m_tail_id;
+    uint64_t m_generation;                   // of the indexes state read on open
+  };
+}
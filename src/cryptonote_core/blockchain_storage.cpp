@@ -29,14 +29,19 @@
 // Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
 
 #include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <iterator>
+#include <thread>
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/archive/binary_iarchive.hpp>
+#include <boost/thread/thread.hpp>
 
 #include "include_base_utils.h"
 #include "cryptonote_basic_impl.h"
 #include "blockchain_storage.h"
 #include "cryptonote_format_utils.h"
+#include "rpc/core_rpc_server_utils.h"
 #include "cryptonote_boost_serialization.h"
 #include "blockchain_storage_boost_serialization.h"
 #include "cryptonote_config.h"
@@ -45,52 +50,136 @@
 #include "profile_tools.h"
 #include "file_io_utils.h"
 #include "common/boost_serialization_helper.h"
+#include "common/parallel.h"
+#include "common/varint.h"
 #include "warnings.h"
 #include "crypto/hash.h"
 #include "cryptonote_core/checkpoints_create.h"
+#include "serialization/binary_utils.h"
 //#include "serialization/json_archive.h"
 
 using namespace cryptonote;
 
 DISABLE_VS_WARNINGS(4267)
 
+namespace
+{
+  const uint64_t BLOCKCHAIN_INDEXES_STATE_MAGIC = 0x6574617473786469ULL; // "idxstate"
+  const uint64_t BLOCKCHAIN_INDEXES_STATE_VERSION = 2;
+
+  // CRYPTONOTE_BLOCKCHAINDATA_INDEX_FILENAME.state, tells which block log the index files match
+  struct indexes_state
+  {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t clean;                          // 0 while the index files are being changed
+    uint64_t height;
+    crypto::hash tail_id;
+    uint64_t generation;                     // counts the stores, readers of the index files check it didn't change under them
+  };
+
+  size_t varint_size(uint64_t v)
+  {
+    std::string s;
+    tools::write_varint(std::back_inserter(s), v);
+    return s.size();
+  }
+}
+
 //------------------------------------------------------------------
 bool blockchain_storage::have_tx(const crypto::hash &id)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
-  return m_transactions.find(id) != m_transactions.end();
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  return m_transactions.count(id);
 }
 //------------------------------------------------------------------
 bool blockchain_storage::have_tx_keyimg_as_spent(const crypto::key_image &key_im)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
-  return  m_spent_keys.find(key_im) != m_spent_keys.end();
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  return m_spent_keys.count(key_im);
 }
 //------------------------------------------------------------------
-transaction *blockchain_storage::get_tx(const crypto::hash &id)
+bool blockchain_storage::get_tx(const crypto::hash &id, transaction &tx)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
-  auto it = m_transactions.find(id);
-  if (it == m_transactions.end())
-    return NULL;
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  const transaction_index_entry* e = m_transactions.find(id);
+  if (!e)
+    return false;
 
-  return &it->second.tx;
+  return get_main_transaction(id, *e, tx);
 }
 //------------------------------------------------------------------
 uint64_t blockchain_storage::get_current_blockchain_height()
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   return m_blocks.size();
 }
 //------------------------------------------------------------------
 bool blockchain_storage::init(const std::string& config_folder, bool testnet)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   m_config_folder = config_folder;
   m_testnet = testnet;
   LOG_PRINT_L0("Loading blockchain...");
+  if (!tools::create_directories_if_necessary(m_config_folder))
+  {
+    LOG_PRINT_L0("Failed to create data directory: " << m_config_folder);
+    return false;
+  }
+
+  const std::string log_filename = m_config_folder + "/" CRYPTONOTE_BLOCKCHAINDATA_LOG_FILENAME;
+  if(!m_blocks_log.open(log_filename))
+  {
+    LOG_ERROR("Failed to open blockchain data files " << log_filename << ".*");
+    return false;
+  }
+
+  const std::string journal_filename = m_config_folder + "/" CRYPTONOTE_BLOCKCHAINDATA_JOURNAL_FILENAME;
+  uint64_t journal_base_height = 0;
+  std::vector<block_journal::entry> journal_entries;
+  if(block_journal::load(journal_filename, journal_base_height, journal_entries))
+  {
+    bool r = replay_blocks_journal(journal_base_height, journal_entries);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to replay block journal " << journal_filename);
+  }
+
+  if(!open_indexes())
+  {
+    LOG_ERROR("Failed to open blockchain indexes " << m_config_folder << "/" CRYPTONOTE_BLOCKCHAINDATA_INDEX_FILENAME ".*");
+    return false;
+  }
+
+  bool loaded = false;
   const std::string filename = m_config_folder + "/" CRYPTONOTE_BLOCKCHAINDATA_FILENAME;
-  if(tools::unserialize_obj_from_file(*this, filename))
+  if(m_blocks_log.size())
+  {
+    loaded = load_blocks_from_log();
+    CHECK_AND_ASSERT_MES(loaded, false, "Failed to load blockchain from " << log_filename << ".*, blockchain data is corrupted");
+    load_side_blocks();
+  }
+  else if(boost::filesystem::exists(filename))
+  {
+    LOG_PRINT_L0("Converting " << filename << " to the append-only block storage, this is done only once...");
+    //unserializing it writes its blocks to the block log, they are loaded from there
+    loaded = tools::unserialize_obj_from_file(*this, filename) && load_blocks_from_log() && store_side_blocks();
+    CHECK_AND_ASSERT_MES(loaded, false, "Failed to convert " << filename << " to " << log_filename << ".*");
+    LOG_PRINT_L0("Blockchain converted, " << filename << " is not used anymore and can be removed.");
+  }
+  else if(!load_blocks_from_log())
+  {
+    //nothing to index, this only drops whatever the index files held
+    LOG_ERROR("Failed to reset blockchain indexes in " << m_config_folder);
+    return false;
+  }
+
+  //from here on every change of the block log goes through the journal first
+  if(!m_blocks_log.flush() || !m_blocks_journal.open(journal_filename, m_blocks_log.size()))
+  {
+    LOG_ERROR("Failed to open block journal " << journal_filename);
+    return false;
+  }
+
+  if(loaded)
   {
 
       // checkpoints
@@ -98,7 +187,7 @@ bool blockchain_storage::init(const std::string& config_folder, bool testnet)
       // mainchain
       for (size_t height=0; height < m_blocks.size(); ++height) 
       {
-	CHECK_AND_ASSERT_MES((!m_checkpoints.is_in_checkpoint_zone(height)) || m_checkpoints.check_block(height,get_block_hash(m_blocks[height].bl)),false,"checkpoint fail, blockchain.bin invalid");
+	CHECK_AND_ASSERT_MES((!m_checkpoints.is_in_checkpoint_zone(height)) || m_checkpoints.check_block(height,m_blocks[height].id),false,"checkpoint fail, blockchain data invalid");
       }
 
       // check alt chains
@@ -107,7 +196,7 @@ bool blockchain_storage::init(const std::string& config_folder, bool testnet)
       // see issue #118
       BOOST_FOREACH(blocks_ext_by_hash::value_type& alt_block, m_alternative_chains)
       {
-	CHECK_AND_ASSERT_MES(m_checkpoints.is_alternative_block_allowed(m_blocks.size()-1,alt_block.second.height),false,"stored alternative block not allowed, blockchain.bin invalid");
+	CHECK_AND_ASSERT_MES(m_checkpoints.is_alternative_block_allowed(m_blocks.size()-1,alt_block.second.height),false,"stored alternative block not allowed, blockchain data invalid");
       }
       #endif
   }
@@ -146,15 +235,15 @@ bool blockchain_storage::init(const std::string& config_folder, bool testnet)
       generate_genesis_block(b, config::GENESIS_TX, config::GENESIS_NONCE);
     }
 
-    crypto::hash genesis_hash = get_block_hash(m_blocks[0].bl);
+    crypto::hash genesis_hash = m_blocks[0].id;
     crypto::hash testnet_genesis_hash = get_block_hash(b);
     if (genesis_hash != testnet_genesis_hash) {
       LOG_ERROR("Failed to init: genesis block mismatch. Probably you set --testnet flag with data dir with non-test blockchain or another network.");
       return false;
     }
   }
-  uint64_t timestamp_diff = time(NULL) - m_blocks.back().bl.timestamp;
-  if(!m_blocks.back().bl.timestamp)
+  uint64_t timestamp_diff = time(NULL) - m_blocks.back().timestamp;
+  if(!m_blocks.back().timestamp)
     timestamp_diff = time(NULL) - 1341378000;
   LOG_PRINT_GREEN("Blockchain initialized. last block: " << m_blocks.size() - 1 << ", " << epee::misc_utils::get_time_interval_string(timestamp_diff) << " time ago, current difficulty: " << get_difficulty_for_next_block(), LOG_LEVEL_0);
   return true;
@@ -184,26 +273,28 @@ bool blockchain_storage::store_blockchain()
   epee::misc_utils::auto_scope_leave_caller scope_exit_handler = epee::misc_utils::create_scope_leave_handler([&](){m_is_blockchain_storing=false;});
 
   LOG_PRINT_L0("Storing blockchain...");
-  if (!tools::create_directories_if_necessary(m_config_folder))
+  EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  //blocks are appended to m_blocks_log as they are added, only flush them to disk here
+  if(m_blocks_log.is_open() && !m_blocks_log.flush())
   {
-    LOG_PRINT_L0("Failed to create data directory: " << m_config_folder);
+    LOG_ERROR("Failed to flush blockchain data to disk in " << m_config_folder);
     return false;
   }
-
-  const std::string temp_filename = m_config_folder + "/" CRYPTONOTE_BLOCKCHAINDATA_TEMP_FILENAME;
-  // There is a chance that temp_filename and filename are hardlinks to the same file
-  std::remove(temp_filename.c_str());
-  if(!tools::serialize_obj_to_file(*this, temp_filename))
+  //the indexes are only used on the next start if they were flushed after the block log they index
+  if(m_blocks_log.is_open() && !m_indexes_clean && !(flush_indexes() && store_indexes_state(true)))
   {
-    //achtung!
-    LOG_ERROR("Failed to save blockchain data to file: " << temp_filename);
+    LOG_ERROR("Failed to store blockchain indexes in " << m_config_folder);
     return false;
   }
-  const std::string filename = m_config_folder + "/" CRYPTONOTE_BLOCKCHAINDATA_FILENAME;
-  std::error_code ec = tools::replace_file(temp_filename, filename);
-  if (ec)
+  //everything journaled so far is in the flushed block log now
+  if(m_blocks_journal.is_open() && !m_blocks_journal.reset(m_blocks_log.size()))
+  {
+    LOG_ERROR("Failed to restart block journal in " << m_config_folder);
+    return false;
+  }
+  if(m_blocks_log.is_open() && !store_side_blocks())
   {
-    LOG_ERROR("Failed to rename blockchain data file " << temp_filename << " to " << filename << ": " << ec.message() << ':' << ec.value());
+    LOG_ERROR("Failed to store alternative blocks in " << m_config_folder);
     return false;
   }
   LOG_PRINT_L0("Blockchain stored OK.");
@@ -212,39 +303,501 @@ bool blockchain_storage::store_blockchain()
 //------------------------------------------------------------------
 bool blockchain_storage::deinit()
 {
-  return store_blockchain();
+  bool r = store_blockchain();
+  EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  m_blocks_journal.close();
+  m_blocks_log.close();
+  close_indexes();
+  return r;
+}
+//------------------------------------------------------------------
+void blockchain_storage::on_idle()
+{
+  m_journal_sync_interval.do_call([this](){
+    EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+    if(m_blocks_journal.records() >= BLOCKCHAIN_JOURNAL_SNAPSHOT_RECORDS)
+      return store_blockchain();
+    return m_blocks_journal.unsynced_records() ? m_blocks_journal.sync() : true;
+  });
 }
 //------------------------------------------------------------------
-bool blockchain_storage::pop_block_from_blockchain()
+bool blockchain_storage::store_side_blocks()
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  side_blocks side = {m_alternative_chains, m_invalid_blocks};
+  return tools::serialize_obj_to_file(side, m_config_folder + "/" CRYPTONOTE_BLOCKCHAINDATA_ALT_FILENAME);
+}
+//------------------------------------------------------------------
+void blockchain_storage::load_side_blocks()
+{
+  const std::string filename = m_config_folder + "/" CRYPTONOTE_BLOCKCHAINDATA_ALT_FILENAME;
+  if(!boost::filesystem::exists(filename))
+    return;
+  side_blocks side = {m_alternative_chains, m_invalid_blocks};
+  if(!tools::unserialize_obj_from_file(side, filename))
+  {
+    //they are only a fallback for reorganizations, peers send them again if needed
+    LOG_PRINT_RED_L0("Failed to load alternative blocks from " << filename << ", they are dropped");
+    m_alternative_chains.clear();
+    m_invalid_blocks.clear();
+    return;
+  }
+  //the main chain may have taken some of them in after they were stored
+  for(auto it = m_alternative_chains.begin(); it != m_alternative_chains.end();)
+  {
+    if(m_blocks_index.count(it->first))
+      it = m_alternative_chains.erase(it);
+    else
+      ++it;
+  }
+  LOG_PRINT_L1("Loaded " << m_alternative_chains.size() << " alternative and " << m_invalid_blocks.size() << " invalid blocks");
+}
+//------------------------------------------------------------------
+bool blockchain_storage::push_block_to_log(const block_extended_info& bei, const std::vector<blobdata>& tx_blobs, std::vector<blob_location>& tx_locations)
+{
+  //main chain blocks are only kept in the block log, they can't be added before init
+  CHECK_AND_ASSERT_MES(m_blocks_log.is_open(), false, "Internal error: blocks log is not open");
+  CHECK_AND_ASSERT_MES(m_blocks_log.size() == bei.height, false, "Internal error: blocks log size " << m_blocks_log.size() << " doesn't match block height " << bei.height);
+  stored_block sb = AUTO_VAL_INIT(sb);
+  sb.block = block_to_blob(bei.bl);
+  sb.txs = tx_blobs;
+  sb.block_cumulative_size = bei.block_cumulative_size;
+  sb.cumulative_difficulty = bei.cumulative_difficulty;
+  sb.already_generated_coins = bei.already_generated_coins;
+  blobdata record;
+  bool r = t_serializable_object_to_blob(sb, record);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to serialize block on height " << bei.height);
+  r = locate_stored_transactions(record, sb, bei.bl, tx_locations);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to locate transactions in stored block on height " << bei.height);
+  if(m_blocks_journal.is_open())
+  {
+    r = m_blocks_journal.append(block_journal::op_push, bei.height, record);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to journal block on height " << bei.height);
+    //a replay starts from the block log below the base height, so it is only overwritten once the journal is on disk;
+    //blocks past it are dropped by a replay anyway, their records are synced in groups
+    if(bei.height < m_blocks_journal.base_height() || m_blocks_journal.unsynced_records() >= BLOCKCHAIN_JOURNAL_SYNC_RECORDS)
+    {
+      r = m_blocks_journal.sync();
+      CHECK_AND_ASSERT_MES(r, false, "Failed to sync block journal on height " << bei.height);
+    }
+  }
+  return m_blocks_log.append(record);
+}
+//------------------------------------------------------------------
+bool blockchain_storage::pop_block_from_log(uint64_t height)
+{
+  CHECK_AND_ASSERT_MES(m_blocks_log.is_open(), false, "Internal error: blocks log is not open");
+  CHECK_AND_ASSERT_MES(m_blocks_log.size() == height + 1, false, "Internal error: blocks log size " << m_blocks_log.size() << " doesn't match popped block height " << height);
+  if(m_blocks_journal.is_open())
+  {
+    bool r = m_blocks_journal.append(block_journal::op_pop, height, blobdata());
+    CHECK_AND_ASSERT_MES(r, false, "Failed to journal removal of block on height " << height);
+    if(height < m_blocks_journal.base_height())
+    {
+      r = m_blocks_journal.sync();
+      CHECK_AND_ASSERT_MES(r, false, "Failed to sync block journal on height " << height);
+    }
+  }
+  return m_blocks_log.pop_back();
+}
+//------------------------------------------------------------------
+bool blockchain_storage::replay_blocks_journal(uint64_t base_height, const std::vector<block_journal::entry>& entries)
+{
+  //the block log is only known to be intact as it was when it was last flushed
+  bool r = m_blocks_log.size() < base_height ? m_blocks_log.restore(base_height) : m_blocks_log.truncate(base_height);
+  if(!r)
+  {
+    //the journal builds on blocks that were lost, keep the intact ones and download the rest again
+    r = m_blocks_log.restore(m_blocks_log.restorable_count(base_height));
+    CHECK_AND_ASSERT_MES(r, false, "Failed to restore the intact blocks below height " << base_height);
+    LOG_PRINT_RED_L0("Blockchain data holds " << m_blocks_log.size() << " of the " << base_height << " blocks the block journal builds on, the journal is dropped");
+    return m_blocks_log.flush();
+  }
+  size_t replayed = 0;
+  BOOST_FOREACH(const block_journal::entry& e, entries)
+  {
+    if(block_journal::op_push == e.op)
+      r = e.height == m_blocks_log.size() && m_blocks_log.append(e.record);
+    else
+      r = e.height + 1 == m_blocks_log.size() && m_blocks_log.pop_back();
+    if(!r)
+    {
+      LOG_PRINT_RED_L0("Journaled change on height " << e.height << " doesn't apply to blockchain height " << m_blocks_log.size() << ", the rest of the journal is dropped");
+      break;
+    }
+    ++replayed;
+  }
+  if(replayed)
+    LOG_PRINT_L0("Replayed " << replayed << " journaled changes on top of height " << base_height << ", blockchain height is " << m_blocks_log.size());
+  return m_blocks_log.flush();
+}
+//------------------------------------------------------------------
+bool blockchain_storage::locate_stored_transactions(const blobdata& record, const stored_block& sb, const block& bl, std::vector<blob_location>& locations)
+{
+  //a record is the varint sized block blob, the varint count of transaction blobs and each of them varint sized;
+  //the miner transaction is followed by the varint count of tx_hashes and the hashes in the block blob
+  locations.clear();
+  const blobdata miner_tx_blob = tx_to_blob(bl.miner_tx);
+  const uint64_t block_offset = varint_size(sb.block.size());
+  const uint64_t tx_hashes_size = varint_size(bl.tx_hashes.size()) + bl.tx_hashes.size() * sizeof(crypto::hash);
+  CHECK_AND_ASSERT_MES(sb.block.size() >= tx_hashes_size + miner_tx_blob.size(), false, "Stored block blob is too short for its miner transaction");
+  locations.push_back(blob_location(block_offset + sb.block.size() - tx_hashes_size - miner_tx_blob.size(), miner_tx_blob.size()));
+  uint64_t offset = block_offset + sb.block.size() + varint_size(sb.txs.size());
+  BOOST_FOREACH(const blobdata& tx_blob, sb.txs)
+  {
+    offset += varint_size(tx_blob.size());
+    locations.push_back(blob_location(offset, tx_blob.size()));
+    offset += tx_blob.size();
+  }
+
+  //transactions are read from the log by these locations without parsing the record, make sure they hold what they should
+  for(size_t i = 0; i != locations.size(); i++)
+  {
+    const blobdata& tx_blob = i ? sb.txs[i - 1] : miner_tx_blob;
+    bool r = locations[i].first + locations[i].second <= record.size() && 0 == record.compare(locations[i].first, locations[i].second, tx_blob);
+    CHECK_AND_ASSERT_MES(r, false, "Stored block record doesn't hold transaction " << i << " where expected");
+  }
+  return true;
+}
+//------------------------------------------------------------------
+bool blockchain_storage::set_transaction_locations(const block& bl, const std::vector<blob_location>& locations)
+{
+  CHECK_AND_ASSERT_MES(locations.size() == bl.tx_hashes.size() + 1, false, "Internal error: " << locations.size() << " transaction locations for a block with " << bl.tx_hashes.size() + 1 << " transactions");
+  for(size_t i = 0; i != locations.size(); i++)
+  {
+    const crypto::hash tx_id = i ? bl.tx_hashes[i - 1] : get_transaction_hash(bl.miner_tx);
+    transaction_index_entry* e = m_transactions.find(tx_id);
+    CHECK_AND_ASSERT_MES(e, false, "Internal error: transaction " << tx_id << " is not indexed");
+    e->m_blob_offset = locations[i].first;
+    e->m_blob_size = locations[i].second;
+  }
+  return true;
+}
+//------------------------------------------------------------------
+bool blockchain_storage::add_block_from_log(const blobdata& record, uint64_t height)
+{
+  bool r = mark_indexes_changed();
+  CHECK_AND_ASSERT_MES(r, false, "Failed to mark blockchain indexes as changed");
+  stored_block sb = AUTO_VAL_INIT(sb);
+  r = ::serialization::parse_binary(record, sb);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to parse stored block record on height " << height);
+  block bl = AUTO_VAL_INIT(bl);
+  r = parse_and_validate_block_from_blob(sb.block, bl);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to parse stored block on height " << height);
+  CHECK_AND_ASSERT_MES(sb.txs.size() == bl.tx_hashes.size(), false, "Stored block on height " << height << " has " << sb.txs.size() << " transactions, expected " << bl.tx_hashes.size());
+  CHECK_AND_ASSERT_MES(bl.prev_id == get_tail_id(), false, "Stored block on height " << height << " doesn't refer to the previous stored block");
+  std::vector<blob_location> locations;
+  r = locate_stored_transactions(record, sb, bl, locations);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to locate transactions in stored block on height " << height);
+  block_index_entry bie = AUTO_VAL_INIT(bie);
+  bie.id = get_block_hash(bl);
+  bie.timestamp = bl.timestamp;
+  bie.block_cumulative_size = sb.block_cumulative_size;
+  bie.cumulative_difficulty = sb.cumulative_difficulty;
+  bie.already_generated_coins = sb.already_generated_coins;
+
+  r = add_transaction_from_block(bl.miner_tx, get_transaction_hash(bl.miner_tx), bie.id, height, 0);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to add coinbase transaction of stored block on height " << height);
+  for(size_t i = 0; i != sb.txs.size(); i++)
+  {
+    transaction tx;
+    crypto::hash tx_hash = null_hash;
+    crypto::hash tx_prefix_hash = null_hash;
+    r = parse_and_validate_tx_from_blob(sb.txs[i], tx, tx_hash, tx_prefix_hash);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to parse transaction " << i << " of stored block on height " << height);
+    CHECK_AND_ASSERT_MES(tx_hash == bl.tx_hashes[i], false, "Stored transaction " << tx_hash << " doesn't match block on height " << height);
+    r = add_transaction_from_block(tx, tx_hash, bie.id, height, i + 1);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to add transaction " << tx_hash << " of stored block on height " << height);
+  }
+  r = set_transaction_locations(bl, locations);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to index transactions of stored block on height " << height);
+
+  r = m_blocks_index.insert(bie.id, height);
+  CHECK_AND_ASSERT_MES(r, false, "Stored block with id " << bie.id << " is already in block indexes");
+  r = m_blocks.push_back(bie);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to index stored block on height " << height);
+  return true;
+}
+//------------------------------------------------------------------
+bool blockchain_storage::load_blocks_from_log()
+{
+  //the indexes are kept across restarts, only the blocks added to the log since they were stored are indexed here
+  uint64_t height = 0;
+  crypto::hash tail_id = null_hash;
+  m_indexes_clean = load_indexes_state(m_config_folder, height, tail_id, m_indexes_generation);
+  bool intact = m_indexes_clean && height == m_blocks.size() && height == m_blocks_index.size() && height <= m_blocks_log.size();
+  if(intact && height)
+  {
+    block bl = AUTO_VAL_INIT(bl);
+    intact = m_blocks.back().id == tail_id && get_main_block(height - 1, bl) && get_block_hash(bl) == tail_id;
+  }
+  const uint64_t count = m_blocks_log.size();
+  if(!intact)
+  {
+    if(count)
+      LOG_PRINT_L0("Blockchain indexes don't match the stored blocks, building them again...");
+    bool r = mark_indexes_changed();
+    CHECK_AND_ASSERT_MES(r, false, "Failed to mark blockchain indexes as changed");
+    clear_indexes();
+    height = 0;
+  }
+  else if(height != count)
+  {
+    LOG_PRINT_L0("Indexing " << count - height << " blocks stored since height " << height << "...");
+  }
+
+  for(; height != count; height++)
+  {
+    blobdata record;
+    bool r = m_blocks_log.get(height, record);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to read stored block on height " << height);
+    r = add_block_from_log(record, height);
+    if(!r)
+      return false;
+    if(height && 0 == height % 10000)
+      LOG_PRINT_L0("Indexed " << height << " of " << count << " blocks");
+  }
+  rebuild_difficulty_window();
+  update_next_comulative_size_limit();
+  if(m_indexes_clean)
+    return true;
+  //an interrupted start doesn't have to index these blocks again
+  bool r = m_blocks_log.flush() && flush_indexes() && store_indexes_state(true);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to store blockchain indexes");
+  return true;
+}
+//------------------------------------------------------------------
+bool blockchain_storage::open_indexes()
+{
+  const std::string prefix = m_config_folder + "/" CRYPTONOTE_BLOCKCHAINDATA_INDEX_FILENAME;
+  auto open_all = [&]() {
+    return m_blocks.open(prefix + ".blocks") && m_blocks_index.open(prefix + ".ids") && m_transactions.open(prefix + ".txs")
+      && m_tx_global_output_indexes.open(prefix + ".tx_outs") && m_spent_keys.open(prefix + ".key_images")
+      && m_amount_outputs.open(prefix + ".amounts") && m_outputs.open(prefix + ".outs");
+  };
+  if(open_all())
+    return true;
+
+  LOG_PRINT_RED_L0("Blockchain indexes " << prefix << ".* can't be used, they are built again");
+  close_indexes();
+  const char* const suffixes[] = {".blocks", ".ids", ".txs", ".tx_outs", ".key_images", ".amounts", ".outs", ".state"};
+  BOOST_FOREACH(const char* suffix, suffixes)
+  {
+    boost::system::error_code ec;
+    boost::filesystem::remove(prefix + suffix, ec);
+  }
+  bool r = open_all();
+  CHECK_AND_ASSERT_MES(r, false, "Failed to create blockchain indexes " << prefix << ".*");
+  return true;
+}
+//------------------------------------------------------------------
+void blockchain_storage::close_indexes()
+{
+  m_blocks.close();
+  m_blocks_index.close();
+  m_transactions.close();
+  m_tx_global_output_indexes.close();
+  m_spent_keys.close();
+  m_amount_outputs.close();
+  m_outputs.close();
+}
+//------------------------------------------------------------------
+void blockchain_storage::clear_indexes()
+{
+  m_blocks.clear();
+  m_blocks_index.clear();
+  m_transactions.clear();
+  m_tx_global_output_indexes.clear();
+  m_spent_keys.clear();
+  m_amount_outputs.clear();
+  m_outputs.clear();
+}
+//------------------------------------------------------------------
+bool blockchain_storage::flush_indexes()
+{
+  bool r = m_blocks.flush();
+  r = m_blocks_index.flush() && r;
+  r = m_transactions.flush() && r;
+  r = m_tx_global_output_indexes.flush() && r;
+  r = m_spent_keys.flush() && r;
+  r = m_amount_outputs.flush() && r;
+  return m_outputs.flush() && r;
+}
+//------------------------------------------------------------------
+bool blockchain_storage::load_indexes_state(const std::string& config_folder, uint64_t& height, crypto::hash& tail_id, uint64_t& generation)
+{
+  const std::string path = config_folder + "/" CRYPTONOTE_BLOCKCHAINDATA_INDEX_FILENAME ".state";
+  boost::system::error_code ec;
+  if(!boost::filesystem::exists(path, ec))
+    return false;
+  std::string buf;
+  indexes_state state = AUTO_VAL_INIT(state);
+  if(!epee::file_io_utils::load_file_to_string(path, buf) || buf.size() != sizeof(state))
+  {
+    LOG_PRINT_RED_L0("Blockchain indexes state " << path << " can't be read");
+    return false;
+  }
+  memcpy(&state, buf.data(), sizeof(state));
+  if(state.magic != BLOCKCHAIN_INDEXES_STATE_MAGIC || state.version != BLOCKCHAIN_INDEXES_STATE_VERSION)
+  {
+    LOG_PRINT_RED_L0("Blockchain indexes state " << path << " was written by another version");
+    return false;
+  }
+  generation = state.generation;
+  if(!state.clean)
+  {
+    LOG_PRINT_RED_L0("Blockchain indexes were not stored on exit");
+    return false;
+  }
+  height = state.height;
+  tail_id = state.tail_id;
+  return true;
+}
+//------------------------------------------------------------------
+bool blockchain_storage::store_indexes_state(bool clean)
+{
+  indexes_state state = AUTO_VAL_INIT(state);
+  state.magic = BLOCKCHAIN_INDEXES_STATE_MAGIC;
+  state.version = BLOCKCHAIN_INDEXES_STATE_VERSION;
+  state.clean = clean ? 1 : 0;
+  state.height = m_blocks.size();
+  state.tail_id = get_tail_id();
+  state.generation = ++m_indexes_generation;
+
+  //written aside and renamed over the old state, so a crash leaves either of them
+  const std::string path = m_config_folder + "/" CRYPTONOTE_BLOCKCHAINDATA_INDEX_FILENAME ".state";
+  const std::string tmp_path = path + ".tmp";
+  std::FILE* f = std::fopen(tmp_path.c_str(), "wb");
+  CHECK_AND_ASSERT_MES(f, false, "Failed to create " << tmp_path);
+  bool r = 1 == std::fwrite(&state, sizeof(state), 1, f) && tools::sync_file(f);
+  r = 0 == std::fclose(f) && r;
+  CHECK_AND_ASSERT_MES(r, false, "Failed to write " << tmp_path);
+  std::error_code ec = tools::replace_file(tmp_path, path);
+  CHECK_AND_ASSERT_MES(!ec, false, "Failed to replace " << path << ": " << ec.message());
+  r = tools::sync_directory(m_config_folder);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to sync directory " << m_config_folder);
+  m_indexes_clean = clean;
+  return true;
+}
+//------------------------------------------------------------------
+bool blockchain_storage::mark_indexes_changed()
+{
+  if(!m_indexes_clean)
+    return true;
+  //the OS writes changed pages of the index files back at any time, from here on they only match the log once stored again
+  return store_indexes_state(false);
+}
+//------------------------------------------------------------------
+bool blockchain_storage::convert_blocks_to_log(const legacy_blocks_container& blocks, const legacy_transactions_container& transactions)
+{
+  m_blocks_log.truncate(0);
+  for(size_t height = 0; height != blocks.size(); height++)
+  {
+    const block_extended_info& bei = blocks[height];
+    std::vector<blobdata> tx_blobs;
+    tx_blobs.reserve(bei.bl.tx_hashes.size());
+    BOOST_FOREACH(const crypto::hash& tx_id, bei.bl.tx_hashes)
+    {
+      auto it = transactions.find(tx_id);
+      CHECK_AND_ASSERT_MES(it != transactions.end(), false, "Transaction " << tx_id << " from block on height " << height << " not found");
+      tx_blobs.push_back(tx_to_blob(it->second.tx));
+    }
+    std::vector<blob_location> tx_locations;
+    bool r = push_block_to_log(bei, tx_blobs, tx_locations);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to store block on height " << height);
+  }
+  return m_blocks_log.flush();
+}
+//------------------------------------------------------------------
+bool blockchain_storage::get_stored_block(uint64_t height, stored_block& sb)
+{
+  blobdata record;
+  return m_blocks_log.get(height, record) && ::serialization::parse_binary(record, sb);
+}
+//------------------------------------------------------------------
+bool blockchain_storage::get_main_block(uint64_t height, block& bl)
+{
+  stored_block sb = AUTO_VAL_INIT(sb);
+  bool r = get_stored_block(height, sb);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to read stored block on height " << height);
+  r = parse_and_validate_block_from_blob(sb.block, bl);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to parse stored block on height " << height);
+  return true;
+}
+//------------------------------------------------------------------
+bool blockchain_storage::get_main_block(uint64_t height, block& bl, std::vector<transaction>& txs)
+{
+  stored_block sb = AUTO_VAL_INIT(sb);
+  bool r = get_stored_block(height, sb);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to read stored block on height " << height);
+  r = parse_and_validate_block_from_blob(sb.block, bl);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to parse stored block on height " << height);
+  txs.resize(sb.txs.size());
+  for(size_t i = 0; i != sb.txs.size(); i++)
+  {
+    r = parse_and_validate_tx_from_blob(sb.txs[i], txs[i]);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to parse transaction " << i << " of stored block on height " << height);
+  }
+  return true;
+}
+//------------------------------------------------------------------
+bool blockchain_storage::get_main_transaction(const crypto::hash& tx_id, const transaction_index_entry& e, transaction& tx)
+{
+  blobdata blob;
+  bool r = m_blocks_log.get(e.m_keeper_block_height, e.m_blob_offset, e.m_blob_size, blob);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to read transaction " << tx_id << " from stored block on height " << e.m_keeper_block_height);
+  //only a part of the record is read, so it isn't checked against the record's checksum but against the transaction hash
+  crypto::hash tx_hash = null_hash;
+  crypto::hash tx_prefix_hash = null_hash;
+  r = parse_and_validate_tx_from_blob(blob, tx, tx_hash, tx_prefix_hash) && tx_hash == tx_id;
+  CHECK_AND_ASSERT_MES(r, false, "Stored transaction " << tx_id << " on height " << e.m_keeper_block_height << " is corrupted");
+  return true;
+}
+//------------------------------------------------------------------
+bool blockchain_storage::pop_block_from_blockchain(block* popped)
+{
+  EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
   CHECK_AND_ASSERT_MES(m_blocks.size() > 1, false, "pop_block_from_blockchain: can't pop from blockchain with size = " << m_blocks.size());
   size_t h = m_blocks.size()-1;
-  block_extended_info& bei = m_blocks[h];
-  //crypto::hash id = get_block_hash(bei.bl);
-  bool r = purge_block_data_from_blockchain(bei.bl, bei.bl.tx_hashes.size());
-  CHECK_AND_ASSERT_MES(r, false, "Failed to purge_block_data_from_blockchain for block " << get_block_hash(bei.bl) << " on height " << h);
+  const crypto::hash id = m_blocks[h].id;
+  block bl = AUTO_VAL_INIT(bl);
+  std::vector<transaction> txs;
+  bool r = get_main_block(h, bl, txs);
+  CHECK_AND_ASSERT_MES(r, false, "pop_block_from_blockchain: failed to read block " << id << " on height " << h);
+  r = mark_indexes_changed();
+  CHECK_AND_ASSERT_MES(r, false, "pop_block_from_blockchain: failed to mark blockchain indexes as changed");
+  r = purge_block_data_from_blockchain(bl, txs);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to purge_block_data_from_blockchain for block " << id << " on height " << h);
 
   //remove from index
-  auto bl_ind = m_blocks_index.find(get_block_hash(bei.bl));
-  CHECK_AND_ASSERT_MES(bl_ind != m_blocks_index.end(), false, "pop_block_from_blockchain: blockchain id not found in index");
-  m_blocks_index.erase(bl_ind);
+  r = m_blocks_index.erase(id);
+  CHECK_AND_ASSERT_MES(r, false, "pop_block_from_blockchain: blockchain id not found in index");
   //pop block from core
+  pop_from_difficulty_window(m_difficulty_window, h);
   m_blocks.pop_back();
+  r = pop_block_from_log(h);
+  CHECK_AND_ASSERT_MES(r, false, "pop_block_from_blockchain: failed to remove block on height " << h << " from blockchain data files");
   m_tx_pool.on_blockchain_dec(m_blocks.size()-1, get_tail_id());
+  if(popped)
+    *popped = bl;
   return true;
 }
 //------------------------------------------------------------------
 bool blockchain_storage::reset_and_set_genesis_block(const block& b)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
-  m_transactions.clear();
-  m_spent_keys.clear();
-  m_blocks.clear();
-  m_blocks_index.clear();
+  EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  bool r = mark_indexes_changed();
+  CHECK_AND_ASSERT_MES(r, false, "Failed to mark blockchain indexes as changed");
+  clear_indexes();
+  m_difficulty_window.clear();
   m_alternative_chains.clear();
-  m_outputs.clear();
+  if(m_blocks_log.is_open())
+  {
+    m_blocks_log.truncate(0);
+    m_blocks_log.flush();
+    if(m_blocks_journal.is_open())
+      m_blocks_journal.reset(0);
+  }
 
   block_verification_context bvc = boost::value_initialized<block_verification_context>();
   add_new_block(b, bvc);
@@ -253,7 +806,7 @@ bool blockchain_storage::reset_and_set_genesis_block(const block& b)
 //------------------------------------------------------------------
 bool blockchain_storage::purge_transaction_keyimages_from_blockchain(const transaction& tx, bool strict_check)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
     struct purge_transaction_visitor: public boost::static_visitor<bool>
   {
     key_images_container& m_spent_keys;
@@ -263,11 +816,7 @@ bool blockchain_storage::purge_transaction_keyimages_from_blockchain(const trans
     bool operator()(const txin_to_key& inp) const
     {
       //const crypto::key_image& ki = inp.k_image;
-      auto r = m_spent_keys.find(inp.k_image);
-      if(r != m_spent_keys.end())
-      {
-        m_spent_keys.erase(r);
-      }else
+      if(!m_spent_keys.erase(inp.k_image))
       {
         CHECK_AND_ASSERT_MES(!m_strict_check, false, "purge_block_data_from_blockchain: key image in transaction not found");
       }
@@ -296,12 +845,10 @@ bool blockchain_storage::purge_transaction_keyimages_from_blockchain(const trans
   return true;
 }
 //------------------------------------------------------------------
-bool blockchain_storage::purge_transaction_from_blockchain(const crypto::hash& tx_id)
+bool blockchain_storage::purge_transaction_from_blockchain(const transaction& tx, const crypto::hash& tx_id)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
-  auto tx_index_it = m_transactions.find(tx_id);
-  CHECK_AND_ASSERT_MES(tx_index_it != m_transactions.end(), false, "purge_block_data_from_blockchain: transaction not found in blockchain index!!");
-  transaction& tx = tx_index_it->second.tx;
+  EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  CHECK_AND_ASSERT_MES(m_transactions.count(tx_id), false, "purge_block_data_from_blockchain: transaction not found in blockchain index!!");
 
   purge_transaction_keyimages_from_blockchain(tx, true);
 
@@ -313,48 +860,50 @@ bool blockchain_storage::purge_transaction_from_blockchain(const crypto::hash& t
   }
 
   bool res = pop_transaction_from_global_index(tx, tx_id);
-  m_transactions.erase(tx_index_it);
+  m_transactions.erase(tx_id);
   LOG_PRINT_L1("Removed transaction from blockchain history:" << tx_id << ENDL);
   return res;
 }
 //------------------------------------------------------------------
-bool blockchain_storage::purge_block_data_from_blockchain(const block& bl, size_t processed_tx_count)
+bool blockchain_storage::purge_block_data_from_blockchain(const block& bl, const std::vector<transaction>& processed_txs)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
   bool res = true;
+  size_t processed_tx_count = processed_txs.size();
   CHECK_AND_ASSERT_MES(processed_tx_count <= bl.tx_hashes.size(), false, "wrong processed_tx_count in purge_block_data_from_blockchain");
   for(size_t count = 0; count != processed_tx_count; count++)
   {
-    res = purge_transaction_from_blockchain(bl.tx_hashes[(processed_tx_count -1)- count]) && res;
+    size_t i = (processed_tx_count -1)- count;
+    res = purge_transaction_from_blockchain(processed_txs[i], bl.tx_hashes[i]) && res;
   }
 
-  res = purge_transaction_from_blockchain(get_transaction_hash(bl.miner_tx)) && res;
+  res = purge_transaction_from_blockchain(bl.miner_tx, get_transaction_hash(bl.miner_tx)) && res;
 
   return res;
 }
 //------------------------------------------------------------------
 crypto::hash blockchain_storage::get_tail_id(uint64_t& height)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   height = get_current_blockchain_height()-1;
   return get_tail_id();
 }
 //------------------------------------------------------------------
 crypto::hash blockchain_storage::get_tail_id()
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   crypto::hash id = null_hash;
   if(m_blocks.size())
   {
-    get_block_hash(m_blocks.back().bl, id);
+    id = m_blocks.back().id;
   }
   return id;
 }
 //------------------------------------------------------------------
 bool blockchain_storage::get_short_chain_history(std::list<crypto::hash>& ids)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   size_t i = 0;
   size_t current_multiplier = 1;
   size_t sz = m_blocks.size();
@@ -364,7 +913,7 @@ bool blockchain_storage::get_short_chain_history(std::list<crypto::hash>& ids)
   bool genesis_included = false;
   while(current_back_offset < sz)
   {
-    ids.push_back(get_block_hash(m_blocks[sz-current_back_offset].bl));
+    ids.push_back(m_blocks[sz-current_back_offset].id);
     if(sz-current_back_offset == 0)
       genesis_included = true;
     if(i < 10)
@@ -377,28 +926,27 @@ bool blockchain_storage::get_short_chain_history(std::list<crypto::hash>& ids)
     ++i;
   }
   if(!genesis_included)
-    ids.push_back(get_block_hash(m_blocks[0].bl));
+    ids.push_back(m_blocks[0].id);
 
   return true;
 }
 //------------------------------------------------------------------
 crypto::hash blockchain_storage::get_block_id_by_height(uint64_t height)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   if(height >= m_blocks.size())
     return null_hash;
 
-  return get_block_hash(m_blocks[height].bl);
+  return m_blocks[height].id;
 }
 //------------------------------------------------------------------
 bool blockchain_storage::get_block_by_hash(const crypto::hash &h, block &blk) {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
   // try to find block in main chain
-  blocks_by_id_index::const_iterator it = m_blocks_index.find(h);
-  if (m_blocks_index.end() != it) {
-    blk = m_blocks[it->second].bl;
-    return true;
+  const uint64_t* height = m_blocks_index.find(h);
+  if (height) {
+    return get_main_block(*height, blk);
   }
 
   // try to find block in alternative chain
@@ -412,10 +960,10 @@ bool blockchain_storage::get_block_by_hash(const crypto::hash &h, block &blk) {
 }
 //------------------------------------------------------------------
 void blockchain_storage::get_all_known_block_ids(std::list<crypto::hash> &main, std::list<crypto::hash> &alt, std::list<crypto::hash> &invalid) {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
-  BOOST_FOREACH(blocks_by_id_index::value_type &v, m_blocks_index)
-    main.push_back(v.first);
+  for(uint64_t height = 0; height != m_blocks.size(); height++)
+    main.push_back(m_blocks[height].id);
 
   BOOST_FOREACH(blocks_ext_by_hash::value_type &v, m_alternative_chains)
     alt.push_back(v.first);
@@ -426,23 +974,34 @@ void blockchain_storage::get_all_known_block_ids(std::list<crypto::hash> &main,
 //------------------------------------------------------------------
 difficulty_type blockchain_storage::get_difficulty_for_next_block()
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
-  std::vector<uint64_t> timestamps;
-  std::vector<difficulty_type> commulative_difficulties;
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  return m_difficulty_window.next_difficulty();
+}
+//------------------------------------------------------------------
+void blockchain_storage::rebuild_difficulty_window()
+{
+  m_difficulty_window.clear();
   size_t offset = m_blocks.size() - std::min(m_blocks.size(), static_cast<size_t>(DIFFICULTY_BLOCKS_COUNT));
   if(!offset)
     ++offset;//skip genesis block
   for(; offset < m_blocks.size(); offset++)
+    m_difficulty_window.push_back(m_blocks[offset].timestamp, m_blocks[offset].cumulative_difficulty);
+}
+//------------------------------------------------------------------
+void blockchain_storage::pop_from_difficulty_window(difficulty_window& window, size_t height)
+{
+  //window of the chain ending at height becomes the one of the chain ending at height - 1, genesis block is never in it
+  window.pop_back();
+  if(height > static_cast<size_t>(DIFFICULTY_BLOCKS_COUNT))
   {
-    timestamps.push_back(m_blocks[offset].bl.timestamp);
-    commulative_difficulties.push_back(m_blocks[offset].cumulative_difficulty);
+    const block_index_entry& bie = m_blocks[height - static_cast<size_t>(DIFFICULTY_BLOCKS_COUNT)];
+    window.push_front(bie.timestamp, bie.cumulative_difficulty);
   }
-  return next_difficulty(timestamps, commulative_difficulties);
 }
 //------------------------------------------------------------------
 bool blockchain_storage::rollback_blockchain_switching(std::list<block>& original_chain, size_t rollback_height)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
   // fail if rollback_height passed is too high
   if (rollback_height > m_blocks.size())
@@ -470,7 +1029,7 @@ bool blockchain_storage::rollback_blockchain_switching(std::list<block>& origina
 //------------------------------------------------------------------
 bool blockchain_storage::switch_to_alternative_blockchain(std::list<blocks_ext_by_hash::iterator>& alt_chain, bool discard_disconnected_chain)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   CHECK_AND_ASSERT_MES(alt_chain.size(), false, "switch_to_alternative_blockchain: empty chain passed");
 
   size_t split_height = alt_chain.front()->second.height;
@@ -480,8 +1039,8 @@ bool blockchain_storage::switch_to_alternative_blockchain(std::list<blocks_ext_b
   std::list<block> disconnected_chain;
   for(size_t i = m_blocks.size()-1; i >=split_height; i--)
   {
-    block b = m_blocks[i].bl;
-    bool r = pop_block_from_blockchain();
+    block b;
+    bool r = pop_block_from_blockchain(&b);
     CHECK_AND_ASSERT_MES(r, false, "failed to remove block on chain switching");
     disconnected_chain.push_front(b);
   }
@@ -496,8 +1055,8 @@ bool blockchain_storage::switch_to_alternative_blockchain(std::list<blocks_ext_b
     {
       LOG_PRINT_L1("Failed to switch to alternative blockchain");
       rollback_blockchain_switching(disconnected_chain, split_height);
-      add_block_as_invalid(ch_ent->second, get_block_hash(ch_ent->second.bl));
-      LOG_PRINT_L1("The block was inserted as invalid while connecting new alternative chain, block_id: " << get_block_hash(ch_ent->second.bl));
+      add_block_as_invalid(ch_ent->second, ch_ent->second.id);
+      LOG_PRINT_L1("The block was inserted as invalid while connecting new alternative chain, block_id: " << ch_ent->second.id);
       m_alternative_chains.erase(ch_ent);
 
       for(auto alt_ch_to_orph_iter = ++alt_ch_iter; alt_ch_to_orph_iter != alt_chain.end(); alt_ch_to_orph_iter++)
@@ -538,47 +1097,32 @@ bool blockchain_storage::switch_to_alternative_blockchain(std::list<blocks_ext_b
 //------------------------------------------------------------------
 difficulty_type blockchain_storage::get_next_difficulty_for_alternative_chain(const std::list<blocks_ext_by_hash::iterator>& alt_chain, block_extended_info& bei)
 {
-  std::vector<uint64_t> timestamps;
-  std::vector<difficulty_type> commulative_difficulties;
+  difficulty_window window;
   if(alt_chain.size()< DIFFICULTY_BLOCKS_COUNT)
   {
-    CRITICAL_REGION_LOCAL(m_blockchain_lock);
+    SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
     size_t main_chain_stop_offset = alt_chain.size() ? alt_chain.front()->second.height : bei.height;
-    size_t main_chain_count = DIFFICULTY_BLOCKS_COUNT - std::min(static_cast<size_t>(DIFFICULTY_BLOCKS_COUNT), alt_chain.size());
-    main_chain_count = std::min(main_chain_count, main_chain_stop_offset);
-    size_t main_chain_start_offset = main_chain_stop_offset - main_chain_count;
-
-    if(!main_chain_start_offset)
-      ++main_chain_start_offset; //skip genesis block
-    for(; main_chain_start_offset < main_chain_stop_offset; ++main_chain_start_offset)
-    {
-      timestamps.push_back(m_blocks[main_chain_start_offset].bl.timestamp);
-      commulative_difficulties.push_back(m_blocks[main_chain_start_offset].cumulative_difficulty);
-    }
-
-    CHECK_AND_ASSERT_MES((alt_chain.size() + timestamps.size()) <= DIFFICULTY_BLOCKS_COUNT, false, "Internal error, alt_chain.size()["<< alt_chain.size()
-                                                                                    << "] + vtimestampsec.size()[" << timestamps.size() << "] NOT <= DIFFICULTY_WINDOW[]" << DIFFICULTY_BLOCKS_COUNT );
-    BOOST_FOREACH(auto it, alt_chain)
+    CHECK_AND_ASSERT_MES(main_chain_stop_offset && main_chain_stop_offset <= m_blocks.size(), false, "Internal error, alternative chain starts at height " << main_chain_stop_offset
+                                                                                    << " while blockchain size is " << m_blocks.size());
+    if(m_blocks.size() - main_chain_stop_offset < static_cast<size_t>(DIFFICULTY_BLOCKS_COUNT))
     {
-      timestamps.push_back(it->second.bl.timestamp);
-      commulative_difficulties.push_back(it->second.cumulative_difficulty);
-    }
-  }else
-  {
-    timestamps.resize(std::min(alt_chain.size(), static_cast<size_t>(DIFFICULTY_BLOCKS_COUNT)));
-    commulative_difficulties.resize(std::min(alt_chain.size(), static_cast<size_t>(DIFFICULTY_BLOCKS_COUNT)));
-    size_t count = 0;
-    size_t max_i = timestamps.size()-1;
-    BOOST_REVERSE_FOREACH(auto it, alt_chain)
+      //roll the main chain window back to the split point
+      window = m_difficulty_window;
+      for(size_t height = m_blocks.size(); height != main_chain_stop_offset; --height)
+        pop_from_difficulty_window(window, height - 1);
+    }else
     {
-      timestamps[max_i - count] = it->second.bl.timestamp;
-      commulative_difficulties[max_i - count] = it->second.cumulative_difficulty;
-      count++;
-      if(count >= DIFFICULTY_BLOCKS_COUNT)
-        break;
+      size_t main_chain_start_offset = main_chain_stop_offset - std::min(main_chain_stop_offset, static_cast<size_t>(DIFFICULTY_BLOCKS_COUNT));
+      if(!main_chain_start_offset)
+        ++main_chain_start_offset; //skip genesis block
+      for(; main_chain_start_offset < main_chain_stop_offset; ++main_chain_start_offset)
+        window.push_back(m_blocks[main_chain_start_offset].timestamp, m_blocks[main_chain_start_offset].cumulative_difficulty);
     }
   }
-  return next_difficulty(timestamps, commulative_difficulties);
+  //the window keeps only the last DIFFICULTY_BLOCKS_COUNT blocks, so main chain blocks are pushed out as needed
+  BOOST_FOREACH(auto it, alt_chain)
+    window.push_back(it->second.bl.timestamp, it->second.cumulative_difficulty);
+  return window.next_difficulty();
 }
 //------------------------------------------------------------------
 bool blockchain_storage::prevalidate_miner_transaction(const block& b, uint64_t height)
@@ -633,7 +1177,7 @@ bool blockchain_storage::validate_miner_transaction(const block& b, size_t cumul
 //------------------------------------------------------------------
 bool blockchain_storage::get_backward_blocks_sizes(size_t from_height, std::vector<size_t>& sz, size_t count)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   CHECK_AND_ASSERT_MES(from_height < m_blocks.size(), false, "Internal error: get_backward_blocks_sizes called with from_height=" << from_height << ", blockchain height = " << m_blocks.size());
 
   size_t start_offset = (from_height+1) - std::min((from_height+1), count);
@@ -645,7 +1189,7 @@ bool blockchain_storage::get_backward_blocks_sizes(size_t from_height, std::vect
 //------------------------------------------------------------------
 bool blockchain_storage::get_last_n_blocks_sizes(std::vector<size_t>& sz, size_t count)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   if(!m_blocks.size())
     return true;
   return get_backward_blocks_sizes(m_blocks.size() -1, sz, count);
@@ -661,7 +1205,7 @@ bool blockchain_storage::create_block_template(block& b, const account_public_ad
   size_t median_size;
   uint64_t already_generated_coins;
 
-  CRITICAL_REGION_BEGIN(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_BEGIN(m_blockchain_lock);
   b.major_version = CURRENT_BLOCK_MAJOR_VERSION;
   b.minor_version = CURRENT_BLOCK_MINOR_VERSION;
   b.prev_id = get_tail_id();
@@ -781,13 +1325,13 @@ bool blockchain_storage::complete_timestamps_vector(uint64_t start_top_height, s
   if(timestamps.size() >= BLOCKCHAIN_TIMESTAMP_CHECK_WINDOW)
     return true;
 
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   size_t need_elements = BLOCKCHAIN_TIMESTAMP_CHECK_WINDOW - timestamps.size();
   CHECK_AND_ASSERT_MES(start_top_height < m_blocks.size(), false, "internal error: passed start_height = " << start_top_height << " not less then m_blocks.size()=" << m_blocks.size());
   size_t stop_offset = start_top_height > need_elements ? start_top_height - need_elements:0;
   do
   {
-    timestamps.push_back(m_blocks[start_top_height].bl.timestamp);
+    timestamps.push_back(m_blocks[start_top_height].timestamp);
     if(start_top_height == 0)
       break;
     --start_top_height;
@@ -797,7 +1341,7 @@ bool blockchain_storage::complete_timestamps_vector(uint64_t start_top_height, s
 //------------------------------------------------------------------
 bool blockchain_storage::handle_alternative_block(const block& b, const crypto::hash& id, block_verification_context& bvc)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
   uint64_t block_height = get_block_height(b);
   if(0 == block_height)
@@ -817,9 +1361,9 @@ bool blockchain_storage::handle_alternative_block(const block& b, const crypto::
 
   //Block is not related with head of main chain
   //first of all - look in alternative chains container
-  auto it_main_prev = m_blocks_index.find(b.prev_id);
+  const uint64_t* main_prev_height = m_blocks_index.find(b.prev_id);
   auto it_prev = m_alternative_chains.find(b.prev_id);
-  if(it_prev != m_alternative_chains.end() || it_main_prev != m_blocks_index.end())
+  if(it_prev != m_alternative_chains.end() || main_prev_height)
   {
     //we have new block in alternative chain
 
@@ -839,13 +1383,13 @@ bool blockchain_storage::handle_alternative_block(const block& b, const crypto::
       //make sure that it has right connection to main chain
       CHECK_AND_ASSERT_MES(m_blocks.size() > alt_chain.front()->second.height, false, "main blockchain wrong height");
       crypto::hash h = null_hash;
-      get_block_hash(m_blocks[alt_chain.front()->second.height - 1].bl, h);
+      h = m_blocks[alt_chain.front()->second.height - 1].id;
       CHECK_AND_ASSERT_MES(h == alt_chain.front()->second.bl.prev_id, false, "alternative chain has wrong connection to main chain");
       complete_timestamps_vector(alt_chain.front()->second.height - 1, timestamps);
     }else
     {
-      CHECK_AND_ASSERT_MES(it_main_prev != m_blocks_index.end(), false, "internal error: broken imperative condition it_main_prev != m_blocks_index.end()");
-      complete_timestamps_vector(it_main_prev->second, timestamps);
+      CHECK_AND_ASSERT_MES(main_prev_height, false, "internal error: broken imperative condition main_prev_height != NULL");
+      complete_timestamps_vector(*main_prev_height, timestamps);
     }
     //check timestamp correct
     if(!check_block_timestamp(timestamps, b))
@@ -859,7 +1403,8 @@ bool blockchain_storage::handle_alternative_block(const block& b, const crypto::
 
     block_extended_info bei = boost::value_initialized<block_extended_info>();
     bei.bl = b;
-    bei.height = alt_chain.size() ? it_prev->second.height + 1 : it_main_prev->second + 1;
+    bei.id = id;
+    bei.height = alt_chain.size() ? it_prev->second.height + 1 : *main_prev_height + 1;
 
     bool is_a_checkpoint;
     if(!m_checkpoints.check_block(bei.height, id, is_a_checkpoint))
@@ -873,8 +1418,7 @@ bool blockchain_storage::handle_alternative_block(const block& b, const crypto::
     m_is_in_checkpoint_zone = false;
     difficulty_type current_diff = get_next_difficulty_for_alternative_chain(alt_chain, bei);
     CHECK_AND_ASSERT_MES(current_diff, false, "!!!!!!! DIFFICULTY OVERHEAD !!!!!!!");
-    crypto::hash proof_of_work = null_hash;
-    get_block_longhash(bei.bl, proof_of_work, bei.height);
+    crypto::hash proof_of_work = get_block_proof_of_work(bei.bl, id, bei.height);
     if(!check_hash(proof_of_work, current_diff))
     {
       LOG_PRINT_RED_L1("Block with id: " << id
@@ -893,7 +1437,7 @@ bool blockchain_storage::handle_alternative_block(const block& b, const crypto::
 
     }
 
-    bei.cumulative_difficulty = alt_chain.size() ? it_prev->second.cumulative_difficulty: m_blocks[it_main_prev->second].cumulative_difficulty;
+    bei.cumulative_difficulty = alt_chain.size() ? it_prev->second.cumulative_difficulty: m_blocks[*main_prev_height].cumulative_difficulty;
     bei.cumulative_difficulty += current_diff;
 
 #ifdef _DEBUG
@@ -942,15 +1486,16 @@ bool blockchain_storage::handle_alternative_block(const block& b, const crypto::
 //------------------------------------------------------------------
 bool blockchain_storage::get_blocks(uint64_t start_offset, size_t count, std::list<block>& blocks, std::list<transaction>& txs)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   if(start_offset >= m_blocks.size())
     return false;
   for(size_t i = start_offset; i < start_offset + count && i < m_blocks.size();i++)
   {
-    blocks.push_back(m_blocks[i].bl);
-    std::list<crypto::hash> missed_ids;
-    get_transactions(m_blocks[i].bl.tx_hashes, txs, missed_ids);
-    CHECK_AND_ASSERT_MES(!missed_ids.size(), false, "has missed transactions in own block in main blockchain");
+    blocks.push_back(block());
+    std::vector<transaction> block_txs;
+    bool r = get_main_block(i, blocks.back(), block_txs);
+    CHECK_AND_ASSERT_MES(r, false, "internal error, failed to read block on height " << i);
+    txs.insert(txs.end(), block_txs.begin(), block_txs.end());
   }
 
   return true;
@@ -958,37 +1503,35 @@ bool blockchain_storage::get_blocks(uint64_t start_offset, size_t count, std::li
 //------------------------------------------------------------------
 bool blockchain_storage::get_blocks(uint64_t start_offset, size_t count, std::list<block>& blocks)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   if(start_offset >= m_blocks.size())
     return false;
 
   for(size_t i = start_offset; i < start_offset + count && i < m_blocks.size();i++)
-    blocks.push_back(m_blocks[i].bl);
+  {
+    blocks.push_back(block());
+    bool r = get_main_block(i, blocks.back());
+    CHECK_AND_ASSERT_MES(r, false, "internal error, failed to read block on height " << i);
+  }
   return true;
 }
 //------------------------------------------------------------------
 bool blockchain_storage::handle_get_objects(NOTIFY_REQUEST_GET_OBJECTS::request& arg, NOTIFY_RESPONSE_GET_OBJECTS::request& rsp)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   rsp.current_blockchain_height = get_current_blockchain_height();
-  std::list<block> blocks;
-  get_blocks(arg.blocks, blocks, rsp.missed_ids);
-
-  BOOST_FOREACH(const auto& bl, blocks)
+  BOOST_FOREACH(const crypto::hash& bl_id, arg.blocks)
   {
-    std::list<crypto::hash> missed_tx_id;
-    std::list<transaction> txs;
-    get_transactions(bl.tx_hashes, txs, rsp.missed_ids);
-    CHECK_AND_ASSERT_MES(!missed_tx_id.size(), false, "Internal error: has missed missed_tx_id.size()=" << missed_tx_id.size()
-      << ENDL << "for block id = " << get_block_hash(bl));
-   rsp.blocks.push_back(block_complete_entry());
-   block_complete_entry& e = rsp.blocks.back();
-   //pack block
-   e.block = t_serializable_object_to_blob(bl);
-   //pack transactions
-   BOOST_FOREACH(transaction& tx, txs)
-     e.txs.push_back(t_serializable_object_to_blob(tx));
-
+    const uint64_t* height = m_blocks_index.find(bl_id);
+    if(!height)
+    {
+      rsp.missed_ids.push_back(bl_id);
+      continue;
+    }
+    //blocks and their transactions are served as they are kept in the block log
+    rsp.blocks.push_back(block_complete_entry());
+    bool r = get_block_complete_entry(*height, rsp.blocks.back());
+    CHECK_AND_ASSERT_MES(r, false, "Internal error: failed to get blobs of block " << bl_id << " on height " << *height);
   }
   //get another transactions, if need
   std::list<transaction> txs;
@@ -1002,7 +1545,7 @@ bool blockchain_storage::handle_get_objects(NOTIFY_REQUEST_GET_OBJECTS::request&
 //------------------------------------------------------------------
 bool blockchain_storage::get_alternative_blocks(std::list<block>& blocks)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
   BOOST_FOREACH(const auto& alt_bl, m_alternative_chains)
   {
@@ -1013,43 +1556,70 @@ bool blockchain_storage::get_alternative_blocks(std::list<block>& blocks)
 //------------------------------------------------------------------
 size_t blockchain_storage::get_alternative_blocks_count()
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   return m_alternative_chains.size();
 }
 //------------------------------------------------------------------
-bool blockchain_storage::add_out_to_get_random_outs(std::vector<std::pair<crypto::hash, size_t> >& amount_outs, COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::outs_for_amount& result_outs, uint64_t amount, size_t i)
+uint64_t blockchain_storage::get_outputs_count(uint64_t amount) const
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
-  transactions_container::iterator tx_it = m_transactions.find(amount_outs[i].first);
-  CHECK_AND_ASSERT_MES(tx_it != m_transactions.end(), false, "internal error: transaction with id " << amount_outs[i].first << ENDL <<
-    ", used in mounts global index for amount=" << amount << ": i=" << i << "not found in transactions index");
-  CHECK_AND_ASSERT_MES(tx_it->second.tx.vout.size() > amount_outs[i].second, false, "internal error: in global outs index, transaction out index="
-    << amount_outs[i].second << " more than transaction outputs = " << tx_it->second.tx.vout.size() << ", for tx id = " << amount_outs[i].first);
-  transaction& tx = tx_it->second.tx;
-  CHECK_AND_ASSERT_MES(tx.vout[amount_outs[i].second].target.type() == typeid(txout_to_key), false, "unknown tx out type");
+  const amount_outputs_entry* range = m_amount_outputs.find(amount);
+  return range ? range->count : 0;
+}
+//------------------------------------------------------------------
+const blockchain_storage::output_index_entry* blockchain_storage::get_output(uint64_t amount, uint64_t i) const
+{
+  const amount_outputs_entry* range = m_amount_outputs.find(amount);
+  return range && i < range->count ? &m_outputs[range->offset + i] : NULL;
+}
+//------------------------------------------------------------------
+bool blockchain_storage::grow_amount_outputs(amount_outputs_entry& range)
+{
+  const uint64_t end = m_outputs.size();
+  const uint64_t added = std::max<uint64_t>(range.capacity, 1);
+  if(range.offset + range.capacity == end)
+  {
+    //last range, grows in place
+    CHECK_AND_ASSERT_MES(m_outputs.resize(end + added), false, "failed to grow outputs index");
+    range.capacity += added;
+    return true;
+  }
+  CHECK_AND_ASSERT_MES(m_outputs.resize(end + range.capacity + added), false, "failed to grow outputs index");
+  for(uint64_t i = 0; i != range.count; i++)
+    m_outputs[end + i] = m_outputs[range.offset + i];
+  range.offset = end;
+  range.capacity += added;
+  return true;
+}
+//------------------------------------------------------------------
+bool blockchain_storage::add_out_to_get_random_outs(uint64_t amount, size_t i, COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::outs_for_amount& result_outs)
+{
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  const output_index_entry* out = get_output(amount, i);
+  CHECK_AND_ASSERT_MES(out, false, "internal error: global index " << i << " for amount=" << amount << " is out of range " << get_outputs_count(amount));
+  CHECK_AND_ASSERT_MES(out->to_key, false, "unknown tx out type");
 
   //check if transaction is unlocked
-  if(!is_tx_spendtime_unlocked(tx.unlock_time))
+  if(!is_tx_spendtime_unlocked(out->unlock_time))
     return false;
 
   COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::out_entry& oen = *result_outs.outs.insert(result_outs.outs.end(), COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::out_entry());
   oen.global_amount_index = i;
-  oen.out_key = boost::get<txout_to_key>(tx.vout[amount_outs[i].second].target).key;
+  oen.out_key = out->key;
   return true;
 }
 //------------------------------------------------------------------
-size_t blockchain_storage::find_end_of_allowed_index(const std::vector<std::pair<crypto::hash, size_t> >& amount_outs)
+size_t blockchain_storage::find_end_of_allowed_index(uint64_t amount, uint64_t outs_count)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
-  if(!amount_outs.size())
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  if(!outs_count)
     return 0;
-  size_t i = amount_outs.size();
+  size_t i = outs_count;
   do
   {
     --i;
-    transactions_container::iterator it = m_transactions.find(amount_outs[i].first);
-    CHECK_AND_ASSERT_MES(it != m_transactions.end(), 0, "internal error: failed to find transaction from outputs index with tx_id=" << amount_outs[i].first);
-    if(it->second.m_keeper_block_height + CRYPTONOTE_MINED_MONEY_UNLOCK_WINDOW <= get_current_blockchain_height() )
+    const output_index_entry* out = get_output(amount, i);
+    CHECK_AND_ASSERT_MES(out, 0, "internal error: output " << i << " of amount " << amount << " is not indexed");
+    if(out->keeper_block_height + CRYPTONOTE_MINED_MONEY_UNLOCK_WINDOW <= get_current_blockchain_height() )
       return i+1;
   } while (i != 0);
   return 0;
@@ -1057,23 +1627,22 @@ size_t blockchain_storage::find_end_of_allowed_index(const std::vector<std::pair
 //------------------------------------------------------------------
 bool blockchain_storage::get_random_outs_for_amounts(const COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::request& req, COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::response& res)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   BOOST_FOREACH(uint64_t amount, req.amounts)
   {
     COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::outs_for_amount& result_outs = *res.outs.insert(res.outs.end(), COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::outs_for_amount());
     result_outs.amount = amount;
-    auto it = m_outputs.find(amount);
-    if(it == m_outputs.end())
+    const uint64_t outs_count = get_outputs_count(amount);
+    if(!outs_count)
     {
       LOG_PRINT_L1("COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS: not outs for amount " << amount << ", wallet should use some real outs when it lookup for some mix, so, at least one out for this amount should exist");
       continue;//actually this is strange situation, wallet should use some real outs when it lookup for some mix, so, at least one out for this amount should exist
     }
-    std::vector<std::pair<crypto::hash, size_t> >& amount_outs  = it->second;
     //it is not good idea to use top fresh outs, because it increases possibility of transaction canceling on split
     //lets find upper bound of not fresh outs
-    size_t up_index_limit = find_end_of_allowed_index(amount_outs);
-    CHECK_AND_ASSERT_MES(up_index_limit <= amount_outs.size(), false, "internal error: find_end_of_allowed_index returned wrong index=" << up_index_limit << ", with amount_outs.size = " << amount_outs.size());
-    if(amount_outs.size() > req.outs_count)
+    size_t up_index_limit = find_end_of_allowed_index(amount, outs_count);
+    CHECK_AND_ASSERT_MES(up_index_limit <= outs_count, false, "internal error: find_end_of_allowed_index returned wrong index=" << up_index_limit << ", with amount_outs.size = " << outs_count);
+    if(outs_count > req.outs_count)
     {
       std::set<size_t> used;
       size_t try_count = 0;
@@ -1082,7 +1651,7 @@ bool blockchain_storage::get_random_outs_for_amounts(const COMMAND_RPC_GET_RANDO
         size_t i = crypto::rand<size_t>()%up_index_limit;
         if(used.count(i))
           continue;
-        bool added = add_out_to_get_random_outs(amount_outs, result_outs, amount, i);
+        bool added = add_out_to_get_random_outs(amount, i, result_outs);
         used.insert(i);
         if(added)
           ++j;
@@ -1091,7 +1660,7 @@ bool blockchain_storage::get_random_outs_for_amounts(const COMMAND_RPC_GET_RANDO
     }else
     {
       for(size_t i = 0; i != up_index_limit; i++)
-        add_out_to_get_random_outs(amount_outs, result_outs, amount, i);
+        add_out_to_get_random_outs(amount, i, result_outs);
     }
   }
   return true;
@@ -1099,7 +1668,7 @@ bool blockchain_storage::get_random_outs_for_amounts(const COMMAND_RPC_GET_RANDO
 //------------------------------------------------------------------
 bool blockchain_storage::find_blockchain_supplement(const std::list<crypto::hash>& qblock_ids, uint64_t& starter_offset)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
   if(!qblock_ids.size() /*|| !req.m_total_height*/)
   {
@@ -1107,10 +1676,10 @@ bool blockchain_storage::find_blockchain_supplement(const std::list<crypto::hash
     return false;
   }
   //check genesis match
-  if(qblock_ids.back() != get_block_hash(m_blocks[0].bl))
+  if(qblock_ids.back() != m_blocks[0].id)
   {
     LOG_PRINT_L1("Client sent wrong NOTIFY_REQUEST_CHAIN: genesis block missmatch: " << ENDL << "id: "
-      << qblock_ids.back() << ", " << ENDL << "expected: " << get_block_hash(m_blocks[0].bl)
+      << qblock_ids.back() << ", " << ENDL << "expected: " << m_blocks[0].id
       << "," << ENDL << " dropping connection");
     return false;
   }
@@ -1118,11 +1687,11 @@ bool blockchain_storage::find_blockchain_supplement(const std::list<crypto::hash
   /* Figure out what blocks we should request to get state_normal */
   size_t i = 0;
   auto bl_it = qblock_ids.begin();
-  auto block_index_it = m_blocks_index.find(*bl_it);
+  const uint64_t* block_height = NULL;
   for(; bl_it != qblock_ids.end(); bl_it++, i++)
   {
-    block_index_it = m_blocks_index.find(*bl_it);
-    if(block_index_it != m_blocks_index.end())
+    block_height = m_blocks_index.find(*bl_it);
+    if(block_height)
       break;
   }
 
@@ -1132,7 +1701,7 @@ bool blockchain_storage::find_blockchain_supplement(const std::list<crypto::hash
     return false;
   }
 
-  if(block_index_it == m_blocks_index.end())
+  if(!block_height)
   {
     //this should NEVER happen, but, dose of paranoia in such cases is not too bad
     LOG_PRINT_L1("Internal error handling connection, can't find split point");
@@ -1140,13 +1709,13 @@ bool blockchain_storage::find_blockchain_supplement(const std::list<crypto::hash
   }
 
   //we start to put block ids INCLUDING last known id, just to make other side be sure
-  starter_offset = block_index_it->second;
+  starter_offset = *block_height;
   return true;
 }
 //------------------------------------------------------------------
 uint64_t blockchain_storage::block_difficulty(size_t i)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   CHECK_AND_ASSERT_MES(i < m_blocks.size(), false, "wrong block index i = " << i << " at blockchain_storage::block_difficulty()");
   if(i == 0)
     return m_blocks[i].cumulative_difficulty;
@@ -1157,7 +1726,7 @@ uint64_t blockchain_storage::block_difficulty(size_t i)
 void blockchain_storage::print_blockchain(uint64_t start_index, uint64_t end_index)
 {
   std::stringstream ss;
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   if(start_index >=m_blocks.size())
   {
     LOG_PRINT_L1("Wrong starter index set: " << start_index << ", expected max index " << m_blocks.size()-1);
@@ -1166,9 +1735,12 @@ void blockchain_storage::print_blockchain(uint64_t start_index, uint64_t end_ind
 
   for(size_t i = start_index; i != m_blocks.size() && i != end_index; i++)
   {
-    ss << "height " << i << ", timestamp " << m_blocks[i].bl.timestamp << ", cumul_dif " << m_blocks[i].cumulative_difficulty << ", cumul_size " << m_blocks[i].block_cumulative_size
-      << "\nid\t\t" <<  get_block_hash(m_blocks[i].bl)
-      << "\ndifficulty\t\t" << block_difficulty(i) << ", nonce " << m_blocks[i].bl.nonce << ", tx_count " << m_blocks[i].bl.tx_hashes.size() << ENDL;
+    block bl = AUTO_VAL_INIT(bl);
+    if(!get_main_block(i, bl))
+      return;
+    ss << "height " << i << ", timestamp " << m_blocks[i].timestamp << ", cumul_dif " << m_blocks[i].cumulative_difficulty << ", cumul_size " << m_blocks[i].block_cumulative_size
+      << "\nid\t\t" <<  m_blocks[i].id
+      << "\ndifficulty\t\t" << block_difficulty(i) << ", nonce " << bl.nonce << ", tx_count " << bl.tx_hashes.size() << ENDL;
   }
   LOG_PRINT_L1("Current blockchain:" << ENDL << ss.str());
   LOG_PRINT_L0("Blockchain printed with log level 1");
@@ -1177,9 +1749,9 @@ void blockchain_storage::print_blockchain(uint64_t start_index, uint64_t end_ind
 void blockchain_storage::print_blockchain_index()
 {
   std::stringstream ss;
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
-  BOOST_FOREACH(const blocks_by_id_index::value_type& v, m_blocks_index)
-    ss << "id\t\t" <<  v.first << " height" <<  v.second << ENDL << "";
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  for(uint64_t height = 0; height != m_blocks.size(); height++)
+    ss << "id\t\t" <<  m_blocks[height].id << " height" <<  height << ENDL << "";
 
   LOG_PRINT_L0("Current blockchain index:" << ENDL << ss.str());
 }
@@ -1187,15 +1759,17 @@ void blockchain_storage::print_blockchain_index()
 void blockchain_storage::print_blockchain_outs(const std::string& file)
 {
   std::stringstream ss;
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
-  BOOST_FOREACH(const outputs_container::value_type& v, m_outputs)
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  std::map<uint64_t, uint64_t> outs_counts;
+  m_amount_outputs.for_each([&outs_counts](uint64_t amount, const amount_outputs_entry& range) { outs_counts[amount] = range.count; });
+  BOOST_FOREACH(const auto& v, outs_counts)
   {
-    const std::vector<std::pair<crypto::hash, size_t> >& vals = v.second;
-    if(vals.size())
+    ss << "amount: " <<  v.first << ENDL;
+    for(uint64_t i = 0; i != v.second; i++)
     {
-      ss << "amount: " <<  v.first << ENDL;
-      for(size_t i = 0; i != vals.size(); i++)
-        ss << "\t" << vals[i].first << ": " << vals[i].second << ENDL;
+      const output_index_entry* out = get_output(v.first, i);
+      if(out)
+        ss << "\t" << out->tx_id << ": " << out->index_in_tx << ENDL;
     }
   }
   if(epee::file_io_utils::save_string_to_file(file, ss.str()))
@@ -1209,20 +1783,20 @@ void blockchain_storage::print_blockchain_outs(const std::string& file)
 //------------------------------------------------------------------
 bool blockchain_storage::find_blockchain_supplement(const std::list<crypto::hash>& qblock_ids, NOTIFY_RESPONSE_CHAIN_ENTRY::request& resp)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   if(!find_blockchain_supplement(qblock_ids, resp.start_height))
     return false;
 
   resp.total_height = get_current_blockchain_height();
   size_t count = 0;
   for(size_t i = resp.start_height; i != m_blocks.size() && count < BLOCKS_IDS_SYNCHRONIZING_DEFAULT_COUNT; i++, count++)
-    resp.m_block_ids.push_back(get_block_hash(m_blocks[i].bl));
+    resp.m_block_ids.push_back(m_blocks[i].id);
   return true;
 }
 //------------------------------------------------------------------
-bool blockchain_storage::find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<std::pair<block, std::list<transaction> > >& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count)
+bool blockchain_storage::find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<block_complete_entry>& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   if(req_start_block > 0) {
      start_height = req_start_block; 
   } else {
@@ -1232,13 +1806,72 @@ bool blockchain_storage::find_blockchain_supplement(const uint64_t req_start_blo
 
   total_height = get_current_blockchain_height();
   size_t count = 0;
-  for(size_t i = start_height; i != m_blocks.size() && count < max_count; i++, count++)
+  for(size_t i = start_height; i < m_blocks.size() && count < max_count; i++, count++)
   {
     blocks.resize(blocks.size()+1);
-    blocks.back().first = m_blocks[i].bl;
-    std::list<crypto::hash> mis;
-    get_transactions(m_blocks[i].bl.tx_hashes, blocks.back().second, mis);
-    CHECK_AND_ASSERT_MES(!mis.size(), false, "internal error, transaction from block not found");
+    bool r = get_block_complete_entry(i, blocks.back());
+    CHECK_AND_ASSERT_MES(r, false, "internal error, failed to get blobs of block on height " << i);
+  }
+  return true;
+}
+//------------------------------------------------------------------
+bool blockchain_storage::find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<COMMAND_RPC_GET_BLOCKS_COMPACT::block_entry>& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count)
+{
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  if(req_start_block > 0) {
+     start_height = req_start_block;
+  } else {
+    if(!find_blockchain_supplement(qblock_ids, start_height))
+      return false;
+  }
+
+  total_height = get_current_blockchain_height();
+  size_t count = 0;
+  for(size_t i = start_height; i < m_blocks.size() && count < max_count; i++, count++)
+  {
+    block bl = AUTO_VAL_INIT(bl);
+    std::vector<transaction> txs;
+    bool r = get_main_block(i, bl, txs);
+    CHECK_AND_ASSERT_MES(r, false, "internal error, failed to read block on height " << i);
+    blocks.resize(blocks.size()+1);
+    COMMAND_RPC_GET_BLOCKS_COMPACT::block_entry& e = blocks.back();
+    get_compact_block_header(bl, m_blocks[i].id, e);
+    e.txs.resize(txs.size() + 1);
+    r = get_compact_tx_entry(bl.miner_tx, get_transaction_hash(bl.miner_tx), e.txs[0]);
+    for(size_t j = 0; r && j < txs.size(); ++j)
+      r = get_compact_tx_entry(txs[j], bl.tx_hashes[j], e.txs[j + 1]);
+    CHECK_AND_ASSERT_MES(r, false, "internal error, failed to get transactions of block on height " << i);
+  }
+  return true;
+}
+//------------------------------------------------------------------
+bool blockchain_storage::get_compact_tx_entry(const transaction& tx, const crypto::hash& tx_id, COMMAND_RPC_GET_BLOCKS_COMPACT::tx_entry& e)
+{
+  const transaction_index_entry* tx_entry = m_transactions.find(tx_id);
+  CHECK_AND_ASSERT_MES(tx_entry, false, "internal error: transaction " << tx_id << " not found");
+  CHECK_AND_ASSERT_MES(tx_entry->m_outputs_count == tx.vout.size(), false,
+    "internal error: global indexes for transaction " << tx_id << " do not match its outputs");
+
+  std::vector<uint64_t> global_output_indexes;
+  bool r = get_global_output_indexes(*tx_entry, global_output_indexes);
+  CHECK_AND_ASSERT_MES(r, false, "internal error: global indexes for transaction " << tx_id << " are out of range");
+  cryptonote::get_compact_tx_entry(tx, tx_id, global_output_indexes, e);
+  return true;
+}
+//------------------------------------------------------------------
+bool blockchain_storage::get_block_complete_entry(uint64_t height, block_complete_entry& e)
+{
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  blobdata record;
+  stored_block sb = AUTO_VAL_INIT(sb);
+  bool r = m_blocks_log.get(height, record) && ::serialization::parse_binary(record, sb);
+  CHECK_AND_ASSERT_MES(r, false, "Failed to read stored block on height " << height);
+  e.block.swap(sb.block);
+  e.txs.clear();
+  BOOST_FOREACH(blobdata& tx_blob, sb.txs)
+  {
+    e.txs.push_back(blobdata());
+    e.txs.back().swap(tx_blob);
   }
   return true;
 }
@@ -1247,12 +1880,13 @@ bool blockchain_storage::add_block_as_invalid(const block& bl, const crypto::has
 {
   block_extended_info bei = AUTO_VAL_INIT(bei);
   bei.bl = bl;
+  bei.id = h;
   return add_block_as_invalid(bei, h);
 }
 //------------------------------------------------------------------
 bool blockchain_storage::add_block_as_invalid(const block_extended_info& bei, const crypto::hash& h)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   auto i_res = m_invalid_blocks.insert(std::map<crypto::hash, block_extended_info>::value_type(h, bei));
   CHECK_AND_ASSERT_MES(i_res.second, false, "at insertion invalid by tx returned status existed");
   LOG_PRINT_L1("BLOCK ADDED AS INVALID: " << h << ENDL << ", prev_id=" << bei.bl.prev_id << ", m_invalid_blocks count=" << m_invalid_blocks.size());
@@ -1261,7 +1895,7 @@ bool blockchain_storage::add_block_as_invalid(const block_extended_info& bei, co
 //------------------------------------------------------------------
 bool blockchain_storage::have_block(const crypto::hash& id)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   if(m_blocks_index.count(id))
     return true;
   if(m_alternative_chains.count(id))
@@ -1283,40 +1917,68 @@ bool blockchain_storage::handle_block_to_main_chain(const block& bl, block_verif
   return handle_block_to_main_chain(bl, id, bvc);
 }
 //------------------------------------------------------------------
-bool blockchain_storage::push_transaction_to_global_outs_index(const transaction& tx, const crypto::hash& tx_id, std::vector<uint64_t>& global_indexes)
-{
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
-  size_t i = 0;
-  BOOST_FOREACH(const auto& ot, tx.vout)
-  {
-    outputs_container::mapped_type& amount_index = m_outputs[ot.amount];
-    amount_index.push_back(std::pair<crypto::hash, size_t>(tx_id, i));
-    global_indexes.push_back(amount_index.size()-1);
-    ++i;
+bool blockchain_storage::push_transaction_to_global_outs_index(const transaction& tx, const crypto::hash& tx_id, uint64_t keeper_block_height, transaction_index_entry& e)
+{
+  EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  e.m_global_output_indexes_offset = m_tx_global_output_indexes.size();
+  e.m_outputs_count = tx.vout.size();
+  for(size_t i = 0; i != tx.vout.size(); i++)
+  {
+    const tx_out& ot = tx.vout[i];
+    output_index_entry out = AUTO_VAL_INIT(out);
+    out.to_key = ot.target.type() == typeid(txout_to_key);
+    if(out.to_key)
+      out.key = boost::get<txout_to_key>(ot.target).key;
+    out.unlock_time = tx.unlock_time;
+    out.keeper_block_height = keeper_block_height;
+    out.tx_id = tx_id;
+    out.index_in_tx = i;
+    amount_outputs_entry* range = m_amount_outputs.find(ot.amount);
+    if(!range)
+    {
+      amount_outputs_entry new_range = AUTO_VAL_INIT(new_range);
+      new_range.offset = m_outputs.size();
+      bool r = m_amount_outputs.insert(ot.amount, new_range);
+      CHECK_AND_ASSERT_MES(r, false, "failed to index outputs of amount " << ot.amount);
+      range = m_amount_outputs.find(ot.amount);
+    }
+    bool r = range->count != range->capacity || grow_amount_outputs(*range);
+    CHECK_AND_ASSERT_MES(r, false, "failed to index output " << range->count << " of amount " << ot.amount);
+    const uint64_t global_index = range->count++;
+    m_outputs[range->offset + global_index] = out;
+    r = m_tx_global_output_indexes.push_back(global_index);
+    CHECK_AND_ASSERT_MES(r, false, "failed to index global indexes of transaction " << tx_id);
   }
   return true;
 }
 //------------------------------------------------------------------
+bool blockchain_storage::get_global_output_indexes(const transaction_index_entry& e, std::vector<uint64_t>& indexs) const
+{
+  CHECK_AND_ASSERT_MES(e.m_global_output_indexes_offset + e.m_outputs_count <= m_tx_global_output_indexes.size(), false,
+    "internal error: global indexes at " << e.m_global_output_indexes_offset << " are out of range " << m_tx_global_output_indexes.size());
+  indexs.clear();
+  indexs.reserve(e.m_outputs_count);
+  for(uint64_t i = 0; i != e.m_outputs_count; i++)
+    indexs.push_back(m_tx_global_output_indexes[e.m_global_output_indexes_offset + i]);
+  return true;
+}
+//------------------------------------------------------------------
 size_t blockchain_storage::get_total_transactions()
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   return m_transactions.size();
 }
 //------------------------------------------------------------------
 bool blockchain_storage::get_outs(uint64_t amount, std::list<crypto::public_key>& pkeys)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
-  auto it = m_outputs.find(amount);
-  if(it == m_outputs.end())
-    return true;
-
-  BOOST_FOREACH(const auto& out_entry, it->second)
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  const uint64_t outs_count = get_outputs_count(amount);
+  for(uint64_t i = 0; i != outs_count; i++)
   {
-    auto tx_it = m_transactions.find(out_entry.first);
-    CHECK_AND_ASSERT_MES(tx_it != m_transactions.end(), false, "transactions outs global index consistency broken: wrong tx id in index");
-    CHECK_AND_ASSERT_MES(tx_it->second.tx.vout.size() > out_entry.second, false, "transactions outs global index consistency broken: index in tx_outx more then size");
-    CHECK_AND_ASSERT_MES(tx_it->second.tx.vout[out_entry.second].target.type() == typeid(txout_to_key), false, "transactions outs global index consistency broken: index in tx_outx more then size");
-    pkeys.push_back(boost::get<txout_to_key>(tx_it->second.tx.vout[out_entry.second].target).key);
+    const output_index_entry* out = get_output(amount, i);
+    CHECK_AND_ASSERT_MES(out, false, "transactions outs global index consistency broken: output " << i << " of amount " << amount << " not found");
+    CHECK_AND_ASSERT_MES(out->to_key, false, "transactions outs global index consistency broken: unknown tx out type");
+    pkeys.push_back(out->key);
   }
 
   return true;
@@ -1324,36 +1986,47 @@ bool blockchain_storage::get_outs(uint64_t amount, std::list<crypto::public_key>
 //------------------------------------------------------------------
 bool blockchain_storage::pop_transaction_from_global_index(const transaction& tx, const crypto::hash& tx_id)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  const transaction_index_entry* e = m_transactions.find(tx_id);
+  CHECK_AND_ASSERT_MES(e, false, "transactions outs global index consistency broken: transaction " << tx_id << " not found");
+  CHECK_AND_ASSERT_MES(e->m_global_output_indexes_offset + tx.vout.size() == m_tx_global_output_indexes.size(), false,
+    "transactions outs global index consistency broken: transaction " << tx_id << " is not the last one");
+  const uint64_t offset = e->m_global_output_indexes_offset;
   size_t i = tx.vout.size()-1;
   BOOST_REVERSE_FOREACH(const auto& ot, tx.vout)
   {
-    auto it = m_outputs.find(ot.amount);
-    CHECK_AND_ASSERT_MES(it != m_outputs.end(), false, "transactions outs global index consistency broken");
-    CHECK_AND_ASSERT_MES(it->second.size(), false, "transactions outs global index: empty index for amount: " << ot.amount);
-    CHECK_AND_ASSERT_MES(it->second.back().first == tx_id , false, "transactions outs global index consistency broken: tx id missmatch");
-    CHECK_AND_ASSERT_MES(it->second.back().second == i, false, "transactions outs global index consistency broken: in transaction index missmatch");
-    it->second.pop_back();
+    amount_outputs_entry* range = m_amount_outputs.find(ot.amount);
+    CHECK_AND_ASSERT_MES(range && range->count, false, "transactions outs global index: empty index for amount: " << ot.amount);
+    const output_index_entry& out = m_outputs[range->offset + range->count - 1];
+    CHECK_AND_ASSERT_MES(out.tx_id == tx_id , false, "transactions outs global index consistency broken: tx id missmatch");
+    CHECK_AND_ASSERT_MES(out.index_in_tx == i, false, "transactions outs global index consistency broken: in transaction index missmatch");
+    if(--range->count == 0)
+    {
+      if(range->offset + range->capacity == m_outputs.size())
+        m_outputs.resize_down(range->offset);
+      m_amount_outputs.erase(ot.amount);
+    }
     --i;
   }
+  m_tx_global_output_indexes.resize_down(offset);
   return true;
 }
 //------------------------------------------------------------------
-bool blockchain_storage::add_transaction_from_block(const transaction& tx, const crypto::hash& tx_id, const crypto::hash& bl_id, uint64_t bl_height, size_t blob_size)
+bool blockchain_storage::add_transaction_from_block(const transaction& tx, const crypto::hash& tx_id, const crypto::hash& bl_id, uint64_t bl_height, size_t index_in_block)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   struct add_transaction_input_visitor: public boost::static_visitor<bool>
   {
     key_images_container& m_spent_keys;
     const crypto::hash& m_tx_id;
     const crypto::hash& m_bl_id;
-    add_transaction_input_visitor(key_images_container& spent_keys, const crypto::hash& tx_id, const crypto::hash& bl_id):m_spent_keys(spent_keys), m_tx_id(tx_id), m_bl_id(bl_id)
+    uint64_t m_bl_height;
+    add_transaction_input_visitor(key_images_container& spent_keys, const crypto::hash& tx_id, const crypto::hash& bl_id, uint64_t bl_height):m_spent_keys(spent_keys), m_tx_id(tx_id), m_bl_id(bl_id), m_bl_height(bl_height)
     {}
     bool operator()(const txin_to_key& in) const
     {
       const crypto::key_image& ki = in.k_image;
-      auto r = m_spent_keys.insert(ki);
-      if(!r.second)
+      if(!m_spent_keys.insert(ki, m_bl_height))
       {
         //double spend detected
         LOG_PRINT_L1("tx with id: " << m_tx_id << " in block id: " << m_bl_id << " has input marked as spent with key image: " << ki << ", block declined");
@@ -1367,27 +2040,28 @@ bool blockchain_storage::add_transaction_from_block(const transaction& tx, const
     bool operator()(const txin_to_scripthash& tx) const{return false;}
   };
 
+  if(m_transactions.count(tx_id))
+  {
+    LOG_PRINT_L1("tx with id: " << tx_id << " in block id: " << bl_id << " already in blockchain");
+    return false;
+  }
   BOOST_FOREACH(const txin_v& in, tx.vin)
   {
-    if(!boost::apply_visitor(add_transaction_input_visitor(m_spent_keys, tx_id, bl_id), in))
+    if(!boost::apply_visitor(add_transaction_input_visitor(m_spent_keys, tx_id, bl_id, bl_height), in))
     {
       LOG_PRINT_L1("critical internal error: add_transaction_input_visitor failed. but here key_images should be checked");
       purge_transaction_keyimages_from_blockchain(tx, false);
       return false;
     }
   }
-  transaction_chain_entry ch_e;
+  transaction_index_entry ch_e = AUTO_VAL_INIT(ch_e);
   ch_e.m_keeper_block_height = bl_height;
-  ch_e.m_blob_size = blob_size;
-  ch_e.tx = tx;
-  auto i_r = m_transactions.insert(std::pair<crypto::hash, transaction_chain_entry>(tx_id, ch_e));
-  if(!i_r.second)
-  {
-    LOG_PRINT_L1("tx with id: " << tx_id << " in block id: " << bl_id << " already in blockchain");
-    return false;
-  }
-  bool r = push_transaction_to_global_outs_index(tx, tx_id, i_r.first->second.m_global_output_indexes);
+  ch_e.m_index_in_block = index_in_block;
+  //the blob location is set by set_transaction_locations once the block is in the log
+  bool r = push_transaction_to_global_outs_index(tx, tx_id, bl_height, ch_e);
   CHECK_AND_ASSERT_MES(r, false, "failed to return push_transaction_to_global_outs_index tx id " << tx_id);
+  r = m_transactions.insert(tx_id, ch_e);
+  CHECK_AND_ASSERT_MES(r, false, "failed to index transaction " << tx_id);
   LOG_PRINT_L2("Added transaction to blockchain history:" << ENDL
     << "tx_id: " << tx_id << ENDL
     << "inputs: " << tx.vin.size() << ", outs: " << tx.vout.size() << ", spend money: " << print_money(get_outs_money_amount(tx)) << "(fee: " << (is_coinbase(tx) ? "0[coinbase]" : print_money(get_tx_fee(tx))) << ")");
@@ -1396,26 +2070,87 @@ bool blockchain_storage::add_transaction_from_block(const transaction& tx, const
 //------------------------------------------------------------------
 bool blockchain_storage::get_tx_outputs_gindexs(const crypto::hash& tx_id, std::vector<uint64_t>& indexs)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
-  auto it = m_transactions.find(tx_id);
-  if(it == m_transactions.end())
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  const transaction_index_entry* e = m_transactions.find(tx_id);
+  if(!e)
   {
     LOG_PRINT_RED_L1("warning: get_tx_outputs_gindexs failed to find transaction with id = " << tx_id);
     return false;
   }
 
-  CHECK_AND_ASSERT_MES(it->second.m_global_output_indexes.size(), false, "internal error: global indexes for transaction " << tx_id << " is empty");
-  indexs = it->second.m_global_output_indexes;
-  return true;
+  CHECK_AND_ASSERT_MES(e->m_outputs_count, false, "internal error: global indexes for transaction " << tx_id << " is empty");
+  return get_global_output_indexes(*e, indexs);
 }
 //------------------------------------------------------------------
 bool blockchain_storage::check_tx_inputs(const transaction& tx, uint64_t& max_used_block_height, crypto::hash& max_used_block_id)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  crypto::hash tx_id = get_transaction_hash(tx);
+  //ring signatures checked ahead by check_txs_ring_signatures, only key images are left
+  if(is_tx_verified(tx_id, max_used_block_height, max_used_block_id))
+    return check_tx_inputs(tx, get_transaction_prefix_hash(tx), NULL, true);
   bool res = check_tx_inputs(tx, &max_used_block_height);
   if(!res) return false;
   CHECK_AND_ASSERT_MES(max_used_block_height < m_blocks.size(), false,  "internal error: max used block index=" << max_used_block_height << " is not less then blockchain size = " << m_blocks.size());
-  get_block_hash(m_blocks[max_used_block_height].bl, max_used_block_id);
+  max_used_block_id = m_blocks[max_used_block_height].id;
+  if(!m_is_in_checkpoint_zone)
+    add_verified_tx(tx_id, max_used_block_height, max_used_block_id);
+  return true;
+}
+//------------------------------------------------------------------
+void blockchain_storage::add_verified_tx(const crypto::hash& tx_id, uint64_t max_used_block_height, const crypto::hash& max_used_block_id)
+{
+  CRITICAL_REGION_LOCAL(m_verified_txs_lock);
+  auto r = m_verified_txs.insert(std::make_pair(tx_id, verified_tx_entry()));
+  verified_tx_entry& e = r.first->second;
+  if(r.second)
+  {
+    e.order_it = m_verified_txs_order.insert(m_verified_txs_order.end(), tx_id);
+    if(m_verified_txs.size() > BLOCKCHAIN_VERIFIED_TXS_CACHE_SIZE)
+    {
+      m_verified_txs.erase(m_verified_txs_order.front());
+      m_verified_txs_order.pop_front();
+    }
+  }
+  e.max_used_block_height = max_used_block_height;
+  e.max_used_block_id = max_used_block_id;
+  e.chain_height = m_blocks.size();
+}
+//------------------------------------------------------------------
+void blockchain_storage::remove_verified_txs(const std::vector<crypto::hash>& tx_ids)
+{
+  CRITICAL_REGION_LOCAL(m_verified_txs_lock);
+  BOOST_FOREACH(const crypto::hash& tx_id, tx_ids)
+  {
+    auto it = m_verified_txs.find(tx_id);
+    if(it == m_verified_txs.end())
+      continue;
+    m_verified_txs_order.erase(it->second.order_it);
+    m_verified_txs.erase(it);
+  }
+}
+//------------------------------------------------------------------
+bool blockchain_storage::is_tx_verified(const crypto::hash& tx_id)
+{
+  uint64_t max_used_block_height = 0;
+  crypto::hash max_used_block_id = null_hash;
+  return is_tx_verified(tx_id, max_used_block_height, max_used_block_id);
+}
+//------------------------------------------------------------------
+bool blockchain_storage::is_tx_verified(const crypto::hash& tx_id, uint64_t& max_used_block_height, crypto::hash& max_used_block_id)
+{
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  CRITICAL_REGION_LOCAL1(m_verified_txs_lock);
+  auto it = m_verified_txs.find(tx_id);
+  if(it == m_verified_txs.end())
+    return false;
+  //ring members resolve to the same outputs only while the block they were checked against is still in the chain,
+  //and unlock times only stay satisfied while the chain is not shorter than when they were checked
+  const verified_tx_entry& e = it->second;
+  if(e.max_used_block_height >= m_blocks.size() || m_blocks.size() < e.chain_height || m_blocks[e.max_used_block_height].id != e.max_used_block_id)
+    return false;
+  max_used_block_height = e.max_used_block_height;
+  max_used_block_id = e.max_used_block_id;
   return true;
 }
 //------------------------------------------------------------------
@@ -1437,6 +2172,11 @@ bool blockchain_storage::check_tx_inputs(const transaction& tx, uint64_t* pmax_u
 }
 //------------------------------------------------------------------
 bool blockchain_storage::check_tx_inputs(const transaction& tx, const crypto::hash& tx_prefix_hash, uint64_t* pmax_used_block_height)
+{
+  return check_tx_inputs(tx, tx_prefix_hash, pmax_used_block_height, false);
+}
+//------------------------------------------------------------------
+bool blockchain_storage::check_tx_inputs(const transaction& tx, const crypto::hash& tx_prefix_hash, uint64_t* pmax_used_block_height, bool signatures_checked)
 {
   size_t sig_index = 0;
   if(pmax_used_block_height)
@@ -1456,7 +2196,7 @@ bool blockchain_storage::check_tx_inputs(const transaction& tx, const crypto::ha
     }
 
     CHECK_AND_ASSERT_MES(sig_index < tx.signatures.size(), false, "wrong transaction: not signature entry for input with index= " << sig_index);
-    if(!check_tx_input(in_to_key, tx_prefix_hash, tx.signatures[sig_index], pmax_used_block_height))
+    if(!signatures_checked && !check_tx_input(in_to_key, tx_prefix_hash, tx.signatures[sig_index], pmax_used_block_height))
     {
       LOG_PRINT_L1("Failed to check ring signature for tx " << get_transaction_hash(tx));
       return false;
@@ -1489,38 +2229,37 @@ bool blockchain_storage::is_tx_spendtime_unlocked(uint64_t unlock_time)
   return false;
 }
 //------------------------------------------------------------------
-bool blockchain_storage::check_tx_input(const txin_to_key& txin, const crypto::hash& tx_prefix_hash, const std::vector<crypto::signature>& sig, uint64_t* pmax_related_block_height)
+bool blockchain_storage::get_tx_input_keys(const txin_to_key& txin, std::vector<crypto::public_key>& output_keys, uint64_t* pmax_related_block_height)
 {
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
+  //keys are copied out: entries of m_outputs move when it grows
   struct outputs_visitor
   {
-    std::vector<const crypto::public_key *>& m_results_collector;
+    std::vector<crypto::public_key>& m_results_collector;
     blockchain_storage& m_bch;
-    outputs_visitor(std::vector<const crypto::public_key *>& results_collector, blockchain_storage& bch):m_results_collector(results_collector), m_bch(bch)
+    outputs_visitor(std::vector<crypto::public_key>& results_collector, blockchain_storage& bch):m_results_collector(results_collector), m_bch(bch)
     {}
-    bool handle_output(const transaction& tx, const tx_out& out)
+    bool handle_output(const output_index_entry& out)
     {
       //check tx unlock time
-      if(!m_bch.is_tx_spendtime_unlocked(tx.unlock_time))
+      if(!m_bch.is_tx_spendtime_unlocked(out.unlock_time))
       {
-        LOG_PRINT_L1("One of outputs for one of inputs has wrong tx.unlock_time = " << tx.unlock_time);
+        LOG_PRINT_L1("One of outputs for one of inputs has wrong tx.unlock_time = " << out.unlock_time);
         return false;
       }
 
-      if(out.target.type() != typeid(txout_to_key))
+      if(!out.to_key)
       {
-        LOG_PRINT_L1("Output has wrong type id, which=" << out.target.which());
+        LOG_PRINT_L1("Output has wrong type id");
         return false;
       }
 
-      m_results_collector.push_back(&boost::get<txout_to_key>(out.target).key);
+      m_results_collector.push_back(out.key);
       return true;
     }
   };
 
-  //check ring signature
-  std::vector<const crypto::public_key *> output_keys;
   outputs_visitor vi(output_keys, *this);
   if(!scan_outputkeys_for_indexes(txin, vi, pmax_related_block_height))
   {
@@ -1533,10 +2272,222 @@ bool blockchain_storage::check_tx_input(const txin_to_key& txin, const crypto::h
     LOG_PRINT_L1("Output keys for tx with amount = " << txin.amount << " and count indexes " << txin.key_offsets.size() << " returned wrong keys count " << output_keys.size());
     return false;
   }
+  return true;
+}
+//------------------------------------------------------------------
+bool blockchain_storage::check_tx_input(const txin_to_key& txin, const crypto::hash& tx_prefix_hash, const std::vector<crypto::signature>& sig, uint64_t* pmax_related_block_height)
+{
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+
+  //check ring signature
+  std::vector<crypto::public_key> output_keys;
+  if(!get_tx_input_keys(txin, output_keys, pmax_related_block_height))
+    return false;
   CHECK_AND_ASSERT_MES(sig.size() == output_keys.size(), false, "internal error: tx signatures count=" << sig.size() << " mismatch with outputs keys count for inputs=" << output_keys.size());
   if(m_is_in_checkpoint_zone)
     return true;
-  return crypto::check_ring_signature(tx_prefix_hash, txin.k_image, output_keys, sig.data());
+
+  std::vector<crypto::public_key_precomp> members(output_keys.size());
+  std::vector<const crypto::public_key_precomp *> member_ptrs;
+  for(size_t i = 0; i != output_keys.size(); i++)
+  {
+    if(!m_ring_members_cache.get(output_keys[i], members[i]))
+    {
+      LOG_PRINT_L1("Ring member " << output_keys[i] << " is not a valid public key");
+      return false;
+    }
+    member_ptrs.push_back(&members[i]);
+  }
+  return crypto::check_ring_signature(tx_prefix_hash, txin.k_image, member_ptrs, sig.data());
+}
+//------------------------------------------------------------------
+void blockchain_storage::precompute_blocks_pow(const std::list<block>& blocks)
+{
+  //the proof of work only depends on the block and its height, which the coinbase input claims;
+  //a wrong claim just means the result is not used when the block gets added
+  std::vector<const block*> pending;
+  std::vector<crypto::hash> ids;
+  std::vector<uint64_t> heights;
+  BOOST_FOREACH(const block& bl, blocks)
+  {
+    if(bl.miner_tx.vin.size() != 1 || bl.miner_tx.vin[0].type() != typeid(txin_gen))
+      continue;
+    crypto::hash id = get_block_hash(bl);
+    //already added, or hashed for another copy of the same block
+    if(have_block(id) || m_precomputed_pow.have(id))
+      continue;
+    pending.push_back(&bl);
+    ids.push_back(id);
+    heights.push_back(boost::get<txin_gen>(bl.miner_tx.vin[0]).height);
+  }
+
+  //the pool threads keep their scratchpads between calls
+  tools::run_in_parallel(pending.size(), [&](size_t i)
+  {
+    m_precomputed_pow.add(ids[i], heights[i], get_block_longhash(*pending[i], heights[i]));
+  });
+}
+//------------------------------------------------------------------
+crypto::hash blockchain_storage::get_block_proof_of_work(const block& bl, const crypto::hash& id, uint64_t height)
+{
+  return m_precomputed_pow.get(bl, id, height);
+}
+//------------------------------------------------------------------
+void blockchain_storage::check_ring_signatures(const std::vector<const transaction*>& txs, const std::vector<crypto::hash>& tx_prefix_hashes, std::vector<uint8_t>& results, std::vector<uint64_t>& max_used_block_heights)
+{
+  struct signature_job
+  {
+    size_t tx_index;
+    const crypto::key_image* k_image;
+    std::vector<crypto::public_key> output_keys;
+    std::vector<size_t> members;
+    const crypto::signature* sig;
+  };
+
+  //resolve ring members sequentially; transactions which can't be resolved here are left to the regular check
+  results.assign(txs.size(), ring_signatures_unresolved);
+  max_used_block_heights.assign(txs.size(), 0);
+  std::vector<signature_job> jobs;
+  for(size_t tx_index = 0; tx_index != txs.size(); tx_index++)
+  {
+    const transaction& tx = *txs[tx_index];
+    std::vector<signature_job> tx_jobs;
+    bool resolved = tx.vin.size() == tx.signatures.size();
+    for(size_t i = 0; resolved && i != tx.vin.size(); i++)
+    {
+      const txin_to_key* in_to_key = boost::get<txin_to_key>(&tx.vin[i]);
+      signature_job job = AUTO_VAL_INIT(job);
+      resolved = in_to_key && !in_to_key->key_offsets.empty() && get_tx_input_keys(*in_to_key, job.output_keys, &max_used_block_heights[tx_index]) && tx.signatures[i].size() == job.output_keys.size();
+      if(!resolved)
+        break;
+      job.tx_index = tx_index;
+      job.k_image = &in_to_key->k_image;
+      job.sig = tx.signatures[i].data();
+      tx_jobs.push_back(std::move(job));
+    }
+    if(!resolved)
+      continue;
+    results[tx_index] = ring_signatures_valid;
+    std::move(tx_jobs.begin(), tx_jobs.end(), std::back_inserter(jobs));
+  }
+
+  //decompress each distinct ring member once, popular decoys are usually left in the cache by earlier checks
+  std::unordered_map<crypto::public_key, size_t> member_indexes;
+  std::vector<crypto::public_key_precomp> members;
+  std::vector<uint8_t> members_valid;
+  std::vector<crypto::public_key> missing_keys;
+  std::vector<size_t> missing_indexes;
+  BOOST_FOREACH(signature_job& job, jobs)
+  {
+    BOOST_FOREACH(const crypto::public_key& key, job.output_keys)
+    {
+      auto res = member_indexes.insert(std::make_pair(key, members.size()));
+      job.members.push_back(res.first->second);
+      if(!res.second)
+        continue;
+      members.push_back(crypto::public_key_precomp());
+      members_valid.push_back(1);
+      if(m_ring_members_cache.find(key, members.back()))
+        continue;
+      missing_keys.push_back(key);
+      missing_indexes.push_back(members.size() - 1);
+    }
+  }
+  tools::run_in_parallel(missing_keys.size(), [&](size_t i)
+  {
+    members_valid[missing_indexes[i]] = crypto::precompute_public_key(missing_keys[i], members[missing_indexes[i]]) ? 1 : 0;
+  });
+  std::vector<crypto::public_key> computed_keys;
+  std::vector<crypto::public_key_precomp> computed_members;
+  for(size_t i = 0; i != missing_keys.size(); i++)
+  {
+    if(!members_valid[missing_indexes[i]])
+      continue;
+    computed_keys.push_back(missing_keys[i]);
+    computed_members.push_back(members[missing_indexes[i]]);
+  }
+  m_ring_members_cache.add(computed_keys.data(), computed_members.data(), computed_keys.size());
+
+  //check all ring signatures at once
+  std::vector<uint8_t> job_results(jobs.size(), 0);
+  tools::run_in_parallel(jobs.size(), [&](size_t i)
+  {
+    const signature_job& job = jobs[i];
+    std::vector<const crypto::public_key_precomp *> ring;
+    BOOST_FOREACH(size_t member_index, job.members)
+    {
+      if(!members_valid[member_index])
+        return;
+      ring.push_back(&members[member_index]);
+    }
+    job_results[i] = crypto::check_ring_signature(tx_prefix_hashes[job.tx_index], *job.k_image, ring, job.sig) ? 1 : 0;
+  });
+
+  for(size_t i = 0; i != jobs.size(); i++)
+  {
+    if(!job_results[i])
+      results[jobs[i].tx_index] = ring_signatures_invalid;
+  }
+}
+//------------------------------------------------------------------
+void blockchain_storage::check_block_ring_signatures(const block& bl, std::unordered_map<crypto::hash, bool>& results)
+{
+  EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  if(m_is_in_checkpoint_zone || bl.tx_hashes.empty())
+    return;
+
+  std::vector<transaction> txs;
+  std::vector<crypto::hash> tx_ids;
+  txs.reserve(bl.tx_hashes.size());
+  BOOST_FOREACH(const crypto::hash& tx_id, bl.tx_hashes)
+  {
+    //signatures of transactions checked when they entered the pool are still good, only their key images need checking
+    if(is_tx_verified(tx_id))
+    {
+      results[tx_id] = true;
+      continue;
+    }
+
+    transaction tx;
+    if(!m_tx_pool.get_transaction(tx_id, tx))
+      continue;
+    txs.push_back(tx);
+    tx_ids.push_back(tx_id);
+  }
+
+  std::vector<const transaction*> tx_ptrs;
+  std::vector<crypto::hash> tx_prefix_hashes;
+  BOOST_FOREACH(const transaction& tx, txs)
+  {
+    tx_ptrs.push_back(&tx);
+    tx_prefix_hashes.push_back(get_transaction_prefix_hash(tx));
+  }
+  std::vector<uint8_t> checked;
+  std::vector<uint64_t> max_used_block_heights;
+  check_ring_signatures(tx_ptrs, tx_prefix_hashes, checked, max_used_block_heights);
+  for(size_t i = 0; i != tx_ids.size(); i++)
+  {
+    if(checked[i] != ring_signatures_unresolved)
+      results[tx_ids[i]] = checked[i] == ring_signatures_valid;
+  }
+}
+//------------------------------------------------------------------
+void blockchain_storage::check_txs_ring_signatures(const std::vector<const transaction*>& txs, const std::vector<crypto::hash>& tx_ids, const std::vector<crypto::hash>& tx_prefix_hashes, std::vector<bool>& invalid)
+{
+  SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  invalid.assign(txs.size(), false);
+  if(m_is_in_checkpoint_zone || txs.empty())
+    return;
+
+  std::vector<uint8_t> checked;
+  std::vector<uint64_t> max_used_block_heights;
+  check_ring_signatures(txs, tx_prefix_hashes, checked, max_used_block_heights);
+  for(size_t i = 0; i != txs.size(); i++)
+  {
+    if(checked[i] == ring_signatures_valid && max_used_block_heights[i] < m_blocks.size())
+      add_verified_tx(tx_ids[i], max_used_block_heights[i], m_blocks[max_used_block_heights[i]].id);
+    invalid[i] = checked[i] == ring_signatures_invalid;
+  }
 }
 //------------------------------------------------------------------
 uint64_t blockchain_storage::get_adjusted_time()
@@ -1556,7 +2507,7 @@ bool blockchain_storage::check_block_timestamp_main(const block& b)
   std::vector<uint64_t> timestamps;
   size_t offset = m_blocks.size() <= BLOCKCHAIN_TIMESTAMP_CHECK_WINDOW ? 0: m_blocks.size()- BLOCKCHAIN_TIMESTAMP_CHECK_WINDOW;
   for(;offset!= m_blocks.size(); ++offset)
-    timestamps.push_back(m_blocks[offset].bl.timestamp);
+    timestamps.push_back(m_blocks[offset].timestamp);
 
   return check_block_timestamp(std::move(timestamps), b);
 }
@@ -1580,7 +2531,7 @@ bool blockchain_storage::check_block_timestamp(std::vector<uint64_t> timestamps,
 bool blockchain_storage::handle_block_to_main_chain(const block& bl, const crypto::hash& id, block_verification_context& bvc)
 {
   TIME_MEASURE_START(block_processing_time);
-  CRITICAL_REGION_LOCAL(m_blockchain_lock);
+  EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
   if(bl.prev_id != get_tail_id())
   {
     LOG_PRINT_L1("Block with id: " << id << ENDL
@@ -1612,7 +2563,7 @@ bool blockchain_storage::handle_block_to_main_chain(const block& bl, const crypt
   // before checkpoints, which is very dangerous behaviour. We moved the PoW
   // validation out of the next chunk of code to make sure that we correctly
   // check PoW now.
-  proof_of_work = get_block_longhash(bl, m_blocks.size());
+  proof_of_work = get_block_proof_of_work(bl, id, m_blocks.size());
 
   if(!check_hash(proof_of_work, current_diffic))
   {
@@ -1644,19 +2595,30 @@ bool blockchain_storage::handle_block_to_main_chain(const block& bl, const crypt
     bvc.m_verifivation_failed = true;
     return false;
   }
+  if(!mark_indexes_changed())
+  {
+    LOG_ERROR("Failed to mark blockchain indexes as changed");
+    return false;
+  }
   crypto::hash coinbase_hash = null_hash;
   size_t coinbase_blob_size = 0;
   get_transaction_hash(bl.miner_tx, coinbase_hash, coinbase_blob_size);
   size_t cumulative_block_size = coinbase_blob_size;
   //process transactions
-  if(!add_transaction_from_block(bl.miner_tx, coinbase_hash, id, get_current_blockchain_height(), coinbase_blob_size))
+  if(!add_transaction_from_block(bl.miner_tx, coinbase_hash, id, get_current_blockchain_height(), 0))
   {
     LOG_PRINT_L1("Block with id: " << id << " failed to add transaction to blockchain storage");
     bvc.m_verifivation_failed = true;
     return false;
   }
-  size_t tx_processed_count = 0;
+  std::unordered_map<crypto::hash, bool> ring_signatures_checked;
+  check_block_ring_signatures(bl, ring_signatures_checked);
+
   uint64_t fee_summary = 0;
+  std::vector<transaction> txs;
+  std::vector<blobdata> tx_blobs;
+  txs.reserve(bl.tx_hashes.size());
+  tx_blobs.reserve(bl.tx_hashes.size());
   BOOST_FOREACH(const crypto::hash& tx_id, bl.tx_hashes)
   {
     transaction tx;
@@ -1665,37 +2627,40 @@ bool blockchain_storage::handle_block_to_main_chain(const block& bl, const crypt
     if(!m_tx_pool.take_tx(tx_id, tx, blob_size, fee))
     {
       LOG_PRINT_L1("Block with id: " << id  << "has at least one unknown transaction with id: " << tx_id);
-      purge_block_data_from_blockchain(bl, tx_processed_count);
+      purge_block_data_from_blockchain(bl, txs);
       //add_block_as_invalid(bl, id);
       bvc.m_verifivation_failed = true;
       return false;
     }
-    if(!check_tx_inputs(tx))
+    auto sig_it = ring_signatures_checked.find(tx_id);
+    bool inputs_ok = sig_it == ring_signatures_checked.end() ? check_tx_inputs(tx) : sig_it->second && check_tx_inputs(tx, get_transaction_prefix_hash(tx), NULL, true);
+    if(!inputs_ok)
     {
       LOG_PRINT_L1("Block with id: " << id  << "has at least one transaction (id: " << tx_id << ") with wrong inputs.");
       cryptonote::tx_verification_context tvc = AUTO_VAL_INIT(tvc);
       bool add_res = m_tx_pool.add_tx(tx, tvc, true);
       CHECK_AND_ASSERT_MES2(add_res, "handle_block_to_main_chain: failed to add transaction back to transaction pool");
-      purge_block_data_from_blockchain(bl, tx_processed_count);
+      purge_block_data_from_blockchain(bl, txs);
       add_block_as_invalid(bl, id);
       LOG_PRINT_L1("Block with id " << id << " added as invalid becouse of wrong inputs in transactions");
       bvc.m_verifivation_failed = true;
       return false;
     }
 
-    if(!add_transaction_from_block(tx, tx_id, id, get_current_blockchain_height(), blob_size))
+    if(!add_transaction_from_block(tx, tx_id, id, get_current_blockchain_height(), txs.size() + 1))
     {
        LOG_PRINT_L1("Block with id: " << id << " failed to add transaction to blockchain storage");
        cryptonote::tx_verification_context tvc = AUTO_VAL_INIT(tvc);
        bool add_res = m_tx_pool.add_tx(tx, tvc, true);
        CHECK_AND_ASSERT_MES2(add_res, "handle_block_to_main_chain: failed to add transaction back to transaction pool");
-       purge_block_data_from_blockchain(bl, tx_processed_count);
+       purge_block_data_from_blockchain(bl, txs);
        bvc.m_verifivation_failed = true;
        return false;
     }
+    tx_blobs.push_back(tx_to_blob(tx));
+    txs.push_back(tx);
     fee_summary += fee;
     cumulative_block_size += blob_size;
-    ++tx_processed_count;
   }
   uint64_t base_reward = 0;
   uint64_t already_generated_coins = m_blocks.size() ? m_blocks.back().already_generated_coins:0;
@@ -1703,7 +2668,7 @@ bool blockchain_storage::handle_block_to_main_chain(const block& bl, const crypt
   {
     LOG_PRINT_L1("Block with id: " << id
       << " has incorrect miner transaction");
-    purge_block_data_from_blockchain(bl, tx_processed_count);
+    purge_block_data_from_blockchain(bl, txs);
     bvc.m_verifivation_failed = true;
     return false;
   }
@@ -1711,6 +2676,7 @@ bool blockchain_storage::handle_block_to_main_chain(const block& bl, const crypt
 
   block_extended_info bei = boost::value_initialized<block_extended_info>();
   bei.bl = bl;
+  bei.id = id;
   bei.block_cumulative_size = cumulative_block_size;
   bei.cumulative_difficulty = current_diffic;
 
@@ -1726,17 +2692,43 @@ bool blockchain_storage::handle_block_to_main_chain(const block& bl, const crypt
 
   bei.height = m_blocks.size();
 
-  auto ind_res = m_blocks_index.insert(std::pair<crypto::hash, size_t>(id, bei.height));
-  if(!ind_res.second)
+  if(!m_blocks_index.insert(id, bei.height))
   {
     LOG_PRINT_L1("block with id: " << id << " already in block indexes");
-    purge_block_data_from_blockchain(bl, tx_processed_count);
+    purge_block_data_from_blockchain(bl, txs);
+    bvc.m_verifivation_failed = true;
+    return false;
+  }
+
+  std::vector<blob_location> tx_locations;
+  if(!push_block_to_log(bei, tx_blobs, tx_locations))
+  {
+    LOG_ERROR("Failed to write block with id: " << id << " to blockchain data files");
+    m_blocks_index.erase(id);
+    purge_block_data_from_blockchain(bl, txs);
     bvc.m_verifivation_failed = true;
     return false;
   }
 
-  m_blocks.push_back(bei);
+  block_index_entry bie = AUTO_VAL_INIT(bie);
+  bie.id = id;
+  bie.timestamp = bl.timestamp;
+  bie.block_cumulative_size = bei.block_cumulative_size;
+  bie.cumulative_difficulty = bei.cumulative_difficulty;
+  bie.already_generated_coins = bei.already_generated_coins;
+  if(!set_transaction_locations(bl, tx_locations) || !m_blocks.push_back(bie))
+  {
+    LOG_ERROR("Failed to index block with id: " << id);
+    pop_block_from_log(bei.height);
+    m_blocks_index.erase(id);
+    purge_block_data_from_blockchain(bl, txs);
+    bvc.m_verifivation_failed = true;
+    return false;
+  }
+  if(bei.height)
+    m_difficulty_window.push_back(bie.timestamp, bie.cumulative_difficulty);
   update_next_comulative_size_limit();
+  remove_verified_txs(bl.tx_hashes);
   TIME_MEASURE_FINISH(block_processing_time);
   LOG_PRINT_L1("+++++ BLOCK SUCCESSFULLY ADDED" << ENDL << "id:\t" << id
     << ENDL << "PoW:\t" << proof_of_work
@@ -1805,7 +2797,7 @@ void blockchain_storage::check_against_checkpoints(checkpoints& points, bool enf
       continue;
     }
 
-    if (!points.check_block(pt.first, get_block_hash(m_blocks[pt.first].bl)))
+    if (!points.check_block(pt.first, m_blocks[pt.first].id))
     {
       // if asked to enforce checkpoints, roll back to a couple of blocks before the checkpoint
       if (enforce)
@@ -40,6 +40,7 @@
 #include <atomic>
 
 #include "syncobj.h"
+#include "math_helper.h"
 #include "string_tools.h"
 #include "tx_pool.h"
 #include "cryptonote_basic.h"
@@ -51,6 +52,11 @@
 #include "verification_context.h"
 #include "crypto/hash.h"
 #include "checkpoints.h"
+#include "blob_log.h"
+#include "block_journal.h"
+#include "mapped_index.h"
+#include "pow_cache.h"
+#include "ring_members_cache.h"
 
 namespace cryptonote
 {
@@ -61,6 +67,7 @@ namespace cryptonote
   class blockchain_storage
   {
   public:
+    // main chain transaction as blockchain.bin (CRYPTONOTE_BLOCKCHAINDATA_FILENAME) keeps it
     struct transaction_chain_entry
     {
       transaction tx;
@@ -72,13 +79,49 @@ namespace cryptonote
     struct block_extended_info
     {
       block   bl;
+      crypto::hash id;                       // get_block_hash(bl)
       uint64_t height;
       size_t block_cumulative_size;
       difficulty_type cumulative_difficulty;
       uint64_t already_generated_coins;
     };
 
-    blockchain_storage(tx_memory_pool& tx_pool):m_tx_pool(tx_pool), m_current_block_cumul_sz_limit(0), m_is_in_checkpoint_zone(false), m_is_blockchain_storing(false), m_enforce_dns_checkpoints(false)
+    // main chain block as it is kept in m_blocks_log (CRYPTONOTE_BLOCKCHAINDATA_LOG_FILENAME), one record per height
+    struct stored_block
+    {
+      blobdata block;
+      std::vector<blobdata> txs;
+      uint64_t block_cumulative_size;
+      difficulty_type cumulative_difficulty;
+      uint64_t already_generated_coins;
+
+      BEGIN_SERIALIZE_OBJECT()
+        FIELD(block)
+        FIELD(txs)
+        VARINT_FIELD(block_cumulative_size)
+        VARINT_FIELD(cumulative_difficulty)
+        VARINT_FIELD(already_generated_coins)
+      END_SERIALIZE()
+    };
+
+    // what is indexed of a main chain transaction, the transaction itself is read from m_blocks_log as needed;
+    // CRYPTONOTE_BLOCKCHAINDATA_INDEX_FILENAME ".txs" maps transaction ids to these and ".tx_outs" holds the global output indexes
+    struct transaction_index_entry
+    {
+      uint64_t m_keeper_block_height;
+      uint64_t m_index_in_block;             // 0 for the miner transaction, i + 1 for tx_hashes[i]
+      uint64_t m_blob_offset;                // in the block log record of the keeper block
+      uint64_t m_blob_size;
+      uint64_t m_global_output_indexes_offset; // in m_tx_global_output_indexes, one per output
+      uint64_t m_outputs_count;
+    };
+    typedef mapped_hash_table<crypto::hash, transaction_index_entry> transactions_container;
+
+    // height and tail id of the main chain the index files in config_folder hold, if they were stored whole;
+    // generation changes with every store of the state, clean or not
+    static bool load_indexes_state(const std::string& config_folder, uint64_t& height, crypto::hash& tail_id, uint64_t& generation);
+
+    blockchain_storage(tx_memory_pool& tx_pool):m_tx_pool(tx_pool), m_indexes_clean(false), m_indexes_generation(0), m_current_block_cumul_sz_limit(0), m_is_in_checkpoint_zone(false), m_is_blockchain_storing(false), m_enforce_dns_checkpoints(false), m_ring_members_cache(BLOCKCHAIN_RING_MEMBERS_CACHE_SIZE), m_precomputed_pow(BLOCKCHAIN_PRECOMPUTED_POW_CACHE_SIZE)
     {};
 
     bool init() { return init(tools::get_default_data_dir(), true); }
@@ -102,7 +145,7 @@ namespace cryptonote
     bool have_tx(const crypto::hash &id);
     bool have_tx_keyimges_as_spent(const transaction &tx);
     bool have_tx_keyimg_as_spent(const crypto::key_image &key_im);
-    transaction *get_tx(const crypto::hash &id);
+    bool get_tx(const crypto::hash &id, transaction &tx);
 
     template<class visitor_t>
     bool scan_outputkeys_for_indexes(const txin_to_key& tx_in_to_key, visitor_t& vis, uint64_t* pmax_related_block_height = NULL);
@@ -115,22 +158,26 @@ namespace cryptonote
     bool reset_and_set_genesis_block(const block& b);
     bool create_block_template(block& b, const account_public_address& miner_address, difficulty_type& di, uint64_t& height, const blobdata& ex_nonce);
     bool have_block(const crypto::hash& id);
+    void precompute_blocks_pow(const std::list<block>& blocks);
     size_t get_total_transactions();
     bool get_outs(uint64_t amount, std::list<crypto::public_key>& pkeys);
     bool get_short_chain_history(std::list<crypto::hash>& ids);
     bool find_blockchain_supplement(const std::list<crypto::hash>& qblock_ids, NOTIFY_RESPONSE_CHAIN_ENTRY::request& resp);
     bool find_blockchain_supplement(const std::list<crypto::hash>& qblock_ids, uint64_t& starter_offset);
-    bool find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<std::pair<block, std::list<transaction> > >& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count);
+    bool find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<block_complete_entry>& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count);
+    bool find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<COMMAND_RPC_GET_BLOCKS_COMPACT::block_entry>& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count);
     bool handle_get_objects(NOTIFY_REQUEST_GET_OBJECTS::request& arg, NOTIFY_RESPONSE_GET_OBJECTS::request& rsp);
     bool handle_get_objects(const COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::request& req, COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::response& res);
     bool get_random_outs_for_amounts(const COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::request& req, COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::response& res);
     bool get_backward_blocks_sizes(size_t from_height, std::vector<size_t>& sz, size_t count);
     bool get_tx_outputs_gindexs(const crypto::hash& tx_id, std::vector<uint64_t>& indexs);
     bool store_blockchain();
+    void on_idle();
     bool check_tx_input(const txin_to_key& txin, const crypto::hash& tx_prefix_hash, const std::vector<crypto::signature>& sig, uint64_t* pmax_related_block_height = NULL);
     bool check_tx_inputs(const transaction& tx, const crypto::hash& tx_prefix_hash, uint64_t* pmax_used_block_height = NULL);
     bool check_tx_inputs(const transaction& tx, uint64_t* pmax_used_block_height = NULL);
     bool check_tx_inputs(const transaction& tx, uint64_t& pmax_used_block_height, crypto::hash& max_used_block_id);
+    void check_txs_ring_signatures(const std::vector<const transaction*>& txs, const std::vector<crypto::hash>& tx_ids, const std::vector<crypto::hash>& tx_prefix_hashes, std::vector<bool>& invalid);
     uint64_t get_current_comulative_blocksize_limit();
     bool is_storing_blockchain(){return m_is_blockchain_storing;}
     uint64_t block_difficulty(size_t i);
@@ -138,18 +185,19 @@ namespace cryptonote
     template<class t_ids_container, class t_blocks_container, class t_missed_container>
     bool get_blocks(const t_ids_container& block_ids, t_blocks_container& blocks, t_missed_container& missed_bs)
     {
-      CRITICAL_REGION_LOCAL(m_blockchain_lock);
+      SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
       BOOST_FOREACH(const auto& bl_id, block_ids)
       {
-        auto it = m_blocks_index.find(bl_id);
-        if(it == m_blocks_index.end())
+        const uint64_t* height = m_blocks_index.find(bl_id);
+        if(!height)
           missed_bs.push_back(bl_id);
         else
         {
-          CHECK_AND_ASSERT_MES(it->second < m_blocks.size(), false, "Internal error: bl_id=" << epee::string_tools::pod_to_hex(bl_id)
-            << " have index record with offset="<<it->second<< ", bigger then m_blocks.size()=" << m_blocks.size());
-            blocks.push_back(m_blocks[it->second].bl);
+          CHECK_AND_ASSERT_MES(*height < m_blocks.size(), false, "Internal error: bl_id=" << epee::string_tools::pod_to_hex(bl_id)
+            << " have index record with offset="<<*height<< ", bigger then m_blocks.size()=" << m_blocks.size());
+          blocks.push_back(block());
+          CHECK_AND_ASSERT_MES(get_main_block(*height, blocks.back()), false, "Internal error: failed to read block " << bl_id << " on height " << *height);
         }
       }
       return true;
@@ -158,21 +206,24 @@ namespace cryptonote
     template<class t_ids_container, class t_tx_container, class t_missed_container>
     bool get_transactions(const t_ids_container& txs_ids, t_tx_container& txs, t_missed_container& missed_txs)
     {
-      CRITICAL_REGION_LOCAL(m_blockchain_lock);
+      SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
 
       BOOST_FOREACH(const auto& tx_id, txs_ids)
       {
-        auto it = m_transactions.find(tx_id);
-        if(it == m_transactions.end())
+        transaction tx;
+        const transaction_index_entry* e = m_transactions.find(tx_id);
+        if(!e)
         {
-          transaction tx;
           if(!m_tx_pool.get_transaction(tx_id, tx))
             missed_txs.push_back(tx_id);
           else
             txs.push_back(tx);
         }
         else
-          txs.push_back(it->second.tx);
+        {
+          CHECK_AND_ASSERT_MES(get_main_transaction(tx_id, *e, tx), false, "Internal error: failed to read transaction " << tx_id << " on height " << e->m_keeper_block_height);
+          txs.push_back(tx);
+        }
       }
       return true;
     }
@@ -185,23 +236,97 @@ namespace cryptonote
     void set_enforce_dns_checkpoints(bool enforce_checkpoints);
 
   private:
-    typedef std::unordered_map<crypto::hash, size_t> blocks_by_id_index;
-    typedef std::unordered_map<crypto::hash, transaction_chain_entry> transactions_container;
-    typedef std::unordered_set<crypto::key_image> key_images_container;
-    typedef std::vector<block_extended_info> blocks_container;
+    // what is indexed of a main chain block, the block itself is read from m_blocks_log as needed
+    struct block_index_entry
+    {
+      crypto::hash id;
+      uint64_t timestamp;
+      uint64_t block_cumulative_size;
+      difficulty_type cumulative_difficulty;
+      uint64_t already_generated_coins;
+    };
+
+    // where a transaction blob lies in a block log record: offset and size
+    typedef std::pair<uint64_t, uint64_t> blob_location;
+
+    typedef mapped_array<block_index_entry> blocks_container;
+    typedef mapped_hash_table<crypto::hash, uint64_t> blocks_by_id_index;
+    typedef mapped_hash_table<crypto::key_image, uint64_t> key_images_container; // key image -> height of the block spending it
+    typedef std::unordered_map<crypto::hash, size_t> legacy_blocks_by_id_index;
+    typedef std::unordered_set<crypto::key_image> legacy_key_images_container;
+    typedef std::vector<block_extended_info> legacy_blocks_container;
+    typedef std::unordered_map<crypto::hash, transaction_chain_entry> legacy_transactions_container;
     typedef std::unordered_map<crypto::hash, block_extended_info> blocks_ext_by_hash;
     typedef std::unordered_map<crypto::hash, block> blocks_by_hash;
-    typedef std::map<uint64_t, std::vector<std::pair<crypto::hash, size_t>>> outputs_container; //crypto::hash - tx hash, size_t - index of out in transaction
+    typedef std::map<uint64_t, std::vector<std::pair<crypto::hash, size_t>>> legacy_outputs_container; //crypto::hash - tx hash, size_t - index of out in transaction
+
+    // what resolving a ring member or picking a random output needs, kept inline so it takes no lookup into m_transactions
+    struct output_index_entry
+    {
+      crypto::public_key key;                // only meaningful for txout_to_key outputs
+      uint64_t unlock_time;                  // of the transaction the output belongs to
+      uint64_t keeper_block_height;
+      crypto::hash tx_id;
+      uint64_t index_in_tx;
+      uint64_t to_key;
+    };
+
+    // where the outputs of an amount lie in m_outputs: global index i is at offset + i
+    struct amount_outputs_entry
+    {
+      uint64_t offset;
+      uint64_t count;
+      uint64_t capacity;                     // slots reserved from offset, a full range is moved to the end of m_outputs twice as large
+    };
+
+    typedef mapped_hash_table<uint64_t, amount_outputs_entry> amount_outputs_index; // amount -> range of its outputs
+    typedef mapped_array<output_index_entry> outputs_container;
+
+    // pool transaction whose inputs passed check_tx_inputs against the chain ending at max_used_block_id
+    struct verified_tx_entry
+    {
+      uint64_t max_used_block_height;
+      crypto::hash max_used_block_id;
+      uint64_t chain_height;
+      std::list<crypto::hash>::iterator order_it;
+    };
+
+    // alternative and invalid blocks as they are kept in CRYPTONOTE_BLOCKCHAINDATA_ALT_FILENAME, stored whole by store_blockchain
+    struct side_blocks
+    {
+      blocks_ext_by_hash& alternative;
+      blocks_ext_by_hash& invalid;
+
+      template<class archive_t>
+      void serialize(archive_t & ar, const unsigned int version)
+      {
+        ar & alternative;
+        ar & invalid;
+      }
+    };
+
+    enum ring_signatures_check_result
+    {
+      ring_signatures_unresolved,
+      ring_signatures_valid,
+      ring_signatures_invalid
+    };
 
     tx_memory_pool& m_tx_pool;
-    epee::critical_section m_blockchain_lock; // TODO: add here reader/writer lock
+    epee::shared_critical_section m_blockchain_lock; // shared for lookups, exclusive for anything that changes the chain
 
-    // main chain
-    blocks_container m_blocks;               // height  -> block_extended_info
+    // main chain, indexed in files next to the block log (CRYPTONOTE_BLOCKCHAINDATA_INDEX_FILENAME.*)
+    blocks_container m_blocks;               // height  -> block_index_entry
     blocks_by_id_index m_blocks_index;       // crypto::hash -> height
     transactions_container m_transactions;
+    mapped_array<uint64_t> m_tx_global_output_indexes; // of the outputs of all transactions, in chain order
     key_images_container m_spent_keys;
+    amount_outputs_index m_amount_outputs;
+    outputs_container m_outputs;             // outputs of each amount in a range of their own, by global index
+    bool m_indexes_clean;                    // index files on disk match the state file, nothing was changed since
+    uint64_t m_indexes_generation;           // of the last stored state
     size_t m_current_block_cumul_sz_limit;
+    difficulty_window m_difficulty_window;   // last DIFFICULTY_BLOCKS_COUNT blocks of m_blocks
 
 
     // all alternative chains
@@ -209,8 +334,20 @@ namespace cryptonote
 
     // some invalid blocks
     blocks_ext_by_hash m_invalid_blocks;     // crypto::hash -> block_extended_info
-    outputs_container m_outputs;
 
+    std::unordered_map<crypto::hash, verified_tx_entry> m_verified_txs;
+    std::list<crypto::hash> m_verified_txs_order; // oldest first, the first to go when the cache is full
+    epee::critical_section m_verified_txs_lock;
+
+    // decompressed ring members, by output key
+    ring_members_cache m_ring_members_cache;
+
+    // proofs of work computed ahead for downloaded blocks
+    pow_cache m_precomputed_pow;
+
+    blob_log m_blocks_log;                   // height -> stored_block, on disk
+    block_journal m_blocks_journal;          // changes of m_blocks_log since it was last flushed
+    epee::math_helper::once_a_time_seconds<BLOCKCHAIN_JOURNAL_SYNC_INTERVAL> m_journal_sync_interval;
 
     std::string m_config_folder;
     checkpoints m_checkpoints;
@@ -221,34 +358,71 @@ namespace cryptonote
     bool m_testnet;
 
     bool switch_to_alternative_blockchain(std::list<blocks_ext_by_hash::iterator>& alt_chain, bool discard_disconnected_chain);
-    bool pop_block_from_blockchain();
-    bool purge_block_data_from_blockchain(const block& b, size_t processed_tx_count);
-    bool purge_transaction_from_blockchain(const crypto::hash& tx_id);
+    bool pop_block_from_blockchain(block* popped = NULL);
+    bool store_side_blocks();
+    void load_side_blocks();
+    bool purge_block_data_from_blockchain(const block& b, const std::vector<transaction>& processed_txs);
+    bool purge_transaction_from_blockchain(const transaction& tx, const crypto::hash& tx_id);
     bool purge_transaction_keyimages_from_blockchain(const transaction& tx, bool strict_check);
 
     bool handle_block_to_main_chain(const block& bl, block_verification_context& bvc);
     bool handle_block_to_main_chain(const block& bl, const crypto::hash& id, block_verification_context& bvc);
     bool handle_alternative_block(const block& b, const crypto::hash& id, block_verification_context& bvc);
+    crypto::hash get_block_proof_of_work(const block& bl, const crypto::hash& id, uint64_t height);
     difficulty_type get_next_difficulty_for_alternative_chain(const std::list<blocks_ext_by_hash::iterator>& alt_chain, block_extended_info& bei);
+    void rebuild_difficulty_window();
+    void pop_from_difficulty_window(difficulty_window& window, size_t height);
     bool prevalidate_miner_transaction(const block& b, uint64_t height);
     bool validate_miner_transaction(const block& b, size_t cumulative_block_size, uint64_t fee, uint64_t& base_reward, uint64_t already_generated_coins);
     bool validate_transaction(const block& b, uint64_t height, const transaction& tx);
     bool rollback_blockchain_switching(std::list<block>& original_chain, size_t rollback_height);
-    bool add_transaction_from_block(const transaction& tx, const crypto::hash& tx_id, const crypto::hash& bl_id, uint64_t bl_height, size_t blob_size);
-    bool push_transaction_to_global_outs_index(const transaction& tx, const crypto::hash& tx_id, std::vector<uint64_t>& global_indexes);
+    bool add_transaction_from_block(const transaction& tx, const crypto::hash& tx_id, const crypto::hash& bl_id, uint64_t bl_height, size_t index_in_block);
+    bool set_transaction_locations(const block& bl, const std::vector<blob_location>& locations);
+    bool push_transaction_to_global_outs_index(const transaction& tx, const crypto::hash& tx_id, uint64_t keeper_block_height, transaction_index_entry& e);
     bool pop_transaction_from_global_index(const transaction& tx, const crypto::hash& tx_id);
+    uint64_t get_outputs_count(uint64_t amount) const;
+    const output_index_entry* get_output(uint64_t amount, uint64_t i) const;
+    bool grow_amount_outputs(amount_outputs_entry& range);
+    bool get_global_output_indexes(const transaction_index_entry& e, std::vector<uint64_t>& indexs) const;
     bool get_last_n_blocks_sizes(std::vector<size_t>& sz, size_t count);
-    bool add_out_to_get_random_outs(std::vector<std::pair<crypto::hash, size_t> >& amount_outs, COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::outs_for_amount& result_outs, uint64_t amount, size_t i);
+    bool add_out_to_get_random_outs(uint64_t amount, size_t i, COMMAND_RPC_GET_RANDOM_OUTPUTS_FOR_AMOUNTS::outs_for_amount& result_outs);
     bool is_tx_spendtime_unlocked(uint64_t unlock_time);
+    bool check_tx_inputs(const transaction& tx, const crypto::hash& tx_prefix_hash, uint64_t* pmax_used_block_height, bool signatures_checked);
+    bool get_tx_input_keys(const txin_to_key& txin, std::vector<crypto::public_key>& output_keys, uint64_t* pmax_related_block_height);
+    void add_verified_tx(const crypto::hash& tx_id, uint64_t max_used_block_height, const crypto::hash& max_used_block_id);
+    void remove_verified_txs(const std::vector<crypto::hash>& tx_ids);
+    bool is_tx_verified(const crypto::hash& tx_id);
+    bool is_tx_verified(const crypto::hash& tx_id, uint64_t& max_used_block_height, crypto::hash& max_used_block_id);
+    void check_ring_signatures(const std::vector<const transaction*>& txs, const std::vector<crypto::hash>& tx_prefix_hashes, std::vector<uint8_t>& results, std::vector<uint64_t>& max_used_block_heights);
+    void check_block_ring_signatures(const block& bl, std::unordered_map<crypto::hash, bool>& results);
     bool add_block_as_invalid(const block& bl, const crypto::hash& h);
     bool add_block_as_invalid(const block_extended_info& bei, const crypto::hash& h);
-    size_t find_end_of_allowed_index(const std::vector<std::pair<crypto::hash, size_t> >& amount_outs);
+    size_t find_end_of_allowed_index(uint64_t amount, uint64_t outs_count);
     bool check_block_timestamp_main(const block& b);
     bool check_block_timestamp(std::vector<uint64_t> timestamps, const block& b);
     uint64_t get_adjusted_time();
     bool complete_timestamps_vector(uint64_t start_height, std::vector<uint64_t>& timestamps);
     bool update_next_comulative_size_limit();
     bool store_genesis_block(bool testnet);
+    bool push_block_to_log(const block_extended_info& bei, const std::vector<blobdata>& tx_blobs, std::vector<blob_location>& tx_locations);
+    static bool locate_stored_transactions(const blobdata& record, const stored_block& sb, const block& bl, std::vector<blob_location>& locations);
+    bool open_indexes();
+    void close_indexes();
+    void clear_indexes();
+    bool flush_indexes();
+    bool store_indexes_state(bool clean);
+    bool mark_indexes_changed();
+    bool load_blocks_from_log();
+    bool add_block_from_log(const blobdata& record, uint64_t height);
+    bool convert_blocks_to_log(const legacy_blocks_container& blocks, const legacy_transactions_container& transactions);
+    bool replay_blocks_journal(uint64_t base_height, const std::vector<block_journal::entry>& entries);
+    bool pop_block_from_log(uint64_t height);
+    bool get_stored_block(uint64_t height, stored_block& sb);
+    bool get_main_block(uint64_t height, block& bl);
+    bool get_main_block(uint64_t height, block& bl, std::vector<transaction>& txs);
+    bool get_main_transaction(const crypto::hash& tx_id, const transaction_index_entry& e, transaction& tx);
+    bool get_block_complete_entry(uint64_t height, block_complete_entry& e);
+    bool get_compact_tx_entry(const transaction& tx, const crypto::hash& tx_id, COMMAND_RPC_GET_BLOCKS_COMPACT::tx_entry& e);
   };
 
 
@@ -261,93 +435,94 @@ namespace cryptonote
   template<class archive_t>
   void blockchain_storage::serialize(archive_t & ar, const unsigned int version)
   {
+    //blockchain.bin is only read, to be converted to the block log
+    static_assert(!archive_t::is_saving::value, "blockchain storage is stored in the block log");
     if(version < 11)
       return;
-    CRITICAL_REGION_LOCAL(m_blockchain_lock);
-    ar & m_blocks;
-    ar & m_blocks_index;
-    ar & m_transactions;
-    ar & m_spent_keys;
+    EXCLUSIVE_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+    legacy_blocks_container blocks;
+    legacy_blocks_by_id_index blocks_index;
+    legacy_transactions_container transactions;
+    legacy_key_images_container spent_keys;
+    legacy_outputs_container outputs;
+    ar & blocks;
+    ar & blocks_index;
+    ar & transactions;
+    ar & spent_keys;
     ar & m_alternative_chains;
-    ar & m_outputs;
+    ar & outputs;
     ar & m_invalid_blocks;
     ar & m_current_block_cumul_sz_limit;
     /*serialization bug workaround*/
     if(version > 11)
     {
-      uint64_t total_check_count = m_blocks.size() + m_blocks_index.size() + m_transactions.size() + m_spent_keys.size() + m_alternative_chains.size() + m_outputs.size() + m_invalid_blocks.size() + m_current_block_cumul_sz_limit;
-      if(archive_t::is_saving::value)
-      {        
-        ar & total_check_count;
-      }else
+      uint64_t total_check_count = blocks.size() + blocks_index.size() + transactions.size() + spent_keys.size() + m_alternative_chains.size() + outputs.size() + m_invalid_blocks.size() + m_current_block_cumul_sz_limit;
+      uint64_t total_check_count_loaded = 0;
+      ar & total_check_count_loaded;
+      if(total_check_count != total_check_count_loaded)
       {
-        uint64_t total_check_count_loaded = 0;
-        ar & total_check_count_loaded;
-        if(total_check_count != total_check_count_loaded)
-        {
-          LOG_ERROR("Blockchain storage data corruption detected. total_count loaded from file = " << total_check_count_loaded << ", expected = " << total_check_count);
-
-          LOG_PRINT_L0("Blockchain storage:" << ENDL << 
-            "m_blocks: " << m_blocks.size() << ENDL  << 
-            "m_blocks_index: " << m_blocks_index.size() << ENDL  << 
-            "m_transactions: " << m_transactions.size() << ENDL  << 
-            "m_spent_keys: " << m_spent_keys.size() << ENDL  << 
-            "m_alternative_chains: " << m_alternative_chains.size() << ENDL  << 
-            "m_outputs: " << m_outputs.size() << ENDL  << 
-            "m_invalid_blocks: " << m_invalid_blocks.size() << ENDL  << 
-            "m_current_block_cumul_sz_limit: " << m_current_block_cumul_sz_limit);
-
-          throw std::runtime_error("Blockchain data corruption");
-        }
+        LOG_ERROR("Blockchain storage data corruption detected. total_count loaded from file = " << total_check_count_loaded << ", expected = " << total_check_count);
+
+        LOG_PRINT_L0("Blockchain storage:" << ENDL << 
+          "m_blocks: " << blocks.size() << ENDL  << 
+          "m_blocks_index: " << blocks_index.size() << ENDL  << 
+          "m_transactions: " << transactions.size() << ENDL  << 
+          "m_spent_keys: " << spent_keys.size() << ENDL  << 
+          "m_alternative_chains: " << m_alternative_chains.size() << ENDL  << 
+          "m_outputs: " << outputs.size() << ENDL  << 
+          "m_invalid_blocks: " << m_invalid_blocks.size() << ENDL  << 
+          "m_current_block_cumul_sz_limit: " << m_current_block_cumul_sz_limit);
+
+        throw std::runtime_error("Blockchain data corruption");
       }
     }
 
-
     LOG_PRINT_L2("Blockchain storage:" << ENDL << 
-        "m_blocks: " << m_blocks.size() << ENDL  << 
-        "m_blocks_index: " << m_blocks_index.size() << ENDL  << 
-        "m_transactions: " << m_transactions.size() << ENDL  << 
-        "m_spent_keys: " << m_spent_keys.size() << ENDL  << 
+        "m_blocks: " << blocks.size() << ENDL  << 
+        "m_blocks_index: " << blocks_index.size() << ENDL  << 
+        "m_transactions: " << transactions.size() << ENDL  << 
+        "m_spent_keys: " << spent_keys.size() << ENDL  << 
         "m_alternative_chains: " << m_alternative_chains.size() << ENDL  << 
-        "m_outputs: " << m_outputs.size() << ENDL  << 
+        "m_outputs: " << outputs.size() << ENDL  << 
         "m_invalid_blocks: " << m_invalid_blocks.size() << ENDL  << 
         "m_current_block_cumul_sz_limit: " << m_current_block_cumul_sz_limit);
+
+    //the indexes are built as the converted blocks are loaded from the block log
+    if(!convert_blocks_to_log(blocks, transactions))
+      throw std::runtime_error("Failed to convert blockchain data");
   }
 
   //------------------------------------------------------------------
   template<class visitor_t>
   bool blockchain_storage::scan_outputkeys_for_indexes(const txin_to_key& tx_in_to_key, visitor_t& vis, uint64_t* pmax_related_block_height)
   {
-    CRITICAL_REGION_LOCAL(m_blockchain_lock);
-    auto it = m_outputs.find(tx_in_to_key.amount);
-    if(it == m_outputs.end() || !tx_in_to_key.key_offsets.size())
+    SHARED_CRITICAL_REGION_LOCAL(m_blockchain_lock);
+    uint64_t outs_count = get_outputs_count(tx_in_to_key.amount);
+    if(!outs_count || !tx_in_to_key.key_offsets.size())
       return false;
 
     std::vector<uint64_t> absolute_offsets = relative_output_offsets_to_absolute(tx_in_to_key.key_offsets);
 
 
-    std::vector<std::pair<crypto::hash, size_t> >& amount_outs_vec = it->second;
     size_t count = 0;
     BOOST_FOREACH(uint64_t i, absolute_offsets)
     {
-      if(i >= amount_outs_vec.size() )
+      const output_index_entry* pout = i < outs_count ? get_output(tx_in_to_key.amount, i) : NULL;
+      if(!pout)
       {
-        LOG_PRINT_L0("Wrong index in transaction inputs: " << i << ", expected maximum " << amount_outs_vec.size() - 1);
+        LOG_PRINT_L0("Wrong index in transaction inputs: " << i << ", expected maximum " << outs_count - 1);
         return false;
       }
-      transactions_container::iterator tx_it = m_transactions.find(amount_outs_vec[i].first);
-      CHECK_AND_ASSERT_MES(tx_it != m_transactions.end(), false, "Wrong transaction id in output indexes: " << epee::string_tools::pod_to_hex(amount_outs_vec[i].first));
-      CHECK_AND_ASSERT_MES(amount_outs_vec[i].second < tx_it->second.tx.vout.size(), false,
-        "Wrong index in transaction outputs: " << amount_outs_vec[i].second << ", expected less then " << tx_it->second.tx.vout.size());
-      if(!vis.handle_output(tx_it->second.tx, tx_it->second.tx.vout[amount_outs_vec[i].second]))
+      const output_index_entry& out = *pout;
+      if(!vis.handle_output(out))
       {
         LOG_PRINT_L0("Failed to handle_output for output no = " << count << ", with absolute offset " << i);
         return false;
       }
       if(count++ == absolute_offsets.size()-1 && pmax_related_block_height)
       {
-        if(*pmax_related_block_height < tx_it->second.m_keeper_block_height)
-          *pmax_related_block_height = tx_it->second.m_keeper_block_height;
+        if(*pmax_related_block_height < out.keeper_block_height)
+          *pmax_related_block_height = out.keeper_block_height;
       }
     }
 
@@ -49,6 +49,8 @@ namespace boost
     void serialize(archive_t & ar, cryptonote::blockchain_storage::block_extended_info& ei, const unsigned int version)
     {
       ar & ei.bl;
+      if(!archive_t::is_saving::value)
+        ei.id = cryptonote::get_block_hash(ei.bl);
       ar & ei.height;
       ar & ei.cumulative_difficulty;
       ar & ei.block_cumulative_size;
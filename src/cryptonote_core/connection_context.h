@@ -33,6 +33,7 @@
 #include <atomic>
 #include "net/net_utils_base.h"
 #include "copyable_atomic.h"
+#include "cryptonote_basic.h"
 
 namespace cryptonote
 {
@@ -54,6 +55,8 @@ namespace cryptonote
     uint64_t m_remote_blockchain_height;
     uint64_t m_last_response_height;
     epee::copyable_atomic m_callback_request_count; //in debug purpose: problem with double callback rise
+    bool m_compact_blocks = false;                  //relay NOTIFY_NEW_COMPACT_BLOCK instead of NOTIFY_NEW_BLOCK
+    crypto::hash m_requested_block_txs = null_hash;  //block whose missing transactions were requested last
     //size_t m_score;  TODO: add score calculations
   };
 
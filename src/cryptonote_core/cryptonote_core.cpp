@@ -222,12 +222,8 @@ namespace cryptonote
     return true;
   }
   //-----------------------------------------------------------------------------------------------
-  bool core::handle_incoming_tx(const blobdata& tx_blob, tx_verification_context& tvc, bool keeped_by_block)
+  bool core::parse_and_check_incoming_tx(const blobdata& tx_blob, transaction& tx, crypto::hash& tx_hash, crypto::hash& tx_prefixt_hash, tx_verification_context& tvc, bool keeped_by_block)
   {
-    tvc = boost::value_initialized<tx_verification_context>();
-    //want to process all transactions sequentially
-    CRITICAL_REGION_LOCAL(m_incoming_tx_lock);
-
     if(tx_blob.size() > get_max_tx_size())
     {
       LOG_PRINT_L1("WRONG TRANSACTION BLOB, too big size " << tx_blob.size() << ", rejected");
@@ -235,9 +231,8 @@ namespace cryptonote
       return false;
     }
 
-    crypto::hash tx_hash = null_hash;
-    crypto::hash tx_prefixt_hash = null_hash;
-    transaction tx;
+    tx_hash = null_hash;
+    tx_prefixt_hash = null_hash;
 
     if(!parse_tx_from_blob(tx, tx_hash, tx_prefixt_hash, tx_blob))
     {
@@ -260,8 +255,12 @@ namespace cryptonote
       tvc.m_verifivation_failed = true;
       return false;
     }
-
-    bool r = add_new_tx(tx, tx_hash, tx_prefixt_hash, tx_blob.size(), tvc, keeped_by_block);
+    return true;
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::add_incoming_tx(const transaction& tx, const crypto::hash& tx_hash, const crypto::hash& tx_prefixt_hash, size_t blob_size, tx_verification_context& tvc, bool keeped_by_block)
+  {
+    bool r = add_new_tx(tx, tx_hash, tx_prefixt_hash, blob_size, tvc, keeped_by_block);
     if(tvc.m_verifivation_failed)
     {LOG_PRINT_RED_L1("Transaction verification failed: " << tx_hash);}
     else if(tvc.m_verifivation_impossible)
@@ -272,6 +271,74 @@ namespace cryptonote
     return r;
   }
   //-----------------------------------------------------------------------------------------------
+  bool core::handle_incoming_tx(const blobdata& tx_blob, tx_verification_context& tvc, bool keeped_by_block)
+  {
+    tvc = boost::value_initialized<tx_verification_context>();
+    //want to process all transactions sequentially
+    CRITICAL_REGION_LOCAL(m_incoming_tx_lock);
+
+    crypto::hash tx_hash = null_hash;
+    crypto::hash tx_prefixt_hash = null_hash;
+    transaction tx;
+    if(!parse_and_check_incoming_tx(tx_blob, tx, tx_hash, tx_prefixt_hash, tvc, keeped_by_block))
+      return false;
+
+    return add_incoming_tx(tx, tx_hash, tx_prefixt_hash, tx_blob.size(), tvc, keeped_by_block);
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::handle_incoming_txs(const std::list<blobdata>& tx_blobs, std::vector<tx_verification_context>& tvcs, bool keeped_by_block)
+  {
+    tvcs.assign(tx_blobs.size(), boost::value_initialized<tx_verification_context>());
+    //want to process all transactions sequentially
+    CRITICAL_REGION_LOCAL(m_incoming_tx_lock);
+
+    //parse and check everything that doesn't need the chain first
+    std::vector<transaction> txs(tx_blobs.size());
+    std::vector<crypto::hash> tx_hashes(tx_blobs.size(), null_hash);
+    std::vector<crypto::hash> tx_prefix_hashes(tx_blobs.size(), null_hash);
+    std::vector<bool> parsed(tx_blobs.size(), false);
+    std::vector<const transaction*> check_txs;
+    std::vector<crypto::hash> check_tx_hashes;
+    std::vector<crypto::hash> check_tx_prefix_hashes;
+    std::vector<size_t> check_positions;
+    size_t i = 0;
+    BOOST_FOREACH(const blobdata& tx_blob, tx_blobs)
+    {
+      parsed[i] = parse_and_check_incoming_tx(tx_blob, txs[i], tx_hashes[i], tx_prefix_hashes[i], tvcs[i], keeped_by_block);
+      if(parsed[i] && !m_mempool.have_tx(tx_hashes[i]) && !m_blockchain_storage.have_tx(tx_hashes[i]))
+      {
+        check_txs.push_back(&txs[i]);
+        check_tx_hashes.push_back(tx_hashes[i]);
+        check_tx_prefix_hashes.push_back(tx_prefix_hashes[i]);
+        check_positions.push_back(i);
+      }
+      ++i;
+    }
+
+    //ring signatures of the whole batch are checked in parallel, add_new_tx then only checks key images of the valid ones
+    std::vector<bool> invalid_signatures;
+    m_blockchain_storage.check_txs_ring_signatures(check_txs, check_tx_hashes, check_tx_prefix_hashes, invalid_signatures);
+    for(size_t j = 0; j != check_positions.size(); j++)
+    {
+      if(!invalid_signatures[j])
+        continue;
+      LOG_PRINT_RED_L1("Transaction verification failed, wrong ring signature: " << tx_hashes[check_positions[j]]);
+      tvcs[check_positions[j]].m_verifivation_failed = true;
+      parsed[check_positions[j]] = false;
+    }
+
+    //admit to the pool in arrival order
+    bool r = true;
+    i = 0;
+    BOOST_FOREACH(const blobdata& tx_blob, tx_blobs)
+    {
+      if(!parsed[i] || !add_incoming_tx(txs[i], tx_hashes[i], tx_prefix_hashes[i], tx_blob.size(), tvcs[i], keeped_by_block))
+        r = false;
+      ++i;
+    }
+    return r;
+  }
+  //-----------------------------------------------------------------------------------------------
   bool core::get_stat_info(core_stat_info& st_inf)
   {
     st_inf.mining_speed = m_miner.get_speed();
@@ -394,7 +461,12 @@ namespace cryptonote
     return m_blockchain_storage.find_blockchain_supplement(qblock_ids, resp);
   }
   //-----------------------------------------------------------------------------------------------
-  bool core::find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<std::pair<block, std::list<transaction> > >& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count)
+  bool core::find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<block_complete_entry>& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count)
+  {
+    return m_blockchain_storage.find_blockchain_supplement(req_start_block, qblock_ids, blocks, total_height, start_height, max_count);
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::find_blockchain_supplement(const uint64_t req_start_block, const std::list<crypto::hash>& qblock_ids, std::list<COMMAND_RPC_GET_BLOCKS_COMPACT::block_entry>& blocks, uint64_t& total_height, uint64_t& start_height, size_t max_count)
   {
     return m_blockchain_storage.find_blockchain_supplement(req_start_block, qblock_ids, blocks, total_height, start_height, max_count);
   }
@@ -540,6 +612,11 @@ namespace cryptonote
     return m_blockchain_storage.have_block(id);
   }
   //-----------------------------------------------------------------------------------------------
+  void core::precompute_blocks_pow(const std::list<block>& blocks)
+  {
+    m_blockchain_storage.precompute_blocks_pow(blocks);
+  }
+  //-----------------------------------------------------------------------------------------------
   bool core::parse_tx_from_blob(transaction& tx, crypto::hash& tx_hash, crypto::hash& tx_prefix_hash, const blobdata& blob)
   {
     return parse_and_validate_tx_from_blob(blob, tx, tx_hash, tx_prefix_hash);
@@ -556,6 +633,16 @@ namespace cryptonote
     return true;
   }
   //-----------------------------------------------------------------------------------------------
+  bool core::get_pool_transaction(const crypto::hash& id, transaction& tx)
+  {
+    return m_mempool.get_transaction(id, tx);
+  }
+  //-----------------------------------------------------------------------------------------------
+  bool core::pool_has_tx(const crypto::hash& id)
+  {
+    return m_mempool.have_tx(id);
+  }
+  //-----------------------------------------------------------------------------------------------
   bool core::get_short_chain_history(std::list<crypto::hash>& ids)
   {
     return m_blockchain_storage.get_short_chain_history(ids);
@@ -607,6 +694,7 @@ namespace cryptonote
     }
 
     m_store_blockchain_interval.do_call(boost::bind(&blockchain_storage::store_blockchain, &m_blockchain_storage));
+    m_blockchain_storage.on_idle();
     m_miner.on_idle();
     m_mempool.on_idle();
     return true;
@@ -544,9 +544,11 @@ namespace cryptonote
   bool is_out_to_acc(const account_keys& acc, const txout_to_key& out_key, const crypto::public_key& tx_pub_key, size_t output_index)
   {
     crypto::key_derivation derivation;
-    generate_key_derivation(tx_pub_key, acc.m_view_secret_key, derivation);
+    if(!generate_key_derivation(tx_pub_key, acc.m_view_secret_key, derivation))
+      return false;
     crypto::public_key pk;
-    derive_public_key(derivation, output_index, acc.m_account_address.m_spend_public_key, pk);
+    if(!derive_public_key(derivation, output_index, acc.m_account_address.m_spend_public_key, pk))
+      return false;
     return pk == out_key.key;
   }
   //---------------------------------------------------------------
@@ -561,16 +563,39 @@ namespace cryptonote
   bool lookup_acc_outs(const account_keys& acc, const transaction& tx, const crypto::public_key& tx_pub_key, std::vector<size_t>& outs, uint64_t& money_transfered)
   {
     money_transfered = 0;
-    size_t i = 0;
+    std::vector<crypto::public_key> out_keys;
+    out_keys.reserve(tx.vout.size());
     BOOST_FOREACH(const tx_out& o,  tx.vout)
     {
       CHECK_AND_ASSERT_MES(o.target.type() ==  typeid(txout_to_key), false, "wrong type id in transaction out" );
-      if(is_out_to_acc(acc, boost::get<txout_to_key>(o.target), tx_pub_key, i))
-      {
+      out_keys.push_back(boost::get<txout_to_key>(o.target).key);
+    }
+    size_t first_out = outs.size();
+    //a key the derivation fails on pays nobody, the transaction just has no outputs to the account
+    if(!find_outs_to_acc(acc, tx_pub_key, out_keys, outs))
+    {
+      LOG_PRINT_L1("Failed to derive output keys with transaction public key " << tx_pub_key);
+      return true;
+    }
+    for(size_t i = first_out; i < outs.size(); ++i)
+      money_transfered += tx.vout[outs[i]].amount;
+    return true;
+  }
+  //---------------------------------------------------------------
+  bool find_outs_to_acc(const account_keys& acc, const crypto::public_key& tx_pub_key, const std::vector<crypto::public_key>& out_keys, std::vector<size_t>& outs)
+  {
+    if(out_keys.empty())
+      return true;
+    crypto::key_derivation derivation;
+    if(!generate_key_derivation(tx_pub_key, acc.m_view_secret_key, derivation))
+      return false;
+    std::vector<crypto::public_key> derived_keys(out_keys.size());
+    if(!derive_public_keys(derivation, derived_keys.size(), acc.m_account_address.m_spend_public_key, derived_keys.data()))
+      return false;
+    for(size_t i = 0; i < out_keys.size(); ++i)
+    {
+      if(derived_keys[i] == out_keys[i])
         outs.push_back(i);
-        money_transfered += o.amount;
-      }
-      i++;
     }
     return true;
   }
@@ -626,6 +651,16 @@ namespace cryptonote
     return blob;
   }
   //---------------------------------------------------------------
+  blobdata get_block_hashing_blob(const block_header& header, const std::vector<crypto::hash>& tx_hashes)
+  {
+    // tx_hashes start with the miner transaction's
+    blobdata blob = t_serializable_object_to_blob(header);
+    crypto::hash tree_root_hash = get_tx_tree_hash(tx_hashes);
+    blob.append(reinterpret_cast<const char*>(&tree_root_hash), sizeof(tree_root_hash));
+    blob.append(tools::get_varint_data(tx_hashes.size()));
+    return blob;
+  }
+  //---------------------------------------------------------------
   bool get_block_hash(const block& b, crypto::hash& res)
   {
     // EXCEPTION FOR BLOCK 202612
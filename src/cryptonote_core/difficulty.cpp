@@ -119,6 +119,31 @@ namespace cryptonote {
     return !carry;
   }
 
+  static void get_cut_bounds(size_t length, size_t& cut_begin, size_t& cut_end) {
+    static_assert(2 * DIFFICULTY_CUT <= DIFFICULTY_WINDOW - 2, "Cut length is too large");
+    if (length <= DIFFICULTY_WINDOW - 2 * DIFFICULTY_CUT) {
+      cut_begin = 0;
+      cut_end = length;
+    } else {
+      cut_begin = (length - (DIFFICULTY_WINDOW - 2 * DIFFICULTY_CUT) + 1) / 2;
+      cut_end = cut_begin + (DIFFICULTY_WINDOW - 2 * DIFFICULTY_CUT);
+    }
+    assert(/*cut_begin >= 0 &&*/ cut_begin + 2 <= cut_end && cut_end <= length);
+  }
+
+  static difficulty_type get_difficulty(uint64_t time_span, difficulty_type total_work, size_t target_seconds) {
+    if (time_span == 0) {
+      time_span = 1;
+    }
+    assert(total_work > 0);
+    uint64_t low, high;
+    mul(total_work, target_seconds, low, high);
+    if (high != 0 || low + time_span - 1 < low) {
+      return 0;
+    }
+    return (low + time_span - 1) / time_span;
+  }
+
   difficulty_type next_difficulty(vector<uint64_t> timestamps, vector<difficulty_type> cumulative_difficulties, size_t target_seconds) {
     //cutoff DIFFICULTY_LAG
     if(timestamps.size() > DIFFICULTY_WINDOW)
@@ -137,31 +162,83 @@ namespace cryptonote {
     assert(length <= DIFFICULTY_WINDOW);
     sort(timestamps.begin(), timestamps.end());
     size_t cut_begin, cut_end;
-    static_assert(2 * DIFFICULTY_CUT <= DIFFICULTY_WINDOW - 2, "Cut length is too large");
-    if (length <= DIFFICULTY_WINDOW - 2 * DIFFICULTY_CUT) {
-      cut_begin = 0;
-      cut_end = length;
-    } else {
-      cut_begin = (length - (DIFFICULTY_WINDOW - 2 * DIFFICULTY_CUT) + 1) / 2;
-      cut_end = cut_begin + (DIFFICULTY_WINDOW - 2 * DIFFICULTY_CUT);
-    }
-    assert(/*cut_begin >= 0 &&*/ cut_begin + 2 <= cut_end && cut_end <= length);
+    get_cut_bounds(length, cut_begin, cut_end);
     uint64_t time_span = timestamps[cut_end - 1] - timestamps[cut_begin];
-    if (time_span == 0) {
-      time_span = 1;
-    }
     difficulty_type total_work = cumulative_difficulties[cut_end - 1] - cumulative_difficulties[cut_begin];
-    assert(total_work > 0);
-    uint64_t low, high;
-    mul(total_work, target_seconds, low, high);
-    if (high != 0 || low + time_span - 1 < low) {
-      return 0;
-    }
-    return (low + time_span - 1) / time_span;
+    return get_difficulty(time_span, total_work, target_seconds);
   }
 
   difficulty_type next_difficulty(vector<uint64_t> timestamps, vector<difficulty_type> cumulative_difficulties)
   {
     return next_difficulty(std::move(timestamps), std::move(cumulative_difficulties), DIFFICULTY_TARGET);
   }
+  //-----------------------------------------------------------------------------------------------
+  difficulty_window::difficulty_window() {
+    m_sorted_timestamps.reserve(DIFFICULTY_WINDOW + 1);
+  }
+  //-----------------------------------------------------------------------------------------------
+  void difficulty_window::clear() {
+    m_timestamps.clear();
+    m_cumulative_difficulties.clear();
+    m_sorted_timestamps.clear();
+  }
+  //-----------------------------------------------------------------------------------------------
+  void difficulty_window::push_back(uint64_t timestamp, difficulty_type cumulative_difficulty) {
+    m_timestamps.push_back(timestamp);
+    m_cumulative_difficulties.push_back(cumulative_difficulty);
+    if (m_timestamps.size() <= DIFFICULTY_WINDOW) {
+      m_sorted_timestamps.insert(upper_bound(m_sorted_timestamps.begin(), m_sorted_timestamps.end(), timestamp), timestamp);
+    }
+    if (m_timestamps.size() > DIFFICULTY_BLOCKS_COUNT) {
+      pop_front();
+    }
+  }
+  //-----------------------------------------------------------------------------------------------
+  void difficulty_window::pop_back() {
+    assert(!m_timestamps.empty());
+    if (m_timestamps.size() <= DIFFICULTY_WINDOW) {
+      m_sorted_timestamps.erase(lower_bound(m_sorted_timestamps.begin(), m_sorted_timestamps.end(), m_timestamps.back()));
+    }
+    m_timestamps.pop_back();
+    m_cumulative_difficulties.pop_back();
+  }
+  //-----------------------------------------------------------------------------------------------
+  void difficulty_window::push_front(uint64_t timestamp, difficulty_type cumulative_difficulty) {
+    assert(m_timestamps.size() < DIFFICULTY_BLOCKS_COUNT);
+    m_timestamps.push_front(timestamp);
+    m_cumulative_difficulties.push_front(cumulative_difficulty);
+    m_sorted_timestamps.insert(upper_bound(m_sorted_timestamps.begin(), m_sorted_timestamps.end(), timestamp), timestamp);
+    if (m_timestamps.size() > DIFFICULTY_WINDOW) {
+      // the block at the end of the window moves to the lag
+      m_sorted_timestamps.erase(lower_bound(m_sorted_timestamps.begin(), m_sorted_timestamps.end(), m_timestamps[DIFFICULTY_WINDOW]));
+    }
+  }
+  //-----------------------------------------------------------------------------------------------
+  void difficulty_window::pop_front() {
+    m_sorted_timestamps.erase(lower_bound(m_sorted_timestamps.begin(), m_sorted_timestamps.end(), m_timestamps.front()));
+    m_timestamps.pop_front();
+    m_cumulative_difficulties.pop_front();
+    if (m_timestamps.size() >= DIFFICULTY_WINDOW) {
+      // the oldest block of the lag moves to the window
+      uint64_t timestamp = m_timestamps[DIFFICULTY_WINDOW - 1];
+      m_sorted_timestamps.insert(upper_bound(m_sorted_timestamps.begin(), m_sorted_timestamps.end(), timestamp), timestamp);
+    }
+  }
+  //-----------------------------------------------------------------------------------------------
+  difficulty_type difficulty_window::next_difficulty(size_t target_seconds) const {
+    size_t length = m_sorted_timestamps.size();
+    assert(length == std::min(m_timestamps.size(), (size_t) DIFFICULTY_WINDOW));
+    if (length <= 1) {
+      return 1;
+    }
+    size_t cut_begin, cut_end;
+    get_cut_bounds(length, cut_begin, cut_end);
+    uint64_t time_span = m_sorted_timestamps[cut_end - 1] - m_sorted_timestamps[cut_begin];
+    difficulty_type total_work = m_cumulative_difficulties[cut_end - 1] - m_cumulative_difficulties[cut_begin];
+    return get_difficulty(time_span, total_work, target_seconds);
+  }
+  //-----------------------------------------------------------------------------------------------
+  difficulty_type difficulty_window::next_difficulty() const {
+    return next_difficulty(DIFFICULTY_TARGET);
+  }
 }
@@ -31,6 +31,7 @@
 #pragma once
 
 #include <cstdint>
+#include <deque>
 #include <vector>
 
 #include "crypto/hash.h"
@@ -42,4 +43,33 @@ namespace cryptonote
     bool check_hash(const crypto::hash &hash, difficulty_type difficulty);
     difficulty_type next_difficulty(std::vector<std::uint64_t> timestamps, std::vector<difficulty_type> cumulative_difficulties);
     difficulty_type next_difficulty(std::vector<std::uint64_t> timestamps, std::vector<difficulty_type> cumulative_difficulties, size_t target_seconds);
+
+    /************************************************************************/
+    /* Last DIFFICULTY_BLOCKS_COUNT blocks of a chain, kept up to date as   */
+    /* blocks are pushed and popped, so that next_difficulty() doesn't have */
+    /* to collect and sort the timestamps again for every block             */
+    /************************************************************************/
+    class difficulty_window
+    {
+    public:
+      difficulty_window();
+
+      void clear();
+      size_t size() const { return m_timestamps.size(); }
+      // appends the newest block, dropping the oldest one once the window is full
+      void push_back(std::uint64_t timestamp, difficulty_type cumulative_difficulty);
+      void pop_back();
+      // prepends the block preceding the oldest one, to refill the window after pop_back()
+      void push_front(std::uint64_t timestamp, difficulty_type cumulative_difficulty);
+      // same as next_difficulty() called with the contents of the window
+      difficulty_type next_difficulty(size_t target_seconds) const;
+      difficulty_type next_difficulty() const;
+
+    private:
+      void pop_front();
+
+      std::deque<std::uint64_t> m_timestamps;                // in chain order
+      std::deque<difficulty_type> m_cumulative_difficulties; // in chain order
+      std::vector<std::uint64_t> m_sorted_timestamps;        // sorted timestamps of the first DIFFICULTY_WINDOW blocks, the rest is the lag
+    };
 }
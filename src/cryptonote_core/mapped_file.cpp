@@ -0,0 +1,118 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <algorithm>
+#include <fstream>
+#include <boost/filesystem.hpp>
+
+#include "include_base_utils.h"
+#include "mapped_file.h"
+
+using namespace cryptonote;
+
+//------------------------------------------------------------------
+mapped_file::mapped_file():m_capacity(0), m_read_only(false)
+{
+}
+//------------------------------------------------------------------
+bool mapped_file::open(const std::string& path, uint64_t min_capacity, bool read_only)
+{
+  TRY_ENTRY();
+  close();
+  m_path = path;
+  m_read_only = read_only;
+  if(m_read_only)
+  {
+    CHECK_AND_ASSERT_MES(boost::filesystem::exists(m_path), false, "File " << m_path << " doesn't exist");
+    m_capacity = boost::filesystem::file_size(m_path);
+    CHECK_AND_ASSERT_MES(m_capacity >= min_capacity, false, "File " << m_path << " is too small");
+    return map();
+  }
+  if(!boost::filesystem::exists(m_path))
+  {
+    std::ofstream f(m_path, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+    CHECK_AND_ASSERT_MES(!f.fail(), false, "Failed to create file " << m_path);
+  }
+  m_capacity = boost::filesystem::file_size(m_path);
+  if(m_capacity < min_capacity)
+  {
+    boost::filesystem::resize_file(m_path, min_capacity);
+    m_capacity = min_capacity;
+  }
+  return map();
+  CATCH_ENTRY_L0("mapped_file::open", false);
+}
+//------------------------------------------------------------------
+bool mapped_file::map()
+{
+  TRY_ENTRY();
+  boost::interprocess::mode_t mode = m_read_only ? boost::interprocess::read_only : boost::interprocess::read_write;
+  m_mapping.reset(new boost::interprocess::file_mapping(m_path.c_str(), mode));
+  m_region.reset(new boost::interprocess::mapped_region(*m_mapping, mode, 0, m_capacity));
+  return true;
+  CATCH_ENTRY_L0("mapped_file::map", false);
+}
+//------------------------------------------------------------------
+void mapped_file::close()
+{
+  m_region.reset();
+  m_mapping.reset();
+  m_capacity = 0;
+}
+//------------------------------------------------------------------
+bool mapped_file::reserve(uint64_t capacity)
+{
+  if(capacity <= m_capacity)
+    return true;
+  CHECK_AND_ASSERT_MES(!m_read_only, false, "File " << m_path << " is open read-only");
+
+  TRY_ENTRY();
+  uint64_t new_capacity = std::max(capacity, m_capacity * 2);
+  m_region.reset();
+  m_mapping.reset();
+  boost::filesystem::resize_file(m_path, new_capacity);
+  m_capacity = new_capacity;
+  return map();
+  CATCH_ENTRY_L0("mapped_file::reserve", false);
+}
+//------------------------------------------------------------------
+bool mapped_file::flush()
+{
+  if(!m_region || m_read_only)
+    return true;
+  return m_region->flush(0, 0, false);
+}
+//------------------------------------------------------------------
+bool mapped_file::flush(uint64_t offset, uint64_t size)
+{
+  if(!m_region || m_read_only || !size)
+    return true;
+  CHECK_AND_ASSERT_MES(offset < m_capacity && size <= m_capacity - offset, false, "Range " << offset << "+" << size << " is out of file " << m_path);
+  return m_region->flush(offset, size, false);
+}
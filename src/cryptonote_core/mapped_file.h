@@ -0,0 +1,67 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace cryptonote
+{
+  /************************************************************************/
+  /* File mapped as a whole; grows geometrically so appends rarely remap. */
+  /************************************************************************/
+  class mapped_file
+  {
+  public:
+    mapped_file();
+    bool open(const std::string& path, uint64_t min_capacity, bool read_only);
+    void close();
+    bool is_open() const { return m_region != nullptr; }
+    bool reserve(uint64_t capacity);
+    bool flush();
+    // writes back the pages holding [offset, offset + size) before returning
+    bool flush(uint64_t offset, uint64_t size);
+    uint64_t capacity() const { return m_capacity; }
+    char* data() const { return static_cast<char*>(m_region->get_address()); }
+    const std::string& path() const { return m_path; }
+
+  private:
+    bool map();
+
+    std::string m_path;
+    uint64_t m_capacity;
+    bool m_read_only;
+    std::unique_ptr<boost::interprocess::file_mapping> m_mapping;
+    std::unique_ptr<boost::interprocess::mapped_region> m_region;
+  };
+}
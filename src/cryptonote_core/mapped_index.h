@@ -0,0 +1,283 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <boost/filesystem.hpp>
+
+#include "include_base_utils.h"
+#include "common/util.h"
+#include "mapped_file.h"
+
+namespace cryptonote
+{
+  // first bytes of every index file; items are kept in host byte order, a file written
+  // on another platform or by a build with other item layouts doesn't match and is rejected
+  struct mapped_index_header
+  {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t item_size;
+    uint64_t count;
+    uint64_t capacity;
+  };
+
+  const uint64_t MAPPED_INDEX_MAGIC = 0x7865646e6970616dULL; // "mapindex"
+  const uint64_t MAPPED_INDEX_VERSION = 1;
+  const uint64_t MAPPED_INDEX_INITIAL_CAPACITY = 1024;
+
+  // a new file is made with room for capacity items, unless it is opened read-only
+  inline bool open_mapped_index(mapped_file& file, const std::string& path, uint64_t item_size, uint64_t capacity = MAPPED_INDEX_INITIAL_CAPACITY, bool read_only = false)
+  {
+    bool r = file.open(path, sizeof(mapped_index_header) + (read_only ? 0 : capacity * item_size), read_only);
+    CHECK_AND_ASSERT_MES(r, false, "Failed to open index file " << path);
+    mapped_index_header& h = *reinterpret_cast<mapped_index_header*>(file.data());
+    if(0 == h.magic && !read_only)
+    {
+      h.magic = MAPPED_INDEX_MAGIC;
+      h.version = MAPPED_INDEX_VERSION;
+      h.item_size = item_size;
+      h.count = 0;
+      h.capacity = capacity;
+    }
+    r = h.magic == MAPPED_INDEX_MAGIC && h.version == MAPPED_INDEX_VERSION && h.item_size == item_size;
+    CHECK_AND_ASSERT_MES(r, false, "Index file " << path << " was written by another version or platform");
+    r = h.count <= h.capacity && h.capacity <= (file.capacity() - sizeof(mapped_index_header)) / item_size;
+    CHECK_AND_ASSERT_MES(r, false, "Index file " << path << " is corrupted");
+    return true;
+  }
+
+  /************************************************************************/
+  /* Vector of trivially copyable items kept in a memory mapped file.     */
+  /************************************************************************/
+  template<class T>
+  class mapped_array
+  {
+  public:
+    bool open(const std::string& path) { return open_mapped_index(m_file, path, sizeof(T)); }
+    // only for reading, fails if there is no such file
+    bool open_read_only(const std::string& path) { return open_mapped_index(m_file, path, sizeof(T), 0, true); }
+    void close() { m_file.close(); }
+    bool flush() { return m_file.flush(); }
+
+    bool is_open() const { return m_file.is_open(); }
+    uint64_t size() const { return is_open() ? header().count : 0; }
+    bool empty() const { return !size(); }
+    const T& operator[](uint64_t i) const { return items()[i]; }
+    T& operator[](uint64_t i) { return items()[i]; }
+    const T& back() const { return items()[size() - 1]; }
+
+    bool push_back(const T& item)
+    {
+      uint64_t count = size();
+      if(count == header().capacity)
+      {
+        bool r = m_file.reserve(sizeof(mapped_index_header) + 2 * count * sizeof(T));
+        CHECK_AND_ASSERT_MES(r, false, "Failed to grow index file " << m_file.path() << " to " << 2 * count << " items");
+        header().capacity = (m_file.capacity() - sizeof(mapped_index_header)) / sizeof(T);
+      }
+      items()[count] = item;
+      header().count = count + 1;
+      return true;
+    }
+    void pop_back() { --header().count; }
+    void resize_down(uint64_t count) { if(count < size()) header().count = count; }
+
+    // items added by growing are left as the file has them
+    bool resize(uint64_t count)
+    {
+      if(count > header().capacity)
+      {
+        uint64_t capacity = std::max(count, 2 * header().capacity);
+        bool r = m_file.reserve(sizeof(mapped_index_header) + capacity * sizeof(T));
+        CHECK_AND_ASSERT_MES(r, false, "Failed to grow index file " << m_file.path() << " to " << capacity << " items");
+        header().capacity = (m_file.capacity() - sizeof(mapped_index_header)) / sizeof(T);
+      }
+      header().count = count;
+      return true;
+    }
+    void clear() { header().count = 0; }
+
+  private:
+    mapped_index_header& header() const { return *reinterpret_cast<mapped_index_header*>(m_file.data()); }
+    T* items() const { return reinterpret_cast<T*>(m_file.data() + sizeof(mapped_index_header)); }
+
+    mapped_file m_file;
+  };
+
+  /************************************************************************/
+  /* Hash table of trivially copyable keys and values kept in a memory    */
+  /* mapped file: open addressing with linear probing, a power of two of  */
+  /* slots, rebuilt twice as large in a new file at 3/4 load. Pointers    */
+  /* returned by find() are invalidated by insert().                      */
+  /************************************************************************/
+  template<class K, class V, class H = std::hash<K>>
+  class mapped_hash_table
+  {
+  public:
+    bool open(const std::string& path) { return open(path, MAPPED_INDEX_INITIAL_CAPACITY); }
+    // only for lookups, fails if there is no such file
+    bool open_read_only(const std::string& path) { return open(path, 0, true); }
+    void close() { m_file.close(); }
+    bool flush() { return m_file.flush(); }
+
+    bool is_open() const { return m_file.is_open(); }
+    uint64_t size() const { return is_open() ? header().count : 0; }
+
+    const V* find(const K& key) const
+    {
+      const slot* s = find_slot(key);
+      return s->used ? &s->value : nullptr;
+    }
+    V* find(const K& key)
+    {
+      slot* s = find_slot(key);
+      return s->used ? &s->value : nullptr;
+    }
+    bool count(const K& key) const { return nullptr != find(key); }
+
+    // fails if the key is already there
+    bool insert(const K& key, const V& value)
+    {
+      if(4 * (size() + 1) > 3 * header().capacity && !grow())
+        return false;
+      slot* s = find_slot(key);
+      if(s->used)
+        return false;
+      s->key = key;
+      s->value = value;
+      s->used = 1;
+      ++header().count;
+      return true;
+    }
+
+    bool erase(const K& key)
+    {
+      slot* s = find_slot(key);
+      if(!s->used)
+        return false;
+      //move back the following slots which probed past the freed one, so no probe sequence is broken
+      const uint64_t mask = header().capacity - 1;
+      uint64_t i = s - slots();
+      for(uint64_t j = (i + 1) & mask; slots()[j].used; j = (j + 1) & mask)
+      {
+        uint64_t home = bucket(slots()[j].key);
+        if(((j - home) & mask) >= ((j - i) & mask))
+        {
+          slots()[i] = slots()[j];
+          i = j;
+        }
+      }
+      memset(&slots()[i], 0, sizeof(slot));
+      --header().count;
+      return true;
+    }
+
+    void clear()
+    {
+      memset(slots(), 0, header().capacity * sizeof(slot));
+      header().count = 0;
+    }
+
+    template<class F>
+    void for_each(F f) const
+    {
+      for(uint64_t i = 0; i != header().capacity; ++i)
+        if(slots()[i].used)
+          f(slots()[i].key, slots()[i].value);
+    }
+
+  private:
+    struct slot
+    {
+      K key;
+      V value;
+      uint64_t used;
+    };
+
+    bool open(const std::string& path, uint64_t capacity, bool read_only = false)
+    {
+      if(!open_mapped_index(m_file, path, sizeof(slot), capacity, read_only))
+        return false;
+      CHECK_AND_ASSERT_MES(header().capacity && !(header().capacity & (header().capacity - 1)), false, "Index file " << path << " is corrupted");
+      return true;
+    }
+
+    mapped_index_header& header() const { return *reinterpret_cast<mapped_index_header*>(m_file.data()); }
+    slot* slots() const { return reinterpret_cast<slot*>(m_file.data() + sizeof(mapped_index_header)); }
+
+    uint64_t bucket(const K& key) const
+    {
+      //std::hash of an integer is the integer itself, spread it over all bits
+      uint64_t x = H()(key);
+      x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+      return (x ^ (x >> 31)) & (header().capacity - 1);
+    }
+
+    // the slot holding the key or the empty one where it would go
+    slot* find_slot(const K& key) const
+    {
+      const uint64_t mask = header().capacity - 1;
+      uint64_t i = bucket(key);
+      while(slots()[i].used && !(slots()[i].key == key))
+        i = (i + 1) & mask;
+      return &slots()[i];
+    }
+
+    bool grow()
+    {
+      const std::string path = m_file.path();
+      const std::string grown_path = path + ".tmp";
+      boost::system::error_code ec;
+      boost::filesystem::remove(grown_path, ec);
+      {
+        mapped_hash_table grown;
+        bool r = grown.open(grown_path, 2 * header().capacity);
+        CHECK_AND_ASSERT_MES(r, false, "Failed to create index file " << grown_path);
+        for_each([&grown](const K& key, const V& value) { grown.insert(key, value); });
+      }
+      m_file.close();
+      std::error_code replace_ec = tools::replace_file(grown_path, path);
+      if(replace_ec)
+      {
+        LOG_ERROR("Failed to replace index file " << path << " with " << grown_path << ": " << replace_ec.message());
+        open(path);
+        return false;
+      }
+      return open(path);
+    }
+
+    mapped_file m_file;
+  };
+}
@@ -48,6 +48,10 @@ using namespace epee;
 #include "miner.h"
 
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
 extern "C" void slow_hash_allocate_state();
 extern "C" void slow_hash_free_state();
 namespace cryptonote
@@ -58,6 +62,8 @@ namespace cryptonote
     const command_line::arg_descriptor<std::string> arg_extra_messages =  {"extra-messages-file", "Specify file for extra messages to include into coinbase transactions", "", true};
     const command_line::arg_descriptor<std::string> arg_start_mining =    {"start-mining", "Specify wallet address to mining for", "", true};
     const command_line::arg_descriptor<uint32_t>      arg_mining_threads =  {"mining-threads", "Specify mining threads count", 0, true};
+
+    const size_t cn_scratchpad_size = 1 << 21;
   }
 
 
@@ -336,6 +342,24 @@ namespace cryptonote
       LOG_PRINT_L2("MINING RESUMED");
   }
   //-----------------------------------------------------------------------------------------------------
+  size_t miner::get_hashes_per_round() const
+  {
+    //every hash in flight needs its own scratchpad, only interleave as many as fit this thread's share of the cache
+    long cache_size = 0;
+#if defined(_SC_LEVEL3_CACHE_SIZE)
+    cache_size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if(cache_size <= 0)
+      cache_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    if(cache_size <= 0)
+      return 1;
+    size_t per_thread = static_cast<size_t>(cache_size) / std::max<uint32_t>(static_cast<uint32_t>(m_threads_total), 1);
+    size_t ways = per_thread / cn_scratchpad_size;
+    if(ways >= CN_SLOW_HASH_MAX_WAYS)
+      return CN_SLOW_HASH_MAX_WAYS;
+    return ways >= 2 ? 2 : 1;
+  }
+  //-----------------------------------------------------------------------------------------------------
   bool miner::worker_thread()
   {
     uint32_t th_local_index = boost::interprocess::ipcdetail::atomic_inc32(&m_thread_index);
@@ -346,6 +370,12 @@ namespace cryptonote
     difficulty_type local_diff = 0;
     uint32_t local_template_ver = 0;
     block b;
+    size_t ways = get_hashes_per_round();
+    LOG_PRINT_L1("Hashing " << ways << " nonce(s) per round");
+    blobdata blobs[CN_SLOW_HASH_MAX_WAYS];
+    const void* blob_ptrs[CN_SLOW_HASH_MAX_WAYS];
+    crypto::hash hashes[CN_SLOW_HASH_MAX_WAYS];
+    char* hash_ptrs[CN_SLOW_HASH_MAX_WAYS];
 	  slow_hash_allocate_state();
     while(!m_stop)
     {
@@ -374,13 +404,34 @@ namespace cryptonote
         continue;
       }
 
-      b.nonce = nonce;
-      crypto::hash h;
-      get_block_longhash(b, h, height);
+      //hash several nonces of this thread at once, their scratchpads are worked on interleaved
+      //cn_slow_hash_multi knows nothing of the block 202612 workaround, so leave that height to get_block_longhash
+      if(ways == 1 || height == 202612)
+      {
+        for(size_t i = 0; i != ways; i++)
+        {
+          b.nonce = nonce + static_cast<uint32_t>(i) * m_threads_total;
+          get_block_longhash(b, hashes[i], height);
+        }
+      }
+      else
+      {
+        for(size_t i = 0; i != ways; i++)
+        {
+          b.nonce = nonce + static_cast<uint32_t>(i) * m_threads_total;
+          blobs[i] = get_block_hashing_blob(b);
+          blob_ptrs[i] = blobs[i].data();
+          hash_ptrs[i] = reinterpret_cast<char*>(&hashes[i]);
+        }
+        crypto::cn_slow_hash_multi(blob_ptrs, blobs[0].size(), hash_ptrs, ways);
+      }
 
-      if(check_hash(h, local_diff))
+      for(size_t i = 0; i != ways; i++)
       {
+        if(!check_hash(hashes[i], local_diff))
+          continue;
         //we lucky!
+        b.nonce = nonce + static_cast<uint32_t>(i) * m_threads_total;
         ++m_config.current_extra_message_index;
         LOG_PRINT_GREEN("Found block for difficulty: " << local_diff, LOG_LEVEL_0);
         if(!m_phandler->handle_block_found(b))
@@ -391,9 +442,10 @@ namespace cryptonote
           //success update, lets update config
           epee::serialization::store_t_to_json_file(m_config, m_config_folder_path + "/" + MINER_CONFIG_FILE_NAME);
         }
+        break;
       }
-      nonce+=m_threads_total;
-      ++m_hashes;
+      nonce+=static_cast<uint32_t>(ways) * m_threads_total;
+      m_hashes += ways;
     }
 	  slow_hash_free_state();
     LOG_PRINT_L0("Miner thread stopped ["<< th_local_index << "]");
@@ -77,6 +77,7 @@ namespace cryptonote
 
   private:
     bool worker_thread();
+    size_t get_hashes_per_round() const;
     bool request_block_template();
     void  merge_hr();
     
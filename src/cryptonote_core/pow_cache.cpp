@@ -0,0 +1,88 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "include_base_utils.h"
+#include "cryptonote_format_utils.h"
+#include "pow_cache.h"
+
+namespace cryptonote
+{
+  //---------------------------------------------------------------------------------
+  pow_cache::pow_cache(size_t max_size): m_max_size(max_size)
+  {
+  }
+  //---------------------------------------------------------------------------------
+  bool pow_cache::have(const crypto::hash& id)
+  {
+    CRITICAL_REGION_LOCAL(m_lock);
+    return m_entries.count(id) != 0;
+  }
+  //---------------------------------------------------------------------------------
+  void pow_cache::add(const crypto::hash& id, uint64_t height, const crypto::hash& proof_of_work)
+  {
+    CRITICAL_REGION_LOCAL(m_lock);
+    auto r = m_entries.insert(std::make_pair(id, entry()));
+    entry& e = r.first->second;
+    if(r.second)
+    {
+      //the spans buffered first are added first, their entries are the ones needed soonest
+      e.order_it = m_entries_order.insert(m_entries_order.end(), id);
+      if(m_entries.size() > m_max_size)
+      {
+        m_entries.erase(m_entries_order.front());
+        m_entries_order.pop_front();
+      }
+    }
+    e.height = height;
+    e.proof_of_work = proof_of_work;
+  }
+  //---------------------------------------------------------------------------------
+  crypto::hash pow_cache::get(const block& bl, const crypto::hash& id, uint64_t height)
+  {
+    {
+      CRITICAL_REGION_LOCAL(m_lock);
+      auto it = m_entries.find(id);
+      if(it != m_entries.end())
+      {
+        bool usable = it->second.height == height;
+        crypto::hash proof_of_work = it->second.proof_of_work;
+        m_entries_order.erase(it->second.order_it);
+        m_entries.erase(it);
+        if(usable)
+          return proof_of_work;
+      }
+    }
+    return get_block_longhash(bl, height);
+  }
+  //---------------------------------------------------------------------------------
+  size_t pow_cache::size()
+  {
+    CRITICAL_REGION_LOCAL(m_lock);
+    return m_entries.size();
+  }
+}
@@ -0,0 +1,70 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+
+#include "syncobj.h"
+#include "crypto/hash.h"
+#include "cryptonote_basic.h"
+
+namespace cryptonote
+{
+  /************************************************************************/
+  /* Proofs of work computed ahead for downloaded blocks, by block id.    */
+  /* An entry is used once, and only for the height it was computed for; */
+  /* past its size, the cache drops its oldest entries first.             */
+  /************************************************************************/
+  class pow_cache
+  {
+  public:
+    pow_cache(size_t max_size);
+
+    bool have(const crypto::hash& id);
+    void add(const crypto::hash& id, uint64_t height, const crypto::hash& proof_of_work);
+    //! Takes the cached proof of work of bl at height, or computes it if there is none
+    crypto::hash get(const block& bl, const crypto::hash& id, uint64_t height);
+    size_t size();
+
+  private:
+    struct entry
+    {
+      uint64_t height;
+      crypto::hash proof_of_work;
+      std::list<crypto::hash>::iterator order_it;
+    };
+
+    std::unordered_map<crypto::hash, entry> m_entries;
+    std::list<crypto::hash> m_entries_order; // oldest first, the first to go when the cache is full
+    size_t m_max_size;
+    epee::critical_section m_lock;
+  };
+}
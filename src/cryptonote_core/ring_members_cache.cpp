@@ -0,0 +1,83 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#include "include_base_utils.h"
+#include "ring_members_cache.h"
+
+namespace cryptonote
+{
+  //---------------------------------------------------------------------------------
+  ring_members_cache::ring_members_cache(size_t max_size): m_max_size(max_size)
+  {
+  }
+  //---------------------------------------------------------------------------------
+  bool ring_members_cache::find(const crypto::public_key& key, crypto::public_key_precomp& precomp)
+  {
+    CRITICAL_REGION_LOCAL(m_lock);
+    auto it = m_entries.find(key);
+    if(it == m_entries.end())
+      return false;
+    m_uses.splice(m_uses.end(), m_uses, it->second.use_it);
+    precomp = it->second.precomp;
+    return true;
+  }
+  //---------------------------------------------------------------------------------
+  void ring_members_cache::add(const crypto::public_key* keys, const crypto::public_key_precomp* precomps, size_t count)
+  {
+    CRITICAL_REGION_LOCAL(m_lock);
+    for(size_t i = 0; i != count; i++)
+    {
+      auto r = m_entries.insert(std::make_pair(keys[i], entry()));
+      if(r.second)
+        r.first->second.use_it = m_uses.insert(m_uses.end(), keys[i]);
+      else
+        m_uses.splice(m_uses.end(), m_uses, r.first->second.use_it);
+      r.first->second.precomp = precomps[i];
+    }
+    while(m_entries.size() > m_max_size)
+    {
+      m_entries.erase(m_uses.front());
+      m_uses.pop_front();
+    }
+  }
+  //---------------------------------------------------------------------------------
+  bool ring_members_cache::get(const crypto::public_key& key, crypto::public_key_precomp& precomp)
+  {
+    if(find(key, precomp))
+      return true;
+    if(!crypto::precompute_public_key(key, precomp))
+      return false;
+    add(&key, &precomp, 1);
+    return true;
+  }
+  //---------------------------------------------------------------------------------
+  size_t ring_members_cache::size()
+  {
+    CRITICAL_REGION_LOCAL(m_lock);
+    return m_entries.size();
+  }
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+
+#include "syncobj.h"
+#include "crypto/crypto.h"
+
+namespace cryptonote
+{
+  /************************************************************************/
+  /* Ring members decompressed for ring signature checks, by output key.  */
+  /* The data only depends on the key, so entries never go stale; the     */
+  /* least recently used ones make room for new ones once it is full.     */
+  /************************************************************************/
+  class ring_members_cache
+  {
+  public:
+    ring_members_cache(size_t max_size);
+
+    bool find(const crypto::public_key& key, crypto::public_key_precomp& precomp);
+    void add(const crypto::public_key* keys, const crypto::public_key_precomp* precomps, size_t count);
+    //! Takes the cached member for key, or computes and caches it; false if key is not a valid point
+    bool get(const crypto::public_key& key, crypto::public_key_precomp& precomp);
+    size_t size();
+
+  private:
+    struct entry
+    {
+      crypto::public_key_precomp precomp;
+      std::list<crypto::public_key>::iterator use_it;
+    };
+
+    std::unordered_map<crypto::public_key, entry> m_entries;
+    std::list<crypto::public_key> m_uses; //least recently used first
+    size_t m_max_size;
+    epee::critical_section m_lock;
+  };
+}
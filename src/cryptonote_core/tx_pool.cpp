@@ -51,6 +51,8 @@ namespace cryptonote
   namespace
   {
     size_t const TRANSACTION_SIZE_LIMIT = (((CRYPTONOTE_BLOCK_GRANTED_FULL_REWARD_ZONE * 125) / 100) - CRYPTONOTE_COINBASE_BLOB_RESERVED_SIZE);
+    // transactions too big for the space left in a block template looked at in a row before it is taken as full
+    size_t const BLOCK_TEMPLATE_MAX_SKIPPED_TXS = 100;
   }
 
   //---------------------------------------------------------------------------------
@@ -133,6 +135,7 @@ namespace cryptonote
         txd_p.first->second.max_used_block_height = 0;
         txd_p.first->second.kept_by_block = kept_by_block;
         txd_p.first->second.receive_time = time(nullptr);
+        add_to_fee_rate_index(id, txd_p.first->second);
         tvc.m_verifivation_impossible = true;
         tvc.m_added_to_pool = true;
       }else
@@ -155,6 +158,7 @@ namespace cryptonote
       txd_p.first->second.last_failed_height = 0;
       txd_p.first->second.last_failed_id = null_hash;
       txd_p.first->second.receive_time = time(nullptr);
+      add_to_fee_rate_index(id, txd_p.first->second);
       tvc.m_added_to_pool = true;
 
       if(txd_p.first->second.fee > 0)
@@ -225,6 +229,7 @@ namespace cryptonote
     blob_size = it->second.blob_size;
     fee = it->second.fee;
     remove_transaction_keyimages(it->second.tx);
+    remove_from_fee_rate_index(id);
     m_transactions.erase(it);
     return true;
   }
@@ -246,6 +251,7 @@ namespace cryptonote
          (tx_age > CRYPTONOTE_MEMPOOL_TX_FROM_ALT_BLOCK_LIVETIME && it->second.kept_by_block) )
       {
         LOG_PRINT_L1("Tx " << it->first << " removed from tx pool due to outdated, age: " << tx_age );
+        remove_from_fee_rate_index(it->first);
         m_transactions.erase(it++);
       }else
         ++it;
@@ -422,26 +428,39 @@ namespace cryptonote
     // Maximum block size is 130% of the median block size.  This gives a
     // little extra headroom for the max size transaction.
     size_t max_total_size = (130 * median_size) / 100 - CRYPTONOTE_COINBASE_BLOB_RESERVED_SIZE;
+    // If adding a tx would make the block size
+    // greater than CRYPTONOTE_GETBLOCKTEMPLATE_MAX
+    // _BLOCK_SIZE bytes, reject the tx; this will
+    // keep block sizes from becoming too unwieldly
+    // to propagate at 60s block times.
+    max_total_size = std::min<size_t>(max_total_size, CRYPTONOTE_GETBLOCKTEMPLATE_MAX_BLOCK_SIZE);
     std::unordered_set<crypto::key_image> k_images;
+    if (m_txs_by_fee_rate.empty())
+      return true;
+    const size_t min_blob_size = m_txs_by_fee_rate.get<by_blob_size>().begin()->blob_size;
+    size_t skipped = 0;
 
-    BOOST_FOREACH(transactions_container::value_type& tx, m_transactions)
+    // Best paying transactions first, the walk stops as soon as none of the rest can fit
+    BOOST_FOREACH(const fee_rate_entry& e, m_txs_by_fee_rate.get<by_fee_rate>())
     {
-      // Can not exceed maximum block size
-      if (max_total_size < total_size + tx.second.blob_size)
-        continue;
+      // If we've exceeded the penalty free size,
+      // or not even the smallest tx fits anymore,
+      // stop including more tx
+      if (total_size > median_size || max_total_size < total_size + min_blob_size)
+        break;
 
-      // If adding this tx will make the block size
-      // greater than CRYPTONOTE_GETBLOCKTEMPLATE_MAX
-      // _BLOCK_SIZE bytes, reject the tx; this will 
-      // keep block sizes from becoming too unwieldly
-      // to propagate at 60s block times.
-      if ( (total_size + tx.second.blob_size) > CRYPTONOTE_GETBLOCKTEMPLATE_MAX_BLOCK_SIZE )
+      // Can not exceed maximum block size
+      if (max_total_size < total_size + e.blob_size)
+      {
+        if (++skipped >= BLOCK_TEMPLATE_MAX_SKIPPED_TXS)
+          break;
         continue;
+      }
+      skipped = 0;
 
-      // If we've exceeded the penalty free size,
-      // stop including more tx
-      if (total_size > median_size)
-        break;      
+      auto tx_it = m_transactions.find(e.id);
+      CHECK_AND_ASSERT_MES(tx_it != m_transactions.end(), false, "internal error: transaction " << e.id << " from fee rate index not found in pool");
+      transactions_container::value_type& tx = *tx_it;
 
       // Skip transactions that are not ready to be
       // included into the blockchain or that are
@@ -458,6 +477,36 @@ namespace cryptonote
     return true;
   }
   //---------------------------------------------------------------------------------
+  bool tx_memory_pool::fee_rate_greater::operator()(const fee_rate_entry& a, const fee_rate_entry& b) const
+  {
+    // a.fee / a.blob_size > b.fee / b.blob_size, compared as 128 bit products
+    uint64_t a_hi, b_hi;
+    uint64_t a_lo = mul128(a.fee, b.blob_size, &a_hi);
+    uint64_t b_lo = mul128(b.fee, a.blob_size, &b_hi);
+    return a_hi > b_hi || (a_hi == b_hi && a_lo > b_lo);
+  }
+  //---------------------------------------------------------------------------------
+  void tx_memory_pool::add_to_fee_rate_index(const crypto::hash& id, const tx_details& txd)
+  {
+    fee_rate_entry e = AUTO_VAL_INIT(e);
+    e.id = id;
+    e.fee = txd.fee;
+    e.blob_size = txd.blob_size;
+    m_txs_by_fee_rate.insert(e);
+  }
+  //---------------------------------------------------------------------------------
+  void tx_memory_pool::remove_from_fee_rate_index(const crypto::hash& id)
+  {
+    m_txs_by_fee_rate.get<by_id>().erase(id);
+  }
+  //---------------------------------------------------------------------------------
+  void tx_memory_pool::rebuild_fee_rate_index()
+  {
+    m_txs_by_fee_rate.clear();
+    BOOST_FOREACH(const transactions_container::value_type& tx, m_transactions)
+      add_to_fee_rate_index(tx.first, tx.second);
+  }
+  //---------------------------------------------------------------------------------
   bool tx_memory_pool::init(const std::string& config_folder)
   {
     CRITICAL_REGION_LOCAL(m_transactions_lock);
@@ -475,12 +524,14 @@ namespace cryptonote
       m_transactions.clear();
       m_spent_key_images.clear();
     }
+    rebuild_fee_rate_index();
 
     for (auto it = m_transactions.begin(); it != m_transactions.end(); ) {
       auto it2 = it++;
       if (it2->second.blob_size >= TRANSACTION_SIZE_LIMIT) {
         LOG_PRINT_L1("Transaction " << get_transaction_hash(it2->second.tx) << " is too big (" << it2->second.blob_size << " bytes), removing it from pool");
         remove_transaction_keyimages(it2->second.tx);
+        remove_from_fee_rate_index(it2->first);
         m_transactions.erase(it2);
       }
     }
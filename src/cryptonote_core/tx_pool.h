@@ -36,6 +36,11 @@
 #include <unordered_set>
 #include <boost/serialization/version.hpp>
 #include <boost/utility.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/identity.hpp>
+#include <boost/multi_index/member.hpp>
 
 #include "string_tools.h"
 #include "syncobj.h"
@@ -107,6 +112,19 @@ namespace cryptonote
       time_t receive_time;
     };
 
+    struct fee_rate_entry
+    {
+      crypto::hash id;
+      uint64_t fee;
+      size_t blob_size;
+    };
+
+    // higher fee per byte first
+    struct fee_rate_greater
+    {
+      bool operator()(const fee_rate_entry& a, const fee_rate_entry& b) const;
+    };
+
   private:
   	bool remove_stuck_transactions();
     bool have_tx_keyimg_as_spent(const crypto::key_image& key_im) const;
@@ -119,8 +137,29 @@ namespace cryptonote
     typedef std::unordered_map<crypto::hash, tx_details > transactions_container;
     typedef std::unordered_map<crypto::key_image, std::unordered_set<crypto::hash> > key_images_container;
 
+    struct by_id{};
+    struct by_fee_rate{};
+    struct by_blob_size{};
+
+    typedef boost::multi_index_container<
+      fee_rate_entry,
+      boost::multi_index::indexed_by<
+      // access by fee_rate_entry::id
+      boost::multi_index::hashed_unique<boost::multi_index::tag<by_id>, boost::multi_index::member<fee_rate_entry,crypto::hash,&fee_rate_entry::id>, std::hash<crypto::hash> >,
+      // sort by fee per byte, transactions paying the same rate stay in the order they came in
+      boost::multi_index::ordered_non_unique<boost::multi_index::tag<by_fee_rate>, boost::multi_index::identity<fee_rate_entry>, fee_rate_greater>,
+      // sort by size, the smallest transaction tells when a block template is full
+      boost::multi_index::ordered_non_unique<boost::multi_index::tag<by_blob_size>, boost::multi_index::member<fee_rate_entry,size_t,&fee_rate_entry::blob_size> >
+      >
+    > fee_rate_index;
+
+    void add_to_fee_rate_index(const crypto::hash& id, const tx_details& txd);
+    void remove_from_fee_rate_index(const crypto::hash& id);
+    void rebuild_fee_rate_index();
+
     mutable epee::critical_section m_transactions_lock;
     transactions_container m_transactions;
+    fee_rate_index m_txs_by_fee_rate;        // every transaction of m_transactions, not serialized
     key_images_container m_spent_key_images;
     epee::math_helper::once_a_time_seconds<30> m_remove_stuck_tx_interval;
 
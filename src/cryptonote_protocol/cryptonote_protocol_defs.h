@@ -171,10 +171,12 @@ namespace cryptonote
   {
     uint64_t current_height;
     crypto::hash  top_id;
+    bool compact_blocks; //understands NOTIFY_NEW_COMPACT_BLOCK, left false by peers which don't send it
 
     BEGIN_KV_SERIALIZE_MAP()
       KV_SERIALIZE(current_height)
       KV_SERIALIZE_VAL_POD_AS_BLOB(top_id)
+      KV_SERIALIZE(compact_blocks)
     END_KV_SERIALIZE_MAP()
   };
 
@@ -210,4 +212,42 @@ namespace cryptonote
     };
   };
 
+  /************************************************************************/
+  /* New block, with only the transactions the receiver is not expected   */
+  /* to have in its pool; also the answer to NOTIFY_REQUEST_BLOCK_TXS     */
+  /************************************************************************/
+  struct NOTIFY_NEW_COMPACT_BLOCK
+  {
+    const static int ID = BC_COMMANDS_POOL_BASE + 8;
+
+    struct request
+    {
+      block_complete_entry b;
+      uint64_t current_blockchain_height;
+      uint32_t hop;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(b)
+        KV_SERIALIZE(current_blockchain_height)
+        KV_SERIALIZE(hop)
+      END_KV_SERIALIZE_MAP()
+    };
+  };
+
+  struct NOTIFY_REQUEST_BLOCK_TXS
+  {
+    const static int ID = BC_COMMANDS_POOL_BASE + 9;
+
+    struct request
+    {
+      crypto::hash block_id;
+      std::list<crypto::hash> txs;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE_VAL_POD_AS_BLOB(block_id)
+        KV_SERIALIZE_CONTAINER_POD_AS_BLOB(txs)
+      END_KV_SERIALIZE_MAP()
+    };
+  };
+
 }
@@ -31,8 +31,14 @@
 #pragma once
 
 #include <boost/program_options/variables_map.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/uuid/uuid.hpp>
+#include <set>
 #include <string>
 #include <ctime>
+#include <unordered_map>
 
 #include "storages/levin_abstract_invoke2.h"
 #include "warnings.h"
@@ -66,6 +72,8 @@ namespace cryptonote
       HANDLE_NOTIFY_T2(NOTIFY_RESPONSE_GET_OBJECTS, &cryptonote_protocol_handler::handle_response_get_objects)
       HANDLE_NOTIFY_T2(NOTIFY_REQUEST_CHAIN, &cryptonote_protocol_handler::handle_request_chain)
       HANDLE_NOTIFY_T2(NOTIFY_RESPONSE_CHAIN_ENTRY, &cryptonote_protocol_handler::handle_response_chain_entry)
+      HANDLE_NOTIFY_T2(NOTIFY_NEW_COMPACT_BLOCK, &cryptonote_protocol_handler::handle_notify_new_compact_block)
+      HANDLE_NOTIFY_T2(NOTIFY_REQUEST_BLOCK_TXS, &cryptonote_protocol_handler::handle_request_block_txs)
     END_INVOKE_MAP2()
 
     bool on_idle();
@@ -78,8 +86,10 @@ namespace cryptonote
     bool get_payload_sync_data(CORE_SYNC_DATA& hshd);
     bool get_stat_info(core_stat_info& stat_inf);
     bool on_callback(cryptonote_connection_context& context);
+    void on_connection_close(cryptonote_connection_context& context);
     t_core& get_core(){return m_core;}
     bool is_synchronized(){return m_synchronized;}
+    void set_sync_timeout(time_t timeout){m_sync_timeout = timeout;}
     void log_connections();
     std::list<connection_info> get_connections();
   private:
@@ -90,6 +100,8 @@ namespace cryptonote
     int handle_response_get_objects(int command, NOTIFY_RESPONSE_GET_OBJECTS::request& arg, cryptonote_connection_context& context);
     int handle_request_chain(int command, NOTIFY_REQUEST_CHAIN::request& arg, cryptonote_connection_context& context);
     int handle_response_chain_entry(int command, NOTIFY_RESPONSE_CHAIN_ENTRY::request& arg, cryptonote_connection_context& context);
+    int handle_notify_new_compact_block(int command, NOTIFY_NEW_COMPACT_BLOCK::request& arg, cryptonote_connection_context& context);
+    int handle_request_block_txs(int command, NOTIFY_REQUEST_BLOCK_TXS::request& arg, cryptonote_connection_context& context);
 
 
     //----------------- i_bc_protocol_layout ---------------------------------------
@@ -98,8 +110,36 @@ namespace cryptonote
     //----------------------------------------------------------------------------------
     //bool get_payload_sync_data(HANDSHAKE_DATA::request& hshd, cryptonote_connection_context& context);
     bool request_missing_objects(cryptonote_connection_context& context, bool check_having_blocks);
+    void handle_new_block(NOTIFY_NEW_BLOCK::request& arg, const block& b, const std::list<blobdata>& unknown_txs, cryptonote_connection_context& context);
+    void request_missing_block_txs(const crypto::hash& id, std::list<crypto::hash>& txs, cryptonote_connection_context& context);
+    bool relay_block_to_peers(NOTIFY_NEW_BLOCK::request& arg, const std::list<blobdata>& unknown_txs, cryptonote_connection_context& exclude_context);
     size_t get_synchronizing_connections_count();
     bool on_connection_synchronized();
+    void incoming_txs_worker();
+    void handle_incoming_txs(std::list<std::pair<NOTIFY_NEW_TRANSACTIONS::request, cryptonote_connection_context> >& notifications);
+
+    // blocks of one NOTIFY_RESPONSE_GET_OBJECTS, waiting until their parent block is in the core
+    struct sync_span
+    {
+      epee::net_utils::connection_context_base context;
+      std::list<block_complete_entry> blocks;
+      std::list<crypto::hash> block_ids;
+      bool pow_ready;                        //proofs of work of the blocks are computed
+      time_t time;                           //when it arrived, or the blocks below it were released
+    };
+    // a block requested from a connection, until it is added to the core
+    struct sync_claim
+    {
+      boost::uuids::uuid connection_id;
+      time_t time;                           //when it was requested
+      bool in_span;                          //arrived, waits in m_sync_spans
+    };
+    bool add_sync_span(sync_span& span);
+    void add_ready_sync_spans();
+    bool release_sync_objects(const boost::uuids::uuid& connection_id);
+    void expire_sync_objects();
+    void wake_waiting_connections();
+    void precompute_span_pow(const crypto::hash& span_parent_id, const std::list<block>& blocks);
     t_core& m_core;
 
     nodetool::p2p_endpoint_stub<connection_context> m_p2p_stub;
@@ -107,6 +147,25 @@ namespace cryptonote
     std::atomic<uint32_t> m_syncronized_connections_count;
     std::atomic<bool> m_synchronized;
 
+    // NOTIFY_NEW_TRANSACTIONS are verified off the network threads, in arrival order
+    std::list<std::pair<NOTIFY_NEW_TRANSACTIONS::request, cryptonote_connection_context> > m_incoming_txs;
+    size_t m_incoming_txs_count; //transactions queued in m_incoming_txs
+    boost::mutex m_incoming_txs_lock;
+    boost::condition_variable m_incoming_txs_cond;
+    boost::thread m_incoming_txs_thread;
+    bool m_stop_incoming_txs;
+
+    // during synchronization every block is requested from one connection only, and the spans
+    // downloaded ahead of the chain tip are added to the core in chain order
+    boost::mutex m_sync_lock;
+    std::unordered_map<crypto::hash, sync_claim> m_sync_requested_blocks;         //requested or buffered block -> connection
+    std::unordered_map<crypto::hash, sync_span> m_sync_spans;                      //parent of the first block -> span
+    std::set<boost::uuids::uuid> m_sync_waiting_connections;                       //nothing to request until spans are added
+    bool m_sync_adding_spans;
+    size_t m_sync_pow_pending;                                                     //spans being hashed on the thread pool
+    boost::condition_variable m_sync_pow_done;
+    time_t m_sync_timeout;
+
     template<class t_parametr>
       bool post_notify(typename t_parametr::request& arg, cryptonote_connection_context& context)
       {
@@ -31,6 +31,7 @@
 #include <boost/interprocess/detail/atomic.hpp>
 #include <list>
 
+#include "common/thread_pool.h"
 #include "cryptonote_core/cryptonote_format_utils.h"
 #include "profile_tools.h"
 namespace cryptonote
@@ -41,7 +42,12 @@ namespace cryptonote
     t_cryptonote_protocol_handler<t_core>::t_cryptonote_protocol_handler(t_core& rcore, nodetool::i_p2p_endpoint<connection_context>* p_net_layout):m_core(rcore), 
                                                                                                               m_p2p(p_net_layout),
                                                                                                               m_syncronized_connections_count(0),
-                                                                                                              m_synchronized(false)
+                                                                                                              m_synchronized(false),
+                                                                                                              m_incoming_txs_count(0),
+                                                                                                              m_stop_incoming_txs(false),
+                                                                                                              m_sync_adding_spans(false),
+                                                                                                              m_sync_pow_pending(0),
+                                                                                                              m_sync_timeout(BLOCKS_SYNCHRONIZING_TIMEOUT)
 
   {
     if(!m_p2p)
@@ -51,14 +57,28 @@ namespace cryptonote
   template<class t_core> 
   bool t_cryptonote_protocol_handler<t_core>::init(const boost::program_options::variables_map& vm)
   {
+    m_stop_incoming_txs = false;
+    m_incoming_txs_thread = boost::thread(&t_cryptonote_protocol_handler<t_core>::incoming_txs_worker, this);
     return true;
   }
   //------------------------------------------------------------------------------------------------------------------------  
   template<class t_core> 
   bool t_cryptonote_protocol_handler<t_core>::deinit()
   {
-    
+    {
+      boost::unique_lock<boost::mutex> lock(m_incoming_txs_lock);
+      m_stop_incoming_txs = true;
+      m_incoming_txs.clear();
+      m_incoming_txs_count = 0;
+    }
+    m_incoming_txs_cond.notify_all();
+    if(m_incoming_txs_thread.joinable())
+      m_incoming_txs_thread.join();
 
+    //the spans being hashed add themselves to the core when they are done
+    boost::unique_lock<boost::mutex> lock(m_sync_lock);
+    while(m_sync_pow_pending)
+      m_sync_pow_done.wait(lock);
     return true;
   }
   //------------------------------------------------------------------------------------------------------------------------  
@@ -80,6 +100,8 @@ namespace cryptonote
 
     if(context.m_state == cryptonote_connection_context::state_synchronizing)
     {
+      //also where waiting connections resume: blocks they skipped may have been released since
+      context.m_needed_objects.clear();
       NOTIFY_REQUEST_CHAIN::request r = boost::value_initialized<NOTIFY_REQUEST_CHAIN::request>();
       m_core.get_short_chain_history(r.block_ids);
       LOG_PRINT_CCONTEXT_L2("-->>NOTIFY_REQUEST_CHAIN: m_block_ids.size()=" << r.block_ids.size() );
@@ -89,6 +111,20 @@ namespace cryptonote
     return true;
   }
   //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::on_connection_close(cryptonote_connection_context& context)
+  {
+    bool released = false;
+    {
+      boost::unique_lock<boost::mutex> lock(m_sync_lock);
+      //blocks still requested from this connection, and the spans it delivered, are up for grabs again
+      released = release_sync_objects(context.m_connection_id);
+      m_sync_waiting_connections.erase(context.m_connection_id);
+    }
+    if(released)
+      wake_waiting_connections();
+  }
+  //------------------------------------------------------------------------------------------------------------------------
   template<class t_core> 
   bool t_cryptonote_protocol_handler<t_core>::get_stat_info(core_stat_info& stat_inf)
   {
@@ -164,6 +200,7 @@ namespace cryptonote
     if(context.m_state == cryptonote_connection_context::state_befor_handshake && !is_inital)
       return true;
 
+    context.m_compact_blocks = hshd.compact_blocks;
     if(context.m_state == cryptonote_connection_context::state_synchronizing)
       return true;
 
@@ -200,6 +237,7 @@ namespace cryptonote
   {
     m_core.get_blockchain_top(hshd.current_height, hshd.top_id);
     hshd.current_height +=1;
+    hshd.compact_blocks = true;
     return true;
   }
   //------------------------------------------------------------------------------------------------------------------------  
@@ -219,8 +257,20 @@ namespace cryptonote
     if(context.m_state != cryptonote_connection_context::state_normal)
       return 1;
 
+    block b;
+    if(!parse_and_validate_block_from_blob(arg.b.block, b))
+    {
+      LOG_PRINT_CCONTEXT_L1("Failed to parse block, dropping connection");
+      m_p2p->drop_connection(context);
+      return 1;
+    }
+
+    //transactions which only came with the block are passed on with it in compact relays
+    std::list<blobdata> unknown_txs;
     for(auto tx_blob_it = arg.b.txs.begin(); tx_blob_it!=arg.b.txs.end();tx_blob_it++)
     {
+      if(!m_core.pool_has_tx(get_blob_hash(*tx_blob_it)))
+        unknown_txs.push_back(*tx_blob_it);
       cryptonote::tx_verification_context tvc = AUTO_VAL_INIT(tvc);
       m_core.handle_incoming_tx(*tx_blob_it, tvc, true);
       if(tvc.m_verifivation_failed)
@@ -231,22 +281,153 @@ namespace cryptonote
       }
     }
 
+    handle_new_block(arg, b, unknown_txs, context);
+    return 1;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  int t_cryptonote_protocol_handler<t_core>::handle_notify_new_compact_block(int command, NOTIFY_NEW_COMPACT_BLOCK::request& arg, cryptonote_connection_context& context)
+  {
+    LOG_PRINT_CCONTEXT_L2("NOTIFY_NEW_COMPACT_BLOCK (hop " << arg.hop << ", " << arg.b.txs.size() << " txs)");
+    if(context.m_state != cryptonote_connection_context::state_normal)
+      return 1;
+
+    block b;
+    if(!parse_and_validate_block_from_blob(arg.b.block, b))
+    {
+      LOG_PRINT_CCONTEXT_L1("Failed to parse compact block, dropping connection");
+      m_p2p->drop_connection(context);
+      return 1;
+    }
+    crypto::hash id = get_block_hash(b);
+    if(m_core.have_block(id))
+      return 1;
 
+    std::list<blobdata> unknown_txs;
+    BOOST_FOREACH(const blobdata& tx_blob, arg.b.txs)
+    {
+      if(!m_core.pool_has_tx(get_blob_hash(tx_blob)))
+        unknown_txs.push_back(tx_blob);
+      cryptonote::tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+      m_core.handle_incoming_tx(tx_blob, tvc, true);
+      if(tvc.m_verifivation_failed)
+      {
+        LOG_PRINT_CCONTEXT_L1("Compact block verification failed: transaction verification failed, dropping connection");
+        m_p2p->drop_connection(context);
+        return 1;
+      }
+    }
+
+    //the rest of the block's transactions have to be in the pool already
+    std::list<crypto::hash> missing_txs;
+    BOOST_FOREACH(const crypto::hash& tx_id, b.tx_hashes)
+    {
+      if(!m_core.pool_has_tx(tx_id))
+        missing_txs.push_back(tx_id);
+    }
+    if(missing_txs.size())
+    {
+      request_missing_block_txs(id, missing_txs, context);
+      return 1;
+    }
+
+    NOTIFY_NEW_BLOCK::request full_arg = AUTO_VAL_INIT(full_arg);
+    full_arg.b.block.swap(arg.b.block);
+    full_arg.current_blockchain_height = arg.current_blockchain_height;
+    full_arg.hop = arg.hop;
+    handle_new_block(full_arg, b, unknown_txs, context);
+    return 1;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  int t_cryptonote_protocol_handler<t_core>::handle_request_block_txs(int command, NOTIFY_REQUEST_BLOCK_TXS::request& arg, cryptonote_connection_context& context)
+  {
+    LOG_PRINT_CCONTEXT_L2("NOTIFY_REQUEST_BLOCK_TXS: txs.size()=" << arg.txs.size());
+    block b;
+    if(!m_core.get_block_by_hash(arg.block_id, b))
+    {
+      LOG_PRINT_CCONTEXT_L1("Transactions requested for unknown block " << arg.block_id);
+      return 1;
+    }
+
+    std::unordered_set<crypto::hash> block_txs(b.tx_hashes.begin(), b.tx_hashes.end());
+    std::vector<crypto::hash> tx_ids;
+    BOOST_FOREACH(const crypto::hash& tx_id, arg.txs)
+    {
+      if(!block_txs.count(tx_id))
+      {
+        LOG_ERROR_CCONTEXT("requested transaction " << tx_id << " which is not in block " << arg.block_id << ", dropping connection");
+        m_p2p->drop_connection(context);
+        return 1;
+      }
+      tx_ids.push_back(tx_id);
+    }
+
+    //the block may not be on the main chain, so look into the pool too
+    std::list<transaction> txs;
+    std::list<crypto::hash> missed_txs;
+    m_core.get_transactions(tx_ids, txs, missed_txs);
+    BOOST_FOREACH(const crypto::hash& tx_id, missed_txs)
+    {
+      transaction tx;
+      if(m_core.get_pool_transaction(tx_id, tx))
+        txs.push_back(tx);
+    }
+
+    NOTIFY_NEW_COMPACT_BLOCK::request rsp = AUTO_VAL_INIT(rsp);
+    block_to_blob(b, rsp.b.block);
+    BOOST_FOREACH(const transaction& tx, txs)
+      rsp.b.txs.push_back(tx_to_blob(tx));
+    rsp.current_blockchain_height = m_core.get_current_blockchain_height();
+    LOG_PRINT_CCONTEXT_L2("-->>NOTIFY_NEW_COMPACT_BLOCK: txs.size()=" << rsp.b.txs.size());
+    post_notify<NOTIFY_NEW_COMPACT_BLOCK>(rsp, context);
+    return 1;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::handle_new_block(NOTIFY_NEW_BLOCK::request& arg, const block& b, const std::list<blobdata>& unknown_txs, cryptonote_connection_context& context)
+  {
     block_verification_context bvc = boost::value_initialized<block_verification_context>();
     m_core.pause_mine();
     m_core.handle_incoming_block(arg.b.block, bvc);
     m_core.resume_mine();
     if(bvc.m_verifivation_failed)
     {
+      if(arg.b.txs.size() != b.tx_hashes.size())
+      {
+        //rebuilt from the pool, which may have lost some of the transactions since they were looked up
+        std::list<crypto::hash> missing_txs;
+        BOOST_FOREACH(const crypto::hash& tx_id, b.tx_hashes)
+        {
+          if(!m_core.pool_has_tx(tx_id))
+            missing_txs.push_back(tx_id);
+        }
+        if(missing_txs.size())
+        {
+          request_missing_block_txs(get_block_hash(b), missing_txs, context);
+          return;
+        }
+      }
       LOG_PRINT_CCONTEXT_L1("Block verification failed, dropping connection");
       m_p2p->drop_connection(context);
-      return 1;
+      return;
     }
     if(bvc.m_added_to_main_chain)
     {
+      if(arg.b.txs.size() != b.tx_hashes.size())
+      {
+        //rebuilt from the pool, peers without compact blocks need all the transactions
+        std::vector<crypto::hash> tx_ids(b.tx_hashes.begin(), b.tx_hashes.end());
+        std::list<transaction> txs;
+        std::list<crypto::hash> missed_txs;
+        m_core.get_transactions(tx_ids, txs, missed_txs);
+        arg.b.txs.clear();
+        BOOST_FOREACH(const transaction& tx, txs)
+          arg.b.txs.push_back(tx_to_blob(tx));
+      }
       ++arg.hop;
       //TODO: Add here announce protocol usage
-      relay_block(arg, context);
+      relay_block_to_peers(arg, unknown_txs, context);
     }else if(bvc.m_marked_as_orphaned)
     {
       context.m_state = cryptonote_connection_context::state_synchronizing;
@@ -255,8 +436,29 @@ namespace cryptonote
       LOG_PRINT_CCONTEXT_L2("-->>NOTIFY_REQUEST_CHAIN: m_block_ids.size()=" << r.block_ids.size() );
       post_notify<NOTIFY_REQUEST_CHAIN>(r, context);
     }
-      
-    return 1;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::request_missing_block_txs(const crypto::hash& id, std::list<crypto::hash>& txs, cryptonote_connection_context& context)
+  {
+    if(context.m_requested_block_txs == id)
+    {
+      //asked once already, get the block through the regular synchronization instead
+      LOG_PRINT_CCONTEXT_L1("Compact block " << id << " still misses " << txs.size() << " transactions, requesting chain");
+      context.m_requested_block_txs = null_hash;
+      context.m_state = cryptonote_connection_context::state_synchronizing;
+      NOTIFY_REQUEST_CHAIN::request r = boost::value_initialized<NOTIFY_REQUEST_CHAIN::request>();
+      m_core.get_short_chain_history(r.block_ids);
+      LOG_PRINT_CCONTEXT_L2("-->>NOTIFY_REQUEST_CHAIN: m_block_ids.size()=" << r.block_ids.size() );
+      post_notify<NOTIFY_REQUEST_CHAIN>(r, context);
+      return;
+    }
+    context.m_requested_block_txs = id;
+    NOTIFY_REQUEST_BLOCK_TXS::request req = AUTO_VAL_INIT(req);
+    req.block_id = id;
+    req.txs.swap(txs);
+    LOG_PRINT_CCONTEXT_L2("-->>NOTIFY_REQUEST_BLOCK_TXS: txs.size()=" << req.txs.size());
+    post_notify<NOTIFY_REQUEST_BLOCK_TXS>(req, context);
   }
   //------------------------------------------------------------------------------------------------------------------------
   template<class t_core> 
@@ -266,29 +468,94 @@ namespace cryptonote
     if(context.m_state != cryptonote_connection_context::state_normal)
       return 1;
 
-    for(auto tx_blob_it = arg.txs.begin(); tx_blob_it!=arg.txs.end();)
+    const size_t txs_count = arg.txs.size();
+    if(txs_count > CRYPTONOTE_PROTOCOL_MAX_QUEUED_TXS)
     {
-      cryptonote::tx_verification_context tvc = AUTO_VAL_INIT(tvc);
-      m_core.handle_incoming_tx(*tx_blob_it, tvc, false);
-      if(tvc.m_verifivation_failed)
+      LOG_PRINT_CCONTEXT_L1("NOTIFY_NEW_TRANSACTIONS with " << txs_count << " txs is bigger than the whole incoming transactions queue, dropping connection");
+      m_p2p->drop_connection(context);
+      return 1;
+    }
+    std::list<std::pair<NOTIFY_NEW_TRANSACTIONS::request, cryptonote_connection_context> > notifications;
+    notifications.push_back(std::make_pair(NOTIFY_NEW_TRANSACTIONS::request(), context));
+    notifications.back().first.txs.swap(arg.txs);
+    if(!m_incoming_txs_thread.joinable())
+    {
+      //not initialized (tests), verify right here
+      handle_incoming_txs(notifications);
+      return 1;
+    }
+
+    {
+      boost::unique_lock<boost::mutex> lock(m_incoming_txs_lock);
+      if(m_incoming_txs_count + txs_count > CRYPTONOTE_PROTOCOL_MAX_QUEUED_TXS)
       {
-        LOG_PRINT_CCONTEXT_L1("Tx verification failed, dropping connection");
-        m_p2p->drop_connection(context);
+        LOG_PRINT_CCONTEXT_L1("Too many transactions waiting for verification, NOTIFY_NEW_TRANSACTIONS with " << txs_count << " txs dropped");
         return 1;
       }
-      if(tvc.m_should_be_relayed)
-        ++tx_blob_it;
-      else
-        arg.txs.erase(tx_blob_it++);
+      m_incoming_txs.splice(m_incoming_txs.end(), notifications);
+      m_incoming_txs_count += txs_count;
     }
-
-    if(arg.txs.size())
+    m_incoming_txs_cond.notify_one();
+    return 1;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core> 
+  void t_cryptonote_protocol_handler<t_core>::incoming_txs_worker()
+  {
+    while(true)
     {
-      //TODO: add announce usage here
-      relay_transactions(arg, context);
+      std::list<std::pair<NOTIFY_NEW_TRANSACTIONS::request, cryptonote_connection_context> > notifications;
+      {
+        boost::unique_lock<boost::mutex> lock(m_incoming_txs_lock);
+        while(!m_stop_incoming_txs && m_incoming_txs.empty())
+          m_incoming_txs_cond.wait(lock);
+        if(m_stop_incoming_txs)
+          return;
+        //take everything queued so far, the whole batch gets its signatures checked at once
+        notifications.swap(m_incoming_txs);
+        m_incoming_txs_count = 0;
+      }
+      handle_incoming_txs(notifications);
     }
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core> 
+  void t_cryptonote_protocol_handler<t_core>::handle_incoming_txs(std::list<std::pair<NOTIFY_NEW_TRANSACTIONS::request, cryptonote_connection_context> >& notifications)
+  {
+    std::list<blobdata> tx_blobs;
+    BOOST_FOREACH(auto& notification, notifications)
+      tx_blobs.insert(tx_blobs.end(), notification.first.txs.begin(), notification.first.txs.end());
 
-    return true;
+    std::vector<tx_verification_context> tvcs;
+    m_core.handle_incoming_txs(tx_blobs, tvcs, false);
+
+    size_t i = 0;
+    BOOST_FOREACH(auto& notification, notifications)
+    {
+      NOTIFY_NEW_TRANSACTIONS::request& arg = notification.first;
+      cryptonote_connection_context& context = notification.second;
+      bool failed = false;
+      for(auto tx_blob_it = arg.txs.begin(); tx_blob_it!=arg.txs.end(); ++i)
+      {
+        failed = failed || tvcs[i].m_verifivation_failed;
+        if(tvcs[i].m_should_be_relayed)
+          ++tx_blob_it;
+        else
+          arg.txs.erase(tx_blob_it++);
+      }
+      if(failed)
+      {
+        LOG_PRINT_CCONTEXT_L1("Tx verification failed, dropping connection");
+        m_p2p->drop_connection(context);
+        continue;
+      }
+
+      if(arg.txs.size())
+      {
+        //TODO: add announce usage here
+        relay_transactions(arg, context);
+      }
+    }
   }
   //------------------------------------------------------------------------------------------------------------------------
   template<class t_core> 
@@ -321,32 +588,22 @@ namespace cryptonote
 
     context.m_remote_blockchain_height = arg.current_blockchain_height;
 
-    size_t count = 0;
+    std::list<block> span_blocks;
+    std::list<crypto::hash> span_ids;
     BOOST_FOREACH(const block_complete_entry& block_entry, arg.blocks)
     {
-      ++count;
-      block b;
+      span_blocks.push_back(block());
+      block& b = span_blocks.back();
       if(!parse_and_validate_block_from_blob(block_entry.block, b))
       {
         LOG_ERROR_CCONTEXT("sent wrong block: failed to parse and validate block: \r\n" 
           << epee::string_tools::buff_to_hex_nodelimer(block_entry.block) << "\r\n dropping connection");
         m_p2p->drop_connection(context);
         return 1;
-      }      
-      //to avoid concurrency in core between connections, suspend connections which delivered block later then first one
-      if(count == 2)
-      { 
-        if(m_core.have_block(get_block_hash(b)))
-        {
-          context.m_state = cryptonote_connection_context::state_idle;
-          context.m_needed_objects.clear();
-          context.m_requested_objects.clear();
-          LOG_PRINT_CCONTEXT_L1("Connection set to idle state.");
-          return 1;
-        }
       }
       
-      auto req_it = context.m_requested_objects.find(get_block_hash(b));
+      span_ids.push_back(get_block_hash(b));
+      auto req_it = context.m_requested_objects.find(span_ids.back());
       if(req_it == context.m_requested_objects.end())
       {
         LOG_ERROR_CCONTEXT("sent wrong NOTIFY_RESPONSE_GET_OBJECTS: block with id=" << epee::string_tools::pod_to_hex(get_blob_hash(block_entry.block)) 
@@ -373,60 +630,281 @@ namespace cryptonote
       return 1;
     }
 
+    if(!arg.blocks.empty())
     {
-      m_core.pause_mine();
-      epee::misc_utils::auto_scope_leave_caller scope_exit_handler = epee::misc_utils::create_scope_leave_handler(
-        boost::bind(&t_core::resume_mine, &m_core));
-
-      BOOST_FOREACH(const block_complete_entry& block_entry, arg.blocks)
+      const crypto::hash span_parent_id = span_blocks.front().prev_id;
+      bool added = false;
       {
-        //process transactions
-        TIME_MEASURE_START(transactions_process_time);
-        BOOST_FOREACH(auto& tx_blob, block_entry.txs)
+        boost::unique_lock<boost::mutex> lock(m_sync_lock);
+        auto span_it = m_sync_spans.insert(std::make_pair(span_parent_id, sync_span()));
+        added = span_it.second;
+        //the blocks stay claimed until they are added, while the span itself may time out waiting
+        BOOST_FOREACH(const crypto::hash& id, span_ids)
         {
-          tx_verification_context tvc = AUTO_VAL_INIT(tvc);
-          m_core.handle_incoming_tx(tx_blob, tvc, true);
-          if(tvc.m_verifivation_failed)
+          auto claim_it = m_sync_requested_blocks.find(id);
+          if(claim_it != m_sync_requested_blocks.end() && claim_it->second.connection_id == context.m_connection_id)
           {
-            LOG_ERROR_CCONTEXT("transaction verification failed on NOTIFY_RESPONSE_GET_OBJECTS, \r\ntx_id = " 
-              << epee::string_tools::pod_to_hex(get_blob_hash(tx_blob)) << ", dropping connection");
-            m_p2p->drop_connection(context);
-            return 1;
+            if(added)
+              claim_it->second.in_span = true;
+            else
+              m_sync_requested_blocks.erase(claim_it);
           }
         }
-        TIME_MEASURE_FINISH(transactions_process_time);
-
-        //process block
-        TIME_MEASURE_START(block_process_time);
-        block_verification_context bvc = boost::value_initialized<block_verification_context>();
+        if(added)
+        {
+          span_it.first->second.context = context;
+          span_it.first->second.blocks.swap(arg.blocks);
+          span_it.first->second.block_ids.swap(span_ids);
+          span_it.first->second.pow_ready = false;
+          span_it.first->second.time = time(NULL);
+          ++m_sync_pow_pending;
+          LOG_PRINT_CCONTEXT_L2("Got " << span_it.first->second.blocks.size() << " blocks after " << span_parent_id << ", " << m_sync_spans.size() << " spans waiting");
+        }
+        else
+        {
+          //another connection already delivered blocks on top of this parent, only this connection's claims are released above
+          LOG_PRINT_CCONTEXT_L1("Got blocks after " << span_parent_id << " twice, dropping the later ones");
+        }
+      }
+      if(added)
+      {
+        //hash the blocks on all cores off the network thread, adding them in order later only compares against the difficulty
+        std::shared_ptr<std::list<block> > blocks = std::make_shared<std::list<block> >();
+        blocks->swap(span_blocks);
+        tools::thread_pool::instance().submit([this, span_parent_id, blocks]() { precompute_span_pow(span_parent_id, *blocks); });
+      }
+    }
+    add_ready_sync_spans();
 
-        m_core.handle_incoming_block(block_entry.block, bvc, false);
+    request_missing_objects(context, true);
+    return 1;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  bool t_cryptonote_protocol_handler<t_core>::add_sync_span(sync_span& span)
+  {
+    const epee::net_utils::connection_context_base& context = span.context;
+    m_core.pause_mine();
+    epee::misc_utils::auto_scope_leave_caller scope_exit_handler = epee::misc_utils::create_scope_leave_handler(
+      boost::bind(&t_core::resume_mine, &m_core));
 
-        if(bvc.m_verifivation_failed)
+    BOOST_FOREACH(const block_complete_entry& block_entry, span.blocks)
+    {
+      //process transactions
+      TIME_MEASURE_START(transactions_process_time);
+      BOOST_FOREACH(auto& tx_blob, block_entry.txs)
+      {
+        tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+        m_core.handle_incoming_tx(tx_blob, tvc, true);
+        if(tvc.m_verifivation_failed)
         {
-          LOG_PRINT_CCONTEXT_L1("Block verification failed, dropping connection");
+          LOG_ERROR_CCONTEXT("transaction verification failed on NOTIFY_RESPONSE_GET_OBJECTS, \r\ntx_id = " 
+            << epee::string_tools::pod_to_hex(get_blob_hash(tx_blob)) << ", dropping connection");
           m_p2p->drop_connection(context);
-          return 1;
+          return false;
         }
-        if(bvc.m_marked_as_orphaned)
+      }
+      TIME_MEASURE_FINISH(transactions_process_time);
+
+      //process block
+      TIME_MEASURE_START(block_process_time);
+      block_verification_context bvc = boost::value_initialized<block_verification_context>();
+
+      m_core.handle_incoming_block(block_entry.block, bvc, false);
+
+      if(bvc.m_verifivation_failed)
+      {
+        LOG_PRINT_CCONTEXT_L1("Block verification failed, dropping connection");
+        m_p2p->drop_connection(context);
+        return false;
+      }
+      if(bvc.m_marked_as_orphaned)
+      {
+        LOG_PRINT_CCONTEXT_L1("Block received at sync phase was marked as orphaned, dropping connection");
+        m_p2p->drop_connection(context);
+        return false;
+      }
+
+      TIME_MEASURE_FINISH(block_process_time);
+      LOG_PRINT_CCONTEXT_L2("Block process time: " << block_process_time + transactions_process_time << "(" << transactions_process_time << "/" << block_process_time << ")ms");
+    }
+    return true;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::add_ready_sync_spans()
+  {
+    //one thread at a time adds the spans whose parent is known, in chain order; the others just leave theirs
+    bool adding = false;
+    while(true)
+    {
+      sync_span span;
+      {
+        boost::unique_lock<boost::mutex> lock(m_sync_lock);
+        if(!adding && m_sync_adding_spans)
+          return;
+        adding = true;
+        m_sync_adding_spans = false;
+
+        auto it = m_sync_spans.begin();
+        while(it != m_sync_spans.end() && (!it->second.pow_ready || !m_core.have_block(it->first)))
+          ++it;
+        if(it == m_sync_spans.end())
+          break;
+        std::swap(span, it->second);
+        m_sync_spans.erase(it);
+        m_sync_adding_spans = true;
+      }
+
+      if(!add_sync_span(span))
+      {
+        //spans on top of a bad one would never become ready
+        boost::unique_lock<boost::mutex> lock(m_sync_lock);
+        BOOST_FOREACH(auto& waiting, m_sync_spans)
         {
-          LOG_PRINT_CCONTEXT_L1("Block received at sync phase was marked as orphaned, dropping connection");
-          m_p2p->drop_connection(context);
-          return 1;
+          BOOST_FOREACH(const crypto::hash& id, waiting.second.block_ids)
+            m_sync_requested_blocks.erase(id);
         }
+        m_sync_spans.clear();
+      }
 
-        TIME_MEASURE_FINISH(block_process_time);
-        LOG_PRINT_CCONTEXT_L2("Block process time: " << block_process_time + transactions_process_time << "(" << transactions_process_time << "/" << block_process_time << ")ms");
+      {
+        boost::unique_lock<boost::mutex> lock(m_sync_lock);
+        BOOST_FOREACH(const crypto::hash& id, span.block_ids)
+          m_sync_requested_blocks.erase(id);
+      }
+      wake_waiting_connections();
+    }
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  bool t_cryptonote_protocol_handler<t_core>::release_sync_objects(const boost::uuids::uuid& connection_id)
+  {
+    //called with m_sync_lock held
+    bool released = false;
+    for(auto it = m_sync_spans.begin(); it != m_sync_spans.end();)
+    {
+      if(it->second.context.m_connection_id == connection_id)
+      {
+        m_sync_spans.erase(it++);
+        released = true;
+      }
+      else
+        ++it;
+    }
+    for(auto it = m_sync_requested_blocks.begin(); it != m_sync_requested_blocks.end();)
+    {
+      if(it->second.connection_id == connection_id)
+      {
+        m_sync_requested_blocks.erase(it++);
+        released = true;
       }
+      else
+        ++it;
+    }
+    if(released)
+    {
+      //the spans left wait a whole timeout again, for the blocks below them to be requested anew
+      const time_t now = time(NULL);
+      BOOST_FOREACH(auto& span, m_sync_spans)
+        span.second.time = now;
     }
+    return released;
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::expire_sync_objects()
+  {
+    std::set<boost::uuids::uuid> stalled;
+    {
+      boost::unique_lock<boost::mutex> lock(m_sync_lock);
+      const time_t now = time(NULL);
+      BOOST_FOREACH(const auto& claim, m_sync_requested_blocks)
+      {
+        if(!claim.second.in_span && now - claim.second.time >= m_sync_timeout)
+          stalled.insert(claim.second.connection_id);
+      }
+      //a span nobody downloads the parent of is never added, and counts against BLOCKS_SYNCHRONIZING_MAX_SPANS
+      BOOST_FOREACH(const auto& span, m_sync_spans)
+      {
+        if(now - span.second.time >= m_sync_timeout && !m_sync_requested_blocks.count(span.first) && !m_core.have_block(span.first))
+          stalled.insert(span.second.context.m_connection_id);
+      }
+      BOOST_FOREACH(const boost::uuids::uuid& connection_id, stalled)
+      {
+        release_sync_objects(connection_id);
+        m_sync_waiting_connections.erase(connection_id);
+      }
+    }
+    if(stalled.empty())
+      return;
 
-    request_missing_objects(context, true);
-    return 1;
+    std::list<epee::net_utils::connection_context_base> stalled_contexts;
+    m_p2p->for_each_connection([&](cryptonote_connection_context& context, nodetool::peerid_type peer_id)->bool{
+      if(stalled.count(context.m_connection_id))
+        stalled_contexts.push_back(context);
+      return true;
+    });
+    BOOST_FOREACH(const epee::net_utils::connection_context_base& context, stalled_contexts)
+    {
+      LOG_PRINT_CCONTEXT_L1("Requested blocks didn't arrive or can't be added for " << m_sync_timeout << " seconds, dropping connection");
+      m_p2p->drop_connection(context);
+    }
+    wake_waiting_connections();
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::precompute_span_pow(const crypto::hash& span_parent_id, const std::list<block>& blocks)
+  {
+    try
+    {
+      m_core.precompute_blocks_pow(blocks);
+    }
+    catch(const std::exception& e)
+    {
+      //the proofs of work are then computed when the blocks are added
+      LOG_ERROR("Failed to compute proofs of work of blocks after " << span_parent_id << ": " << e.what());
+    }
+
+    {
+      boost::unique_lock<boost::mutex> lock(m_sync_lock);
+      //the span may be gone already, dropped with a bad span it was waiting on
+      auto it = m_sync_spans.find(span_parent_id);
+      if(it != m_sync_spans.end())
+        it->second.pow_ready = true;
+    }
+    add_ready_sync_spans();
+
+    boost::unique_lock<boost::mutex> lock(m_sync_lock);
+    --m_sync_pow_pending;
+    m_sync_pow_done.notify_all();
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  void t_cryptonote_protocol_handler<t_core>::wake_waiting_connections()
+  {
+    std::set<boost::uuids::uuid> waiting;
+    {
+      boost::unique_lock<boost::mutex> lock(m_sync_lock);
+      waiting.swap(m_sync_waiting_connections);
+    }
+    if(waiting.empty())
+      return;
+
+    m_p2p->for_each_connection([&](cryptonote_connection_context& context, nodetool::peerid_type peer_id)->bool{
+      if(waiting.count(context.m_connection_id))
+      {
+        ++context.m_callback_request_count;
+        m_p2p->request_callback(context);
+      }
+      return true;
+    });
   }
   //------------------------------------------------------------------------------------------------------------------------
   template<class t_core> 
   bool t_cryptonote_protocol_handler<t_core>::on_idle()
   {
+    expire_sync_objects();
     return m_core.on_idle();
   }
   //------------------------------------------------------------------------------------------------------------------------
@@ -448,23 +926,47 @@ namespace cryptonote
   template<class t_core> 
   bool t_cryptonote_protocol_handler<t_core>::request_missing_objects(cryptonote_connection_context& context, bool check_having_blocks)
   {
-    if(context.m_needed_objects.size())
+    NOTIFY_REQUEST_GET_OBJECTS::request req;
     {
-      //we know objects that we need, request this objects
-      NOTIFY_REQUEST_GET_OBJECTS::request req;
-      size_t count = 0;
-      auto it = context.m_needed_objects.begin();
+      boost::unique_lock<boost::mutex> lock(m_sync_lock);
+      if(context.m_needed_objects.size() && m_sync_spans.size() >= BLOCKS_SYNCHRONIZING_MAX_SPANS)
+      {
+        //too much downloaded ahead, wait until the blocks below are in
+        LOG_PRINT_CCONTEXT_L2("waiting for " << m_sync_spans.size() << " downloaded spans to be added");
+        m_sync_waiting_connections.insert(context.m_connection_id);
+        return true;
+      }
 
-      while(it != context.m_needed_objects.end() && count < BLOCKS_SYNCHRONIZING_DEFAULT_COUNT)
+      //request the next blocks nobody else requested, in one contiguous span
+      auto it = context.m_needed_objects.begin();
+      while(it != context.m_needed_objects.end() && req.blocks.size() < BLOCKS_SYNCHRONIZING_DEFAULT_COUNT)
       {
-        if( !(check_having_blocks && m_core.have_block(*it)))
+        if((check_having_blocks && m_core.have_block(*it)) || m_sync_requested_blocks.count(*it))
+        {
+          if(req.blocks.size())
+            break;
+        }
+        else
         {
           req.blocks.push_back(*it);
-          ++count;
           context.m_requested_objects.insert(*it);
+          sync_claim& claim = m_sync_requested_blocks[*it];
+          claim.connection_id = context.m_connection_id;
+          claim.time = time(NULL);
+          claim.in_span = false;
         }
         context.m_needed_objects.erase(it++);
       }
+      if(req.blocks.empty() && !m_sync_requested_blocks.empty())
+      {
+        //everything this connection knows about is being downloaded by others
+        m_sync_waiting_connections.insert(context.m_connection_id);
+        return true;
+      }
+    }
+
+    if(req.blocks.size())
+    {
       LOG_PRINT_CCONTEXT_L2("-->>NOTIFY_REQUEST_GET_OBJECTS: blocks.size()=" << req.blocks.size() << ", txs.size()=" << req.txs.size());
       post_notify<NOTIFY_REQUEST_GET_OBJECTS>(req, context);    
     }else if(context.m_last_response_height < context.m_remote_blockchain_height-1)
@@ -567,7 +1069,44 @@ namespace cryptonote
   template<class t_core> 
   bool t_cryptonote_protocol_handler<t_core>::relay_block(NOTIFY_NEW_BLOCK::request& arg, cryptonote_connection_context& exclude_context)
   {
-    return relay_post_notify<NOTIFY_NEW_BLOCK>(arg, exclude_context);
+    //a block found here is made of pool transactions, which were relayed already
+    return relay_block_to_peers(arg, std::list<blobdata>(), exclude_context);
+  }
+  //------------------------------------------------------------------------------------------------------------------------
+  template<class t_core>
+  bool t_cryptonote_protocol_handler<t_core>::relay_block_to_peers(NOTIFY_NEW_BLOCK::request& arg, const std::list<blobdata>& unknown_txs, cryptonote_connection_context& exclude_context)
+  {
+    NOTIFY_NEW_COMPACT_BLOCK::request compact_arg = AUTO_VAL_INIT(compact_arg);
+    compact_arg.b.block = arg.b.block;
+    compact_arg.b.txs = unknown_txs;
+    compact_arg.current_blockchain_height = arg.current_blockchain_height;
+    compact_arg.hop = arg.hop;
+
+    std::list<epee::net_utils::connection_context_base> full_peers;
+    std::list<epee::net_utils::connection_context_base> compact_peers;
+    m_p2p->for_each_connection([&](cryptonote_connection_context& context, nodetool::peerid_type peer_id)->bool{
+      if(peer_id && context.m_connection_id != exclude_context.m_connection_id)
+        (context.m_compact_blocks ? compact_peers : full_peers).push_back(context);
+      return true;
+    });
+    LOG_PRINT_L2("[" << epee::net_utils::print_connection_context_short(exclude_context) << "] post relay block to "
+      << compact_peers.size() << " peers with " << compact_arg.b.txs.size() << " of " << arg.b.txs.size() << " transactions, "
+      << full_peers.size() << " peers with all -->");
+
+    std::string arg_buff;
+    if(full_peers.size())
+    {
+      epee::serialization::store_t_to_binary(arg, arg_buff);
+      BOOST_FOREACH(const epee::net_utils::connection_context_base& context, full_peers)
+        m_p2p->invoke_notify_to_peer(NOTIFY_NEW_BLOCK::ID, arg_buff, context);
+    }
+    if(compact_peers.size())
+    {
+      epee::serialization::store_t_to_binary(compact_arg, arg_buff);
+      BOOST_FOREACH(const epee::net_utils::connection_context_base& context, compact_peers)
+        m_p2p->invoke_notify_to_peer(NOTIFY_NEW_COMPACT_BLOCK::ID, arg_buff, context);
+    }
+    return true;
   }
   //------------------------------------------------------------------------------------------------------------------------
   template<class t_core> 
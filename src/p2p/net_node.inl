@@ -1265,6 +1265,7 @@ namespace nodetool
   void node_server<t_payload_net_handler>::on_connection_close(p2p_connection_context& context)
   {
     LOG_PRINT_L2("["<< epee::net_utils::print_connection_context(context) << "] CLOSE CONNECTION");
+    m_payload_handler.on_connection_close(context);
   }
 
   template<class t_payload_net_handler>
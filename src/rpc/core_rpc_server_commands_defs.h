@@ -90,6 +90,68 @@ namespace cryptonote
     };
   };
   //-----------------------------------------------
+  struct COMMAND_RPC_GET_BLOCKS_COMPACT
+  {
+    typedef COMMAND_RPC_GET_BLOCKS_FAST::request request;
+
+    // only what view key scanning needs; non to_key outputs get a null key
+    struct tx_entry
+    {
+      crypto::hash id;
+      crypto::public_key pub_key;                         //null_pkey if extra holds none
+      std::vector<crypto::public_key> output_keys;
+      std::vector<uint64_t> output_amounts;
+      std::vector<uint64_t> global_output_indexes;
+      std::vector<crypto::key_image> key_images;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE_VAL_POD_AS_BLOB(id)
+        KV_SERIALIZE_VAL_POD_AS_BLOB(pub_key)
+        KV_SERIALIZE_CONTAINER_POD_AS_BLOB(output_keys)
+        KV_SERIALIZE_CONTAINER_POD_AS_BLOB(output_amounts)
+        KV_SERIALIZE_CONTAINER_POD_AS_BLOB(global_output_indexes)
+        KV_SERIALIZE_CONTAINER_POD_AS_BLOB(key_images)
+      END_KV_SERIALIZE_MAP()
+    };
+
+    // the header and the transaction ids let the wallet check the block id
+    struct block_entry
+    {
+      crypto::hash id;
+      uint8_t major_version;
+      uint8_t minor_version;
+      uint64_t timestamp;
+      crypto::hash prev_id;
+      uint32_t nonce;
+      std::vector<tx_entry> txs;                          //miner tx first
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE_VAL_POD_AS_BLOB(id)
+        KV_SERIALIZE(major_version)
+        KV_SERIALIZE(minor_version)
+        KV_SERIALIZE(timestamp)
+        KV_SERIALIZE_VAL_POD_AS_BLOB(prev_id)
+        KV_SERIALIZE(nonce)
+        KV_SERIALIZE(txs)
+      END_KV_SERIALIZE_MAP()
+    };
+
+    struct response
+    {
+      std::list<block_entry> blocks;
+      uint64_t    start_height;
+      uint64_t    current_height;
+      std::string status;
+
+      BEGIN_KV_SERIALIZE_MAP()
+        KV_SERIALIZE(blocks)
+        KV_SERIALIZE(start_height)
+        KV_SERIALIZE(current_height)
+        KV_SERIALIZE(status)
+      END_KV_SERIALIZE_MAP()
+    };
+  };
+  //-----------------------------------------------
   struct COMMAND_RPC_GET_TRANSACTIONS
   {
     struct request
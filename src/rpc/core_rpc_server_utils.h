@@ -0,0 +1,70 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <boost/foreach.hpp>
+
+#include "core_rpc_server_commands_defs.h"
+#include "cryptonote_core/cryptonote_format_utils.h"
+
+namespace cryptonote
+{
+  /************************************************************************/
+  /* Entries of getblocks_compact.bin, built by the core and by the       */
+  /* wallet's offline block sources alike                                 */
+  /************************************************************************/
+  inline void get_compact_block_header(const block_header& bl, const crypto::hash& id, COMMAND_RPC_GET_BLOCKS_COMPACT::block_entry& e)
+  {
+    e.id = id;
+    e.major_version = bl.major_version;
+    e.minor_version = bl.minor_version;
+    e.timestamp = bl.timestamp;
+    e.prev_id = bl.prev_id;
+    e.nonce = bl.nonce;
+  }
+  //---------------------------------------------------------------
+  inline void get_compact_tx_entry(const transaction& tx, const crypto::hash& tx_id, const std::vector<uint64_t>& global_output_indexes, COMMAND_RPC_GET_BLOCKS_COMPACT::tx_entry& e)
+  {
+    e.id = tx_id;
+    e.pub_key = tx.vout.empty() ? null_pkey : get_tx_pub_key_from_extra(tx);
+    e.output_keys.reserve(tx.vout.size());
+    e.output_amounts.reserve(tx.vout.size());
+    BOOST_FOREACH(const tx_out& out, tx.vout)
+    {
+      e.output_keys.push_back(out.target.type() == typeid(txout_to_key) ? boost::get<txout_to_key>(out.target).key : null_pkey);
+      e.output_amounts.push_back(out.amount);
+    }
+    e.global_output_indexes = global_output_indexes;
+    BOOST_FOREACH(const txin_v& in, tx.vin)
+    {
+      if(in.type() == typeid(txin_to_key))
+        e.key_images.push_back(boost::get<txin_to_key>(in).k_image);
+    }
+  }
+}
@@ -47,7 +47,9 @@
 #include "cryptonote_protocol/cryptonote_protocol_handler.h"
 #include "simplewallet.h"
 #include "cryptonote_core/cryptonote_format_utils.h"
+#include "cryptonote_core/blockchain_snapshot.h"
 #include "storages/http_abstract_invoke.h"
+#include "misc_language.h"
 #include "rpc/core_rpc_server_commands_defs.h"
 #include "wallet/wallet_rpc_server.h"
 #include "version.h"
@@ -83,6 +85,7 @@ namespace
   const command_line::arg_descriptor<uint32_t> arg_log_level = {"set_log", "", 0, true};
   const command_line::arg_descriptor<bool> arg_testnet = {"testnet", "Used to deploy test nets. The daemon must be launched with --testnet flag", false};
   const command_line::arg_descriptor<bool> arg_restricted = {"restricted-rpc", "Restricts RPC to view only commands", false};
+  const command_line::arg_descriptor< std::vector<std::string> > arg_scan_wallet_file = {"scan-wallet-file", "Keep wallet <file>[:<password-file>] refreshed along with the RPC wallet, the password is asked for if no file has it"};
 
   const command_line::arg_descriptor< std::vector<std::string> > arg_command = {"command", ""};
 
@@ -185,6 +188,53 @@ namespace
   {
     return message_writer(epee::log_space::console_color_red, true, "Error: ", LOG_LEVEL_0);
   }
+
+  // blocks of a daemon's stored blockchain, for refresh_offline
+  class snapshot_block_source: public tools::i_wallet2_block_source
+  {
+  public:
+    snapshot_block_source(cryptonote::blockchain_snapshot& snapshot): m_snapshot(snapshot) {}
+
+    virtual uint64_t height() { return m_snapshot.height(); }
+    virtual bool get_block_id(uint64_t height, crypto::hash& id) { return m_snapshot.get_block_id(height, id); }
+    virtual bool get_blocks(uint64_t start_height, size_t max_count, std::list<cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::block_entry>& blocks, std::unordered_map<crypto::hash, cryptonote::transaction>& txs)
+    {
+      return m_snapshot.get_blocks(start_height, max_count, blocks, txs);
+    }
+
+  private:
+    cryptonote::blockchain_snapshot& m_snapshot;
+  };
+
+  // splits a --scan-wallet-file argument, reading the password from its file or from the terminal
+  bool get_scan_wallet(const std::string& arg, std::string& wallet_file, std::string& password)
+  {
+    //a colon right after a drive letter isn't a separator
+    std::string::size_type pos = arg.rfind(':');
+    if(pos == std::string::npos || (pos == 1 && arg.size() > 2 && (arg[2] == '\\' || arg[2] == '/')))
+    {
+      wallet_file = arg;
+      std::cout << "Wallet " << wallet_file << " ";
+      tools::password_container pwd_container;
+      if(!pwd_container.read_password())
+      {
+        LOG_ERROR("Failed to read the password of wallet " << wallet_file);
+        return false;
+      }
+      password = pwd_container.password();
+      return true;
+    }
+
+    wallet_file = arg.substr(0, pos);
+    std::string password_file = arg.substr(pos + 1);
+    if(!epee::file_io_utils::load_file_to_string(password_file, password))
+    {
+      LOG_ERROR("Failed to read the password of wallet " << wallet_file << " from " << password_file);
+      return false;
+    }
+    boost::trim_right_if(password, boost::is_any_of("\r\n"));
+    return true;
+  }
 }
 
 
@@ -277,6 +327,7 @@ simple_wallet::simple_wallet()
   m_cmd_binder.set_handler("stop_mining", boost::bind(&simple_wallet::stop_mining, this, _1), "Stop mining in daemon");
   m_cmd_binder.set_handler("save_bc", boost::bind(&simple_wallet::save_bc, this, _1), "Save current blockchain data");
   m_cmd_binder.set_handler("refresh", boost::bind(&simple_wallet::refresh, this, _1), "Resynchronize transactions and balance");
+  m_cmd_binder.set_handler("refresh_offline", boost::bind(&simple_wallet::refresh_offline, this, _1), "refresh_offline <blockchain_dir> - Resynchronize from the blockchain data dir of a daemon, without connecting to it. The daemon must be stopped");
   m_cmd_binder.set_handler("balance", boost::bind(&simple_wallet::show_balance, this, _1), "Show current wallet balance");
   m_cmd_binder.set_handler("incoming_transfers", boost::bind(&simple_wallet::show_incoming_transfers, this, _1), "incoming_transfers [available|unavailable] - Show incoming transfers - all of them or filter them by availability");
   m_cmd_binder.set_handler("payments", boost::bind(&simple_wallet::show_payments, this, _1), "payments <payment_id_1> [<payment_id_2> ... <payment_id_N>] - Show payments <payment_id_1>, ... <payment_id_N>");
@@ -820,7 +871,7 @@ bool simple_wallet::save_bc(const std::vector<std::string>& args)
   return true;
 }
 //----------------------------------------------------------------------------------------------------
-void simple_wallet::on_new_block(uint64_t height, const cryptonote::block& block)
+void simple_wallet::on_new_block(uint64_t height, const crypto::hash& block_id)
 {
   m_refresh_progress_reporter.update(height, false);
 }
@@ -834,12 +885,12 @@ void simple_wallet::on_money_received(uint64_t height, const cryptonote::transac
   m_refresh_progress_reporter.update(height, true);
 }
 //----------------------------------------------------------------------------------------------------
-void simple_wallet::on_money_spent(uint64_t height, const cryptonote::transaction& in_tx, size_t out_index, const cryptonote::transaction& spend_tx)
+void simple_wallet::on_money_spent(uint64_t height, const crypto::hash& in_txid, uint64_t amount, const cryptonote::transaction& spend_tx)
 {
   message_writer(epee::log_space::console_color_magenta, false) <<
     "Height " << height <<
     ", transaction " << get_transaction_hash(spend_tx) <<
-    ", spent " << print_money(in_tx.vout[out_index].amount);
+    ", spent " << print_money(amount);
   m_refresh_progress_reporter.update(height, true);
 }
 //----------------------------------------------------------------------------------------------------
@@ -925,6 +976,44 @@ bool simple_wallet::refresh(const std::vector<std::string>& args)
   return true;
 }
 //----------------------------------------------------------------------------------------------------
+bool simple_wallet::refresh_offline(const std::vector<std::string>& args)
+{
+  if(args.size() != 1)
+  {
+    fail_msg_writer() << "use: refresh_offline <blockchain_dir>";
+    return true;
+  }
+
+  cryptonote::blockchain_snapshot snapshot;
+  if(!snapshot.open(args[0]))
+  {
+    fail_msg_writer() << "can't read blockchain data in " << args[0] << ", stop the daemon using it first";
+    return true;
+  }
+
+  message_writer() << "Starting refresh from " << args[0] << "...";
+  //the progress reporter asks the daemon for its height, keep notifications off while there's no daemon
+  m_wallet->callback(0);
+  auto callback_restorer = epee::misc_utils::create_scope_leave_handler([this]() { m_wallet->callback(this); });
+  size_t fetched_blocks = 0;
+  try
+  {
+    snapshot_block_source source(snapshot);
+    m_wallet->refresh_offline(source, fetched_blocks);
+    // Clear line "Height xxx of xxx"
+    std::cout << "\r                                                                \r";
+    success_msg_writer(true) << "Refresh done, blocks received: " << fetched_blocks;
+    show_balance();
+  }
+  catch (const std::exception& e)
+  {
+    LOG_ERROR("refresh error: " << e.what());
+    fail_msg_writer() << "refresh failed: " << e.what() << ". Blocks received: " << fetched_blocks;
+  }
+
+  return true;
+}
+//----------------------------------------------------------------------------------------------------
 bool simple_wallet::show_balance(const std::vector<std::string>& args/* = std::vector<std::string>()*/)
 {
   success_msg_writer() << "balance: " << print_money(m_wallet->balance()) << ", unlocked balance: " << print_money(m_wallet->unlocked_balance());
@@ -966,7 +1055,7 @@ bool simple_wallet::show_incoming_transfers(const std::vector<std::string>& args
         std::setw(21) << print_money(td.amount()) << '\t' <<
         std::setw(3) << (td.m_spent ? 'T' : 'F') << "  \t" <<
         std::setw(12) << td.m_global_output_index << '\t' <<
-        get_transaction_hash(td.m_tx);
+        td.m_txid;
     }
   }
 
@@ -1344,6 +1433,7 @@ int main(int argc, char* argv[])
   command_line::add_arg(desc_params, arg_electrum_seed );
   command_line::add_arg(desc_params, arg_testnet);
   command_line::add_arg(desc_params, arg_restricted);
+  command_line::add_arg(desc_params, arg_scan_wallet_file);
   tools::wallet_rpc_server::init_options(desc_params);
 
   po::positional_options_description positional_options;
@@ -1428,12 +1518,29 @@ int main(int argc, char* argv[])
       daemon_address = std::string("http://") + daemon_host + ":" + std::to_string(daemon_port);
 
     tools::wallet2 wal(testnet,restricted);
+    //the other wallets are only kept refreshed, each block batch is fetched once for all of them
+    std::vector<std::unique_ptr<tools::wallet2>> scanned_wallets;
+    tools::wallet_scanner scanner;
     try
     {
       LOG_PRINT_L0("Loading wallet...");
       wal.load(wallet_file, wallet_password);
       wal.init(daemon_address);
-      wal.refresh();
+      scanner.init(daemon_address);
+      scanner.add_wallet(wal);
+      BOOST_FOREACH(const std::string& scan_wallet, command_line::get_arg(vm, arg_scan_wallet_file))
+      {
+        std::string scan_wallet_file;
+        std::string scan_wallet_password;
+        if(!get_scan_wallet(scan_wallet, scan_wallet_file, scan_wallet_password))
+          return 1;
+        scanned_wallets.push_back(std::unique_ptr<tools::wallet2>(new tools::wallet2(testnet, restricted)));
+        scanned_wallets.back()->load(scan_wallet_file, scan_wallet_password);
+        scanned_wallets.back()->init(daemon_address);
+        scanner.add_wallet(*scanned_wallets.back());
+      }
+      if(scanner.refresh())
+        scanner.store();
       LOG_PRINT_GREEN("Loaded ok", LOG_LEVEL_0);
     }
     catch (const std::exception& e)
@@ -1441,13 +1548,14 @@ int main(int argc, char* argv[])
       LOG_ERROR("Wallet initialize failed: " << e.what());
       return 1;
     }
-    tools::wallet_rpc_server wrpc(wal);
+    tools::wallet_rpc_server wrpc(wal, scanner);
     bool r = wrpc.init(vm);
     CHECK_AND_ASSERT_MES(r, 1, "Failed to initialize wallet rpc server");
 
-    tools::signal_handler::install([&wrpc, &wal] {
+    tools::signal_handler::install([&wrpc, &scanner] {
       wrpc.send_stop_signal();
-      wal.store();
+      scanner.stop();
+      scanner.store();
     });
     LOG_PRINT_L0("Starting wallet rpc server");
     wrpc.run();
@@ -1455,7 +1563,7 @@ int main(int argc, char* argv[])
     try
     {
       LOG_PRINT_L0("Storing wallet...");
-      wal.store();
+      scanner.store();
       LOG_PRINT_GREEN("Stored ok", LOG_LEVEL_0);
     }
     catch (const std::exception& e)
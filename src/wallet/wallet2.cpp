@@ -28,6 +28,8 @@
 // 
 // Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
 
+#include <limits>
+#include <unordered_set>
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/archive/binary_iarchive.hpp>
 
@@ -38,7 +40,7 @@ using namespace epee;
 #include "cryptonote_config.h"
 #include "wallet2.h"
 #include "cryptonote_core/cryptonote_format_utils.h"
-#include "rpc/core_rpc_server_commands_defs.h"
+#include "rpc/core_rpc_server_utils.h"
 #include "misc_language.h"
 #include "cryptonote_core/cryptonote_basic_impl.h"
 #include "common/boost_serialization_helper.h"
@@ -48,6 +50,7 @@ using namespace epee;
 #include "cryptonote_protocol/blobdatatype.h"
 #include "mnemonics/electrum-words.h"
 #include "common/dns_utils.h"
+#include "common/parallel.h"
 #include "rapidjson/document.h"
 #include "rapidjson/writer.h"
 #include "rapidjson/stringbuffer.h"
@@ -81,6 +84,8 @@ namespace tools
 {
 // for now, limit to 30 attempts.  TODO: discuss a good number to limit to.
 const size_t MAX_SPLIT_ATTEMPTS = 30;
+// m_unlocked_positions entry of transfers that are spent or still locked
+const size_t NOT_UNLOCKED = std::numeric_limits<size_t>::max();
 
 //----------------------------------------------------------------------------------------------------
 void wallet2::init(const std::string& daemon_address, uint64_t upper_transaction_size_limit)
@@ -139,71 +144,96 @@ bool wallet2::is_deprecated() const
   return is_old_file_format;
 }
 //----------------------------------------------------------------------------------------------------
-void wallet2::process_new_transaction(const cryptonote::transaction& tx, uint64_t height)
+void wallet2::scan_new_transaction(const compact_tx_entry& te, scanned_transaction& scan) const
 {
-  process_unconfirmed(tx);
-  std::vector<size_t> outs;
-  uint64_t tx_money_got_in_outs = 0;
+  scan.outs.clear();
+  scan.key_images.clear();
+  scan.key_images_valid = true;
+  scan.money_got_in_outs = 0;
+  scan.needs_tx = false;
+
+  // Don't try to look up outputs if tx has no ouputs or no public key
+  if(te.output_keys.empty() || te.pub_key == null_pkey)
+    return;
+
+  //anyone can put a key off the curve in tx extra, such a transaction pays nobody
+  if(!find_outs_to_acc(m_account.get_keys(), te.pub_key, te.output_keys, scan.outs))
+  {
+    LOG_PRINT_L0("Failed to derive output keys with public key " << te.pub_key << " of transaction " << te.id);
+    scan.outs.clear();
+    return;
+  }
+  BOOST_FOREACH(size_t o, scan.outs)
+  {
+    scan.money_got_in_outs += te.output_amounts[o];
+
+    cryptonote::keypair in_ephemeral;
+    scan.key_images.push_back(crypto::key_image());
+    cryptonote::generate_key_image_helper(m_account.get_keys(), te.pub_key, o, in_ephemeral, scan.key_images.back());
+    scan.key_images_valid = scan.key_images_valid && in_ephemeral.pub == te.output_keys[o];
+  }
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::process_new_transaction(const cryptonote::transaction& tx, const compact_tx_entry& te, const scanned_transaction& scan, uint64_t height)
+{
+  process_unconfirmed(te.id);
+  const std::vector<size_t>& outs = scan.outs;
+  uint64_t tx_money_got_in_outs = scan.money_got_in_outs;
 
   std::vector<tx_extra_field> tx_extra_fields;
   if(!parse_tx_extra(tx.extra, tx_extra_fields))
   {
     // Extra may only be partially parsed, it's OK if tx_extra_fields contains public key
-    LOG_PRINT_L0("Transaction extra has unsupported format: " << get_transaction_hash(tx));
+    LOG_PRINT_L0("Transaction extra has unsupported format: " << te.id);
   }
 
   // Don't try to extract tx public key if tx has no ouputs
   if (!tx.vout.empty()) 
   {
-    tx_extra_pub_key pub_key_field;
-    if(!find_tx_extra_field_by_type(tx_extra_fields, pub_key_field))
+    if(te.pub_key == null_pkey)
     {
-      LOG_PRINT_L0("Public key wasn't found in the transaction extra. Skipping transaction " << get_transaction_hash(tx));
+      LOG_PRINT_L0("Public key wasn't found in the transaction extra. Skipping transaction " << te.id);
       if(0 != m_callback)
 	m_callback->on_skip_transaction(height, tx);
       return;
     }
 
-    crypto::public_key tx_pub_key = pub_key_field.pub_key;
-    bool r = lookup_acc_outs(m_account.get_keys(), tx, tx_pub_key, outs, tx_money_got_in_outs);
-    THROW_WALLET_EXCEPTION_IF(!r, error::acc_outs_lookup_error, tx, tx_pub_key, m_account.get_keys());
-
     if(!outs.empty() && tx_money_got_in_outs)
     {
       //good news - got money! take care about it
       //usually we have only one transfer for user in transaction
-      cryptonote::COMMAND_RPC_GET_TX_GLOBAL_OUTPUTS_INDEXES::request req = AUTO_VAL_INIT(req);
-      cryptonote::COMMAND_RPC_GET_TX_GLOBAL_OUTPUTS_INDEXES::response res = AUTO_VAL_INIT(res);
-      req.txid = get_transaction_hash(tx);
-      bool r = net_utils::invoke_http_bin_remote_command2(m_daemon_address + "/get_o_indexes.bin", req, res, m_http_client, WALLET_RCP_CONNECTION_TIMEOUT);
-      THROW_WALLET_EXCEPTION_IF(!r, error::no_connection_to_daemon, "get_o_indexes.bin");
-      THROW_WALLET_EXCEPTION_IF(res.status == CORE_RPC_STATUS_BUSY, error::daemon_busy, "get_o_indexes.bin");
-      THROW_WALLET_EXCEPTION_IF(res.status != CORE_RPC_STATUS_OK, error::get_out_indices_error, res.status);
-      THROW_WALLET_EXCEPTION_IF(res.o_indexes.size() != tx.vout.size(), error::wallet_internal_error,
+      std::vector<uint64_t> fetched_global_output_indexes;
+      if(te.global_output_indexes.empty())
+        fetch_global_output_indexes(te.id, fetched_global_output_indexes);
+      const std::vector<uint64_t>& global_output_indexes = te.global_output_indexes.empty() ? fetched_global_output_indexes : te.global_output_indexes;
+      THROW_WALLET_EXCEPTION_IF(global_output_indexes.size() != tx.vout.size(), error::wallet_internal_error,
 				"transactions outputs size=" + std::to_string(tx.vout.size()) +
-				" not match with COMMAND_RPC_GET_TX_GLOBAL_OUTPUTS_INDEXES response size=" + std::to_string(res.o_indexes.size()));
+				" not match with global indexes size=" + std::to_string(global_output_indexes.size()));
+      THROW_WALLET_EXCEPTION_IF(!scan.key_images_valid, error::wallet_internal_error, "key_image generated ephemeral public key not matched with output_key");
 
-      BOOST_FOREACH(size_t o, outs)
+      for(size_t i = 0; i < outs.size(); ++i)
       {
+	size_t o = outs[i];
 	THROW_WALLET_EXCEPTION_IF(tx.vout.size() <= o, error::wallet_internal_error, "wrong out in transaction: internal index=" +
 				  std::to_string(o) + ", total_outs=" + std::to_string(tx.vout.size()));
+	THROW_WALLET_EXCEPTION_IF(tx.vout[o].target.type() != typeid(cryptonote::txout_to_key) ||
+				  boost::get<cryptonote::txout_to_key>(tx.vout[o].target).key != te.output_keys[o],
+				  error::wallet_internal_error, "output_key in transaction not matched with COMMAND_RPC_GET_BLOCKS_COMPACT response");
 
 	m_transfers.push_back(boost::value_initialized<transfer_details>());
 	transfer_details& td = m_transfers.back();
 	td.m_block_height = height;
+	td.set_tx(tx, o);
 	td.m_internal_output_index = o;
-	td.m_global_output_index = res.o_indexes[o];
-	td.m_tx = tx;
+	td.m_global_output_index = global_output_indexes[o];
 	td.m_spent = false;
-	cryptonote::keypair in_ephemeral;
-	cryptonote::generate_key_image_helper(m_account.get_keys(), tx_pub_key, o, in_ephemeral, td.m_key_image);
-	THROW_WALLET_EXCEPTION_IF(in_ephemeral.pub != boost::get<cryptonote::txout_to_key>(tx.vout[o].target).key,
-				  error::wallet_internal_error, "key_image generated ephemeral public key not matched with output_key");
+	td.m_key_image = scan.key_images[i];
 
 	m_key_images[td.m_key_image] = m_transfers.size()-1;
-	LOG_PRINT_L0("Received money: " << print_money(td.amount()) << ", with tx: " << get_transaction_hash(tx));
+	add_unspent_transfer(m_transfers.size()-1);
+	LOG_PRINT_L0("Received money: " << print_money(td.amount()) << ", with tx: " << te.id);
 	if (0 != m_callback)
-	  m_callback->on_money_received(height, td.m_tx, td.m_internal_output_index);
+	  m_callback->on_money_received(height, tx, td.m_internal_output_index);
       }
     }
   }
@@ -217,12 +247,12 @@ void wallet2::process_new_transaction(const cryptonote::transaction& tx, uint64_
     auto it = m_key_images.find(boost::get<cryptonote::txin_to_key>(in).k_image);
     if(it != m_key_images.end())
     {
-      LOG_PRINT_L0("Spent money: " << print_money(boost::get<cryptonote::txin_to_key>(in).amount) << ", with tx: " << get_transaction_hash(tx));
+      LOG_PRINT_L0("Spent money: " << print_money(boost::get<cryptonote::txin_to_key>(in).amount) << ", with tx: " << te.id);
       tx_money_spent_in_ins += boost::get<cryptonote::txin_to_key>(in).amount;
       transfer_details& td = m_transfers[it->second];
-      td.m_spent = true;
+      set_spent(it->second, true);
       if (0 != m_callback)
-        m_callback->on_money_spent(height, td.m_tx, td.m_internal_output_index, tx);
+        m_callback->on_money_spent(height, td.m_txid, td.amount(), tx);
     }
   }
 
@@ -239,7 +269,7 @@ void wallet2::process_new_transaction(const cryptonote::transaction& tx, uint64_
   if (0 < received)
   {
     payment_details payment;
-    payment.m_tx_hash      = cryptonote::get_transaction_hash(tx);
+    payment.m_tx_hash      = te.id;
     payment.m_amount       = received;
     payment.m_block_height = height;
     payment.m_unlock_time  = tx.unlock_time;
@@ -248,43 +278,75 @@ void wallet2::process_new_transaction(const cryptonote::transaction& tx, uint64_
   }
 }
 //----------------------------------------------------------------------------------------------------
-void wallet2::process_unconfirmed(const cryptonote::transaction& tx)
+void wallet2::transfer_details::set_tx(const cryptonote::transaction& tx, size_t internal_output_index)
+{
+  m_txid = get_transaction_hash(tx);
+  m_tx_pub_key = get_tx_pub_key_from_extra(tx);
+  m_output_key = null_pkey;
+  m_amount = 0;
+  if(internal_output_index < tx.vout.size())
+  {
+    const tx_out& out = tx.vout[internal_output_index];
+    m_amount = out.amount;
+    if(out.target.type() == typeid(txout_to_key))
+      m_output_key = boost::get<txout_to_key>(out.target).key;
+  }
+  m_unlock_time = tx.unlock_time;
+  m_tx_size = get_object_blobsize(tx);
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::process_unconfirmed(const crypto::hash& tx_id)
 {
-  auto unconf_it = m_unconfirmed_txs.find(get_transaction_hash(tx));
+  auto unconf_it = m_unconfirmed_txs.find(tx_id);
   if(unconf_it != m_unconfirmed_txs.end())
     m_unconfirmed_txs.erase(unconf_it);
 }
 //----------------------------------------------------------------------------------------------------
-void wallet2::process_new_blockchain_entry(const cryptonote::block& b, cryptonote::block_complete_entry& bche, crypto::hash& bl_id, uint64_t height)
+bool wallet2::is_block_scanned(uint64_t timestamp) const
 {
-  //handle transactions from new block
-    
   //optimization: seeking only for blocks that are not older then the wallet creation time plus 1 day. 1 day is for possible user incorrect time setup
-  if(b.timestamp + 60*60*24 > m_account.get_createtime())
-  {
-    TIME_MEASURE_START(miner_tx_handle_time);
-    process_new_transaction(b.miner_tx, height);
-    TIME_MEASURE_FINISH(miner_tx_handle_time);
+  return timestamp + 60*60*24 > m_account.get_createtime();
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::scan_block(const compact_block_entry& be, pending_block& pb) const
+{
+  if(!is_block_scanned(be.timestamp))
+    return;
 
+  pb.scans.resize(be.txs.size());
+  for(size_t i = 0; i < be.txs.size(); ++i)
+    scan_new_transaction(be.txs[i], pb.scans[i]);
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::process_new_blockchain_entry(const compact_block_entry& be, const pending_block& pb, const std::unordered_map<crypto::hash, cryptonote::transaction>& txs, uint64_t height)
+{
+  //handle transactions from new block
+  if(is_block_scanned(be.timestamp))
+  {
     TIME_MEASURE_START(txs_handle_time);
-    BOOST_FOREACH(auto& txblob, bche.txs)
+    for(size_t i = 0; i < be.txs.size(); ++i)
     {
-      cryptonote::transaction tx;
-      bool r = parse_and_validate_tx_from_blob(txblob, tx);
-      THROW_WALLET_EXCEPTION_IF(!r, error::tx_parse_error, txblob);
-      process_new_transaction(tx, height);
+      const compact_tx_entry& te = be.txs[i];
+      if(!pb.scans[i].needs_tx)
+      {
+        process_unconfirmed(te.id);
+        continue;
+      }
+      auto it = txs.find(te.id);
+      THROW_WALLET_EXCEPTION_IF(it == txs.end(), error::wallet_internal_error, "transaction " + string_tools::pod_to_hex(te.id) + " was not fetched");
+      process_new_transaction(it->second, te, pb.scans[i], height);
     }
     TIME_MEASURE_FINISH(txs_handle_time);
-    LOG_PRINT_L2("Processed block: " << bl_id << ", height " << height << ", " <<  miner_tx_handle_time + txs_handle_time << "(" << miner_tx_handle_time << "/" << txs_handle_time <<")ms");
+    LOG_PRINT_L2("Processed block: " << be.id << ", height " << height << ", " << txs_handle_time << "ms");
   }else
   {
-    LOG_PRINT_L2( "Skipped block by timestamp, height: " << height << ", block time " << b.timestamp << ", account time " << m_account.get_createtime());
+    LOG_PRINT_L2( "Skipped block by timestamp, height: " << height << ", block time " << be.timestamp << ", account time " << m_account.get_createtime());
   }
-  m_blockchain.push_back(bl_id);
+  m_blockchain.push_back(be.id);
   ++m_local_bc_height;
 
   if (0 != m_callback)
-    m_callback->on_new_block(height, b);
+    m_callback->on_new_block(height, be.id);
 }
 //----------------------------------------------------------------------------------------------------
 void wallet2::get_short_chain_history(std::list<crypto::hash>& ids)
@@ -314,51 +376,290 @@ void wallet2::get_short_chain_history(std::list<crypto::hash>& ids)
     ids.push_back(m_blockchain[0]);
 }
 //----------------------------------------------------------------------------------------------------
-void wallet2::pull_blocks(uint64_t start_height, size_t& blocks_added)
+void wallet2::fetch_blocks(epee::net_utils::http::http_simple_client& http_client, const std::string& daemon_address, uint64_t start_height, const std::list<crypto::hash>& short_chain_history, cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::response& res)
+{
+  cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::request req = AUTO_VAL_INIT(req);
+  req.block_ids = short_chain_history;
+  req.start_height = start_height;
+  std::string req_blob;
+  bool r = epee::serialization::store_t_to_binary(req, req_blob);
+  THROW_WALLET_EXCEPTION_IF(!r, error::wallet_internal_error, "failed to serialize getblocks_compact.bin request");
+  const net_utils::http::http_response_info* response = NULL;
+  r = net_utils::http::invoke_request(daemon_address + "/getblocks_compact.bin", http_client, WALLET_RCP_CONNECTION_TIMEOUT, &response, "GET", req_blob);
+  THROW_WALLET_EXCEPTION_IF(!r, error::no_connection_to_daemon, "getblocks_compact.bin");
+  if(response->m_response_code == 404)
+  {
+    LOG_PRINT_L1("Daemon has no getblocks_compact.bin, fetching full blocks");
+    fetch_full_blocks(http_client, daemon_address, start_height, short_chain_history, res);
+    return;
+  }
+  r = response->m_response_code == 200 && epee::serialization::load_t_from_binary(res, response->m_body);
+  THROW_WALLET_EXCEPTION_IF(!r, error::no_connection_to_daemon, "getblocks_compact.bin");
+  THROW_WALLET_EXCEPTION_IF(res.status == CORE_RPC_STATUS_BUSY, error::daemon_busy, "getblocks_compact.bin");
+  THROW_WALLET_EXCEPTION_IF(res.status != CORE_RPC_STATUS_OK, error::get_blocks_error, res.status);
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::fetch_full_blocks(epee::net_utils::http::http_simple_client& http_client, const std::string& daemon_address, uint64_t start_height, const std::list<crypto::hash>& short_chain_history, cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::response& res)
 {
-  blocks_added = 0;
   cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::request req = AUTO_VAL_INIT(req);
-  cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::response res = AUTO_VAL_INIT(res);
-  get_short_chain_history(req.block_ids);
+  cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::response full_res = AUTO_VAL_INIT(full_res);
+  req.block_ids = short_chain_history;
   req.start_height = start_height;
-  bool r = net_utils::invoke_http_bin_remote_command2(m_daemon_address + "/getblocks.bin", req, res, m_http_client, WALLET_RCP_CONNECTION_TIMEOUT);
+  bool r = net_utils::invoke_http_bin_remote_command2(daemon_address + "/getblocks.bin", req, full_res, http_client, WALLET_RCP_CONNECTION_TIMEOUT);
   THROW_WALLET_EXCEPTION_IF(!r, error::no_connection_to_daemon, "getblocks.bin");
-  THROW_WALLET_EXCEPTION_IF(res.status == CORE_RPC_STATUS_BUSY, error::daemon_busy, "getblocks.bin");
-  THROW_WALLET_EXCEPTION_IF(res.status != CORE_RPC_STATUS_OK, error::get_blocks_error, res.status);
-
-  size_t current_index = res.start_height;
-  BOOST_FOREACH(auto& bl_entry, res.blocks)
+  THROW_WALLET_EXCEPTION_IF(full_res.status == CORE_RPC_STATUS_BUSY, error::daemon_busy, "getblocks.bin");
+  THROW_WALLET_EXCEPTION_IF(full_res.status != CORE_RPC_STATUS_OK, error::get_blocks_error, full_res.status);
+
+  //the entries are built here as the daemon would; global output indexes are left out, and fetched for the outputs received only
+  res.blocks.clear();
+  res.start_height = full_res.start_height;
+  res.current_height = full_res.current_height;
+  res.status = full_res.status;
+  BOOST_FOREACH(const block_complete_entry& bl_entry, full_res.blocks)
   {
     cryptonote::block bl;
-    r = cryptonote::parse_and_validate_block_from_blob(bl_entry.block, bl);
+    r = parse_and_validate_block_from_blob(bl_entry.block, bl);
     THROW_WALLET_EXCEPTION_IF(!r, error::block_parse_error, bl_entry.block);
 
-    crypto::hash bl_id = get_block_hash(bl);
+    std::unordered_map<crypto::hash, cryptonote::transaction> txs;
+    BOOST_FOREACH(const cryptonote::blobdata& tx_blob, bl_entry.txs)
+    {
+      cryptonote::transaction tx;
+      r = parse_and_validate_tx_from_blob(tx_blob, tx);
+      THROW_WALLET_EXCEPTION_IF(!r, error::tx_parse_error, tx_blob);
+      txs[get_transaction_hash(tx)] = tx;
+    }
+
+    res.blocks.push_back(compact_block_entry());
+    compact_block_entry& e = res.blocks.back();
+    get_compact_block_header(bl, get_block_hash(bl), e);
+    e.txs.resize(bl.tx_hashes.size() + 1);
+    get_compact_tx_entry(bl.miner_tx, get_transaction_hash(bl.miner_tx), std::vector<uint64_t>(), e.txs[0]);
+    for(size_t i = 0; i < bl.tx_hashes.size(); ++i)
+    {
+      auto it = txs.find(bl.tx_hashes[i]);
+      THROW_WALLET_EXCEPTION_IF(it == txs.end(), error::wallet_internal_error,
+        "wrong daemon response: transaction " + string_tools::pod_to_hex(bl.tx_hashes[i]) + " of block " + string_tools::pod_to_hex(e.id) + " is missing");
+      get_compact_tx_entry(it->second, it->first, std::vector<uint64_t>(), e.txs[i + 1]);
+    }
+  }
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::fetch_global_output_indexes(const crypto::hash& tx_id, std::vector<uint64_t>& indexes)
+{
+  cryptonote::COMMAND_RPC_GET_TX_GLOBAL_OUTPUTS_INDEXES::request req = AUTO_VAL_INIT(req);
+  cryptonote::COMMAND_RPC_GET_TX_GLOBAL_OUTPUTS_INDEXES::response res = AUTO_VAL_INIT(res);
+  req.txid = tx_id;
+  bool r = net_utils::invoke_http_bin_remote_command2(m_daemon_address + "/get_o_indexes.bin", req, res, m_http_client, WALLET_RCP_CONNECTION_TIMEOUT);
+  THROW_WALLET_EXCEPTION_IF(!r, error::no_connection_to_daemon, "get_o_indexes.bin");
+  THROW_WALLET_EXCEPTION_IF(res.status == CORE_RPC_STATUS_BUSY, error::daemon_busy, "get_o_indexes.bin");
+  THROW_WALLET_EXCEPTION_IF(res.status != CORE_RPC_STATUS_OK, error::get_out_indices_error, res.status);
+  indexes.swap(res.o_indexes);
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::fetch_transactions(epee::net_utils::http::http_simple_client& http_client, const std::string& daemon_address, const std::list<crypto::hash>& tx_ids, std::unordered_map<crypto::hash, cryptonote::transaction>& txs)
+{
+  cryptonote::COMMAND_RPC_GET_TRANSACTIONS::request req = AUTO_VAL_INIT(req);
+  cryptonote::COMMAND_RPC_GET_TRANSACTIONS::response res = AUTO_VAL_INIT(res);
+  BOOST_FOREACH(const crypto::hash& tx_id, tx_ids)
+    req.txs_hashes.push_back(string_tools::pod_to_hex(tx_id));
+  bool r = net_utils::invoke_http_json_remote_command2(daemon_address + "/gettransactions", req, res, http_client, WALLET_RCP_CONNECTION_TIMEOUT);
+  THROW_WALLET_EXCEPTION_IF(!r, error::no_connection_to_daemon, "gettransactions");
+  THROW_WALLET_EXCEPTION_IF(res.status == CORE_RPC_STATUS_BUSY, error::daemon_busy, "gettransactions");
+  THROW_WALLET_EXCEPTION_IF(res.status != CORE_RPC_STATUS_OK, error::get_txs_error, res.status);
+  THROW_WALLET_EXCEPTION_IF(!res.missed_tx.empty(), error::wallet_internal_error, "daemon is missing transaction " + res.missed_tx.front());
+
+  BOOST_FOREACH(const std::string& tx_hex, res.txs_as_hex)
+  {
+    cryptonote::blobdata tx_blob;
+    cryptonote::transaction tx;
+    r = string_tools::parse_hexstr_to_binbuff(tx_hex, tx_blob) && parse_and_validate_tx_from_blob(tx_blob, tx);
+    THROW_WALLET_EXCEPTION_IF(!r, error::tx_parse_error, tx_blob);
+    txs[get_transaction_hash(tx)] = tx;
+  }
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::get_block_entries(const cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::response& res, std::vector<const compact_block_entry*>& entries)
+{
+  entries.clear();
+  BOOST_FOREACH(auto& bl_entry, res.blocks)
+  {
+    uint64_t height = res.start_height + entries.size();
+    std::vector<crypto::hash> tx_ids;
+    BOOST_FOREACH(auto& te, bl_entry.txs)
+    {
+      THROW_WALLET_EXCEPTION_IF(te.output_amounts.size() != te.output_keys.size(), error::wallet_internal_error,
+        "wrong daemon response: transaction " + string_tools::pod_to_hex(te.id) + " has " + std::to_string(te.output_keys.size()) +
+        " output keys and " + std::to_string(te.output_amounts.size()) + " amounts");
+      tx_ids.push_back(te.id);
+    }
+    THROW_WALLET_EXCEPTION_IF(tx_ids.empty(), error::wallet_internal_error,
+      "wrong daemon response: block " + string_tools::pod_to_hex(bl_entry.id) + " has no miner transaction");
+
+    //the id commits to the header and the transaction ids, the outputs themselves are checked against the full transactions
+    block_header header = AUTO_VAL_INIT(header);
+    header.major_version = bl_entry.major_version;
+    header.minor_version = bl_entry.minor_version;
+    header.timestamp = bl_entry.timestamp;
+    header.prev_id = bl_entry.prev_id;
+    header.nonce = bl_entry.nonce;
+    crypto::hash id = null_hash;
+    get_object_hash(get_block_hashing_blob(header, tx_ids), id);
+    //block 202612 has an id of its own, see get_block_hash
+    bool known_exception = height == 202612 && string_tools::pod_to_hex(bl_entry.id) == "bbd604d2ba11ba27935e006ed39c9bfdd99b76bf4a50654bc1e1e61217962698";
+    THROW_WALLET_EXCEPTION_IF(id != bl_entry.id && !known_exception, error::wallet_internal_error,
+      "wrong daemon response: block " + string_tools::pod_to_hex(bl_entry.id) + " at height " + std::to_string(height) +
+      " hashes to " + string_tools::pod_to_hex(id));
+    THROW_WALLET_EXCEPTION_IF(!entries.empty() && bl_entry.prev_id != entries.back()->id, error::wallet_internal_error,
+      "wrong daemon response: block " + string_tools::pod_to_hex(bl_entry.id) + " at height " + std::to_string(height) +
+      " is not on top of " + string_tools::pod_to_hex(entries.back()->id));
+    entries.push_back(&bl_entry);
+  }
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::get_pending_blocks(uint64_t start_height, const std::vector<const compact_block_entry*>& entries, std::vector<pending_block>& blocks) const
+{
+  //blocks up to the first unknown one are already ours, every block from there on gets applied
+  blocks.clear();
+  blocks.resize(entries.size());
+  bool processing = false;
+  for(size_t i = 0; i < blocks.size(); ++i)
+  {
+    size_t height = start_height + i;
+    processing = processing || height >= m_blockchain.size() || entries[i]->id != m_blockchain[height];
+    blocks[i].needs_processing = processing;
+  }
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::mark_needed_transactions(const std::vector<const compact_block_entry*>& entries, std::vector<pending_block>& blocks, std::list<crypto::hash>& needed_tx_ids) const
+{
+  //only transactions paying us, spending from us or to be skipped need to be fetched in full;
+  //spends of outputs received earlier in this batch are caught by their key images
+  std::unordered_set<crypto::key_image> batch_key_images;
+  for(size_t i = 0; i < entries.size(); ++i)
+  {
+    for(size_t j = 0; j < blocks[i].scans.size(); ++j)
+    {
+      const compact_tx_entry& te = entries[i]->txs[j];
+      scanned_transaction& scan = blocks[i].scans[j];
+      scan.needs_tx = !scan.outs.empty() || (te.pub_key == null_pkey && !te.output_keys.empty());
+      BOOST_FOREACH(const crypto::key_image& ki, te.key_images)
+      {
+        if(scan.needs_tx)
+          break;
+        scan.needs_tx = m_key_images.count(ki) || batch_key_images.count(ki);
+      }
+      if(scan.money_got_in_outs)
+        batch_key_images.insert(scan.key_images.begin(), scan.key_images.end());
+      if(scan.needs_tx)
+        needed_tx_ids.push_back(te.id);
+    }
+  }
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::apply_blocks(uint64_t start_height, const std::vector<const compact_block_entry*>& entries, const std::vector<pending_block>& blocks, const std::unordered_map<crypto::hash, cryptonote::transaction>& txs, size_t& blocks_added)
+{
+  size_t current_index = start_height;
+  //the entries are linked together, the first one has to be on top of ours
+  THROW_WALLET_EXCEPTION_IF(!entries.empty() && start_height > m_blockchain.size(), error::wallet_internal_error,
+    "wrong daemon response: blocks start at height " + std::to_string(start_height) + ", above local height " + std::to_string(m_blockchain.size()));
+  THROW_WALLET_EXCEPTION_IF(!entries.empty() && start_height && entries.front()->prev_id != m_blockchain[start_height - 1], error::wallet_internal_error,
+    "wrong daemon response: block " + string_tools::pod_to_hex(entries.front()->id) + " at height " + std::to_string(start_height) +
+    " is not on top of local block " + string_tools::pod_to_hex(m_blockchain[start_height - 1]));
+  for(size_t i = 0; i < entries.size(); ++i)
+  {
+    const compact_block_entry& bl_entry = *entries[i];
+    const pending_block& pb = blocks[i];
+
     if(current_index >= m_blockchain.size())
     {
-      process_new_blockchain_entry(bl, bl_entry, bl_id, current_index);
+      process_new_blockchain_entry(bl_entry, pb, txs, current_index);
       ++blocks_added;
     }
-    else if(bl_id != m_blockchain[current_index])
+    else if(bl_entry.id != m_blockchain[current_index])
     {
       //split detected here !!!
-      THROW_WALLET_EXCEPTION_IF(current_index == res.start_height, error::wallet_internal_error,
-        "wrong daemon response: split starts from the first block in response " + string_tools::pod_to_hex(bl_id) +
-        " (height " + std::to_string(res.start_height) + "), local block id at this height: " +
+      THROW_WALLET_EXCEPTION_IF(current_index == start_height, error::wallet_internal_error,
+        "wrong daemon response: split starts from the first block in response " + string_tools::pod_to_hex(bl_entry.id) +
+        " (height " + std::to_string(start_height) + "), local block id at this height: " +
         string_tools::pod_to_hex(m_blockchain[current_index]));
 
       detach_blockchain(current_index);
-      process_new_blockchain_entry(bl, bl_entry, bl_id, current_index);
+      process_new_blockchain_entry(bl_entry, pb, txs, current_index);
     }
     else
     {
-      LOG_PRINT_L2("Block is already in blockchain: " << string_tools::pod_to_hex(bl_id));
+      LOG_PRINT_L2("Block is already in blockchain: " << string_tools::pod_to_hex(bl_entry.id));
     }
 
     ++current_index;
   }
 }
 //----------------------------------------------------------------------------------------------------
+void wallet2::pull_blocks(uint64_t start_height, size_t& blocks_added, cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::response& next_blocks, bool& next_blocks_fetched)
+{
+  blocks_added = 0;
+  std::list<crypto::hash> short_chain_history;
+  get_short_chain_history(short_chain_history);
+  cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::response res = AUTO_VAL_INIT(res);
+  if(next_blocks_fetched)
+  {
+    std::swap(res, next_blocks);
+    next_blocks_fetched = false;
+  }
+  else
+  {
+    fetch_blocks(m_http_client, m_daemon_address, start_height, short_chain_history, res);
+  }
+
+  std::vector<const compact_block_entry*> entries;
+  get_block_entries(res, entries);
+  std::vector<pending_block> blocks;
+  get_pending_blocks(res.start_height, entries, blocks);
+
+  //fetch the next batch on a second connection while this one is scanned and applied
+  bool prefetched = false;
+  boost::thread prefetch_thread;
+  auto prefetch_joiner = epee::misc_utils::create_scope_leave_handler([&]() {
+    if(prefetch_thread.joinable())
+      prefetch_thread.join();
+  });
+  if(!blocks.empty() && blocks.back().needs_processing)
+  {
+    std::list<crypto::hash> next_short_chain_history = short_chain_history;
+    next_short_chain_history.push_front(entries.back()->id);
+    prefetch_thread = boost::thread([this, start_height, next_short_chain_history, &next_blocks, &prefetched]() {
+      try
+      {
+        fetch_blocks(m_prefetch_http_client, m_daemon_address, start_height, next_short_chain_history, next_blocks);
+        prefetched = true;
+      }
+      catch (const std::exception& e)
+      {
+        LOG_PRINT_L1("Prefetching blocks failed, they will be fetched again: " << e.what());
+      }
+    });
+  }
+
+  tools::run_in_parallel(entries.size(), [&](size_t i)
+  {
+    if(blocks[i].needs_processing)
+      scan_block(*entries[i], blocks[i]);
+  });
+
+  std::list<crypto::hash> needed_tx_ids;
+  mark_needed_transactions(entries, blocks, needed_tx_ids);
+  std::unordered_map<crypto::hash, cryptonote::transaction> txs;
+  if(!needed_tx_ids.empty())
+    fetch_transactions(m_http_client, m_daemon_address, needed_tx_ids, txs);
+
+  apply_blocks(res.start_height, entries, blocks, txs, blocks_added);
+
+  if(prefetch_thread.joinable())
+    prefetch_thread.join();
+  next_blocks_fetched = prefetched;
+}
+//----------------------------------------------------------------------------------------------------
 void wallet2::refresh()
 {
   size_t blocks_fetched = 0;
@@ -377,13 +678,16 @@ void wallet2::refresh(uint64_t start_height, size_t & blocks_fetched, bool& rece
   blocks_fetched = 0;
   size_t added_blocks = 0;
   size_t try_count = 0;
-  crypto::hash last_tx_hash_id = m_transfers.size() ? get_transaction_hash(m_transfers.back().m_tx) : null_hash;
+  crypto::hash last_tx_hash_id = m_transfers.size() ? m_transfers.back().m_txid : null_hash;
+  //the batch after the one being processed, fetched by pull_blocks in the meantime
+  cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::response next_blocks = AUTO_VAL_INIT(next_blocks);
+  bool next_blocks_fetched = false;
 
   while(m_run.load(std::memory_order_relaxed))
   {
     try
     {
-      pull_blocks(start_height, added_blocks);
+      pull_blocks(start_height, added_blocks, next_blocks, next_blocks_fetched);
       blocks_fetched += added_blocks;
       if(!added_blocks)
         break;
@@ -403,7 +707,7 @@ void wallet2::refresh(uint64_t start_height, size_t & blocks_fetched, bool& rece
       }
     }
   }
-  if(last_tx_hash_id != (m_transfers.size() ? get_transaction_hash(m_transfers.back().m_tx) : null_hash))
+  if(last_tx_hash_id != (m_transfers.size() ? m_transfers.back().m_txid : null_hash))
     received_money = true;
 
   LOG_PRINT_L1("Refresh done, blocks received: " << blocks_fetched << ", balance: " << print_money(balance()) << ", unlocked: " << print_money(unlocked_balance()));
@@ -423,6 +727,52 @@ bool wallet2::refresh(size_t & blocks_fetched, bool& received_money, bool& ok)
   return ok;
 }
 //----------------------------------------------------------------------------------------------------
+void wallet2::refresh_offline(i_wallet2_block_source& source, size_t& blocks_fetched)
+{
+  blocks_fetched = 0;
+
+  //resume after the last block the wallet shares with the source
+  uint64_t start_height = std::min<uint64_t>(m_blockchain.size(), source.height());
+  while(start_height)
+  {
+    crypto::hash id = null_hash;
+    THROW_WALLET_EXCEPTION_IF(!source.get_block_id(start_height - 1, id), error::wallet_internal_error,
+      "failed to read the block id on height " + std::to_string(start_height - 1));
+    if(id == m_blockchain[start_height - 1])
+      break;
+    --start_height;
+  }
+  THROW_WALLET_EXCEPTION_IF(!start_height && source.height(), error::wallet_internal_error,
+    "blockchain doesn't start with the genesis block of the wallet");
+  if(start_height < m_blockchain.size() && start_height < source.height())
+    detach_blockchain(start_height);
+
+  while(start_height < source.height() && m_run.load(std::memory_order_relaxed))
+  {
+    cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::response res = AUTO_VAL_INIT(res);
+    std::unordered_map<crypto::hash, cryptonote::transaction> txs;
+    bool r = source.get_blocks(start_height, COMMAND_RPC_GET_BLOCKS_FAST_MAX_COUNT, res.blocks, txs);
+    THROW_WALLET_EXCEPTION_IF(!r, error::wallet_internal_error, "failed to read blocks from height " + std::to_string(start_height));
+
+    std::vector<const compact_block_entry*> entries;
+    get_block_entries(res, entries);
+    std::vector<pending_block> blocks;
+    get_pending_blocks(start_height, entries, blocks);
+    tools::run_in_parallel(entries.size(), [&](size_t i)
+    {
+      if(blocks[i].needs_processing)
+        scan_block(*entries[i], blocks[i]);
+    });
+    //every transaction is at hand already, this only tells which ones to apply
+    std::list<crypto::hash> needed_tx_ids;
+    mark_needed_transactions(entries, blocks, needed_tx_ids);
+    apply_blocks(start_height, entries, blocks, txs, blocks_fetched);
+    start_height += entries.size();
+  }
+
+  LOG_PRINT_L1("Offline refresh done, blocks received: " << blocks_fetched << ", balance: " << print_money(balance()) << ", unlocked: " << print_money(unlocked_balance()));
+}
+//----------------------------------------------------------------------------------------------------
 void wallet2::detach_blockchain(uint64_t height)
 {
   LOG_PRINT_L0("Detaching blockchain on height " << height);
@@ -439,10 +789,13 @@ void wallet2::detach_blockchain(uint64_t height)
     ++transfers_detached;
   }
   m_transfers.erase(it, m_transfers.end());
+  m_stored_spent.resize(std::min(m_stored_spent.size(), i_start));
 
   size_t blocks_detached = m_blockchain.end() - (m_blockchain.begin()+height);
   m_blockchain.erase(m_blockchain.begin()+height, m_blockchain.end());
   m_local_bc_height -= blocks_detached;
+  m_stored_height = std::min(m_stored_height, height);
+  rebuild_unspent_transfers();
 
   for (auto it = m_payments.begin(); it != m_payments.end(); )
   {
@@ -465,6 +818,11 @@ bool wallet2::clear()
   m_blockchain.clear();
   m_transfers.clear();
   m_local_bc_height = 1;
+  m_cache_generation = 0;
+  m_cache_deltas.close();
+  m_stored_height = 0;
+  m_stored_spent.clear();
+  rebuild_unspent_transfers();
   return true;
 }
 
@@ -748,6 +1106,7 @@ void wallet2::load(const std::string& wallet_, const std::string& password)
       m_account_public_address.m_view_public_key  != m_account.get_keys().m_account_address.m_view_public_key,
       error::wallet_files_doesnt_correspond, m_keys_file, m_wallet_file);
   }
+  load_cache_deltas();
 
   cryptonote::block genesis;
   generate_genesis(genesis);
@@ -763,6 +1122,8 @@ void wallet2::load(const std::string& wallet_, const std::string& password)
   }
 
   m_local_bc_height = m_blockchain.size();
+  mark_cache_stored();
+  rebuild_unspent_transfers();
 }
 //----------------------------------------------------------------------------------------------------
 void wallet2::check_genesis(const crypto::hash& genesis_hash) {
@@ -773,27 +1134,137 @@ void wallet2::check_genesis(const crypto::hash& genesis_hash) {
 //----------------------------------------------------------------------------------------------------
 void wallet2::store()
 {
-  bool r = tools::serialize_obj_to_file(*this, m_wallet_file);
-  THROW_WALLET_EXCEPTION_IF(!r, error::file_save_error, m_wallet_file);
+  if(!store_cache_delta())
+  {
+    //a new generation, so that deltas of the previous cache file are never applied to this one
+    do
+      m_cache_generation = crypto::rand<uint64_t>();
+    while(!m_cache_generation);
+    bool r = tools::serialize_obj_to_file(*this, m_wallet_file);
+    THROW_WALLET_EXCEPTION_IF(!r, error::file_save_error, m_wallet_file);
+    if(m_cache_deltas.is_open() || open_cache_deltas())
+    {
+      m_cache_deltas.truncate(0);
+      m_cache_deltas.flush();
+    }
+  }
+  mark_cache_stored();
 }
 //----------------------------------------------------------------------------------------------------
-uint64_t wallet2::unlocked_balance()
+bool wallet2::store_cache_delta()
+{
+  boost::system::error_code e;
+  if(!m_cache_generation || !m_cache_deltas.is_open() || m_cache_deltas.size() >= WALLET_CACHE_MAX_DELTAS || !boost::filesystem::exists(m_wallet_file, e) || e)
+    return false;
+
+  cache_delta delta = AUTO_VAL_INIT(delta);
+  delta.generation = m_cache_generation;
+  delta.height = m_stored_height;
+  delta.blocks.assign(m_blockchain.begin() + m_stored_height, m_blockchain.end());
+  size_t i = 0;
+  for(; i < m_transfers.size() && m_transfers[i].m_block_height < m_stored_height; ++i)
+  {
+    if(i < m_stored_spent.size() && m_transfers[i].m_spent != m_stored_spent[i])
+      delta.spent.push_back(std::make_pair(i, m_transfers[i].m_spent));
+  }
+  delta.transfers.assign(m_transfers.begin() + i, m_transfers.end());
+  BOOST_FOREACH(const auto& payment, m_payments)
+  {
+    if(payment.second.m_block_height >= m_stored_height)
+      delta.payments.push_back(payment);
+  }
+  delta.unconfirmed_txs = m_unconfirmed_txs;
+
+  std::string blob;
+  bool r = tools::serialize_obj_to_blob(delta, blob);
+  CHECK_AND_ASSERT_MES(r, false, "failed to serialize wallet cache delta");
+  r = m_cache_deltas.append(blob) && m_cache_deltas.flush();
+  CHECK_AND_ASSERT_MES(r, false, "failed to append wallet cache delta, storing the whole cache");
+  LOG_PRINT_L2("Stored wallet cache delta from height " << delta.height << ": " << delta.blocks.size() << " blocks, " <<
+    delta.transfers.size() << " transfers, " << blob.size() << " bytes");
+  return true;
+}
+//----------------------------------------------------------------------------------------------------
+bool wallet2::open_cache_deltas()
+{
+  //a delta rarely holds more than a few transfers, the log doesn't need the default megabyte
+  return m_cache_deltas.open(m_wallet_file + ".deltas", false, WALLET_CACHE_MAX_DELTAS, WALLET_CACHE_MAX_DELTAS * WALLET_CACHE_DELTA_INITIAL_SIZE);
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::load_cache_deltas()
 {
-  uint64_t amount = 0;
-  BOOST_FOREACH(transfer_details& td, m_transfers)
-    if(!td.m_spent && is_transfer_unlocked(td))
-      amount += td.amount();
+  if(!open_cache_deltas())
+  {
+    LOG_PRINT_L0("Failed to open wallet cache deltas of " << m_wallet_file << ", the whole cache will be stored every time");
+    return;
+  }
 
-  return amount;
+  for(uint64_t i = 0; i < m_cache_deltas.size(); ++i)
+  {
+    std::string blob;
+    cache_delta delta = AUTO_VAL_INIT(delta);
+    bool r = m_cache_deltas.get(i, blob) && tools::unserialize_obj_from_blob(delta, blob);
+    if(!r || !m_cache_generation || delta.generation != m_cache_generation || delta.height > m_blockchain.size())
+    {
+      //left over from a previous cache file, or not completely written
+      LOG_PRINT_L0("Dropping " << m_cache_deltas.size() - i << " wallet cache deltas not matching " << m_wallet_file);
+      m_cache_deltas.truncate(i);
+      m_cache_deltas.flush();
+      break;
+    }
+    apply_cache_delta(delta);
+  }
 }
 //----------------------------------------------------------------------------------------------------
-uint64_t wallet2::balance()
+void wallet2::apply_cache_delta(const cache_delta& delta)
 {
-  uint64_t amount = 0;
-  BOOST_FOREACH(auto& td, m_transfers)
-    if(!td.m_spent)
-      amount += td.amount();
+  m_blockchain.resize(delta.height);
+  m_blockchain.insert(m_blockchain.end(), delta.blocks.begin(), delta.blocks.end());
+
+  auto it = std::find_if(m_transfers.begin(), m_transfers.end(), [&](const transfer_details& td){return td.m_block_height >= delta.height;});
+  for(auto it_td = it; it_td != m_transfers.end(); ++it_td)
+    m_key_images.erase(it_td->m_key_image);
+  m_transfers.erase(it, m_transfers.end());
+  BOOST_FOREACH(const auto& spent, delta.spent)
+  {
+    if(spent.first < m_transfers.size())
+      m_transfers[spent.first].m_spent = spent.second;
+  }
+  BOOST_FOREACH(const transfer_details& td, delta.transfers)
+  {
+    m_transfers.push_back(td);
+    m_key_images[td.m_key_image] = m_transfers.size() - 1;
+  }
 
+  for(auto it_p = m_payments.begin(); it_p != m_payments.end(); )
+  {
+    if(delta.height <= it_p->second.m_block_height)
+      it_p = m_payments.erase(it_p);
+    else
+      ++it_p;
+  }
+  m_payments.insert(delta.payments.begin(), delta.payments.end());
+
+  m_unconfirmed_txs = delta.unconfirmed_txs;
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::mark_cache_stored()
+{
+  m_stored_height = m_blockchain.size();
+  m_stored_spent.resize(m_transfers.size());
+  for(size_t i = 0; i < m_transfers.size(); ++i)
+    m_stored_spent[i] = m_transfers[i].m_spent;
+}
+//----------------------------------------------------------------------------------------------------
+uint64_t wallet2::unlocked_balance()
+{
+  update_unlocked_transfers();
+  return m_unlocked_money;
+}
+//----------------------------------------------------------------------------------------------------
+uint64_t wallet2::balance()
+{
+  uint64_t amount = m_unspent_money;
 
   BOOST_FOREACH(auto& utx, m_unconfirmed_txs)
     amount+= utx.second.m_change;
@@ -830,7 +1301,7 @@ void wallet2::get_payments(std::list<std::pair<crypto::hash,wallet2::payment_det
 //----------------------------------------------------------------------------------------------------
 bool wallet2::is_transfer_unlocked(const transfer_details& td) const
 {
-  if(!is_tx_spendtime_unlocked(td.m_tx.unlock_time))
+  if(!is_tx_spendtime_unlocked(td.m_unlock_time))
     return false;
 
   if(td.m_block_height + DEFAULT_TX_SPENDABLE_AGE > m_blockchain.size())
@@ -839,6 +1310,172 @@ bool wallet2::is_transfer_unlocked(const transfer_details& td) const
   return true;
 }
 //----------------------------------------------------------------------------------------------------
+uint64_t wallet2::get_unlock_height(const transfer_details& td) const
+{
+  //the chain height from which both the spendable age and a height based unlock time are reached
+  uint64_t height = td.m_block_height + DEFAULT_TX_SPENDABLE_AGE;
+  if(td.m_unlock_time < CRYPTONOTE_MAX_BLOCK_NUMBER && td.m_unlock_time + 1 > CRYPTONOTE_LOCKED_TX_ALLOWED_DELTA_BLOCKS)
+    height = std::max<uint64_t>(height, td.m_unlock_time + 1 - CRYPTONOTE_LOCKED_TX_ALLOWED_DELTA_BLOCKS);
+  return height;
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::set_spent(size_t idx, bool spent)
+{
+  transfer_details& td = m_transfers[idx];
+  if(td.m_spent == spent)
+    return;
+  td.m_spent = spent;
+  if(spent)
+    remove_unspent_transfer(idx);
+  else
+    add_unspent_transfer(idx);
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::add_unspent_transfer(size_t idx)
+{
+  const transfer_details& td = m_transfers[idx];
+  if(m_unlocked_positions.size() <= idx)
+    m_unlocked_positions.resize(idx + 1, NOT_UNLOCKED);
+  m_unspent_money += td.amount();
+
+  uint64_t unlock_height = get_unlock_height(td);
+  if(m_blockchain.size() < unlock_height)
+    m_locked_transfers.insert(std::make_pair(unlock_height, idx));
+  else if(!is_tx_spendtime_unlocked(td.m_unlock_time))
+    m_time_locked_transfers.insert(std::make_pair(td.m_unlock_time, idx));
+  else
+    add_unlocked_transfer(idx);
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::remove_unspent_transfer(size_t idx)
+{
+  const transfer_details& td = m_transfers[idx];
+  m_unspent_money -= td.amount();
+  if(m_unlocked_positions[idx] != NOT_UNLOCKED)
+  {
+    remove_unlocked_transfer(idx);
+    return;
+  }
+
+  auto erase_from = [idx](std::multimap<uint64_t, size_t>& transfers, uint64_t key)
+  {
+    auto range = transfers.equal_range(key);
+    for(auto it = range.first; it != range.second; ++it)
+    {
+      if(it->second == idx)
+      {
+        transfers.erase(it);
+        return true;
+      }
+    }
+    return false;
+  };
+  if(!erase_from(m_locked_transfers, get_unlock_height(td)))
+    erase_from(m_time_locked_transfers, td.m_unlock_time);
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::add_unlocked_transfer(size_t idx)
+{
+  uint64_t amount = m_transfers[idx].amount();
+  unlocked_transfers& unlocked = get_unlocked_transfers(amount);
+  std::vector<size_t>& bucket = unlocked.by_amount[amount];
+  m_unlocked_positions[idx] = bucket.size();
+  bucket.push_back(idx);
+  ++unlocked.count;
+  m_unlocked_money += amount;
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::remove_unlocked_transfer(size_t idx)
+{
+  uint64_t amount = m_transfers[idx].amount();
+  unlocked_transfers& unlocked = get_unlocked_transfers(amount);
+  auto it = unlocked.by_amount.find(amount);
+  std::vector<size_t>& bucket = it->second;
+  size_t pos = m_unlocked_positions[idx];
+  bucket[pos] = bucket.back();
+  m_unlocked_positions[bucket[pos]] = pos;
+  bucket.pop_back();
+  if(bucket.empty())
+    unlocked.by_amount.erase(it);
+  --unlocked.count;
+  m_unlocked_positions[idx] = NOT_UNLOCKED;
+  m_unlocked_money -= amount;
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::update_unlocked_transfers()
+{
+  while(!m_locked_transfers.empty() && m_locked_transfers.begin()->first <= m_blockchain.size())
+  {
+    size_t idx = m_locked_transfers.begin()->second;
+    m_locked_transfers.erase(m_locked_transfers.begin());
+    const transfer_details& td = m_transfers[idx];
+    if(!is_tx_spendtime_unlocked(td.m_unlock_time))
+      m_time_locked_transfers.insert(std::make_pair(td.m_unlock_time, idx));
+    else
+      add_unlocked_transfer(idx);
+  }
+
+  while(!m_time_locked_transfers.empty() && is_tx_spendtime_unlocked(m_time_locked_transfers.begin()->first))
+  {
+    size_t idx = m_time_locked_transfers.begin()->second;
+    m_time_locked_transfers.erase(m_time_locked_transfers.begin());
+    add_unlocked_transfer(idx);
+  }
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::rebuild_unspent_transfers()
+{
+  m_unlocked_dust = unlocked_transfers();
+  m_unlocked_non_dust = unlocked_transfers();
+  m_unlocked_positions.assign(m_transfers.size(), NOT_UNLOCKED);
+  m_locked_transfers.clear();
+  m_time_locked_transfers.clear();
+  m_unspent_money = 0;
+  m_unlocked_money = 0;
+  for(size_t i = 0; i < m_transfers.size(); ++i)
+  {
+    if(!m_transfers[i].m_spent)
+      add_unspent_transfer(i);
+  }
+}
+//----------------------------------------------------------------------------------------------------
+void wallet2::set_dust_threshold(uint64_t dust)
+{
+  if(dust == m_dust_threshold)
+    return;
+
+  //the buckets between the old and the new threshold change sides, the transfers in them keep their positions
+  bool raise = m_dust_threshold < dust;
+  unlocked_transfers& from = raise ? m_unlocked_non_dust : m_unlocked_dust;
+  unlocked_transfers& to = raise ? m_unlocked_dust : m_unlocked_non_dust;
+  auto first = raise ? from.by_amount.begin() : from.by_amount.upper_bound(dust);
+  auto last = raise ? from.by_amount.upper_bound(dust) : from.by_amount.end();
+  for(auto it = first; it != last; ++it)
+  {
+    from.count -= it->second.size();
+    to.count += it->second.size();
+    to.by_amount[it->first].swap(it->second);
+  }
+  from.by_amount.erase(first, last);
+  m_dust_threshold = dust;
+}
+//----------------------------------------------------------------------------------------------------
+bool wallet2::pop_random_unlocked_transfer(bool dust_outputs, size_t& idx)
+{
+  const unlocked_transfers& unlocked = dust_outputs ? m_unlocked_dust : m_unlocked_non_dust;
+  if(!unlocked.count)
+    return false;
+
+  //every transfer is as likely to come out, whatever the size of its bucket
+  size_t pos = crypto::rand<size_t>() % unlocked.count;
+  auto it = unlocked.by_amount.begin();
+  for(; pos >= it->second.size(); ++it)
+    pos -= it->second.size();
+  idx = it->second[pos];
+  remove_unlocked_transfer(idx);
+  return true;
+}
+//----------------------------------------------------------------------------------------------------
 bool wallet2::is_tx_spendtime_unlocked(uint64_t unlock_time) const
 {
   if(unlock_time < CRYPTONOTE_MAX_BLOCK_NUMBER)
@@ -860,68 +1497,36 @@ bool wallet2::is_tx_spendtime_unlocked(uint64_t unlock_time) const
   return false;
 }
 //----------------------------------------------------------------------------------------------------
-namespace
-{
-  template<typename T>
-  T pop_random_value(std::vector<T>& vec)
-  {
-    CHECK_AND_ASSERT_MES(!vec.empty(), T(), "Vector must be non-empty");
-
-    size_t idx = crypto::rand<size_t>() % vec.size();
-    T res = vec[idx];
-    if (idx + 1 != vec.size())
-    {
-      vec[idx] = vec.back();
-    }
-    vec.resize(vec.size() - 1);
-
-    return res;
-  }
-}
-//----------------------------------------------------------------------------------------------------
 // Select random input sources for transaction.
 // returns:
 //    direct return: amount of money found
 //    modified reference: selected_transfers, a list of iterators/indices of input sources
 uint64_t wallet2::select_transfers(uint64_t needed_money, bool add_dust, uint64_t dust, std::list<transfer_container::iterator>& selected_transfers)
 {
-  std::vector<size_t> unused_transfers_indices;
-  std::vector<size_t> unused_dust_indices;
+  update_unlocked_transfers();
+  set_dust_threshold(dust);
 
-  // aggregate sources available for transfers
+  // picked transfers leave the index until the selection is done, so that none is picked twice
   // if dust needed, take dust from only one source (so require source has at least dust amount)
-  for (size_t i = 0; i < m_transfers.size(); ++i)
+  std::vector<size_t> picked;
+  uint64_t found_money = 0;
+  size_t idx;
+  if (add_dust && needed_money && pop_random_unlocked_transfer(true, idx))
   {
-    const transfer_details& td = m_transfers[i];
-    if (!td.m_spent && is_transfer_unlocked(td))
-    {
-      if (dust < td.amount())
-        unused_transfers_indices.push_back(i);
-      else
-        unused_dust_indices.push_back(i);
-    }
+    picked.push_back(idx);
+    found_money += m_transfers[idx].amount();
   }
-
-  bool select_one_dust = add_dust && !unused_dust_indices.empty();
-  uint64_t found_money = 0;
-  while (found_money < needed_money && (!unused_transfers_indices.empty() || !unused_dust_indices.empty()))
+  while (found_money < needed_money && (pop_random_unlocked_transfer(false, idx) || pop_random_unlocked_transfer(true, idx)))
   {
-    size_t idx;
-    if (select_one_dust)
-    {
-      idx = pop_random_value(unused_dust_indices);
-      select_one_dust = false;
-    }
-    else
-    {
-      idx = !unused_transfers_indices.empty() ? pop_random_value(unused_transfers_indices) : pop_random_value(unused_dust_indices);
-    }
-
-    transfer_container::iterator it = m_transfers.begin() + idx;
-    selected_transfers.push_back(it);
-    found_money += it->amount();
+    picked.push_back(idx);
+    found_money += m_transfers[idx].amount();
   }
 
+  BOOST_FOREACH(size_t i, picked)
+  {
+    selected_transfers.push_back(m_transfers.begin() + i);
+    add_unlocked_transfer(i);
+  }
   return found_money;
 }
 //----------------------------------------------------------------------------------------------------
@@ -1081,7 +1686,7 @@ void wallet2::commit_tx(pending_tx& ptx)
   LOG_PRINT_L2("transaction " << get_transaction_hash(ptx.tx) << " generated ok and sent to daemon, key_images: [" << ptx.key_images << "]");
 
   BOOST_FOREACH(transfer_container::iterator it, ptx.selected_transfers)
-    it->m_spent = true;
+    set_spent(it - m_transfers.begin(), true);
 
   LOG_PRINT_L0("Transaction successfully sent. <" << get_transaction_hash(ptx.tx) << ">" << ENDL
             << "Commission: " << print_money(ptx.fee+ptx.dust) << " (dust: " << print_money(ptx.dust) << ")" << ENDL
@@ -1147,7 +1752,7 @@ std::vector<wallet2::pending_tx> wallet2::create_transactions(std::vector<crypto
 
         // mark transfers to be used as "spent"
         BOOST_FOREACH(transfer_container::iterator it, ptx.selected_transfers)
-          it->m_spent = true;
+          set_spent(it - m_transfers.begin(), true);
       }
 
       // if we made it this far, we've selected our transactions.  committing them will mark them spent,
@@ -1157,7 +1762,7 @@ std::vector<wallet2::pending_tx> wallet2::create_transactions(std::vector<crypto
       {
         // mark transfers to be used as not spent
         BOOST_FOREACH(transfer_container::iterator it2, ptx.selected_transfers)
-          it2->m_spent = false;
+          set_spent(it2 - m_transfers.begin(), false);
 
       }
 
@@ -1174,7 +1779,7 @@ std::vector<wallet2::pending_tx> wallet2::create_transactions(std::vector<crypto
       {
         // mark transfers to be used as not spent
         BOOST_FOREACH(transfer_container::iterator it2, ptx.selected_transfers)
-          it2->m_spent = false;
+          set_spent(it2 - m_transfers.begin(), false);
 
       }
 
@@ -1192,7 +1797,7 @@ std::vector<wallet2::pending_tx> wallet2::create_transactions(std::vector<crypto
       {
         // mark transfers to be used as not spent
         BOOST_FOREACH(transfer_container::iterator it2, ptx.selected_transfers)
-          it2->m_spent = false;
+          set_spent(it2 - m_transfers.begin(), false);
 
       }
 
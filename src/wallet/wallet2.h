@@ -30,9 +30,11 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
 #include <boost/serialization/list.hpp>
 #include <boost/serialization/vector.hpp>
+#include <boost/serialization/utility.hpp>
 #include <atomic>
 
 #include "include_base_utils.h"
@@ -46,24 +48,38 @@
 #include "common/unordered_containers_boost_serialization.h"
 #include "crypto/chacha8.h"
 #include "crypto/hash.h"
+#include "cryptonote_core/blob_log.h"
 
 #include "wallet_errors.h"
 
 #include <iostream>
 #define DEFAULT_TX_SPENDABLE_AGE                               10
 #define WALLET_RCP_CONNECTION_TIMEOUT                          200000
+#define WALLET_CACHE_MAX_DELTAS                                100
+#define WALLET_CACHE_DELTA_INITIAL_SIZE                        4096
 
 namespace tools
 {
   class i_wallet2_callback
   {
   public:
-    virtual void on_new_block(uint64_t height, const cryptonote::block& block) {}
+    virtual void on_new_block(uint64_t height, const crypto::hash& block_id) {}
     virtual void on_money_received(uint64_t height, const cryptonote::transaction& tx, size_t out_index) {}
-    virtual void on_money_spent(uint64_t height, const cryptonote::transaction& in_tx, size_t out_index, const cryptonote::transaction& spend_tx) {}
+    virtual void on_money_spent(uint64_t height, const crypto::hash& in_txid, uint64_t amount, const cryptonote::transaction& spend_tx) {}
     virtual void on_skip_transaction(uint64_t height, const cryptonote::transaction& tx) {}
   };
 
+  // main chain blocks at hand without a daemon, like the ones stored in a daemon's data dir
+  class i_wallet2_block_source
+  {
+  public:
+    virtual ~i_wallet2_block_source() {}
+    virtual uint64_t height() = 0;
+    virtual bool get_block_id(uint64_t height, crypto::hash& id) = 0;
+    // up to max_count blocks from start_height on, with all their transactions
+    virtual bool get_blocks(uint64_t start_height, size_t max_count, std::list<cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::block_entry>& blocks, std::unordered_map<crypto::hash, cryptonote::transaction>& txs) = 0;
+  };
+
   struct tx_dust_policy
   {
     uint64_t dust_threshold;
@@ -80,19 +96,25 @@ namespace tools
 
   class wallet2
   {
-    wallet2(const wallet2&) : m_run(true), m_callback(0), m_testnet(false) {};
+    wallet2(const wallet2&) : m_run(true), m_callback(0), m_testnet(false), m_dust_threshold(::config::DEFAULT_DUST_THRESHOLD), m_unspent_money(0), m_unlocked_money(0), m_cache_generation(0), m_stored_height(0) {};
   public:
-    wallet2(bool testnet = false, bool restricted = false) : m_run(true), m_callback(0), m_testnet(testnet), m_restricted(restricted), is_old_file_format(false) {};
+    wallet2(bool testnet = false, bool restricted = false) : m_run(true), m_callback(0), m_testnet(testnet), m_restricted(restricted), m_dust_threshold(::config::DEFAULT_DUST_THRESHOLD), m_unspent_money(0), m_unlocked_money(0), m_cache_generation(0), m_stored_height(0), is_old_file_format(false) {};
     struct transfer_details
     {
       uint64_t m_block_height;
-      cryptonote::transaction m_tx;
+      crypto::hash m_txid;
+      crypto::public_key m_tx_pub_key;
+      crypto::public_key m_output_key;
+      uint64_t m_amount;
+      uint64_t m_unlock_time;
+      size_t m_tx_size;
       size_t m_internal_output_index;
       uint64_t m_global_output_index;
       bool m_spent;
       crypto::key_image m_key_image; //TODO: key_image stored twice :(
 
-      uint64_t amount() const { return m_tx.vout[m_internal_output_index].amount; }
+      uint64_t amount() const { return m_amount; }
+      void set_tx(const cryptonote::transaction& tx, size_t internal_output_index);
     };
 
     struct payment_details
@@ -194,6 +216,12 @@ namespace tools
     void refresh(uint64_t start_height, size_t & blocks_fetched);
     void refresh(uint64_t start_height, size_t & blocks_fetched, bool& received_money);
     bool refresh(size_t & blocks_fetched, bool& received_money, bool& ok);
+    /*!
+     * \brief Refreshes from blocks at hand, without connecting to a daemon
+     * \param  source          The main chain blocks, e.g. a daemon's stored blockchain
+     * \param  blocks_fetched  Number of blocks added to the wallet
+     */
+    void refresh_offline(i_wallet2_block_source& source, size_t& blocks_fetched);
 
     bool testnet() { return m_testnet; }
     bool restricted() const { return m_restricted; }
@@ -229,6 +257,9 @@ namespace tools
       if(ver < 7)
         return;
       a & m_payments;
+      if(ver < 8)
+        return;
+      a & m_cache_generation;
     }
 
     /*!
@@ -251,6 +282,8 @@ namespace tools
 
     static std::string address_from_txt_record(const std::string& s);
   private:
+    friend class wallet_scanner;
+
     /*!
      * \brief  Stores wallet information to wallet file.
      * \param  keys_file_name Name of wallet file
@@ -264,17 +297,101 @@ namespace tools
      * \param password       Password of wallet file
      */
     void load_keys(const std::string& keys_file_name, const std::string& password);
-    void process_new_transaction(const cryptonote::transaction& tx, uint64_t height);
-    void process_new_blockchain_entry(const cryptonote::block& b, cryptonote::block_complete_entry& bche, crypto::hash& bl_id, uint64_t height);
+    /*!
+     * \brief What changed in the wallet cache since the previous store, appended to the cache delta log
+     */
+    struct cache_delta
+    {
+      uint64_t generation;                   //!< m_cache_generation of the cache file this delta applies to
+      uint64_t height;                       //!< blocks, transfers and payments from this height on are replaced
+      std::vector<crypto::hash> blocks;
+      std::vector<transfer_details> transfers;
+      std::vector<std::pair<size_t, bool>> spent;    //!< m_spent changes of transfers below height
+      std::vector<std::pair<crypto::hash, payment_details>> payments;
+      std::unordered_map<crypto::hash, unconfirmed_transfer_details> unconfirmed_txs;
+
+      template <class t_archive>
+      inline void serialize(t_archive &a, const unsigned int ver)
+      {
+        a & generation;
+        a & height;
+        a & blocks;
+        a & transfers;
+        a & spent;
+        a & payments;
+        a & unconfirmed_txs;
+      }
+    };
+    bool open_cache_deltas();
+    bool store_cache_delta();
+    void load_cache_deltas();
+    void apply_cache_delta(const cache_delta& delta);
+    void mark_cache_stored();
+    /*!
+     * \brief What scan_new_transaction learned about a transaction, ready to be applied in chain order
+     */
+    struct scanned_transaction
+    {
+      std::vector<size_t> outs;
+      std::vector<crypto::key_image> key_images;   //!< one per entry of outs
+      bool key_images_valid;
+      uint64_t money_got_in_outs;
+      bool needs_tx;                               //!< the full transaction has to be fetched to apply it
+    };
+    /*!
+     * \brief A block of a getblocks_compact.bin batch, scanned ahead of being applied
+     */
+    struct pending_block
+    {
+      bool needs_processing;
+      std::vector<scanned_transaction> scans;      //!< one per entry of the block's txs
+    };
+    /*!
+     * \brief Unspent unlocked transfers bucketed by amount, the transfers of an amount are in no particular order
+     */
+    struct unlocked_transfers
+    {
+      std::map<uint64_t, std::vector<size_t> > by_amount;
+      size_t count;
+
+      unlocked_transfers(): count(0) {}
+    };
+    typedef cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::tx_entry compact_tx_entry;
+    typedef cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::block_entry compact_block_entry;
+
+    void scan_new_transaction(const compact_tx_entry& te, scanned_transaction& scan) const;
+    void process_new_transaction(const cryptonote::transaction& tx, const compact_tx_entry& te, const scanned_transaction& scan, uint64_t height);
+    bool is_block_scanned(uint64_t timestamp) const;
+    void scan_block(const compact_block_entry& be, pending_block& pb) const;
+    void process_new_blockchain_entry(const compact_block_entry& be, const pending_block& pb, const std::unordered_map<crypto::hash, cryptonote::transaction>& txs, uint64_t height);
     void detach_blockchain(uint64_t height);
     void get_short_chain_history(std::list<crypto::hash>& ids);
     bool is_tx_spendtime_unlocked(uint64_t unlock_time) const;
     bool is_transfer_unlocked(const transfer_details& td) const;
+    uint64_t get_unlock_height(const transfer_details& td) const;
+    void set_spent(size_t idx, bool spent);
+    void add_unspent_transfer(size_t idx);
+    void remove_unspent_transfer(size_t idx);
+    void add_unlocked_transfer(size_t idx);
+    void remove_unlocked_transfer(size_t idx);
+    void update_unlocked_transfers();
+    void rebuild_unspent_transfers();
+    unlocked_transfers& get_unlocked_transfers(uint64_t amount) { return amount > m_dust_threshold ? m_unlocked_non_dust : m_unlocked_dust; }
+    void set_dust_threshold(uint64_t dust);
+    bool pop_random_unlocked_transfer(bool dust_outputs, size_t& idx);
     bool clear();
-    void pull_blocks(uint64_t start_height, size_t& blocks_added);
+    static void fetch_blocks(epee::net_utils::http::http_simple_client& http_client, const std::string& daemon_address, uint64_t start_height, const std::list<crypto::hash>& short_chain_history, cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::response& res);
+    static void fetch_full_blocks(epee::net_utils::http::http_simple_client& http_client, const std::string& daemon_address, uint64_t start_height, const std::list<crypto::hash>& short_chain_history, cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::response& res);
+    static void fetch_transactions(epee::net_utils::http::http_simple_client& http_client, const std::string& daemon_address, const std::list<crypto::hash>& tx_ids, std::unordered_map<crypto::hash, cryptonote::transaction>& txs);
+    void fetch_global_output_indexes(const crypto::hash& tx_id, std::vector<uint64_t>& indexes);
+    static void get_block_entries(const cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::response& res, std::vector<const compact_block_entry*>& entries);
+    void get_pending_blocks(uint64_t start_height, const std::vector<const compact_block_entry*>& entries, std::vector<pending_block>& blocks) const;
+    void mark_needed_transactions(const std::vector<const compact_block_entry*>& entries, std::vector<pending_block>& blocks, std::list<crypto::hash>& needed_tx_ids) const;
+    void apply_blocks(uint64_t start_height, const std::vector<const compact_block_entry*>& entries, const std::vector<pending_block>& blocks, const std::unordered_map<crypto::hash, cryptonote::transaction>& txs, size_t& blocks_added);
+    void pull_blocks(uint64_t start_height, size_t& blocks_added, cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::response& next_blocks, bool& next_blocks_fetched);
     uint64_t select_transfers(uint64_t needed_money, bool add_dust, uint64_t dust, std::list<transfer_container::iterator>& selected_transfers);
     bool prepare_file_names(const std::string& file_path);
-    void process_unconfirmed(const cryptonote::transaction& tx);
+    void process_unconfirmed(const crypto::hash& tx_id);
     void add_unconfirmed_tx(const cryptonote::transaction& tx, uint64_t change_amount);
     void generate_genesis(cryptonote::block& b);
     void check_genesis(const crypto::hash& genesis_hash); //throws
@@ -284,6 +401,7 @@ namespace tools
     std::string m_wallet_file;
     std::string m_keys_file;
     epee::net_utils::http::http_simple_client m_http_client;
+    epee::net_utils::http::http_simple_client m_prefetch_http_client;
     std::vector<crypto::hash> m_blockchain;
     std::atomic<uint64_t> m_local_bc_height; //temporary workaround
     std::unordered_map<crypto::hash, unconfirmed_transfer_details> m_unconfirmed_txs;
@@ -291,6 +409,15 @@ namespace tools
     transfer_container m_transfers;
     payment_container m_payments;
     std::unordered_map<crypto::key_image, size_t> m_key_images;
+    // index of the unspent transfers, kept up to date as they are received, spent, unlocked and detached
+    unlocked_transfers m_unlocked_dust;                             //!< unspent unlocked transfers of at most m_dust_threshold
+    unlocked_transfers m_unlocked_non_dust;                         //!< unspent unlocked transfers above m_dust_threshold
+    uint64_t m_dust_threshold;                                      //!< the dust threshold select_transfers was last called with
+    std::vector<size_t> m_unlocked_positions;                       //!< per transfer, its position in the bucket of its amount
+    std::multimap<uint64_t, size_t> m_locked_transfers;             //!< unlock height -> unspent locked transfer
+    std::multimap<uint64_t, size_t> m_time_locked_transfers;        //!< unlock time -> unspent transfer past its unlock height
+    uint64_t m_unspent_money;
+    uint64_t m_unlocked_money;
     cryptonote::account_public_address m_account_public_address;
     uint64_t m_upper_transaction_size_limit; //TODO: auto-calc this value or request from daemon, now use some fixed value
 
@@ -299,11 +426,16 @@ namespace tools
     i_wallet2_callback* m_callback;
     bool m_testnet;
     bool m_restricted;
+    uint64_t m_cache_generation;                  /*!< Tags the cache file, deltas of another cache file are ignored */
+    cryptonote::blob_log m_cache_deltas;
+    uint64_t m_stored_height;                     /*!< Blocks below this height are stored in the cache, unchanged */
+    std::vector<bool> m_stored_spent;             /*!< m_spent of the transfers stored in the cache */
     std::string seed_language; /*!< Language of the mnemonics (seed). */
     bool is_old_file_format; /*!< Whether the wallet file is of an old file format */
   };
 }
-BOOST_CLASS_VERSION(tools::wallet2, 7)
+BOOST_CLASS_VERSION(tools::wallet2, 8)
+BOOST_CLASS_VERSION(tools::wallet2::transfer_details, 1)
 
 namespace boost
 {
@@ -315,7 +447,22 @@ namespace boost
       a & x.m_block_height;
       a & x.m_global_output_index;
       a & x.m_internal_output_index;
-      a & x.m_tx;
+      if(ver < 1)
+      {
+        // older caches kept the whole transaction
+        cryptonote::transaction tx;
+        a & tx;
+        x.set_tx(tx, x.m_internal_output_index);
+      }
+      else
+      {
+        a & x.m_txid;
+        a & x.m_tx_pub_key;
+        a & x.m_output_key;
+        a & x.m_amount;
+        a & x.m_unlock_time;
+        a & x.m_tx_size;
+      }
       a & x.m_spent;
       a & x.m_key_image;
     }
@@ -449,9 +596,6 @@ namespace tools
       req.outs_count = fake_outputs_count + 1;// add one to make possible (if need) to skip real output key
       BOOST_FOREACH(transfer_container::iterator it, selected_transfers)
       {
-        THROW_WALLET_EXCEPTION_IF(it->m_tx.vout.size() <= it->m_internal_output_index, error::wallet_internal_error,
-          "m_internal_output_index = " + std::to_string(it->m_internal_output_index) +
-          " is greater or equal to outputs count = " + std::to_string(it->m_tx.vout.size()));
         req.amounts.push_back(it->amount());
       }
 
@@ -508,9 +652,9 @@ namespace tools
       //size_t real_index = src.outputs.size() ? (rand() % src.outputs.size() ):0;
       tx_output_entry real_oe;
       real_oe.first = td.m_global_output_index;
-      real_oe.second = boost::get<txout_to_key>(td.m_tx.vout[td.m_internal_output_index].target).key;
+      real_oe.second = td.m_output_key;
       auto interted_it = src.outputs.insert(it_to_insert, real_oe);
-      src.real_out_tx_key = get_tx_pub_key_from_extra(td.m_tx);
+      src.real_out_tx_key = td.m_tx_pub_key;
       src.real_output = interted_it - src.outputs.begin();
       src.real_output_in_tx_index = td.m_internal_output_index;
       detail::print_source_entry(src);
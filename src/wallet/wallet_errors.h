@@ -60,6 +60,7 @@ namespace tools
     //         block_parse_error
     //         get_blocks_error
     //         get_out_indexes_error
+    //         get_txs_error
     //         tx_parse_error
     //       transfer_error *
     //         get_random_outs_general_error
@@ -104,12 +105,14 @@ namespace tools
     const char* const failed_rpc_request_messages[] = {
       "failed to get blocks",
       "failed to get out indices",
+      "failed to get transactions",
       "failed to get random outs"
     };
     enum failed_rpc_request_message_indices
     {
       get_blocks_error_message_index,
       get_out_indices_error_message_index,
+      get_txs_error_message_index,
       get_random_outs_error_message_index
     };
 
@@ -284,6 +287,8 @@ namespace tools
     //----------------------------------------------------------------------------------------------------
     typedef failed_rpc_request<refresh_error, get_out_indices_error_message_index> get_out_indices_error;
     //----------------------------------------------------------------------------------------------------
+    typedef failed_rpc_request<refresh_error, get_txs_error_message_index> get_txs_error;
+    //----------------------------------------------------------------------------------------------------
     struct tx_parse_error : public refresh_error
     {
       explicit tx_parse_error(std::string&& loc, const cryptonote::blobdata& tx_blob)
@@ -52,14 +52,16 @@ namespace tools
     command_line::add_arg(desc, arg_rpc_bind_port);
   }
   //------------------------------------------------------------------------------------------------------------------------------
-  wallet_rpc_server::wallet_rpc_server(wallet2& w):m_wallet(w)
+  wallet_rpc_server::wallet_rpc_server(wallet2& w, wallet_scanner& scanner):m_wallet(w), m_scanner(scanner)
   {}
   //------------------------------------------------------------------------------------------------------------------------------
   bool wallet_rpc_server::run()
   {
     m_net_server.add_idle_handler([this](){
       try {
-        m_wallet.refresh();
+        //the wallets refreshed along with this one are stored as they go, nothing else stores them before exit
+        if(m_scanner.refresh())
+          m_scanner.store();
       } catch (const std::exception& ex) {
         LOG_ERROR("Exception at while refreshing, what=" << ex.what());
       }
@@ -431,13 +433,12 @@ namespace tools
         {
           transfers_found = true;
         }
-        auto txBlob = t_serializable_object_to_blob(td.m_tx);
         wallet_rpc::transfer_details rpc_transfers;
         rpc_transfers.amount       = td.amount();
         rpc_transfers.spent        = td.m_spent;
         rpc_transfers.global_index = td.m_global_output_index;
-        rpc_transfers.tx_hash      = boost::lexical_cast<std::string>(cryptonote::get_transaction_hash(td.m_tx));
-        rpc_transfers.tx_size      = txBlob.size();
+        rpc_transfers.tx_hash      = boost::lexical_cast<std::string>(td.m_txid);
+        rpc_transfers.tx_size      = td.m_tx_size;
         res.transfers.push_back(rpc_transfers);
       }
     }
@@ -35,6 +35,7 @@
 #include "net/http_server_impl_base.h"
 #include "wallet_rpc_server_commands_defs.h"
 #include "wallet2.h"
+#include "wallet_scanner.h"
 #include "common/command_line.h"
 namespace tools
 {
@@ -46,7 +47,7 @@ namespace tools
   public:
     typedef epee::net_utils::connection_context_base connection_context;
 
-    wallet_rpc_server(wallet2& cr);
+    wallet_rpc_server(wallet2& cr, wallet_scanner& scanner);
 
     const static command_line::arg_descriptor<std::string> arg_rpc_bind_port;
     const static command_line::arg_descriptor<std::string> arg_rpc_bind_ip;
@@ -90,6 +91,7 @@ namespace tools
       bool on_query_key(const wallet_rpc::COMMAND_RPC_QUERY_KEY::request& req, wallet_rpc::COMMAND_RPC_QUERY_KEY::response& res, epee::json_rpc::error& er);
 
       wallet2& m_wallet;
+      wallet_scanner& m_scanner;
       std::string m_port;
       std::string m_bind_ip;
   };
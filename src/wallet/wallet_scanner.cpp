@@ -0,0 +1,153 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <unordered_set>
+#include "include_base_utils.h"
+using namespace epee;
+
+#include "wallet_scanner.h"
+#include "common/parallel.h"
+
+namespace tools
+{
+  //----------------------------------------------------------------------------------------------------
+  void wallet_scanner::init(const std::string& daemon_address)
+  {
+    m_daemon_address = daemon_address;
+  }
+  //----------------------------------------------------------------------------------------------------
+  void wallet_scanner::add_wallet(wallet2& w)
+  {
+    m_wallets.push_back(&w);
+  }
+  //----------------------------------------------------------------------------------------------------
+  size_t wallet_scanner::pull_blocks()
+  {
+    //the batch starts from the wallet furthest behind, the others skip the blocks they already have
+    wallet2* first = *std::min_element(m_wallets.begin(), m_wallets.end(), [](const wallet2* a, const wallet2* b) {
+      return a->m_blockchain.size() < b->m_blockchain.size();
+    });
+    std::list<crypto::hash> short_chain_history;
+    first->get_short_chain_history(short_chain_history);
+    cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::response res = AUTO_VAL_INIT(res);
+    wallet2::fetch_blocks(m_http_client, m_daemon_address, 0, short_chain_history, res);
+
+    std::vector<const wallet2::compact_block_entry*> entries;
+    wallet2::get_block_entries(res, entries);
+
+    //a wallet on another branch below the batch start can't use it and catches up on its own
+    size_t blocks_added = 0;
+    std::vector<wallet2*> wallets;
+    THROW_WALLET_EXCEPTION_IF(first->m_blockchain.size() < res.start_height, error::wallet_internal_error,
+      "daemon returned blocks from height " + std::to_string(res.start_height) + " above the wallet height " + std::to_string(first->m_blockchain.size()));
+    BOOST_FOREACH(wallet2* w, m_wallets)
+    {
+      THROW_WALLET_EXCEPTION_IF(w->m_blockchain.size() < res.start_height, error::wallet_internal_error,
+        "wallet height " + std::to_string(w->m_blockchain.size()) + " is below the batch start " + std::to_string(res.start_height));
+      if(!res.start_height || w->m_blockchain[res.start_height - 1] == first->m_blockchain[res.start_height - 1])
+      {
+        wallets.push_back(w);
+        continue;
+      }
+      LOG_PRINT_L1("Wallet " << w->get_account().get_public_address_str(w->testnet()) << " is on another branch, refreshing it alone");
+      size_t fetched = 0;
+      w->refresh(0, fetched);
+      blocks_added += fetched;
+    }
+
+    std::vector<std::vector<wallet2::pending_block>> blocks(wallets.size());
+    for(size_t k = 0; k < wallets.size(); ++k)
+      wallets[k]->get_pending_blocks(res.start_height, entries, blocks[k]);
+
+    tools::run_in_parallel(wallets.size() * entries.size(), [&](size_t i)
+    {
+      size_t k = i / entries.size();
+      size_t j = i % entries.size();
+      if(blocks[k][j].needs_processing)
+        wallets[k]->scan_block(*entries[j], blocks[k][j]);
+    });
+
+    std::unordered_set<crypto::hash> needed_tx_set;
+    std::list<crypto::hash> needed_tx_ids;
+    for(size_t k = 0; k < wallets.size(); ++k)
+    {
+      std::list<crypto::hash> wallet_tx_ids;
+      wallets[k]->mark_needed_transactions(entries, blocks[k], wallet_tx_ids);
+      BOOST_FOREACH(const crypto::hash& tx_id, wallet_tx_ids)
+      {
+        if(needed_tx_set.insert(tx_id).second)
+          needed_tx_ids.push_back(tx_id);
+      }
+    }
+    std::unordered_map<crypto::hash, cryptonote::transaction> txs;
+    if(!needed_tx_ids.empty())
+      wallet2::fetch_transactions(m_http_client, m_daemon_address, needed_tx_ids, txs);
+
+    for(size_t k = 0; k < wallets.size(); ++k)
+      wallets[k]->apply_blocks(res.start_height, entries, blocks[k], txs, blocks_added);
+    return blocks_added;
+  }
+  //----------------------------------------------------------------------------------------------------
+  size_t wallet_scanner::refresh()
+  {
+    size_t blocks_fetched = 0;
+    size_t try_count = 0;
+    while(!m_wallets.empty() && m_run.load(std::memory_order_relaxed))
+    {
+      try
+      {
+        size_t added_blocks = pull_blocks();
+        blocks_fetched += added_blocks;
+        if(!added_blocks)
+          break;
+      }
+      catch (const std::exception&)
+      {
+        if(try_count < 3)
+        {
+          LOG_PRINT_L1("Another try pull_blocks (try_count=" << try_count << ")...");
+          ++try_count;
+        }
+        else
+        {
+          LOG_ERROR("pull_blocks failed, try_count=" << try_count);
+          throw;
+        }
+      }
+    }
+
+    LOG_PRINT_L1("Refresh of " << m_wallets.size() << " wallets done, blocks received: " << blocks_fetched);
+    return blocks_fetched;
+  }
+  //----------------------------------------------------------------------------------------------------
+  void wallet_scanner::store()
+  {
+    BOOST_FOREACH(wallet2* w, m_wallets)
+      w->store();
+  }
+}
@@ -0,0 +1,69 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "include_base_utils.h"
+#include "net/http_client.h"
+#include "wallet2.h"
+
+namespace tools
+{
+  /*! \brief Refreshes many wallets against one daemon, fetching each block batch only once.
+   *
+   * \details Every batch of getblocks_compact.bin is fetched and checked once, the wallets'
+   * output scans are spread over all cores together, and the full transactions any of the
+   * wallets needs are fetched in a single request. Each wallet then applies the batch itself,
+   * so its i_wallet2_callback sees the same calls as with wallet2::refresh.
+   *
+   * The wallets must not be refreshed or used for transfers while refresh() runs.
+   */
+  class wallet_scanner
+  {
+  public:
+    wallet_scanner() : m_run(true) {}
+
+    void init(const std::string& daemon_address);
+    void add_wallet(wallet2& w);
+    size_t refresh();
+    //! Stores every wallet, throws like wallet2::store
+    void store();
+    void stop() { m_run.store(false, std::memory_order_relaxed); }
+
+  private:
+    size_t pull_blocks();
+
+    std::string m_daemon_address;
+    epee::net_utils::http::http_simple_client m_http_client;
+    std::vector<wallet2*> m_wallets;
+    std::atomic<bool> m_run;
+  };
+}
@@ -188,6 +188,15 @@ bool tests::proxy_core::handle_incoming_tx(const cryptonote::blobdata& tx_blob,
     return true;
 }
 
+bool tests::proxy_core::handle_incoming_txs(const std::list<cryptonote::blobdata>& tx_blobs, std::vector<cryptonote::tx_verification_context>& tvcs, bool keeped_by_block) {
+    tvcs.assign(tx_blobs.size(), cryptonote::tx_verification_context());
+    bool r = true;
+    size_t i = 0;
+    BOOST_FOREACH(const cryptonote::blobdata& tx_blob, tx_blobs)
+        r = handle_incoming_tx(tx_blob, tvcs[i++], keeped_by_block) && r;
+    return r;
+}
+
 bool tests::proxy_core::handle_incoming_block(const cryptonote::blobdata& block_blob, cryptonote::block_verification_context& bvc, bool update_miner_blocktemplate) {
     block b = AUTO_VAL_INIT(b);
 
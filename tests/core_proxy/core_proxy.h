@@ -73,8 +73,14 @@ namespace tests
     bool get_short_chain_history(std::list<crypto::hash>& ids);
     bool get_stat_info(cryptonote::core_stat_info& st_inf){return true;}
     bool have_block(const crypto::hash& id);
+    void precompute_blocks_pow(const std::list<cryptonote::block>& blocks){}
+    bool get_block_by_hash(const crypto::hash& h, cryptonote::block& blk){return false;}
+    bool get_transactions(const std::vector<crypto::hash>& txs_ids, std::list<cryptonote::transaction>& txs, std::list<crypto::hash>& missed_txs){return true;}
+    bool get_pool_transaction(const crypto::hash& id, cryptonote::transaction& tx){return false;}
+    bool pool_has_tx(const crypto::hash& id){return false;}
     bool get_blockchain_top(uint64_t& height, crypto::hash& top_id);
     bool handle_incoming_tx(const cryptonote::blobdata& tx_blob, cryptonote::tx_verification_context& tvc, bool keeped_by_block);
+    bool handle_incoming_txs(const std::list<cryptonote::blobdata>& tx_blobs, std::vector<cryptonote::tx_verification_context>& tvcs, bool keeped_by_block);
     bool handle_incoming_block(const cryptonote::blobdata& block_blob, cryptonote::block_verification_context& bvc, bool update_miner_blocktemplate = true);
     void pause_mine(){}
     void resume_mine(){}
@@ -29,3 +29,21 @@
 // Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
 
 #include "crypto/crypto-ops.c"
+
+void fe_mul_test(unsigned char *s, const int32_t *f, const int32_t *g) {
+  fe h;
+  fe_mul(h, f, g);
+  fe_tobytes(s, h);
+}
+
+void fe_sq_test(unsigned char *s, const int32_t *f) {
+  fe h;
+  fe_sq(h, f);
+  fe_tobytes(s, h);
+}
+
+void fe_sq2_test(unsigned char *s, const int32_t *f) {
+  fe h;
+  fe_sq2(h, f);
+  fe_tobytes(s, h);
+}
@@ -30,6 +30,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #if defined(__cplusplus)
 #include "crypto/crypto.h"
 
@@ -37,6 +39,9 @@ extern "C" {
 #endif
 
 void setup_random(void);
+void fe_mul_test(unsigned char *s, const int32_t *f, const int32_t *g);
+void fe_sq_test(unsigned char *s, const int32_t *f);
+void fe_sq2_test(unsigned char *s, const int32_t *f);
 
 #if defined(__cplusplus)
 }
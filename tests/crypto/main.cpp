@@ -60,6 +60,17 @@ bool operator !=(const key_derivation &a, const key_derivation &b) {
   return 0 != memcmp(&a, &b, sizeof(key_derivation));
 }
 
+//! Field element as its ten signed limbs, in decimal
+struct fe_limbs {
+  int32_t v[10];
+};
+
+void get(istream &input, fe_limbs &res) {
+  for (size_t i = 0; i < 10; i++) {
+    input >> res.v[i];
+  }
+}
+
 DISABLE_GCC_WARNING(maybe-uninitialized)
 
 int main(int argc, char *argv[]) {
@@ -158,6 +169,13 @@ int main(int argc, char *argv[]) {
       if (expected1 != actual1 || (expected1 && expected2 != actual2)) {
         goto error;
       }
+      if (output_index < 1000) {
+        vector<public_key> keys(output_index + 1);
+        actual1 = derive_public_keys(derivation, keys.size(), base, keys.data());
+        if (expected1 != actual1 || (expected1 && expected2 != keys[output_index])) {
+          goto error;
+        }
+      }
     } else if (cmd == "derive_secret_key") {
       key_derivation derivation;
       size_t output_index;
@@ -243,6 +261,8 @@ int main(int argc, char *argv[]) {
       key_image image;
       vector<public_key> vpubs;
       vector<const public_key *> pubs;
+      vector<public_key_precomp> vprecomps;
+      vector<const public_key_precomp *> precomps;
       size_t pubs_count;
       vector<signature> sigs;
       bool expected, actual;
@@ -250,9 +270,15 @@ int main(int argc, char *argv[]) {
       get(input, prefix_hash, image, pubs_count);
       vpubs.resize(pubs_count);
       pubs.resize(pubs_count);
+      vprecomps.resize(pubs_count);
+      precomps.resize(pubs_count);
       for (i = 0; i < pubs_count; i++) {
         get(input, vpubs[i]);
         pubs[i] = &vpubs[i];
+        if (!precompute_public_key(vpubs[i], vprecomps[i])) {
+          goto error;
+        }
+        precomps[i] = &vprecomps[i];
       }
       sigs.resize(pubs_count);
       getvar(input, pubs_count * sizeof(signature), sigs.data());
@@ -261,6 +287,34 @@ int main(int argc, char *argv[]) {
       if (expected != actual) {
         goto error;
       }
+      actual = check_ring_signature(prefix_hash, image, precomps.data(), pubs_count, sigs.data());
+      if (expected != actual) {
+        goto error;
+      }
+    } else if (cmd == "fe_mul") {
+      fe_limbs f, g;
+      ec_point expected, actual;
+      get(input, f, g, expected);
+      fe_mul_test(reinterpret_cast<unsigned char *>(&actual), f.v, g.v);
+      if (expected != actual) {
+        goto error;
+      }
+    } else if (cmd == "fe_sq") {
+      fe_limbs f;
+      ec_point expected, actual;
+      get(input, f, expected);
+      fe_sq_test(reinterpret_cast<unsigned char *>(&actual), f.v);
+      if (expected != actual) {
+        goto error;
+      }
+    } else if (cmd == "fe_sq2") {
+      fe_limbs f;
+      ec_point expected, actual;
+      get(input, f, expected);
+      fe_sq2_test(reinterpret_cast<unsigned char *>(&actual), f.v);
+      if (expected != actual) {
+        goto error;
+      }
     } else {
       throw ios_base::failure("Unknown function: " + cmd);
     }
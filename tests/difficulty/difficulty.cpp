@@ -48,6 +48,7 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     vector<uint64_t> timestamps, cumulative_difficulties;
+    cryptonote::difficulty_window window;
     fstream data(argv[1], fstream::in);
     data.exceptions(fstream::badbit);
     data.clear(data.rdstate());
@@ -71,8 +72,22 @@ int main(int argc, char *argv[]) {
                 << "Found: " << res << endl;
             return 1;
         }
+        res = window.next_difficulty(DEFAULT_TEST_DIFFICULTY_TARGET);
+        if (res != difficulty) {
+            cerr << "Wrong difficulty window for block " << n << endl
+                << "Expected: " << difficulty << endl
+                << "Found: " << res << endl;
+            return 1;
+        }
         timestamps.push_back(timestamp);
         cumulative_difficulties.push_back(cumulative_difficulty += difficulty);
+        window.push_back(timestamp, cumulative_difficulty);
+        // popping the block and pushing it again must leave the window as it was
+        window.pop_back();
+        if (n >= DIFFICULTY_WINDOW + DIFFICULTY_LAG) {
+            window.push_front(timestamps[n - (DIFFICULTY_WINDOW + DIFFICULTY_LAG)], cumulative_difficulties[n - (DIFFICULTY_WINDOW + DIFFICULTY_LAG)]);
+        }
+        window.push_back(timestamp, cumulative_difficulty);
         ++n;
     }
     if (!data.eof()) {
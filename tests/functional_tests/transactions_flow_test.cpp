@@ -101,7 +101,7 @@ uint64_t get_money_in_first_transfers(const tools::wallet2::transfer_container&
   size_t count = 0;
   BOOST_FOREACH(const tools::wallet2::transfer_details& td, incoming_transfers)
   {
-    summ += td.m_tx.vout[td.m_internal_output_index].amount;
+    summ += td.amount();
     if(++count >= n_transfers)
       return summ;
   }
@@ -191,7 +191,7 @@ bool transactions_flow_test(std::string& working_folder,
       BOOST_FOREACH(tools::wallet2::transfer_details& td, incoming_transfers)
       {
         cryptonote::transaction tx_s;
-        bool r = do_send_money(w1, w1, 0, td.m_tx.vout[td.m_internal_output_index].amount - TEST_FEE, tx_s, 50);
+        bool r = do_send_money(w1, w1, 0, td.amount() - TEST_FEE, tx_s, 50);
         CHECK_AND_ASSERT_MES(r, false, "Failed to send starter tx " << get_transaction_hash(tx_s));
         LOG_PRINT_GREEN("Starter transaction sent " << get_transaction_hash(tx_s), LOG_LEVEL_0);
         if(++count >= FIRST_N_TRANSFERS)
@@ -280,7 +280,7 @@ bool transactions_flow_test(std::string& working_folder,
     w2.get_transfers(tc);
     BOOST_FOREACH(tools::wallet2::transfer_details& td, tc)
     {
-      auto it = txs.find(get_transaction_hash(td.m_tx));
+      auto it = txs.find(td.m_txid);
       CHECK_AND_ASSERT_MES(it != txs.end(), false, "transaction not found in local cache");
       it->second.m_received_count += 1;
     }
@@ -29,10 +29,12 @@
 // Parts of this file are originally copyright (c) 2012-2013 The Cryptonote developers
 
 #include <cstddef>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <ios>
 #include <string>
+#include <vector>
 
 #include "warnings.h"
 #include "crypto/hash.h"
@@ -51,6 +53,39 @@ extern "C" {
     }
     tree_hash((const char (*)[32]) data, length >> 5, hash);
   }
+
+  // Hashes the input in one cn_slow_hash_multi call along with ways - 1 copies of it whose
+  // first byte differs; a copy not hashed as cn_slow_hash does spoils the result
+  static void hash_slow_ways(const void *data, size_t length, char *hash, size_t ways) {
+    vector<vector<char> > inputs(ways, vector<char>((const char *) data, (const char *) data + length));
+    chash hashes[CN_SLOW_HASH_MAX_WAYS];
+    const void *data_ptrs[CN_SLOW_HASH_MAX_WAYS];
+    char *hash_ptrs[CN_SLOW_HASH_MAX_WAYS];
+    for (size_t n = 0; n < ways; n++) {
+      if (length != 0) {
+        inputs[n][0] ^= (char) n;
+      }
+      data_ptrs[n] = inputs[n].data();
+      hash_ptrs[n] = (char *) &hashes[n];
+    }
+    cn_slow_hash_multi(data_ptrs, length, hash_ptrs, ways);
+    for (size_t n = 1; n < ways; n++) {
+      chash expected;
+      cn_slow_hash(inputs[n].data(), length, (char *) &expected);
+      if (expected != hashes[n]) {
+        memset(&hashes[0], 0, sizeof(chash));
+      }
+    }
+    memcpy(hash, &hashes[0], sizeof(chash));
+  }
+
+  static void hash_slow_2(const void *data, size_t length, char *hash) {
+    hash_slow_ways(data, length, hash, 2);
+  }
+
+  static void hash_slow_4(const void *data, size_t length, char *hash) {
+    hash_slow_ways(data, length, hash, 4);
+  }
 }
 POP_WARNINGS
 
@@ -58,7 +93,7 @@ extern "C" typedef void hash_f(const void *, size_t, char *);
 struct hash_func {
   const string name;
   hash_f &f;
-} hashes[] = {{"fast", cn_fast_hash}, {"slow", cn_slow_hash}, {"tree", hash_tree},
+} hashes[] = {{"fast", cn_fast_hash}, {"slow", cn_slow_hash}, {"slow-2", hash_slow_2}, {"slow-4", hash_slow_4}, {"tree", hash_tree},
   {"extra-blake", hash_extra_blake}, {"extra-groestl", hash_extra_groestl},
   {"extra-jh", hash_extra_jh}, {"extra-skein", hash_extra_skein}};
 
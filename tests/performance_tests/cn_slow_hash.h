@@ -33,6 +33,9 @@
 #include "crypto/crypto.h"
 #include "cryptonote_core/cryptonote_basic.h"
 
+template<size_t a_ways>
+class test_cn_slow_hash_multi;
+
 class test_cn_slow_hash
 {
 public:
@@ -66,6 +69,45 @@ public:
   }
 
 private:
+  template<size_t> friend class test_cn_slow_hash_multi;
+
   data_t m_data;
   crypto::hash m_expected_hash;
 };
+
+template<size_t a_ways>
+class test_cn_slow_hash_multi
+{
+  static_assert(0 < a_ways && a_ways <= CN_SLOW_HASH_MAX_WAYS, "ways must be between 1 and CN_SLOW_HASH_MAX_WAYS");
+
+public:
+  static const size_t loop_count = 10;
+  static const size_t ways = a_ways;
+
+  bool init()
+  {
+    return m_single.init();
+  }
+
+  bool test()
+  {
+    const void* data[ways];
+    crypto::hash hashes[ways];
+    char* hash_ptrs[ways];
+    for (size_t i = 0; i < ways; ++i)
+    {
+      data[i] = &m_single.m_data;
+      hash_ptrs[i] = reinterpret_cast<char*>(&hashes[i]);
+    }
+    crypto::cn_slow_hash_multi(data, sizeof(m_single.m_data), hash_ptrs, ways);
+    for (size_t i = 0; i < ways; ++i)
+    {
+      if (hashes[i] != m_single.m_expected_hash)
+        return false;
+    }
+    return true;
+  }
+
+private:
+  test_cn_slow_hash m_single;
+};
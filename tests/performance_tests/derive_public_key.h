@@ -62,3 +62,33 @@ private:
   crypto::key_derivation m_key_derivation;
   crypto::public_key m_spend_public_key;
 };
+
+template<size_t a_out_count>
+class test_derive_public_keys : public single_tx_test_base
+{
+public:
+  static const size_t loop_count = 1000 / a_out_count;
+  static const size_t out_count = a_out_count;
+
+  bool init()
+  {
+    if (!single_tx_test_base::init())
+      return false;
+
+    crypto::generate_key_derivation(m_tx_pub_key, m_bob.get_keys().m_view_secret_key, m_key_derivation);
+    m_spend_public_key = m_bob.get_keys().m_account_address.m_spend_public_key;
+    m_derived_keys.resize(out_count);
+
+    return true;
+  }
+
+  bool test()
+  {
+    return crypto::derive_public_keys(m_key_derivation, out_count, m_spend_public_key, m_derived_keys.data());
+  }
+
+private:
+  crypto::key_derivation m_key_derivation;
+  crypto::public_key m_spend_public_key;
+  std::vector<crypto::public_key> m_derived_keys;
+};
@@ -47,3 +47,30 @@ public:
     return cryptonote::is_out_to_acc(m_bob.get_keys(), tx_out, m_tx_pub_key, 0);
   }
 };
+
+template<size_t a_out_count>
+class test_find_outs_to_acc : public single_tx_test_base
+{
+public:
+  static const size_t loop_count = 1000 / a_out_count;
+  static const size_t out_count = a_out_count;
+
+  bool init()
+  {
+    if (!single_tx_test_base::init())
+      return false;
+
+    const cryptonote::txout_to_key& tx_out = boost::get<cryptonote::txout_to_key>(m_tx.vout[0].target);
+    m_out_keys.assign(out_count, tx_out.key);
+    return true;
+  }
+
+  bool test()
+  {
+    std::vector<size_t> outs;
+    return cryptonote::find_outs_to_acc(m_bob.get_keys(), m_tx_pub_key, m_out_keys, outs) && 1 == outs.size();
+  }
+
+private:
+  std::vector<crypto::public_key> m_out_keys;
+};
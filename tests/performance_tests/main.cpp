@@ -77,13 +77,19 @@ int main(int argc, char** argv)
   TEST_PERFORMANCE1(test_check_ring_signature, 100);
 
   TEST_PERFORMANCE0(test_is_out_to_acc);
+  TEST_PERFORMANCE1(test_find_outs_to_acc, 2);
+  TEST_PERFORMANCE1(test_find_outs_to_acc, 16);
   TEST_PERFORMANCE0(test_generate_key_image_helper);
   TEST_PERFORMANCE0(test_generate_key_derivation);
   TEST_PERFORMANCE0(test_generate_key_image);
   TEST_PERFORMANCE0(test_derive_public_key);
+  TEST_PERFORMANCE1(test_derive_public_keys, 16);
+  TEST_PERFORMANCE1(test_derive_public_keys, 256);
   TEST_PERFORMANCE0(test_derive_secret_key);
 
   TEST_PERFORMANCE0(test_cn_slow_hash);
+  TEST_PERFORMANCE1(test_cn_slow_hash_multi, 2);
+  TEST_PERFORMANCE1(test_cn_slow_hash_multi, 4);
 
   std::cout << "Tests finished. Elapsed time: " << timer.elapsed_ms() / 1000 << " sec" << std::endl;
 
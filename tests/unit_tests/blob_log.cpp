@@ -0,0 +1,314 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <fstream>
+#include <boost/filesystem.hpp>
+
+#include "cryptonote_core/blob_log.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  class blob_log_test : public ::testing::Test
+  {
+  protected:
+    virtual void SetUp()
+    {
+      m_dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("blob_log-%%%%-%%%%-%%%%");
+      boost::filesystem::create_directories(m_dir);
+      m_prefix = (m_dir / "test").string();
+    }
+
+    virtual void TearDown()
+    {
+      boost::system::error_code ec;
+      boost::filesystem::remove_all(m_dir, ec);
+    }
+
+    boost::filesystem::path m_dir;
+    std::string m_prefix;
+  };
+}
+
+TEST_F(blob_log_test, new_log_is_empty)
+{
+  blob_log log;
+  ASSERT_TRUE(log.open(m_prefix));
+  ASSERT_EQ(0, log.size());
+  blobdata blob;
+  ASSERT_FALSE(log.get(0, blob));
+}
+
+TEST_F(blob_log_test, append_and_get)
+{
+  blob_log log;
+  ASSERT_TRUE(log.open(m_prefix));
+  ASSERT_TRUE(log.append("first"));
+  ASSERT_TRUE(log.append(""));
+  ASSERT_TRUE(log.append("third"));
+  ASSERT_EQ(3, log.size());
+
+  blobdata blob;
+  ASSERT_TRUE(log.get(0, blob));
+  ASSERT_EQ("first", blob);
+  ASSERT_TRUE(log.get(1, blob));
+  ASSERT_EQ("", blob);
+  ASSERT_TRUE(log.get(2, blob));
+  ASSERT_EQ("third", blob);
+}
+
+TEST_F(blob_log_test, grows_past_initial_capacity)
+{
+  blob_log log;
+  ASSERT_TRUE(log.open(m_prefix));
+  const blobdata big(3 * 1024 * 1024 + 17, 'x');
+  for (size_t i = 0; i < 2000; ++i)
+    ASSERT_TRUE(log.append(i % 1000 ? std::to_string(i) : big));
+  ASSERT_EQ(2000, log.size());
+
+  blobdata blob;
+  ASSERT_TRUE(log.get(1000, blob));
+  ASSERT_EQ(big, blob);
+  ASSERT_TRUE(log.get(1999, blob));
+  ASSERT_EQ("1999", blob);
+}
+
+TEST_F(blob_log_test, small_initial_capacity_grows)
+{
+  blob_log log;
+  ASSERT_TRUE(log.open(m_prefix, false, 4, 64));
+  ASSERT_GT(1024 * 1024, boost::filesystem::file_size(m_prefix + ".dat"));
+  const blobdata big(1000, 'x');
+  for (size_t i = 0; i < 10; ++i)
+    ASSERT_TRUE(log.append(i % 5 ? std::to_string(i) : big));
+  ASSERT_EQ(10, log.size());
+
+  blobdata blob;
+  ASSERT_TRUE(log.get(5, blob));
+  ASSERT_EQ(big, blob);
+  ASSERT_TRUE(log.get(9, blob));
+  ASSERT_EQ("9", blob);
+}
+
+TEST_F(blob_log_test, pop_back_and_truncate)
+{
+  blob_log log;
+  ASSERT_TRUE(log.open(m_prefix));
+  for (size_t i = 0; i < 10; ++i)
+    ASSERT_TRUE(log.append(std::to_string(i)));
+
+  ASSERT_TRUE(log.pop_back());
+  ASSERT_EQ(9, log.size());
+  ASSERT_TRUE(log.append("new"));
+
+  blobdata blob;
+  ASSERT_TRUE(log.get(9, blob));
+  ASSERT_EQ("new", blob);
+
+  ASSERT_TRUE(log.truncate(3));
+  ASSERT_EQ(3, log.size());
+  ASSERT_TRUE(log.get(2, blob));
+  ASSERT_EQ("2", blob);
+
+  ASSERT_TRUE(log.truncate(0));
+  ASSERT_FALSE(log.pop_back());
+}
+
+TEST_F(blob_log_test, restore_brings_back_removed_records)
+{
+  blob_log log;
+  ASSERT_TRUE(log.open(m_prefix));
+  for (size_t i = 0; i < 5; ++i)
+    ASSERT_TRUE(log.append(std::to_string(i)));
+
+  ASSERT_TRUE(log.truncate(2));
+  ASSERT_EQ(5, log.restorable_count(5));
+  ASSERT_EQ(5, log.restorable_count(7));
+  ASSERT_EQ(4, log.restorable_count(4));
+  ASSERT_TRUE(log.restore(5));
+  ASSERT_EQ(5, log.size());
+  blobdata blob;
+  ASSERT_TRUE(log.get(4, blob));
+  ASSERT_EQ("4", blob);
+
+  ASSERT_FALSE(log.restore(3));
+}
+
+TEST_F(blob_log_test, reopen_keeps_records)
+{
+  {
+    blob_log log;
+    ASSERT_TRUE(log.open(m_prefix));
+    ASSERT_TRUE(log.append("a"));
+    ASSERT_TRUE(log.append("bb"));
+    ASSERT_TRUE(log.flush());
+  }
+
+  blob_log log;
+  ASSERT_TRUE(log.open(m_prefix));
+  ASSERT_EQ(2, log.size());
+  blobdata blob;
+  ASSERT_TRUE(log.get(1, blob));
+  ASSERT_EQ("bb", blob);
+}
+
+TEST_F(blob_log_test, rejects_foreign_index)
+{
+  {
+    std::ofstream f(m_prefix + ".idx", std::ios_base::binary);
+    f << "this is not a blob log index file";
+  }
+  blob_log log;
+  ASSERT_FALSE(log.open(m_prefix));
+}
+
+TEST_F(blob_log_test, read_only_sees_records_present_when_opened)
+{
+  blob_log writer;
+  ASSERT_TRUE(writer.open(m_prefix));
+  ASSERT_TRUE(writer.append("a"));
+  ASSERT_TRUE(writer.append("bb"));
+  ASSERT_TRUE(writer.flush());
+
+  blob_log reader;
+  ASSERT_TRUE(reader.open(m_prefix, true));
+  ASSERT_TRUE(reader.is_read_only());
+  ASSERT_TRUE(writer.append("ccc"));
+  ASSERT_EQ(2, reader.size());
+  blobdata blob;
+  ASSERT_TRUE(reader.get(1, blob));
+  ASSERT_EQ("bb", blob);
+  ASSERT_FALSE(reader.get(2, blob));
+
+  ASSERT_FALSE(reader.append("d"));
+  ASSERT_FALSE(reader.pop_back());
+  ASSERT_FALSE(reader.truncate(0));
+  ASSERT_EQ(3, writer.size());
+}
+
+TEST_F(blob_log_test, read_only_needs_existing_log)
+{
+  blob_log log;
+  ASSERT_FALSE(log.open(m_prefix, true));
+  ASSERT_FALSE(boost::filesystem::exists(m_prefix + ".idx"));
+}
+
+TEST_F(blob_log_test, drops_torn_records_on_open)
+{
+  {
+    blob_log log;
+    ASSERT_TRUE(log.open(m_prefix));
+    ASSERT_TRUE(log.append("first"));
+    ASSERT_TRUE(log.flush());
+    ASSERT_TRUE(log.append("second"));
+    ASSERT_TRUE(log.append("third"));
+  }
+  //crash before the last flush: the header counting one flushed record and the index made it to
+  //the disk, the data of the second record didn't while the one of the third did
+  {
+    std::fstream f(m_prefix + ".idx", std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+    const uint64_t flushed_count = 1;
+    f.seekp(3 * sizeof(uint64_t));
+    f.write(reinterpret_cast<const char*>(&flushed_count), sizeof(flushed_count));
+  }
+  {
+    std::fstream f(m_prefix + ".dat", std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+    f.seekp(strlen("first"));
+    f.write("\0\0\0", 3);
+  }
+
+  blob_log log;
+  ASSERT_TRUE(log.open(m_prefix));
+  ASSERT_EQ(1, log.size());
+  blobdata blob;
+  ASSERT_TRUE(log.get(0, blob));
+  ASSERT_EQ("first", blob);
+}
+
+TEST_F(blob_log_test, get_rejects_corrupted_record)
+{
+  blob_log log;
+  ASSERT_TRUE(log.open(m_prefix));
+  ASSERT_TRUE(log.append("first"));
+  ASSERT_TRUE(log.append("second"));
+  ASSERT_TRUE(log.flush());
+  {
+    std::fstream f(m_prefix + ".dat", std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+    f.write("F", 1);
+  }
+
+  blob_log reader;
+  ASSERT_TRUE(reader.open(m_prefix, true));
+  ASSERT_EQ(2, reader.size());
+  blobdata blob;
+  ASSERT_FALSE(reader.get(0, blob));
+  ASSERT_TRUE(reader.get(1, blob));
+  ASSERT_EQ("second", blob);
+}
+
+TEST_F(blob_log_test, restore_rejects_overwritten_records)
+{
+  blob_log log;
+  ASSERT_TRUE(log.open(m_prefix));
+  for (size_t i = 0; i < 5; ++i)
+    ASSERT_TRUE(log.append(std::to_string(i)));
+
+  //the record appended over the removed ones overwrites their data
+  ASSERT_TRUE(log.truncate(2));
+  ASSERT_TRUE(log.append("xyz"));
+  ASSERT_FALSE(log.restore(5));
+  ASSERT_EQ(3, log.size());
+  ASSERT_EQ(3, log.restorable_count(5));
+
+  ASSERT_TRUE(log.pop_back());
+  ASSERT_TRUE(log.restore(3));
+  blobdata blob;
+  ASSERT_TRUE(log.get(2, blob));
+  ASSERT_EQ("xyz", blob);
+}
+
+TEST_F(blob_log_test, get_reads_part_of_record)
+{
+  blob_log log;
+  ASSERT_TRUE(log.open(m_prefix));
+  ASSERT_TRUE(log.append("first"));
+  ASSERT_TRUE(log.append("second"));
+
+  blobdata blob;
+  ASSERT_TRUE(log.get(1, 1, 3, blob));
+  ASSERT_EQ("eco", blob);
+  ASSERT_TRUE(log.get(1, 6, 0, blob));
+  ASSERT_EQ("", blob);
+  ASSERT_FALSE(log.get(1, 4, 3, blob));
+  ASSERT_FALSE(log.get(1, 7, 0, blob));
+  ASSERT_FALSE(log.get(2, 0, 0, blob));
+}
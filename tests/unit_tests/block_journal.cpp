@@ -0,0 +1,190 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include <fstream>
+#include <boost/filesystem.hpp>
+
+#include "cryptonote_core/block_journal.h"
+#include "blockchain_tests_utils.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  class block_journal_test : public ::testing::Test
+  {
+  protected:
+    virtual void SetUp()
+    {
+      m_dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("block_journal-%%%%-%%%%-%%%%");
+      boost::filesystem::create_directories(m_dir);
+      m_path = (m_dir / "test.journal").string();
+    }
+
+    virtual void TearDown()
+    {
+      boost::system::error_code ec;
+      boost::filesystem::remove_all(m_dir, ec);
+    }
+
+    boost::filesystem::path m_dir;
+    std::string m_path;
+  };
+}
+
+TEST_F(block_journal_test, missing_journal_is_not_loaded)
+{
+  uint64_t base_height = 0;
+  std::vector<block_journal::entry> entries;
+  ASSERT_FALSE(block_journal::load(m_path, base_height, entries));
+}
+
+TEST_F(block_journal_test, append_and_load)
+{
+  {
+    block_journal journal;
+    ASSERT_TRUE(journal.open(m_path, 10));
+    ASSERT_TRUE(journal.append(block_journal::op_push, 10, "block 10"));
+    ASSERT_TRUE(journal.append(block_journal::op_pop, 10, ""));
+    ASSERT_TRUE(journal.append(block_journal::op_push, 10, "other block 10"));
+    ASSERT_EQ(3, journal.records());
+    ASSERT_EQ(3, journal.unsynced_records());
+    ASSERT_TRUE(journal.sync());
+    ASSERT_EQ(0, journal.unsynced_records());
+  }
+
+  uint64_t base_height = 0;
+  std::vector<block_journal::entry> entries;
+  ASSERT_TRUE(block_journal::load(m_path, base_height, entries));
+  ASSERT_EQ(10, base_height);
+  ASSERT_EQ(3, entries.size());
+  ASSERT_EQ(block_journal::op_push, entries[0].op);
+  ASSERT_EQ("block 10", entries[0].record);
+  ASSERT_EQ(block_journal::op_pop, entries[1].op);
+  ASSERT_EQ(10, entries[1].height);
+  ASSERT_EQ("other block 10", entries[2].record);
+}
+
+TEST_F(block_journal_test, reset_drops_records)
+{
+  block_journal journal;
+  ASSERT_TRUE(journal.open(m_path, 0));
+  ASSERT_TRUE(journal.append(block_journal::op_push, 0, "genesis"));
+  ASSERT_TRUE(journal.reset(1));
+  ASSERT_EQ(0, journal.records());
+
+  uint64_t base_height = 0;
+  std::vector<block_journal::entry> entries;
+  ASSERT_TRUE(block_journal::load(m_path, base_height, entries));
+  ASSERT_EQ(1, base_height);
+  ASSERT_TRUE(entries.empty());
+}
+
+TEST_F(block_journal_test, torn_record_is_ignored)
+{
+  {
+    block_journal journal;
+    ASSERT_TRUE(journal.open(m_path, 0));
+    ASSERT_TRUE(journal.append(block_journal::op_push, 0, "complete"));
+    ASSERT_TRUE(journal.append(block_journal::op_push, 1, "torn"));
+  }
+  boost::filesystem::resize_file(m_path, boost::filesystem::file_size(m_path) - 1);
+
+  uint64_t base_height = 0;
+  std::vector<block_journal::entry> entries;
+  ASSERT_TRUE(block_journal::load(m_path, base_height, entries));
+  ASSERT_EQ(1, entries.size());
+  ASSERT_EQ("complete", entries[0].record);
+}
+
+TEST_F(block_journal_test, corrupted_record_is_ignored)
+{
+  {
+    block_journal journal;
+    ASSERT_TRUE(journal.open(m_path, 0));
+    ASSERT_TRUE(journal.append(block_journal::op_push, 0, "complete"));
+    ASSERT_TRUE(journal.append(block_journal::op_push, 1, "corrupted"));
+  }
+  {
+    std::fstream f(m_path, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+    f.seekp(-40, std::ios_base::end);
+    f.put('X');
+  }
+
+  uint64_t base_height = 0;
+  std::vector<block_journal::entry> entries;
+  ASSERT_TRUE(block_journal::load(m_path, base_height, entries));
+  ASSERT_EQ(1, entries.size());
+}
+
+TEST_F(block_journal_test, replay_keeps_intact_blocks_when_its_base_is_lost)
+{
+  account_base miner;
+  miner.generate();
+  {
+    unit_test::test_blockchain chain;
+    ASSERT_TRUE(chain.init(m_dir));
+    ASSERT_TRUE(chain.mine_blocks(miner.get_keys().m_account_address, 5));
+  }
+  //a journal building on two blocks the block log never got
+  {
+    block_journal journal;
+    ASSERT_TRUE(journal.open((m_dir / CRYPTONOTE_BLOCKCHAINDATA_JOURNAL_FILENAME).string(), 8));
+    ASSERT_TRUE(journal.append(block_journal::op_push, 8, "block 8"));
+  }
+
+  unit_test::test_blockchain chain;
+  ASSERT_TRUE(chain.init(m_dir));
+  EXPECT_EQ(6, chain.storage().get_current_blockchain_height());
+  ASSERT_TRUE(chain.mine_blocks(miner.get_keys().m_account_address, 1));
+  EXPECT_EQ(7, chain.storage().get_current_blockchain_height());
+}
+
+TEST_F(block_journal_test, replay_stops_at_changes_that_dont_apply)
+{
+  account_base miner;
+  miner.generate();
+  {
+    unit_test::test_blockchain chain;
+    ASSERT_TRUE(chain.init(m_dir));
+    ASSERT_TRUE(chain.mine_blocks(miner.get_keys().m_account_address, 5));
+  }
+  //the removal of the top block applies, the push of a block above the chain doesn't
+  {
+    block_journal journal;
+    ASSERT_TRUE(journal.open((m_dir / CRYPTONOTE_BLOCKCHAINDATA_JOURNAL_FILENAME).string(), 6));
+    ASSERT_TRUE(journal.append(block_journal::op_pop, 5, ""));
+    ASSERT_TRUE(journal.append(block_journal::op_push, 7, "block 7"));
+  }
+
+  unit_test::test_blockchain chain;
+  ASSERT_TRUE(chain.init(m_dir));
+  EXPECT_EQ(5, chain.storage().get_current_blockchain_height());
+}
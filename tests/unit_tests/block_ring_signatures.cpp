@@ -0,0 +1,160 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+#include "gtest/gtest.h"
+
+#include "cryptonote_core/account.h"
+#include "blockchain_tests_utils.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  const uint64_t test_fee = 100000000000;
+
+  class block_ring_signatures : public ::testing::Test
+  {
+  protected:
+    virtual void SetUp()
+    {
+      m_alice.generate();
+      m_bob.generate();
+      ASSERT_TRUE(m_chain.init());
+
+      //three rewards of alice's to spend, unlocked by the blocks on top
+      for(size_t i = 0; i != 3; i++)
+      {
+        block b;
+        ASSERT_TRUE(m_chain.mine_block(m_alice.get_keys().m_account_address, b));
+        m_rewards.push_back(b.miner_tx);
+      }
+      ASSERT_TRUE(m_chain.mine_blocks(m_alice.get_keys().m_account_address, CRYPTONOTE_MINED_MONEY_UNLOCK_WINDOW));
+    }
+
+    transaction make_transfer(size_t reward)
+    {
+      return m_chain.make_transfer(m_alice.get_keys(), m_rewards[reward], m_bob.get_keys().m_account_address, 1000000000000, test_fee);
+    }
+
+    //! A transfer whose first ring signature doesn't verify, which the pool only takes as part of a block
+    transaction make_bad_transfer(size_t reward)
+    {
+      transaction tx = make_transfer(reward);
+      tx.signatures[0][0].r.data[0] ^= 1;
+      tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+      EXPECT_TRUE(m_chain.pool().add_tx(tx, tvc, true));
+      return tx;
+    }
+
+    void add_to_pool(const transaction& tx)
+    {
+      tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+      ASSERT_TRUE(m_chain.pool().add_tx(tx, tvc, false));
+      ASSERT_FALSE(tvc.m_verifivation_failed);
+    }
+
+    account_base m_alice;
+    account_base m_bob;
+    unit_test::test_blockchain m_chain;
+    std::vector<transaction> m_rewards;
+  };
+}
+
+TEST_F(block_ring_signatures, invalid_signature_is_reported_for_its_transaction)
+{
+  std::vector<transaction> txs;
+  txs.push_back(make_transfer(0));
+  txs.push_back(make_bad_transfer(1));
+  txs.push_back(make_transfer(2));
+
+  std::vector<const transaction*> tx_ptrs;
+  std::vector<crypto::hash> tx_ids;
+  std::vector<crypto::hash> tx_prefix_hashes;
+  BOOST_FOREACH(const transaction& tx, txs)
+  {
+    tx_ptrs.push_back(&tx);
+    tx_ids.push_back(get_transaction_hash(tx));
+    tx_prefix_hashes.push_back(get_transaction_prefix_hash(tx));
+  }
+  std::vector<bool> invalid;
+  m_chain.storage().check_txs_ring_signatures(tx_ptrs, tx_ids, tx_prefix_hashes, invalid);
+  ASSERT_EQ(3, invalid.size());
+  EXPECT_FALSE(invalid[0]);
+  EXPECT_TRUE(invalid[1]);
+  EXPECT_FALSE(invalid[2]);
+}
+
+TEST_F(block_ring_signatures, block_with_an_invalid_signature_is_rejected)
+{
+  transaction good = make_transfer(0);
+  add_to_pool(good);
+  transaction bad = make_bad_transfer(1);
+  crypto::hash bad_id = get_transaction_hash(bad);
+  uint64_t height = m_chain.storage().get_current_blockchain_height();
+
+  //the template only holds the good transaction, the bad one comes after it
+  block b;
+  EXPECT_FALSE(m_chain.mine_block(m_alice.get_keys().m_account_address, b, std::list<crypto::hash>(1, bad_id)));
+  ASSERT_EQ(2, b.tx_hashes.size());
+  EXPECT_EQ(get_transaction_hash(good), b.tx_hashes[0]);
+  EXPECT_EQ(height, m_chain.storage().get_current_blockchain_height());
+  //both are back in the pool
+  EXPECT_TRUE(m_chain.pool().have_tx(get_transaction_hash(good)));
+  EXPECT_TRUE(m_chain.pool().have_tx(bad_id));
+
+  //the good transaction alone goes through, it wasn't blamed for the bad one
+  ASSERT_TRUE(m_chain.mine_block(m_alice.get_keys().m_account_address, b));
+  ASSERT_EQ(1, b.tx_hashes.size());
+  EXPECT_EQ(get_transaction_hash(good), b.tx_hashes[0]);
+  EXPECT_FALSE(m_chain.pool().have_tx(get_transaction_hash(good)));
+
+  //and the bad one still fails on its own
+  EXPECT_FALSE(m_chain.mine_block(m_alice.get_keys().m_account_address, b, std::list<crypto::hash>(1, bad_id)));
+  EXPECT_EQ(height + 1, m_chain.storage().get_current_blockchain_height());
+  EXPECT_TRUE(m_chain.pool().have_tx(bad_id));
+}
+
+TEST_F(block_ring_signatures, invalid_signature_ahead_of_a_valid_one)
+{
+  transaction bad = make_bad_transfer(0);
+  transaction good = make_transfer(1);
+  add_to_pool(good);
+  uint64_t height = m_chain.storage().get_current_blockchain_height();
+
+  //put the bad transaction first
+  block b;
+  ASSERT_TRUE(m_chain.make_block(m_alice.get_keys().m_account_address, b));
+  b.tx_hashes.insert(b.tx_hashes.begin(), get_transaction_hash(bad));
+  EXPECT_FALSE(m_chain.add_block(b));
+  EXPECT_EQ(height, m_chain.storage().get_current_blockchain_height());
+
+  ASSERT_TRUE(m_chain.mine_block(m_alice.get_keys().m_account_address, b));
+  ASSERT_EQ(1, b.tx_hashes.size());
+  EXPECT_EQ(get_transaction_hash(good), b.tx_hashes[0]);
+}
@@ -0,0 +1,456 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include <fstream>
+#include <map>
+#include <boost/filesystem.hpp>
+
+#include "blockchain_tests_utils.h"
+#include "cryptonote_core/blockchain_snapshot.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  class blockchain_storage_test : public ::testing::Test
+  {
+  protected:
+    virtual void SetUp()
+    {
+      m_dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("blockchain_storage-%%%%-%%%%-%%%%");
+      boost::filesystem::create_directories(m_dir);
+      m_miner.generate();
+    }
+
+    virtual void TearDown()
+    {
+      boost::system::error_code ec;
+      boost::filesystem::remove_all(m_dir, ec);
+    }
+
+    const account_public_address& miner_address() const { return m_miner.get_keys().m_account_address; }
+
+    //! Mines a reward of the miner's and the blocks which unlock it, returns the reward
+    transaction mine_spendable_reward(unit_test::test_blockchain& chain)
+    {
+      block b;
+      EXPECT_TRUE(chain.mine_block(miner_address(), b));
+      EXPECT_TRUE(chain.mine_blocks(miner_address(), CRYPTONOTE_MINED_MONEY_UNLOCK_WINDOW));
+      return b.miner_tx;
+    }
+
+    //! Mines a block holding a transfer of the reward to a new account, returns the transfer
+    transaction mine_transfer(unit_test::test_blockchain& chain, const transaction& reward)
+    {
+      account_base to;
+      to.generate();
+      transaction tx = chain.make_transfer(m_miner.get_keys(), reward, to.get_keys().m_account_address, 1000000000000, 100000000000);
+      tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+      EXPECT_TRUE(chain.pool().add_tx(tx, tvc, false));
+      block b;
+      EXPECT_TRUE(chain.mine_block(miner_address(), b));
+      EXPECT_EQ(1, b.tx_hashes.size());
+      return tx;
+    }
+
+    boost::filesystem::path m_dir;
+    account_base m_miner;
+  };
+}
+
+TEST_F(blockchain_storage_test, keeps_alternative_blocks_across_restarts)
+{
+  block main_block, alt_block;
+  {
+    unit_test::test_blockchain chain;
+    ASSERT_TRUE(chain.init(m_dir));
+    ASSERT_TRUE(chain.mine_blocks(miner_address(), 3));
+    //two blocks on the same height, the one added second stays aside
+    account_base other;
+    other.generate();
+    ASSERT_TRUE(chain.make_block(miner_address(), main_block));
+    ASSERT_TRUE(chain.make_block(other.get_keys().m_account_address, alt_block));
+    ASSERT_TRUE(chain.add_block(main_block));
+    ASSERT_FALSE(chain.add_block(alt_block));
+    ASSERT_EQ(1, chain.storage().get_alternative_blocks_count());
+  }
+
+  unit_test::test_blockchain chain;
+  ASSERT_TRUE(chain.init(m_dir));
+  EXPECT_EQ(5, chain.storage().get_current_blockchain_height());
+  std::list<block> alt_blocks;
+  ASSERT_TRUE(chain.storage().get_alternative_blocks(alt_blocks));
+  ASSERT_EQ(1, alt_blocks.size());
+  EXPECT_EQ(get_block_hash(alt_block), get_block_hash(alt_blocks.front()));
+}
+
+TEST_F(blockchain_storage_test, serves_blocks_and_transactions_from_the_block_log)
+{
+  crypto::hash tx_id;
+  std::list<block> blocks;
+  std::list<transaction> txs;
+  std::vector<uint64_t> global_indexes;
+  {
+    unit_test::test_blockchain chain;
+    ASSERT_TRUE(chain.init(m_dir));
+    tx_id = get_transaction_hash(mine_transfer(chain, mine_spendable_reward(chain)));
+    uint64_t height = chain.storage().get_current_blockchain_height();
+    ASSERT_TRUE(chain.storage().get_blocks(0, height, blocks, txs));
+    ASSERT_EQ(height, blocks.size());
+    ASSERT_EQ(1, txs.size());
+    EXPECT_EQ(tx_id, get_transaction_hash(txs.front()));
+    ASSERT_TRUE(chain.storage().get_tx_outputs_gindexs(tx_id, global_indexes));
+  }
+
+  unit_test::test_blockchain chain;
+  ASSERT_TRUE(chain.init(m_dir));
+  std::list<block> loaded_blocks;
+  std::list<transaction> loaded_txs;
+  ASSERT_TRUE(chain.storage().get_blocks(0, blocks.size(), loaded_blocks, loaded_txs));
+  ASSERT_EQ(blocks.size(), loaded_blocks.size());
+  EXPECT_TRUE(std::equal(blocks.begin(), blocks.end(), loaded_blocks.begin(), [](const block& a, const block& b) { return get_block_hash(a) == get_block_hash(b); }));
+  ASSERT_EQ(1, loaded_txs.size());
+  EXPECT_EQ(tx_id, get_transaction_hash(loaded_txs.front()));
+
+  transaction tx;
+  ASSERT_TRUE(chain.storage().get_tx(tx_id, tx));
+  EXPECT_EQ(tx_id, get_transaction_hash(tx));
+  ASSERT_TRUE(chain.storage().get_tx(get_transaction_hash(blocks.back().miner_tx), tx));
+  EXPECT_EQ(get_transaction_hash(blocks.back().miner_tx), get_transaction_hash(tx));
+  EXPECT_FALSE(chain.storage().get_tx(crypto::rand<crypto::hash>(), tx));
+  std::vector<uint64_t> loaded_indexes;
+  ASSERT_TRUE(chain.storage().get_tx_outputs_gindexs(tx_id, loaded_indexes));
+  EXPECT_EQ(global_indexes, loaded_indexes);
+
+  block b;
+  ASSERT_TRUE(chain.storage().get_block_by_hash(get_block_hash(blocks.back()), b));
+  EXPECT_EQ(get_block_hash(blocks.back()), get_block_hash(b));
+}
+
+TEST_F(blockchain_storage_test, reorganization_returns_transactions_of_the_old_chain_to_the_pool)
+{
+  unit_test::test_blockchain chain;
+  ASSERT_TRUE(chain.init(m_dir));
+  const transaction reward = mine_spendable_reward(chain);
+
+  //a second chain sharing the blocks so far
+  unit_test::test_blockchain other;
+  ASSERT_TRUE(other.init());
+  std::list<block> blocks;
+  ASSERT_TRUE(chain.storage().get_blocks(1, chain.storage().get_current_blockchain_height(), blocks));
+  BOOST_FOREACH(const block& b, blocks)
+  {
+    block_verification_context bvc = AUTO_VAL_INIT(bvc);
+    ASSERT_TRUE(other.storage().add_new_block(b, bvc));
+    ASSERT_TRUE(bvc.m_added_to_main_chain);
+  }
+
+  const crypto::hash tx_id = get_transaction_hash(mine_transfer(chain, reward));
+  ASSERT_TRUE(other.mine_blocks(miner_address(), 2));
+  blocks.clear();
+  ASSERT_TRUE(other.storage().get_blocks(chain.storage().get_current_blockchain_height() - 1, 2, blocks));
+  BOOST_FOREACH(const block& b, blocks)
+  {
+    block_verification_context bvc = AUTO_VAL_INIT(bvc);
+    ASSERT_TRUE(chain.storage().add_new_block(b, bvc));
+    ASSERT_FALSE(bvc.m_verifivation_failed);
+  }
+
+  EXPECT_EQ(other.storage().get_current_blockchain_height(), chain.storage().get_current_blockchain_height());
+  EXPECT_EQ(other.storage().get_tail_id(), chain.storage().get_tail_id());
+  EXPECT_EQ(1, chain.storage().get_alternative_blocks_count());
+  transaction tx;
+  EXPECT_FALSE(chain.storage().get_tx(tx_id, tx));
+  EXPECT_TRUE(chain.pool().have_tx(tx_id));
+}
+
+TEST_F(blockchain_storage_test, outputs_of_each_amount_are_indexed_in_chain_order)
+{
+  unit_test::test_blockchain chain;
+  ASSERT_TRUE(chain.init(m_dir));
+  ASSERT_TRUE(chain.mine_blocks(miner_address(), 20));
+
+  //miner transactions of a second chain sharing the blocks so far replace the last one
+  unit_test::test_blockchain other;
+  ASSERT_TRUE(other.init());
+  std::list<block> blocks;
+  ASSERT_TRUE(chain.storage().get_blocks(1, chain.storage().get_current_blockchain_height(), blocks));
+  BOOST_FOREACH(const block& b, blocks)
+  {
+    block_verification_context bvc = AUTO_VAL_INIT(bvc);
+    ASSERT_TRUE(other.storage().add_new_block(b, bvc));
+  }
+  ASSERT_TRUE(chain.mine_blocks(miner_address(), 1));
+  ASSERT_TRUE(other.mine_blocks(miner_address(), 2));
+  blocks.clear();
+  ASSERT_TRUE(other.storage().get_blocks(chain.storage().get_current_blockchain_height() - 1, 2, blocks));
+  BOOST_FOREACH(const block& b, blocks)
+  {
+    block_verification_context bvc = AUTO_VAL_INIT(bvc);
+    ASSERT_TRUE(chain.storage().add_new_block(b, bvc));
+  }
+  ASSERT_EQ(other.storage().get_tail_id(), chain.storage().get_tail_id());
+
+  std::map<uint64_t, std::list<crypto::public_key> > expected;
+  blocks.clear();
+  ASSERT_TRUE(chain.storage().get_blocks(0, chain.storage().get_current_blockchain_height(), blocks));
+  BOOST_FOREACH(const block& b, blocks)
+  {
+    BOOST_FOREACH(const tx_out& out, b.miner_tx.vout)
+      expected[out.amount].push_back(boost::get<txout_to_key>(out.target).key);
+  }
+  ASSERT_LT(1, expected.size());
+  BOOST_FOREACH(const auto& v, expected)
+  {
+    std::list<crypto::public_key> keys;
+    ASSERT_TRUE(chain.storage().get_outs(v.first, keys));
+    EXPECT_EQ(v.second, keys);
+  }
+}
+
+TEST_F(blockchain_storage_test, pool_transaction_is_verified_again_after_reorganization)
+{
+  unit_test::test_blockchain chain;
+  ASSERT_TRUE(chain.init(m_dir));
+  const transaction reward = mine_spendable_reward(chain);
+  account_base to;
+  to.generate();
+  const transaction tx = chain.make_transfer(m_miner.get_keys(), reward, to.get_keys().m_account_address, 1000000000000, 100000000000);
+  const crypto::hash tx_id = get_transaction_hash(tx);
+  tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+  ASSERT_TRUE(chain.pool().add_tx(tx, tvc, false));
+  block b;
+  ASSERT_TRUE(chain.make_block(miner_address(), b));
+  ASSERT_EQ(1, b.tx_hashes.size());
+
+  //a longer chain from the genesis on, without the block of the spent reward
+  account_base other_miner;
+  other_miner.generate();
+  unit_test::test_blockchain other;
+  ASSERT_TRUE(other.init());
+  ASSERT_TRUE(other.mine_blocks(other_miner.get_keys().m_account_address, chain.storage().get_current_blockchain_height() + 1));
+  std::list<block> blocks;
+  ASSERT_TRUE(other.storage().get_blocks(1, other.storage().get_current_blockchain_height(), blocks));
+  BOOST_FOREACH(const block& ob, blocks)
+  {
+    block_verification_context bvc = AUTO_VAL_INIT(bvc);
+    ASSERT_TRUE(chain.storage().add_new_block(ob, bvc));
+    ASSERT_FALSE(bvc.m_verifivation_failed);
+  }
+  ASSERT_EQ(other.storage().get_tail_id(), chain.storage().get_tail_id());
+
+  //the ring member the transaction was verified against is gone
+  EXPECT_TRUE(chain.pool().have_tx(tx_id));
+  ASSERT_TRUE(chain.make_block(miner_address(), b));
+  EXPECT_TRUE(b.tx_hashes.empty());
+  EXPECT_FALSE(chain.mine_block(miner_address(), b, std::list<crypto::hash>(1, tx_id)));
+}
+
+TEST_F(blockchain_storage_test, batch_signature_check_flags_bad_signatures)
+{
+  unit_test::test_blockchain chain;
+  ASSERT_TRUE(chain.init(m_dir));
+  const transaction reward = mine_spendable_reward(chain);
+  account_base to;
+  to.generate();
+  const transaction tx = chain.make_transfer(m_miner.get_keys(), reward, to.get_keys().m_account_address, 1000000000000, 100000000000);
+  transaction bad = tx;
+  reinterpret_cast<unsigned char*>(&bad.signatures[0][0])[0] ^= 1;
+
+  std::vector<const transaction*> txs;
+  std::vector<crypto::hash> tx_ids;
+  std::vector<crypto::hash> tx_prefix_hashes;
+  txs.push_back(&tx);
+  txs.push_back(&bad);
+  BOOST_FOREACH(const transaction* t, txs)
+  {
+    tx_ids.push_back(get_transaction_hash(*t));
+    tx_prefix_hashes.push_back(get_transaction_prefix_hash(*t));
+  }
+  std::vector<bool> invalid;
+  chain.storage().check_txs_ring_signatures(txs, tx_ids, tx_prefix_hashes, invalid);
+  ASSERT_EQ(2, invalid.size());
+  EXPECT_FALSE(invalid[0]);
+  EXPECT_TRUE(invalid[1]);
+
+  tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+  EXPECT_TRUE(chain.pool().add_tx(tx, tvc, false));
+  EXPECT_TRUE(chain.pool().have_tx(tx_ids[0]));
+  tvc = AUTO_VAL_INIT(tvc);
+  EXPECT_FALSE(chain.pool().add_tx(bad, tvc, false));
+  EXPECT_TRUE(tvc.m_verifivation_failed);
+}
+
+TEST_F(blockchain_storage_test, reuses_indexes_stored_on_exit)
+{
+  crypto::hash tx_id;
+  {
+    unit_test::test_blockchain chain;
+    ASSERT_TRUE(chain.init(m_dir));
+    tx_id = get_transaction_hash(mine_transfer(chain, mine_spendable_reward(chain)));
+  }
+  //the state is only written again if the indexes are built again
+  const boost::filesystem::path state = m_dir / CRYPTONOTE_BLOCKCHAINDATA_INDEX_FILENAME ".state";
+  const boost::filesystem::path state_link = m_dir / "state.link";
+  boost::filesystem::create_hard_link(state, state_link);
+
+  unit_test::test_blockchain chain;
+  ASSERT_TRUE(chain.init(m_dir));
+  EXPECT_TRUE(boost::filesystem::equivalent(state, state_link));
+  transaction tx;
+  ASSERT_TRUE(chain.storage().get_tx(tx_id, tx));
+  EXPECT_EQ(tx_id, get_transaction_hash(tx));
+  EXPECT_TRUE(chain.mine_blocks(miner_address(), 1));
+  EXPECT_FALSE(boost::filesystem::equivalent(state, state_link));
+}
+
+TEST_F(blockchain_storage_test, rebuilds_indexes_not_stored_on_exit)
+{
+  crypto::hash tx_id;
+  crypto::hash tail_id;
+  std::vector<uint64_t> global_indexes;
+  {
+    unit_test::test_blockchain chain;
+    ASSERT_TRUE(chain.init(m_dir));
+    tx_id = get_transaction_hash(mine_transfer(chain, mine_spendable_reward(chain)));
+    tail_id = chain.storage().get_tail_id();
+    ASSERT_TRUE(chain.storage().get_tx_outputs_gindexs(tx_id, global_indexes));
+  }
+  //as if the daemon died while changing them: the state says they are not clean and one of them lost its entries
+  const std::string prefix = (m_dir / CRYPTONOTE_BLOCKCHAINDATA_INDEX_FILENAME).string();
+  {
+    std::fstream state(prefix + ".state", std::ios::in | std::ios::out | std::ios::binary);
+    ASSERT_TRUE(state.good());
+    const uint64_t clean = 0;
+    state.seekp(2 * sizeof(uint64_t));
+    state.write(reinterpret_cast<const char*>(&clean), sizeof(clean));
+    ASSERT_TRUE(state.good());
+  }
+  ASSERT_TRUE(boost::filesystem::remove(prefix + ".txs"));
+
+  unit_test::test_blockchain chain;
+  ASSERT_TRUE(chain.init(m_dir));
+  EXPECT_EQ(tail_id, chain.storage().get_tail_id());
+  transaction tx;
+  ASSERT_TRUE(chain.storage().get_tx(tx_id, tx));
+  EXPECT_EQ(tx_id, get_transaction_hash(tx));
+  std::vector<uint64_t> loaded_indexes;
+  ASSERT_TRUE(chain.storage().get_tx_outputs_gindexs(tx_id, loaded_indexes));
+  EXPECT_EQ(global_indexes, loaded_indexes);
+}
+
+TEST_F(blockchain_storage_test, rebuilds_indexes_without_state)
+{
+  crypto::hash tail_id;
+  uint64_t height = 0;
+  {
+    unit_test::test_blockchain chain;
+    ASSERT_TRUE(chain.init(m_dir));
+    ASSERT_TRUE(chain.mine_blocks(miner_address(), 3));
+    tail_id = chain.storage().get_tail_id();
+    height = chain.storage().get_current_blockchain_height();
+  }
+  ASSERT_TRUE(boost::filesystem::remove(m_dir / CRYPTONOTE_BLOCKCHAINDATA_INDEX_FILENAME ".state"));
+
+  unit_test::test_blockchain chain;
+  ASSERT_TRUE(chain.init(m_dir));
+  EXPECT_EQ(height, chain.storage().get_current_blockchain_height());
+  EXPECT_EQ(tail_id, chain.storage().get_tail_id());
+  EXPECT_TRUE(boost::filesystem::exists(m_dir / CRYPTONOTE_BLOCKCHAINDATA_INDEX_FILENAME ".state"));
+}
+
+TEST_F(blockchain_storage_test, snapshot_reads_global_output_indexes_stored_by_the_daemon)
+{
+  std::unordered_map<crypto::hash, std::vector<uint64_t> > global_indexes;
+  uint64_t height = 0;
+  {
+    unit_test::test_blockchain chain;
+    ASSERT_TRUE(chain.init(m_dir));
+    mine_transfer(chain, mine_spendable_reward(chain));
+    height = chain.storage().get_current_blockchain_height();
+    std::list<block> blocks;
+    std::list<transaction> txs;
+    ASSERT_TRUE(chain.storage().get_blocks(0, height, blocks, txs));
+    BOOST_FOREACH(const block& b, blocks)
+      txs.push_back(b.miner_tx);
+    BOOST_FOREACH(const transaction& tx, txs)
+      ASSERT_TRUE(chain.storage().get_tx_outputs_gindexs(get_transaction_hash(tx), global_indexes[get_transaction_hash(tx)]));
+
+    //indexes changed since they were stored can't be used
+    blockchain_snapshot snapshot;
+    EXPECT_FALSE(snapshot.open(m_dir.string()));
+  }
+
+  blockchain_snapshot snapshot;
+  ASSERT_TRUE(snapshot.open(m_dir.string()));
+  ASSERT_EQ(height, snapshot.height());
+  std::list<COMMAND_RPC_GET_BLOCKS_COMPACT::block_entry> blocks;
+  std::unordered_map<crypto::hash, transaction> txs;
+  ASSERT_TRUE(snapshot.get_blocks(1, height, blocks, txs));
+  ASSERT_EQ(height - 1, blocks.size());
+  size_t tx_count = 0;
+  BOOST_FOREACH(const COMMAND_RPC_GET_BLOCKS_COMPACT::block_entry& e, blocks)
+  {
+    BOOST_FOREACH(const COMMAND_RPC_GET_BLOCKS_COMPACT::tx_entry& te, e.txs)
+    {
+      ASSERT_EQ(1, global_indexes.count(te.id));
+      EXPECT_EQ(global_indexes[te.id], te.global_output_indexes);
+      ++tx_count;
+    }
+  }
+  EXPECT_EQ(height, tx_count);
+  EXPECT_EQ(tx_count, txs.size());
+}
+
+TEST_F(blockchain_storage_test, snapshot_fails_once_the_daemon_changes_its_indexes)
+{
+  {
+    unit_test::test_blockchain chain;
+    ASSERT_TRUE(chain.init(m_dir));
+    ASSERT_TRUE(chain.mine_blocks(miner_address(), 3));
+  }
+
+  blockchain_snapshot snapshot;
+  ASSERT_TRUE(snapshot.open(m_dir.string()));
+  std::list<COMMAND_RPC_GET_BLOCKS_COMPACT::block_entry> blocks;
+  std::unordered_map<crypto::hash, transaction> txs;
+  ASSERT_TRUE(snapshot.get_blocks(0, snapshot.height(), blocks, txs));
+  ASSERT_EQ(snapshot.height(), blocks.size());
+
+  //a daemon started on the same data dir while the snapshot is in use
+  unit_test::test_blockchain chain;
+  ASSERT_TRUE(chain.init(m_dir));
+  ASSERT_TRUE(chain.mine_blocks(miner_address(), 1));
+  blocks.clear();
+  txs.clear();
+  EXPECT_FALSE(snapshot.get_blocks(0, snapshot.height(), blocks, txs));
+  EXPECT_TRUE(blocks.empty());
+  EXPECT_TRUE(txs.empty());
+}
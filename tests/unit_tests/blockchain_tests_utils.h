@@ -0,0 +1,182 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <ctime>
+#include <boost/filesystem.hpp>
+
+#include "include_base_utils.h"
+#include "cryptonote_config.h"
+#include "cryptonote_core/blockchain_storage.h"
+#include "cryptonote_core/cryptonote_format_utils.h"
+#include "cryptonote_core/miner.h"
+#include "cryptonote_core/tx_pool.h"
+
+namespace unit_test
+{
+  /*! \brief Builds a transaction spending the outputs of source that belong to from
+   *
+   * \details global_indexes are those of source's outputs. amount goes to to, unlocked from
+   * unlock_time on; what is left after fee goes back to from.
+   */
+  inline cryptonote::transaction construct_transfer(const cryptonote::account_keys& from, const cryptonote::transaction& source, const std::vector<uint64_t>& global_indexes,
+    const cryptonote::account_public_address& to, uint64_t amount, uint64_t fee, uint64_t unlock_time = 0)
+  {
+    std::vector<size_t> outs;
+    uint64_t money = 0;
+    bool r = cryptonote::lookup_acc_outs(from, source, outs, money);
+    CHECK_AND_ASSERT_THROW_MES(r && !outs.empty() && amount + fee <= money, "nothing to spend in the source transaction");
+    CHECK_AND_ASSERT_THROW_MES(global_indexes.size() == source.vout.size(), "global indexes don't match the source transaction");
+
+    std::vector<cryptonote::tx_source_entry> sources;
+    BOOST_FOREACH(size_t o, outs)
+    {
+      sources.push_back(cryptonote::tx_source_entry());
+      cryptonote::tx_source_entry& se = sources.back();
+      se.outputs.push_back(std::make_pair(global_indexes[o], boost::get<cryptonote::txout_to_key>(source.vout[o].target).key));
+      se.real_output = 0;
+      se.real_out_tx_key = cryptonote::get_tx_pub_key_from_extra(source);
+      se.real_output_in_tx_index = o;
+      se.amount = source.vout[o].amount;
+    }
+    std::vector<cryptonote::tx_destination_entry> destinations;
+    destinations.push_back(cryptonote::tx_destination_entry(amount, to));
+    if(money > amount + fee)
+      destinations.push_back(cryptonote::tx_destination_entry(money - amount - fee, from.m_account_address));
+
+    cryptonote::transaction tx;
+    r = cryptonote::construct_tx(from, sources, destinations, std::vector<uint8_t>(), tx, unlock_time);
+    CHECK_AND_ASSERT_THROW_MES(r, "failed to construct transfer");
+    return tx;
+  }
+
+  /*! \brief A blockchain_storage and its pool in a temporary directory
+   *
+   * \details Blocks are spaced by the difficulty target from well in the past, which keeps the
+   * difficulty at its minimum, so mining a block costs a single proof of work.
+   */
+  class test_blockchain
+  {
+  public:
+    test_blockchain()
+      : m_pool(m_storage)
+      , m_storage(m_pool)
+      , m_start_time(time(NULL) - 10000 * DIFFICULTY_TARGET)
+      , m_own_dir(false)
+    {
+    }
+
+    ~test_blockchain()
+    {
+      m_storage.deinit();
+      m_pool.deinit();
+      boost::system::error_code ec;
+      if(m_own_dir)
+        boost::filesystem::remove_all(m_dir, ec);
+    }
+
+    bool init()
+    {
+      m_own_dir = true;
+      m_dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("blockchain-%%%%-%%%%-%%%%");
+      boost::filesystem::create_directories(m_dir);
+      return m_pool.init(m_dir.string()) && m_storage.init(m_dir.string());
+    }
+
+    //! Loads the blockchain stored in dir, which is left in place afterwards
+    bool init(const boost::filesystem::path& dir)
+    {
+      m_dir = dir;
+      return m_pool.init(m_dir.string()) && m_storage.init(m_dir.string());
+    }
+
+    cryptonote::blockchain_storage& storage() { return m_storage; }
+    cryptonote::tx_memory_pool& pool() { return m_pool; }
+
+    //! Builds the next block from the pool, to be added by add_block
+    bool make_block(const cryptonote::account_public_address& miner, cryptonote::block& b)
+    {
+      cryptonote::difficulty_type difficulty = 0;
+      uint64_t height = 0;
+      //the template appends the pool's transactions to whatever b holds
+      b = cryptonote::block();
+      if(!m_storage.create_block_template(b, miner, difficulty, height, cryptonote::blobdata()))
+        return false;
+      b.timestamp = m_start_time + height * DIFFICULTY_TARGET;
+      return true;
+    }
+
+    //! Mines b on top of the chain and adds it, returns whether it went to the main chain
+    bool add_block(cryptonote::block& b)
+    {
+      uint64_t height = boost::get<cryptonote::txin_gen>(b.miner_tx.vin[0]).height;
+      if(!cryptonote::miner::find_nonce_for_given_block(b, m_storage.get_difficulty_for_next_block(), height))
+        return false;
+      cryptonote::block_verification_context bvc = AUTO_VAL_INIT(bvc);
+      m_storage.add_new_block(b, bvc);
+      return bvc.m_added_to_main_chain && !bvc.m_verifivation_failed;
+    }
+
+    //! Builds the next block from the pool, with extra_tx_ids appended, and adds it
+    bool mine_block(const cryptonote::account_public_address& miner, cryptonote::block& b, const std::list<crypto::hash>& extra_tx_ids = std::list<crypto::hash>())
+    {
+      if(!make_block(miner, b))
+        return false;
+      b.tx_hashes.insert(b.tx_hashes.end(), extra_tx_ids.begin(), extra_tx_ids.end());
+      return add_block(b);
+    }
+
+    bool mine_blocks(const cryptonote::account_public_address& miner, size_t count)
+    {
+      cryptonote::block b;
+      for(size_t i = 0; i != count; i++)
+      {
+        if(!mine_block(miner, b))
+          return false;
+      }
+      return true;
+    }
+
+    cryptonote::transaction make_transfer(const cryptonote::account_keys& from, const cryptonote::transaction& source, const cryptonote::account_public_address& to,
+      uint64_t amount, uint64_t fee)
+    {
+      std::vector<uint64_t> global_indexes;
+      bool r = m_storage.get_tx_outputs_gindexs(cryptonote::get_transaction_hash(source), global_indexes);
+      CHECK_AND_ASSERT_THROW_MES(r, "the source transaction is not in the chain");
+      return construct_transfer(from, source, global_indexes, to, amount, fee);
+    }
+
+  private:
+    cryptonote::tx_memory_pool m_pool;
+    cryptonote::blockchain_storage m_storage;
+    uint64_t m_start_time;
+    boost::filesystem::path m_dir;
+    bool m_own_dir;
+  };
+}
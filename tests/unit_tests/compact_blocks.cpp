@@ -0,0 +1,320 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include <unordered_map>
+
+#include "protocol_tests_utils.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  //! Blocks whose transactions have to be in the pool when they are added, nothing else is verified
+  class test_core: public unit_test::test_core_base
+  {
+  public:
+    test_core(): m_lost_tx(null_hash)
+    {
+      m_chain.push_back(unit_test::make_test_block(null_hash, 0));
+    }
+
+    static transaction make_tx(uint64_t amount)
+    {
+      transaction tx = AUTO_VAL_INIT(tx);
+      tx.version = CURRENT_TRANSACTION_VERSION;
+      tx.vout.push_back(tx_out());
+      tx.vout.back().amount = amount;
+      tx.vout.back().target = txout_to_key();
+      return tx;
+    }
+
+    crypto::hash top_id() { return get_block_hash(m_chain.back()); }
+    //! The transaction leaves the pool right before the next block is verified
+    void lose_tx_before_next_block(const crypto::hash& id) { m_lost_tx = id; }
+
+    uint64_t get_current_blockchain_height() { return m_chain.size(); }
+    bool get_short_chain_history(std::list<crypto::hash>& ids) { ids.push_back(top_id()); return true; }
+    bool have_block(const crypto::hash& id)
+    {
+      BOOST_FOREACH(const block& b, m_chain)
+      {
+        if(get_block_hash(b) == id)
+          return true;
+      }
+      return false;
+    }
+    bool get_block_by_hash(const crypto::hash& h, block& blk)
+    {
+      BOOST_FOREACH(const block& b, m_chain)
+      {
+        if(get_block_hash(b) == h)
+        {
+          blk = b;
+          return true;
+        }
+      }
+      return false;
+    }
+    bool get_transactions(const std::vector<crypto::hash>& txs_ids, std::list<transaction>& txs, std::list<crypto::hash>& missed_txs)
+    {
+      BOOST_FOREACH(const crypto::hash& id, txs_ids)
+      {
+        auto it = m_chain_txs.find(id);
+        if(it == m_chain_txs.end())
+          missed_txs.push_back(id);
+        else
+          txs.push_back(it->second);
+      }
+      return true;
+    }
+    bool get_pool_transaction(const crypto::hash& id, transaction& tx)
+    {
+      auto it = m_pool.find(id);
+      if(it == m_pool.end())
+        return false;
+      tx = it->second;
+      return true;
+    }
+    bool pool_has_tx(const crypto::hash& id) { return m_pool.count(id) != 0; }
+    bool get_blockchain_top(uint64_t& height, crypto::hash& top_id)
+    {
+      height = m_chain.size() - 1;
+      top_id = get_block_hash(m_chain.back());
+      return true;
+    }
+    bool handle_incoming_tx(const blobdata& tx_blob, tx_verification_context& tvc, bool keeped_by_block)
+    {
+      transaction tx;
+      if(!parse_and_validate_tx_from_blob(tx_blob, tx))
+      {
+        tvc.m_verifivation_failed = true;
+        return false;
+      }
+      crypto::hash id = get_transaction_hash(tx);
+      if(!m_chain_txs.count(id))
+        m_pool[id] = tx;
+      tvc.m_added_to_pool = true;
+      return true;
+    }
+    bool handle_incoming_txs(const std::list<blobdata>& tx_blobs, std::vector<tx_verification_context>& tvcs, bool keeped_by_block)
+    {
+      tvcs.resize(tx_blobs.size());
+      size_t i = 0;
+      BOOST_FOREACH(const blobdata& tx_blob, tx_blobs)
+        handle_incoming_tx(tx_blob, tvcs[i++], keeped_by_block);
+      return true;
+    }
+    bool handle_incoming_block(const blobdata& block_blob, block_verification_context& bvc, bool update_miner_blocktemplate = true)
+    {
+      block b;
+      if(!parse_and_validate_block_from_blob(block_blob, b))
+      {
+        bvc.m_verifivation_failed = true;
+        return false;
+      }
+      m_pool.erase(m_lost_tx);
+      m_lost_tx = null_hash;
+      if(b.prev_id != top_id())
+      {
+        bvc.m_marked_as_orphaned = true;
+        return false;
+      }
+      BOOST_FOREACH(const crypto::hash& id, b.tx_hashes)
+      {
+        if(!m_pool.count(id))
+        {
+          bvc.m_verifivation_failed = true;
+          return false;
+        }
+      }
+      BOOST_FOREACH(const crypto::hash& id, b.tx_hashes)
+      {
+        m_chain_txs[id] = m_pool[id];
+        m_pool.erase(id);
+      }
+      m_chain.push_back(b);
+      bvc.m_added_to_main_chain = true;
+      return true;
+    }
+
+  private:
+    std::vector<block> m_chain;
+    std::unordered_map<crypto::hash, transaction> m_pool;
+    std::unordered_map<crypto::hash, transaction> m_chain_txs;
+    crypto::hash m_lost_tx;
+  };
+
+  //! A node with a connection to a remote node which knows the new block
+  class compact_blocks : public ::testing::Test
+  {
+  protected:
+    compact_blocks(): m_handler(m_core, &m_p2p), m_remote_handler(m_remote_core, &m_remote_p2p)
+    {
+      m_peer = AUTO_VAL_INIT(m_peer);
+      m_remote_peer = AUTO_VAL_INIT(m_remote_peer);
+      connect(m_p2p, m_peer, true);
+      connect(m_remote_p2p, m_remote_peer, true);
+
+      m_txs.push_back(test_core::make_tx(1));
+      m_txs.push_back(test_core::make_tx(2));
+      std::vector<crypto::hash> tx_hashes;
+      BOOST_FOREACH(const transaction& tx, m_txs)
+      {
+        tx_hashes.push_back(get_transaction_hash(tx));
+        add_tx(m_remote_core, tx);
+      }
+      m_block = unit_test::make_test_block(m_core.top_id(), 1, tx_hashes);
+      block_verification_context bvc = AUTO_VAL_INIT(bvc);
+      m_remote_core.handle_incoming_block(block_to_blob(m_block), bvc);
+    }
+
+    static void connect(unit_test::test_p2p& p2p, cryptonote_connection_context& context, bool compact_blocks)
+    {
+      unit_test::connect_test_context(context, cryptonote_connection_context::state_normal);
+      context.m_compact_blocks = compact_blocks;
+      p2p.add_connection(context);
+    }
+
+    static void add_tx(test_core& core, const transaction& tx)
+    {
+      tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+      core.handle_incoming_tx(tx_to_blob(tx), tvc, false);
+    }
+
+    //! The block as the remote node relays it to compact peers, with the transactions it didn't have in its pool
+    void send_compact_block(const std::list<transaction>& txs)
+    {
+      NOTIFY_NEW_COMPACT_BLOCK::request arg = AUTO_VAL_INIT(arg);
+      arg.b.block = block_to_blob(m_block);
+      BOOST_FOREACH(const transaction& tx, txs)
+        arg.b.txs.push_back(tx_to_blob(tx));
+      arg.current_blockchain_height = 2;
+      unit_test::notify_handler(m_handler, arg, m_peer, NOTIFY_NEW_COMPACT_BLOCK::ID);
+    }
+
+    //! Answers the request for the missing transactions on the remote node
+    void serve_block_txs(NOTIFY_REQUEST_BLOCK_TXS::request& req)
+    {
+      unit_test::notify_handler(m_remote_handler, req, m_remote_peer, NOTIFY_REQUEST_BLOCK_TXS::ID);
+      NOTIFY_NEW_COMPACT_BLOCK::request rsp;
+      ASSERT_TRUE(m_remote_p2p.take_notify<NOTIFY_NEW_COMPACT_BLOCK>(m_remote_peer, rsp));
+      unit_test::notify_handler(m_handler, rsp, m_peer, NOTIFY_NEW_COMPACT_BLOCK::ID);
+    }
+
+    test_core m_core;
+    unit_test::test_p2p m_p2p;
+    t_cryptonote_protocol_handler<test_core> m_handler;
+    test_core m_remote_core;
+    unit_test::test_p2p m_remote_p2p;
+    t_cryptonote_protocol_handler<test_core> m_remote_handler;
+    cryptonote_connection_context m_peer;
+    cryptonote_connection_context m_remote_peer;
+    std::vector<transaction> m_txs;
+    block m_block;
+  };
+}
+
+TEST_F(compact_blocks, block_is_rebuilt_from_the_pool)
+{
+  add_tx(m_core, m_txs[0]);
+  add_tx(m_core, m_txs[1]);
+
+  send_compact_block(std::list<transaction>());
+  ASSERT_EQ(2, m_core.get_current_blockchain_height());
+  EXPECT_EQ(get_block_hash(m_block), m_core.top_id());
+  EXPECT_FALSE(m_core.pool_has_tx(get_transaction_hash(m_txs[0])));
+  EXPECT_FALSE(m_p2p.has_notify(m_peer));
+  EXPECT_FALSE(m_p2p.is_dropped(m_peer));
+}
+
+TEST_F(compact_blocks, missing_transactions_are_requested)
+{
+  add_tx(m_core, m_txs[0]);
+
+  send_compact_block(std::list<transaction>());
+  EXPECT_EQ(1, m_core.get_current_blockchain_height());
+  NOTIFY_REQUEST_BLOCK_TXS::request req;
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_REQUEST_BLOCK_TXS>(m_peer, req));
+  EXPECT_EQ(get_block_hash(m_block), req.block_id);
+  ASSERT_EQ(1, req.txs.size());
+  EXPECT_EQ(get_transaction_hash(m_txs[1]), req.txs.front());
+
+  serve_block_txs(req);
+  ASSERT_EQ(2, m_core.get_current_blockchain_height());
+  EXPECT_EQ(get_block_hash(m_block), m_core.top_id());
+  EXPECT_FALSE(m_p2p.has_notify(m_peer));
+  EXPECT_FALSE(m_p2p.is_dropped(m_peer));
+}
+
+TEST_F(compact_blocks, transaction_leaving_the_pool_does_not_drop_the_peer)
+{
+  add_tx(m_core, m_txs[0]);
+  add_tx(m_core, m_txs[1]);
+  m_core.lose_tx_before_next_block(get_transaction_hash(m_txs[1]));
+
+  send_compact_block(std::list<transaction>());
+  EXPECT_EQ(1, m_core.get_current_blockchain_height());
+  EXPECT_FALSE(m_p2p.is_dropped(m_peer));
+  NOTIFY_REQUEST_BLOCK_TXS::request req;
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_REQUEST_BLOCK_TXS>(m_peer, req));
+  ASSERT_EQ(1, req.txs.size());
+  EXPECT_EQ(get_transaction_hash(m_txs[1]), req.txs.front());
+
+  serve_block_txs(req);
+  ASSERT_EQ(2, m_core.get_current_blockchain_height());
+  EXPECT_FALSE(m_p2p.is_dropped(m_peer));
+}
+
+TEST_F(compact_blocks, full_block_is_relayed_to_peers_without_compact_blocks)
+{
+  cryptonote_connection_context full_peer = AUTO_VAL_INIT(full_peer);
+  cryptonote_connection_context compact_peer = AUTO_VAL_INIT(compact_peer);
+  connect(m_p2p, full_peer, false);
+  connect(m_p2p, compact_peer, true);
+  add_tx(m_core, m_txs[0]);
+
+  //the second transaction only comes with the block
+  send_compact_block(std::list<transaction>(1, m_txs[1]));
+  ASSERT_EQ(2, m_core.get_current_blockchain_height());
+  EXPECT_FALSE(m_p2p.has_notify(m_peer));
+
+  NOTIFY_NEW_BLOCK::request full_arg;
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_NEW_BLOCK>(full_peer, full_arg));
+  EXPECT_EQ(block_to_blob(m_block), full_arg.b.block);
+  ASSERT_EQ(2, full_arg.b.txs.size());
+  EXPECT_EQ(tx_to_blob(m_txs[0]), full_arg.b.txs.front());
+  EXPECT_EQ(tx_to_blob(m_txs[1]), full_arg.b.txs.back());
+
+  NOTIFY_NEW_COMPACT_BLOCK::request compact_arg;
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_NEW_COMPACT_BLOCK>(compact_peer, compact_arg));
+  EXPECT_EQ(block_to_blob(m_block), compact_arg.b.block);
+  ASSERT_EQ(1, compact_arg.b.txs.size());
+  EXPECT_EQ(tx_to_blob(m_txs[1]), compact_arg.b.txs.front());
+}
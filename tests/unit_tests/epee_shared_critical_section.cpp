@@ -0,0 +1,96 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#include "syncobj.h"
+
+TEST(epee_shared_critical_section, is_recursive)
+{
+  epee::shared_critical_section section;
+  section.lock_exclusive();
+  section.lock_exclusive();
+  section.lock_shared();
+  section.unlock_shared();
+  section.unlock_exclusive();
+  section.lock_shared();
+  section.unlock_shared();
+  section.unlock_exclusive();
+
+  section.lock_shared();
+  section.lock_shared();
+  section.unlock_shared();
+  section.unlock_shared();
+
+  EXCLUSIVE_CRITICAL_REGION_LOCAL(section);
+}
+
+TEST(epee_shared_critical_section, readers_share)
+{
+  epee::shared_critical_section section;
+  std::atomic<int> readers(0);
+  std::atomic<int> max_readers(0);
+  auto reader = [&]()
+  {
+    SHARED_CRITICAL_REGION_LOCAL(section);
+    int n = ++readers;
+    int m = max_readers;
+    while (n > m && !max_readers.compare_exchange_weak(m, n));
+    for (int i = 0; i < 200 && max_readers < 2; ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    --readers;
+  };
+  std::thread t1(reader);
+  std::thread t2(reader);
+  t1.join();
+  t2.join();
+  ASSERT_EQ(2, max_readers);
+}
+
+TEST(epee_shared_critical_section, writer_excludes_readers)
+{
+  epee::shared_critical_section section;
+  std::atomic<bool> read(false);
+  std::thread t;
+  {
+    EXCLUSIVE_CRITICAL_REGION_LOCAL(section);
+    t = std::thread([&]()
+    {
+      SHARED_CRITICAL_REGION_LOCAL(section);
+      read = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(read);
+  }
+  t.join();
+  ASSERT_TRUE(read);
+}
@@ -0,0 +1,213 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include <boost/program_options/variables_map.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "protocol_tests_utils.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  //! Takes transaction blobs as they are, except "bad" ones; each batch waits until it is let through
+  class test_core: public unit_test::test_core_base
+  {
+  public:
+    test_core(): m_batches_entered(0), m_batches_allowed(0) {}
+
+    //! Lets count more batches through, returns once all of them are verified
+    void allow_batches(size_t count)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      m_batches_allowed += count;
+      m_cond.notify_all();
+      while(m_batch_sizes.size() < m_batches_allowed)
+        m_cond.wait(lock);
+    }
+
+    //! Returns once count batches are waiting or verified
+    void wait_for_batches(size_t count)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      while(m_batches_entered < count)
+        m_cond.wait(lock);
+    }
+
+    std::vector<size_t> get_batch_sizes() { boost::unique_lock<boost::mutex> lock(m_lock); return m_batch_sizes; }
+
+    bool handle_incoming_txs(const std::list<blobdata>& tx_blobs, std::vector<tx_verification_context>& tvcs, bool keeped_by_block)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      ++m_batches_entered;
+      m_cond.notify_all();
+      while(m_batch_sizes.size() >= m_batches_allowed)
+        m_cond.wait(lock);
+
+      tvcs.assign(tx_blobs.size(), boost::value_initialized<tx_verification_context>());
+      size_t i = 0;
+      BOOST_FOREACH(const blobdata& tx_blob, tx_blobs)
+      {
+        tx_verification_context& tvc = tvcs[i++];
+        tvc.m_verifivation_failed = tx_blob == "bad";
+        tvc.m_added_to_pool = tvc.m_should_be_relayed = !tvc.m_verifivation_failed;
+      }
+      m_batch_sizes.push_back(tx_blobs.size());
+      m_cond.notify_all();
+      return true;
+    }
+
+  private:
+    boost::mutex m_lock;
+    boost::condition_variable m_cond;
+    size_t m_batches_entered;
+    size_t m_batches_allowed;
+    std::vector<size_t> m_batch_sizes;
+  };
+
+  class incoming_txs : public ::testing::Test
+  {
+  protected:
+    incoming_txs(): m_handler(m_core, &m_p2p)
+    {
+      m_handler.init(boost::program_options::variables_map());
+    }
+
+    ~incoming_txs()
+    {
+      m_handler.deinit();
+    }
+
+    void connect(cryptonote_connection_context& context)
+    {
+      unit_test::connect_test_context(context, cryptonote_connection_context::state_normal);
+    }
+
+    //! Sends count transactions, the first one being tx
+    void send_txs(cryptonote_connection_context& context, size_t count, const blobdata& tx = "good")
+    {
+      NOTIFY_NEW_TRANSACTIONS::request arg = AUTO_VAL_INIT(arg);
+      arg.txs.push_back(tx);
+      arg.txs.resize(count, "good");
+      unit_test::notify_handler(m_handler, arg, context, NOTIFY_NEW_TRANSACTIONS::ID);
+    }
+
+    test_core m_core;
+    unit_test::test_p2p m_p2p;
+    t_cryptonote_protocol_handler<test_core> m_handler;
+  };
+}
+
+TEST_F(incoming_txs, queued_notifications_are_verified_in_one_batch)
+{
+  cryptonote_connection_context a = AUTO_VAL_INIT(a);
+  cryptonote_connection_context b = AUTO_VAL_INIT(b);
+  cryptonote_connection_context c = AUTO_VAL_INIT(c);
+  connect(a);
+  connect(b);
+  connect(c);
+
+  //the others queue up while the first one is verified
+  send_txs(a, 1);
+  m_core.wait_for_batches(1);
+  send_txs(b, 3);
+  send_txs(c, 2, "bad");
+  m_core.allow_batches(2);
+  m_p2p.wait_for_events(3);
+
+  std::vector<size_t> batch_sizes = m_core.get_batch_sizes();
+  ASSERT_EQ(2, batch_sizes.size());
+  EXPECT_EQ(1, batch_sizes[0]);
+  EXPECT_EQ(5, batch_sizes[1]);
+  EXPECT_TRUE(m_p2p.is_relayed(a));
+  EXPECT_TRUE(m_p2p.is_relayed(b));
+  EXPECT_FALSE(m_p2p.is_dropped(b));
+  EXPECT_FALSE(m_p2p.is_relayed(c));
+  EXPECT_TRUE(m_p2p.is_dropped(c));
+}
+
+TEST_F(incoming_txs, full_queue_refuses_notifications_by_transaction_count)
+{
+  cryptonote_connection_context a = AUTO_VAL_INIT(a);
+  cryptonote_connection_context b = AUTO_VAL_INIT(b);
+  cryptonote_connection_context c = AUTO_VAL_INIT(c);
+  cryptonote_connection_context d = AUTO_VAL_INIT(d);
+  connect(a);
+  connect(b);
+  connect(c);
+  connect(d);
+
+  send_txs(a, 1);
+  m_core.wait_for_batches(1);
+  //one notification holding all but one of the transactions the queue takes
+  send_txs(b, CRYPTONOTE_PROTOCOL_MAX_QUEUED_TXS - 1);
+  send_txs(c, 2);
+  send_txs(d, 1);
+  m_core.allow_batches(2);
+  m_p2p.wait_for_events(3);
+
+  std::vector<size_t> batch_sizes = m_core.get_batch_sizes();
+  ASSERT_EQ(2, batch_sizes.size());
+  EXPECT_EQ(CRYPTONOTE_PROTOCOL_MAX_QUEUED_TXS, batch_sizes[1]);
+  EXPECT_TRUE(m_p2p.is_relayed(b));
+  EXPECT_FALSE(m_p2p.is_relayed(c));
+  EXPECT_FALSE(m_p2p.is_dropped(c));
+  EXPECT_TRUE(m_p2p.is_relayed(d));
+
+  //the queue takes transactions again once they are verified
+  send_txs(c, 2);
+  m_core.allow_batches(1);
+  m_p2p.wait_for_events(4);
+  EXPECT_TRUE(m_p2p.is_relayed(c));
+}
+
+TEST_F(incoming_txs, oversized_notification_drops_connection)
+{
+  cryptonote_connection_context a = AUTO_VAL_INIT(a);
+  cryptonote_connection_context b = AUTO_VAL_INIT(b);
+  connect(a);
+  connect(b);
+
+  //no queue could ever take it
+  send_txs(a, CRYPTONOTE_PROTOCOL_MAX_QUEUED_TXS + 1);
+  m_p2p.wait_for_events(1);
+  EXPECT_TRUE(m_p2p.is_dropped(a));
+
+  send_txs(b, 1);
+  m_core.allow_batches(1);
+  m_p2p.wait_for_events(2);
+
+  std::vector<size_t> batch_sizes = m_core.get_batch_sizes();
+  ASSERT_EQ(1, batch_sizes.size());
+  EXPECT_EQ(1, batch_sizes[0]);
+  EXPECT_FALSE(m_p2p.is_relayed(a));
+  EXPECT_TRUE(m_p2p.is_relayed(b));
+}
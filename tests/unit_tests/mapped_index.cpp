@@ -0,0 +1,202 @@
+// Copyright (c) 2014-2015, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include <map>
+#include <boost/filesystem.hpp>
+
+#include "cryptonote_core/mapped_index.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  // puts keys into a handful of buckets, so they probe past each other
+  struct colliding_hash
+  {
+    size_t operator()(uint64_t key) const { return key % 4; }
+  };
+
+  class mapped_index_test : public ::testing::Test
+  {
+  protected:
+    virtual void SetUp()
+    {
+      m_dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("mapped_index-%%%%-%%%%-%%%%");
+      boost::filesystem::create_directories(m_dir);
+      m_path = (m_dir / "test").string();
+    }
+
+    virtual void TearDown()
+    {
+      boost::system::error_code ec;
+      boost::filesystem::remove_all(m_dir, ec);
+    }
+
+    boost::filesystem::path m_dir;
+    std::string m_path;
+  };
+}
+
+TEST_F(mapped_index_test, array_grows_and_is_kept_across_reopen)
+{
+  const uint64_t count = 3 * MAPPED_INDEX_INITIAL_CAPACITY + 1;
+  {
+    mapped_array<uint64_t> a;
+    ASSERT_TRUE(a.open(m_path));
+    ASSERT_TRUE(a.empty());
+    for(uint64_t i = 0; i != count; i++)
+      ASSERT_TRUE(a.push_back(i * i));
+    ASSERT_TRUE(a.flush());
+  }
+
+  mapped_array<uint64_t> a;
+  ASSERT_TRUE(a.open(m_path));
+  ASSERT_EQ(count, a.size());
+  for(uint64_t i = 0; i != count; i++)
+    ASSERT_EQ(i * i, a[i]);
+  a.pop_back();
+  a.resize_down(10);
+  ASSERT_EQ(10, a.size());
+  EXPECT_EQ(81, a.back());
+  a.resize_down(20);
+  EXPECT_EQ(10, a.size());
+  a.clear();
+  EXPECT_TRUE(a.empty());
+}
+
+TEST_F(mapped_index_test, array_resize_keeps_items_when_it_grows)
+{
+  mapped_array<uint64_t> a;
+  ASSERT_TRUE(a.open(m_path));
+  for(uint64_t i = 0; i != 10; i++)
+    ASSERT_TRUE(a.push_back(i));
+  ASSERT_TRUE(a.resize(5 * MAPPED_INDEX_INITIAL_CAPACITY));
+  ASSERT_EQ(5 * MAPPED_INDEX_INITIAL_CAPACITY, a.size());
+  for(uint64_t i = 0; i != 10; i++)
+    ASSERT_EQ(i, a[i]);
+  a[a.size() - 1] = 42;
+  ASSERT_TRUE(a.resize(11));
+  ASSERT_EQ(11, a.size());
+  ASSERT_TRUE(a.push_back(43));
+  EXPECT_EQ(43, a.back());
+  EXPECT_EQ(9, a[9]);
+}
+
+TEST_F(mapped_index_test, rejects_file_of_other_item_size)
+{
+  {
+    mapped_array<uint64_t> a;
+    ASSERT_TRUE(a.open(m_path));
+    ASSERT_TRUE(a.push_back(1));
+  }
+  mapped_array<uint32_t> a;
+  EXPECT_FALSE(a.open(m_path));
+}
+
+TEST_F(mapped_index_test, hash_table_insert_find_and_erase)
+{
+  mapped_hash_table<uint64_t, uint64_t> t;
+  ASSERT_TRUE(t.open(m_path));
+  EXPECT_EQ(nullptr, t.find(1));
+  ASSERT_TRUE(t.insert(1, 10));
+  ASSERT_TRUE(t.insert(2, 20));
+  EXPECT_FALSE(t.insert(1, 11));
+  ASSERT_EQ(2, t.size());
+  ASSERT_NE(nullptr, t.find(1));
+  EXPECT_EQ(10, *t.find(1));
+  *t.find(2) = 21;
+  EXPECT_EQ(21, *t.find(2));
+  EXPECT_TRUE(t.erase(1));
+  EXPECT_FALSE(t.erase(1));
+  EXPECT_FALSE(t.count(1));
+  EXPECT_TRUE(t.count(2));
+  EXPECT_EQ(1, t.size());
+  t.clear();
+  EXPECT_EQ(0, t.size());
+  EXPECT_FALSE(t.count(2));
+}
+
+TEST_F(mapped_index_test, hash_table_erase_keeps_colliding_keys_reachable)
+{
+  mapped_hash_table<uint64_t, uint64_t, colliding_hash> t;
+  ASSERT_TRUE(t.open(m_path));
+  std::map<uint64_t, uint64_t> expected;
+  for(uint64_t k = 0; k != 200; k++)
+  {
+    ASSERT_TRUE(t.insert(k, k + 1000));
+    expected[k] = k + 1000;
+  }
+  for(uint64_t k = 0; k < 200; k += 3)
+  {
+    ASSERT_TRUE(t.erase(k));
+    expected.erase(k);
+  }
+
+  ASSERT_EQ(expected.size(), t.size());
+  for(uint64_t k = 0; k != 200; k++)
+  {
+    const uint64_t* v = t.find(k);
+    if(expected.count(k))
+    {
+      ASSERT_NE(nullptr, v);
+      EXPECT_EQ(expected[k], *v);
+    }
+    else
+    {
+      EXPECT_EQ(nullptr, v);
+    }
+  }
+}
+
+TEST_F(mapped_index_test, hash_table_grows_and_is_kept_across_reopen)
+{
+  const uint64_t count = 4 * MAPPED_INDEX_INITIAL_CAPACITY;
+  {
+    mapped_hash_table<uint64_t, uint64_t> t;
+    ASSERT_TRUE(t.open(m_path));
+    for(uint64_t k = 0; k != count; k++)
+      ASSERT_TRUE(t.insert(k * 7, k));
+    ASSERT_TRUE(t.flush());
+  }
+  EXPECT_FALSE(boost::filesystem::exists(m_path + ".tmp"));
+
+  mapped_hash_table<uint64_t, uint64_t> t;
+  ASSERT_TRUE(t.open(m_path));
+  ASSERT_EQ(count, t.size());
+  uint64_t visited = 0;
+  t.for_each([&visited](uint64_t key, uint64_t value) { EXPECT_EQ(value * 7, key); ++visited; });
+  EXPECT_EQ(count, visited);
+  for(uint64_t k = 0; k != count; k++)
+  {
+    const uint64_t* v = t.find(k * 7);
+    ASSERT_NE(nullptr, v);
+    EXPECT_EQ(k, *v);
+  }
+}
@@ -0,0 +1,110 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include "cryptonote_core/cryptonote_format_utils.h"
+#include "cryptonote_core/pow_cache.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  block make_block(uint32_t nonce)
+  {
+    block b = AUTO_VAL_INIT(b);
+    b.major_version = CURRENT_BLOCK_MAJOR_VERSION;
+    b.nonce = nonce;
+    return b;
+  }
+
+  crypto::hash make_proof_of_work(char c)
+  {
+    return crypto::cn_fast_hash(&c, 1);
+  }
+}
+
+TEST(pow_cache, is_used_at_its_height)
+{
+  pow_cache cache(10);
+  block b = make_block(1);
+  crypto::hash id = get_block_hash(b);
+  cache.add(id, 5, make_proof_of_work('a'));
+  ASSERT_TRUE(cache.have(id));
+
+  EXPECT_EQ(make_proof_of_work('a'), cache.get(b, id, 5));
+  //used once only
+  EXPECT_FALSE(cache.have(id));
+  EXPECT_EQ(get_block_longhash(b, 5), cache.get(b, id, 5));
+}
+
+TEST(pow_cache, height_mismatch_falls_back_to_longhash)
+{
+  pow_cache cache(10);
+  block b = make_block(1);
+  crypto::hash id = get_block_hash(b);
+  cache.add(id, 5, make_proof_of_work('a'));
+
+  crypto::hash proof_of_work = cache.get(b, id, 6);
+  EXPECT_NE(make_proof_of_work('a'), proof_of_work);
+  EXPECT_EQ(get_block_longhash(b, 6), proof_of_work);
+  //a block is at one height only, the entry is gone
+  EXPECT_FALSE(cache.have(id));
+}
+
+TEST(pow_cache, missing_block_falls_back_to_longhash)
+{
+  pow_cache cache(10);
+  block b = make_block(1);
+  block other = make_block(2);
+  cache.add(get_block_hash(other), 5, make_proof_of_work('a'));
+
+  EXPECT_EQ(get_block_longhash(b, 5), cache.get(b, get_block_hash(b), 5));
+  EXPECT_TRUE(cache.have(get_block_hash(other)));
+}
+
+TEST(pow_cache, drops_oldest_entries_when_full)
+{
+  pow_cache cache(3);
+  for(uint32_t i = 1; i <= 10; ++i)
+    cache.add(get_block_hash(make_block(i)), i, make_proof_of_work('a' + i));
+  ASSERT_EQ(3, cache.size());
+  for(uint32_t i = 1; i <= 7; ++i)
+    EXPECT_FALSE(cache.have(get_block_hash(make_block(i))));
+
+  //the newest ones are kept and still used
+  block b = make_block(8);
+  EXPECT_EQ(make_proof_of_work('a' + 8), cache.get(b, get_block_hash(b), 8));
+  EXPECT_EQ(2, cache.size());
+  cache.add(get_block_hash(make_block(11)), 11, make_proof_of_work('a' + 11));
+  cache.add(get_block_hash(make_block(12)), 12, make_proof_of_work('a' + 12));
+  EXPECT_EQ(3, cache.size());
+  EXPECT_FALSE(cache.have(get_block_hash(make_block(9))));
+  EXPECT_TRUE(cache.have(get_block_hash(make_block(10))));
+  EXPECT_TRUE(cache.have(get_block_hash(make_block(12))));
+}
@@ -0,0 +1,199 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/uuid/random_generator.hpp>
+
+#include "gtest/gtest.h"
+
+#include "include_base_utils.h"
+#include "cryptonote_core/cryptonote_format_utils.h"
+#include "cryptonote_protocol/cryptonote_protocol_handler.h"
+
+namespace unit_test
+{
+  //! Block on top of prev_id, with an empty miner transaction for height
+  inline cryptonote::block make_test_block(const crypto::hash& prev_id, uint64_t height, const std::vector<crypto::hash>& tx_hashes = std::vector<crypto::hash>())
+  {
+    cryptonote::block b = AUTO_VAL_INIT(b);
+    b.major_version = CURRENT_BLOCK_MAJOR_VERSION;
+    b.prev_id = prev_id;
+    b.miner_tx.vin.push_back(cryptonote::txin_gen());
+    boost::get<cryptonote::txin_gen>(b.miner_tx.vin.back()).height = height;
+    b.tx_hashes = tx_hashes;
+    return b;
+  }
+
+  //! Sets context up as a new connection in state
+  inline void connect_test_context(cryptonote::cryptonote_connection_context& context, cryptonote::cryptonote_connection_context::state state)
+  {
+    static boost::uuids::random_generator uuid_generator;
+    static_cast<epee::net_utils::connection_context_base&>(context) = epee::net_utils::connection_context_base(uuid_generator(), 0, 0, false);
+    context.m_state = state;
+  }
+
+  //! Hands arg to handler as if the peer of context sent it
+  template<class t_handler, class t_request>
+  void notify_handler(t_handler& handler, t_request& arg, cryptonote::cryptonote_connection_context& context, int id)
+  {
+    std::string blob;
+    std::string out;
+    bool handled = false;
+    ASSERT_TRUE(epee::serialization::store_t_to_binary(arg, blob));
+    handler.handle_invoke_map(true, id, blob, out, context, handled);
+    ASSERT_TRUE(handled);
+  }
+
+  /*! \brief The core calls of t_cryptonote_protocol_handler, doing nothing
+   *
+   * \details Test cores derive from it and hide the calls their tests are about.
+   */
+  class test_core_base
+  {
+  public:
+    void on_synchronized(){}
+    uint64_t get_current_blockchain_height() { return 1; }
+    void set_target_blockchain_height(uint64_t) {}
+    bool get_short_chain_history(std::list<crypto::hash>& ids) { return true; }
+    bool get_stat_info(cryptonote::core_stat_info& st_inf){return true;}
+    bool have_block(const crypto::hash& id) { return false; }
+    void precompute_blocks_pow(const std::list<cryptonote::block>& blocks) {}
+    bool get_block_by_hash(const crypto::hash& h, cryptonote::block& blk){return false;}
+    bool get_transactions(const std::vector<crypto::hash>& txs_ids, std::list<cryptonote::transaction>& txs, std::list<crypto::hash>& missed_txs){return true;}
+    bool get_pool_transaction(const crypto::hash& id, cryptonote::transaction& tx){return false;}
+    bool pool_has_tx(const crypto::hash& id){return false;}
+    bool get_blockchain_top(uint64_t& height, crypto::hash& top_id) { height = 0; top_id = cryptonote::null_hash; return true; }
+    bool handle_incoming_tx(const cryptonote::blobdata& tx_blob, cryptonote::tx_verification_context& tvc, bool keeped_by_block){return true;}
+    bool handle_incoming_txs(const std::list<cryptonote::blobdata>& tx_blobs, std::vector<cryptonote::tx_verification_context>& tvcs, bool keeped_by_block){return true;}
+    bool handle_incoming_block(const cryptonote::blobdata& block_blob, cryptonote::block_verification_context& bvc, bool update_miner_blocktemplate = true){return true;}
+    void pause_mine(){}
+    void resume_mine(){}
+    bool on_idle(){return true;}
+    bool find_blockchain_supplement(const std::list<crypto::hash>& qblock_ids, cryptonote::NOTIFY_RESPONSE_CHAIN_ENTRY::request& resp){return true;}
+    bool handle_get_objects(cryptonote::NOTIFY_REQUEST_GET_OBJECTS::request& arg, cryptonote::NOTIFY_RESPONSE_GET_OBJECTS::request& rsp, cryptonote::cryptonote_connection_context& context){return true;}
+  };
+
+  /*! \brief Keeps what the handler relays, the notifications it sends to every connection and the connections it drops
+   *
+   * \details Relays and drops are counted as events, which other threads can wait for.
+   */
+  class test_p2p: public nodetool::i_p2p_endpoint<cryptonote::cryptonote_connection_context>
+  {
+  public:
+    test_p2p(): m_events(0) {}
+
+    void add_connection(cryptonote::cryptonote_connection_context& context) { m_connections.push_back(&context); }
+
+    //! Returns once count connections were relayed from or dropped in all
+    void wait_for_events(size_t count)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      while(m_events < count)
+        m_cond.wait(lock);
+    }
+
+    //! Takes the oldest t_notify sent to the connection, and whatever was sent before it
+    template<class t_notify>
+    bool take_notify(const cryptonote::cryptonote_connection_context& context, typename t_notify::request& req)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      auto it = m_notifications.find(context.m_connection_id);
+      if(it == m_notifications.end())
+        return false;
+      std::list<std::pair<int, std::string> >& sent = it->second;
+      while(!sent.empty() && sent.front().first != t_notify::ID)
+        sent.pop_front();
+      if(sent.empty())
+        return false;
+      bool r = epee::serialization::load_t_from_binary(req, sent.front().second);
+      sent.pop_front();
+      return r;
+    }
+
+    bool has_notify(const cryptonote::cryptonote_connection_context& context)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      auto it = m_notifications.find(context.m_connection_id);
+      return it != m_notifications.end() && !it->second.empty();
+    }
+
+    bool is_relayed(const cryptonote::cryptonote_connection_context& context) { boost::unique_lock<boost::mutex> lock(m_lock); return m_relayed.count(context.m_connection_id) != 0; }
+    bool is_dropped(const cryptonote::cryptonote_connection_context& context) { boost::unique_lock<boost::mutex> lock(m_lock); return m_dropped.count(context.m_connection_id) != 0; }
+
+    virtual bool relay_notify_to_all(int command, const std::string& data_buff, const epee::net_utils::connection_context_base& context)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      m_relayed.insert(context.m_connection_id);
+      ++m_events;
+      m_cond.notify_all();
+      return true;
+    }
+    virtual bool invoke_command_to_peer(int command, const std::string& req_buff, std::string& resp_buff, const epee::net_utils::connection_context_base& context) { return false; }
+    virtual bool invoke_notify_to_peer(int command, const std::string& req_buff, const epee::net_utils::connection_context_base& context)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      m_notifications[context.m_connection_id].push_back(std::make_pair(command, req_buff));
+      return true;
+    }
+    virtual bool drop_connection(const epee::net_utils::connection_context_base& context)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      m_dropped.insert(context.m_connection_id);
+      ++m_events;
+      m_cond.notify_all();
+      return true;
+    }
+    virtual void request_callback(const epee::net_utils::connection_context_base& context) {}
+    virtual uint64_t get_connections_count() { return m_connections.size(); }
+    virtual void for_each_connection(std::function<bool(cryptonote::cryptonote_connection_context&, nodetool::peerid_type)> f)
+    {
+      BOOST_FOREACH(cryptonote::cryptonote_connection_context* context, m_connections)
+      {
+        if(!f(*context, 1))
+          break;
+      }
+    }
+
+  private:
+    boost::mutex m_lock;
+    boost::condition_variable m_cond;
+    size_t m_events;
+    std::map<boost::uuids::uuid, std::list<std::pair<int, std::string> > > m_notifications;
+    std::set<boost::uuids::uuid> m_relayed;
+    std::set<boost::uuids::uuid> m_dropped;
+    std::vector<cryptonote::cryptonote_connection_context*> m_connections;
+  };
+}
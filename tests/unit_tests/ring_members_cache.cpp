@@ -0,0 +1,208 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include <cstring>
+
+#include "crypto/crypto.h"
+#include "cryptonote_core/ring_members_cache.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  bool same_precomp(const crypto::public_key_precomp& a, const crypto::public_key_precomp& b)
+  {
+    return 0 == memcmp(&a, &b, sizeof(crypto::public_key_precomp));
+  }
+
+  crypto::public_key make_key()
+  {
+    crypto::public_key pub;
+    crypto::secret_key sec;
+    crypto::generate_keys(pub, sec);
+    return pub;
+  }
+
+  crypto::public_key make_invalid_key()
+  {
+    crypto::public_key key;
+    do
+      key = crypto::rand<crypto::public_key>();
+    while (crypto::check_key(key));
+    return key;
+  }
+
+  //! A ring of size members, signed by the one at real_index
+  class ring
+  {
+  public:
+    ring(size_t size, size_t real_index)
+      : m_keys(size)
+      , m_sigs(size)
+    {
+      crypto::secret_key real_sec;
+      for(size_t i = 0; i != size; i++)
+      {
+        crypto::secret_key sec;
+        crypto::generate_keys(m_keys[i], sec);
+        if(i == real_index)
+          real_sec = sec;
+      }
+      m_prefix_hash = crypto::rand<crypto::hash>();
+      crypto::generate_key_image(m_keys[real_index], real_sec, m_image);
+      crypto::generate_ring_signature(m_prefix_hash, m_image, key_ptrs(), real_sec, real_index, m_sigs.data());
+    }
+
+    std::vector<const crypto::public_key *> key_ptrs() const
+    {
+      std::vector<const crypto::public_key *> ptrs;
+      for(size_t i = 0; i != m_keys.size(); i++)
+        ptrs.push_back(&m_keys[i]);
+      return ptrs;
+    }
+
+    //! Checks the signatures with the plain keys and with their precomputations
+    void check(bool expected) const
+    {
+      std::vector<crypto::public_key_precomp> precomps(m_keys.size());
+      std::vector<const crypto::public_key_precomp *> precomp_ptrs;
+      for(size_t i = 0; i != m_keys.size(); i++)
+      {
+        ASSERT_TRUE(crypto::precompute_public_key(m_keys[i], precomps[i]));
+        precomp_ptrs.push_back(&precomps[i]);
+      }
+      EXPECT_EQ(expected, crypto::check_ring_signature(m_prefix_hash, m_image, key_ptrs(), m_sigs.data()));
+      EXPECT_EQ(expected, crypto::check_ring_signature(m_prefix_hash, m_image, precomp_ptrs, m_sigs.data()));
+    }
+
+    std::vector<crypto::public_key> m_keys;
+    std::vector<crypto::signature> m_sigs;
+    crypto::hash m_prefix_hash;
+    crypto::key_image m_image;
+  };
+}
+
+TEST(ring_members_cache, precomputed_ring_checks_like_plain_keys)
+{
+  for(size_t size = 1; size < 12; size += 5)
+  {
+    ring r(size, size / 2);
+    r.check(true);
+
+    ring other_hash = r;
+    other_hash.m_prefix_hash = crypto::rand<crypto::hash>();
+    other_hash.check(false);
+
+    ring other_member = r;
+    other_member.m_keys[size - 1] = make_key();
+    other_member.check(false);
+
+    ring other_sig = r;
+    reinterpret_cast<unsigned char*>(&other_sig.m_sigs[0])[0] ^= 1;
+    other_sig.check(false);
+  }
+}
+
+TEST(ring_members_cache, returns_cached_members)
+{
+  ring_members_cache cache(10);
+  crypto::public_key key = make_key();
+  crypto::public_key_precomp expected, precomp;
+  ASSERT_TRUE(crypto::precompute_public_key(key, expected));
+  EXPECT_FALSE(cache.find(key, precomp));
+
+  ASSERT_TRUE(cache.get(key, precomp));
+  EXPECT_TRUE(same_precomp(expected, precomp));
+  EXPECT_EQ(1, cache.size());
+  crypto::public_key_precomp cached;
+  ASSERT_TRUE(cache.find(key, cached));
+  EXPECT_TRUE(same_precomp(expected, cached));
+
+  //what is cached is used as is
+  crypto::public_key other = make_key();
+  crypto::public_key_precomp other_precomp;
+  ASSERT_TRUE(crypto::precompute_public_key(other, other_precomp));
+  cache.add(&key, &other_precomp, 1);
+  ASSERT_TRUE(cache.get(key, precomp));
+  EXPECT_TRUE(same_precomp(other_precomp, precomp));
+  EXPECT_EQ(1, cache.size());
+}
+
+TEST(ring_members_cache, rejects_invalid_keys)
+{
+  ring_members_cache cache(10);
+  crypto::public_key_precomp precomp;
+  EXPECT_FALSE(cache.get(make_invalid_key(), precomp));
+  EXPECT_EQ(0, cache.size());
+}
+
+TEST(ring_members_cache, evicts_least_recently_used_when_full)
+{
+  ring_members_cache cache(3);
+  std::vector<crypto::public_key> keys;
+  crypto::public_key_precomp precomp;
+  for(size_t i = 0; i != 3; i++)
+  {
+    keys.push_back(make_key());
+    ASSERT_TRUE(cache.get(keys.back(), precomp));
+  }
+  ASSERT_EQ(3, cache.size());
+
+  //the first key was used last, the second one goes
+  ASSERT_TRUE(cache.find(keys[0], precomp));
+  keys.push_back(make_key());
+  ASSERT_TRUE(cache.get(keys.back(), precomp));
+  EXPECT_EQ(3, cache.size());
+  EXPECT_TRUE(cache.find(keys[0], precomp));
+  EXPECT_FALSE(cache.find(keys[1], precomp));
+  EXPECT_TRUE(cache.find(keys[2], precomp));
+  EXPECT_TRUE(cache.find(keys[3], precomp));
+
+  //a batch pushes out as many of the least recently used
+  std::vector<crypto::public_key_precomp> precomps(2);
+  std::vector<crypto::public_key> batch;
+  for(size_t i = 0; i != precomps.size(); i++)
+  {
+    batch.push_back(make_key());
+    ASSERT_TRUE(crypto::precompute_public_key(batch.back(), precomps[i]));
+  }
+  cache.add(batch.data(), precomps.data(), batch.size());
+  EXPECT_EQ(3, cache.size());
+  EXPECT_FALSE(cache.find(keys[0], precomp));
+  EXPECT_FALSE(cache.find(keys[2], precomp));
+  EXPECT_TRUE(cache.find(keys[3], precomp));
+  EXPECT_TRUE(cache.find(batch[0], precomp));
+  EXPECT_TRUE(cache.find(batch[1], precomp));
+
+  //adding what is cached already only refreshes it
+  cache.add(batch.data(), precomps.data(), 1);
+  EXPECT_EQ(3, cache.size());
+  EXPECT_TRUE(cache.find(keys[3], precomp));
+}
@@ -0,0 +1,400 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <unordered_map>
+#include <boost/thread/mutex.hpp>
+
+#include "protocol_tests_utils.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  //! A chain of empty blocks, checking only that each one comes on top of the last
+  class test_core: public unit_test::test_core_base
+  {
+  public:
+    test_core(): m_bad_block(null_hash), m_precomputed_spans(0), m_orphans(0)
+    {
+      m_chain.push_back(unit_test::make_test_block(null_hash, 0));
+    }
+
+    crypto::hash get_block_id(uint64_t height)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      return get_block_hash(m_chain[height]);
+    }
+
+    void set_bad_block(const crypto::hash& id) { boost::unique_lock<boost::mutex> lock(m_lock); m_bad_block = id; }
+    size_t get_precomputed_spans() { return m_precomputed_spans; }
+    size_t get_orphans() { return m_orphans; }
+
+    uint64_t get_current_blockchain_height() { boost::unique_lock<boost::mutex> lock(m_lock); return m_chain.size(); }
+    bool get_short_chain_history(std::list<crypto::hash>& ids)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      ids.push_back(get_block_hash(m_chain.back()));
+      if(m_chain.size() > 1)
+        ids.push_back(get_block_hash(m_chain.front()));
+      return true;
+    }
+    bool have_block(const crypto::hash& id)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      BOOST_FOREACH(const block& b, m_chain)
+      {
+        if(get_block_hash(b) == id)
+          return true;
+      }
+      return false;
+    }
+    void precompute_blocks_pow(const std::list<block>& blocks) { ++m_precomputed_spans; }
+    bool get_blockchain_top(uint64_t& height, crypto::hash& top_id)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      height = m_chain.size() - 1;
+      top_id = get_block_hash(m_chain.back());
+      return true;
+    }
+    bool handle_incoming_block(const blobdata& block_blob, block_verification_context& bvc, bool update_miner_blocktemplate = true)
+    {
+      block b;
+      if(!parse_and_validate_block_from_blob(block_blob, b))
+      {
+        bvc.m_verifivation_failed = true;
+        return false;
+      }
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      if(get_block_hash(b) == m_bad_block)
+      {
+        bvc.m_verifivation_failed = true;
+        return false;
+      }
+      if(b.prev_id != get_block_hash(m_chain.back()))
+      {
+        ++m_orphans;
+        bvc.m_marked_as_orphaned = true;
+        return false;
+      }
+      m_chain.push_back(b);
+      bvc.m_added_to_main_chain = true;
+      return true;
+    }
+
+  private:
+    boost::mutex m_lock;
+    std::vector<block> m_chain;
+    crypto::hash m_bad_block;
+    std::atomic<size_t> m_precomputed_spans;
+    std::atomic<size_t> m_orphans;
+  };
+
+  class sync_spans : public ::testing::Test
+  {
+  protected:
+    sync_spans(): m_handler(m_core, &m_p2p)
+    {
+    }
+
+    ~sync_spans()
+    {
+      //waits for the spans still being hashed
+      m_handler.deinit();
+    }
+
+    //! Blocks 1 .. count on top of the core's genesis
+    void make_remote_chain(size_t count)
+    {
+      m_remote_ids.push_back(m_core.get_block_id(0));
+      for(size_t i = 1; i <= count; i++)
+      {
+        block b = unit_test::make_test_block(m_remote_ids.back(), i);
+        m_remote_ids.push_back(get_block_hash(b));
+        m_remote_blobs[m_remote_ids.back()] = block_to_blob(b);
+      }
+    }
+
+    void connect(cryptonote_connection_context& context)
+    {
+      unit_test::connect_test_context(context, cryptonote_connection_context::state_synchronizing);
+      m_p2p.add_connection(context);
+    }
+
+    template<class t_request>
+    void notify(t_request& arg, cryptonote_connection_context& context, int id)
+    {
+      unit_test::notify_handler(m_handler, arg, context, id);
+    }
+
+    //! Announces the whole remote chain, from the genesis
+    void send_chain_entry(cryptonote_connection_context& context)
+    {
+      NOTIFY_RESPONSE_CHAIN_ENTRY::request arg = AUTO_VAL_INIT(arg);
+      arg.start_height = 0;
+      arg.total_height = m_remote_ids.size();
+      arg.m_block_ids.assign(m_remote_ids.begin(), m_remote_ids.end());
+      notify(arg, context, NOTIFY_RESPONSE_CHAIN_ENTRY::ID);
+    }
+
+    void send_blocks(cryptonote_connection_context& context, const NOTIFY_REQUEST_GET_OBJECTS::request& req)
+    {
+      NOTIFY_RESPONSE_GET_OBJECTS::request arg = AUTO_VAL_INIT(arg);
+      arg.current_blockchain_height = m_remote_ids.size();
+      BOOST_FOREACH(const crypto::hash& id, req.blocks)
+      {
+        arg.blocks.push_back(block_complete_entry());
+        arg.blocks.back().block = m_remote_blobs[id];
+      }
+      notify(arg, context, NOTIFY_RESPONSE_GET_OBJECTS::ID);
+    }
+
+    //! The remote block ids from height first on, count of them
+    std::list<crypto::hash> remote_ids(size_t first, size_t count)
+    {
+      return std::list<crypto::hash>(m_remote_ids.begin() + first, m_remote_ids.begin() + first + count);
+    }
+
+    //! Spans are hashed and added on the thread pool, deinit waits until they are done
+    void wait_for_spans()
+    {
+      m_handler.deinit();
+    }
+
+    test_core m_core;
+    unit_test::test_p2p m_p2p;
+    t_cryptonote_protocol_handler<test_core> m_handler;
+    std::vector<crypto::hash> m_remote_ids;
+    std::unordered_map<crypto::hash, blobdata> m_remote_blobs;
+  };
+}
+
+TEST_F(sync_spans, overlapping_connections_request_disjoint_spans)
+{
+  make_remote_chain(2 * BLOCKS_SYNCHRONIZING_DEFAULT_COUNT + 10);
+  cryptonote_connection_context a = AUTO_VAL_INIT(a);
+  cryptonote_connection_context b = AUTO_VAL_INIT(b);
+  connect(a);
+  connect(b);
+
+  //both know the same chain, the second takes the span after the first one's
+  send_chain_entry(a);
+  send_chain_entry(b);
+  NOTIFY_REQUEST_GET_OBJECTS::request a_req;
+  NOTIFY_REQUEST_GET_OBJECTS::request b_req;
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_REQUEST_GET_OBJECTS>(a, a_req));
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_REQUEST_GET_OBJECTS>(b, b_req));
+  EXPECT_EQ(remote_ids(1, BLOCKS_SYNCHRONIZING_DEFAULT_COUNT), a_req.blocks);
+  EXPECT_EQ(remote_ids(BLOCKS_SYNCHRONIZING_DEFAULT_COUNT + 1, BLOCKS_SYNCHRONIZING_DEFAULT_COUNT), b_req.blocks);
+
+  //the upper span waits for the lower one, its connection goes on with the rest
+  send_blocks(b, b_req);
+  wait_for_spans();
+  EXPECT_EQ(1, m_core.get_precomputed_spans());
+  EXPECT_EQ(1, m_core.get_current_blockchain_height());
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_REQUEST_GET_OBJECTS>(b, b_req));
+  EXPECT_EQ(remote_ids(2 * BLOCKS_SYNCHRONIZING_DEFAULT_COUNT + 1, 10), b_req.blocks);
+
+  send_blocks(a, a_req);
+  wait_for_spans();
+  EXPECT_EQ(2 * BLOCKS_SYNCHRONIZING_DEFAULT_COUNT + 1, m_core.get_current_blockchain_height());
+  send_blocks(b, b_req);
+  wait_for_spans();
+  ASSERT_EQ(m_remote_ids.size(), m_core.get_current_blockchain_height());
+
+  EXPECT_EQ(0, m_core.get_orphans());
+  for(size_t i = 0; i != m_remote_ids.size(); i++)
+    ASSERT_EQ(m_remote_ids[i], m_core.get_block_id(i));
+  EXPECT_FALSE(m_p2p.is_dropped(a));
+  EXPECT_FALSE(m_p2p.is_dropped(b));
+
+  //no block is left claimed, a new connection finds it is synchronized
+  cryptonote_connection_context c = AUTO_VAL_INIT(c);
+  connect(c);
+  send_chain_entry(c);
+  EXPECT_EQ(cryptonote_connection_context::state_normal, c.m_state);
+}
+
+TEST_F(sync_spans, failed_span_releases_the_spans_above)
+{
+  make_remote_chain(2 * BLOCKS_SYNCHRONIZING_DEFAULT_COUNT);
+  cryptonote_connection_context a = AUTO_VAL_INIT(a);
+  cryptonote_connection_context b = AUTO_VAL_INIT(b);
+  connect(a);
+  connect(b);
+  send_chain_entry(a);
+  send_chain_entry(b);
+  NOTIFY_REQUEST_GET_OBJECTS::request a_req;
+  NOTIFY_REQUEST_GET_OBJECTS::request b_req;
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_REQUEST_GET_OBJECTS>(a, a_req));
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_REQUEST_GET_OBJECTS>(b, b_req));
+
+  //the upper span waits, then the lower one fails half way
+  m_core.set_bad_block(m_remote_ids[150]);
+  send_blocks(b, b_req);
+  send_blocks(a, a_req);
+  wait_for_spans();
+  EXPECT_EQ(150, m_core.get_current_blockchain_height());
+  ASSERT_TRUE(m_p2p.is_dropped(a));
+  EXPECT_FALSE(m_p2p.is_dropped(b));
+  EXPECT_EQ(0, m_core.get_orphans());
+  //a may have claimed blocks again before going away
+  m_handler.on_connection_close(a);
+
+  //the blocks of both spans can be requested again, from the failed one on
+  m_core.set_bad_block(null_hash);
+  cryptonote_connection_context c = AUTO_VAL_INIT(c);
+  connect(c);
+  send_chain_entry(c);
+  NOTIFY_REQUEST_GET_OBJECTS::request c_req;
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_REQUEST_GET_OBJECTS>(c, c_req));
+  EXPECT_EQ(remote_ids(150, BLOCKS_SYNCHRONIZING_DEFAULT_COUNT), c_req.blocks);
+  send_blocks(c, c_req);
+  wait_for_spans();
+  EXPECT_EQ(350, m_core.get_current_blockchain_height());
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_REQUEST_GET_OBJECTS>(c, c_req));
+  EXPECT_EQ(remote_ids(350, m_remote_ids.size() - 350), c_req.blocks);
+  send_blocks(c, c_req);
+  wait_for_spans();
+  EXPECT_EQ(m_remote_ids.size(), m_core.get_current_blockchain_height());
+  EXPECT_EQ(0, m_core.get_orphans());
+}
+
+TEST_F(sync_spans, closed_connection_releases_its_span)
+{
+  make_remote_chain(2 * BLOCKS_SYNCHRONIZING_DEFAULT_COUNT);
+  cryptonote_connection_context a = AUTO_VAL_INIT(a);
+  cryptonote_connection_context b = AUTO_VAL_INIT(b);
+  connect(a);
+  connect(b);
+  send_chain_entry(a);
+  send_chain_entry(b);
+  NOTIFY_REQUEST_GET_OBJECTS::request a_req;
+  NOTIFY_REQUEST_GET_OBJECTS::request b_req;
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_REQUEST_GET_OBJECTS>(a, a_req));
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_REQUEST_GET_OBJECTS>(b, b_req));
+
+  //a goes away with the lower span, another connection picks it up
+  m_handler.on_connection_close(a);
+  cryptonote_connection_context c = AUTO_VAL_INIT(c);
+  connect(c);
+  send_chain_entry(c);
+  NOTIFY_REQUEST_GET_OBJECTS::request c_req;
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_REQUEST_GET_OBJECTS>(c, c_req));
+  EXPECT_EQ(a_req.blocks, c_req.blocks);
+
+  send_blocks(b, b_req);
+  send_blocks(c, c_req);
+  wait_for_spans();
+  ASSERT_EQ(m_remote_ids.size(), m_core.get_current_blockchain_height());
+  EXPECT_EQ(0, m_core.get_orphans());
+  for(size_t i = 0; i != m_remote_ids.size(); i++)
+    ASSERT_EQ(m_remote_ids[i], m_core.get_block_id(i));
+}
+
+TEST_F(sync_spans, silent_connection_is_dropped_and_its_span_requested_again)
+{
+  make_remote_chain(2 * BLOCKS_SYNCHRONIZING_DEFAULT_COUNT);
+  cryptonote_connection_context a = AUTO_VAL_INIT(a);
+  cryptonote_connection_context b = AUTO_VAL_INIT(b);
+  connect(a);
+  connect(b);
+  send_chain_entry(a);
+  send_chain_entry(b);
+  NOTIFY_REQUEST_GET_OBJECTS::request a_req;
+  NOTIFY_REQUEST_GET_OBJECTS::request b_req;
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_REQUEST_GET_OBJECTS>(a, a_req));
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_REQUEST_GET_OBJECTS>(b, b_req));
+
+  //the upper span waits for the lower one, which a never sends
+  send_blocks(b, b_req);
+  wait_for_spans();
+  m_handler.on_idle();
+  EXPECT_FALSE(m_p2p.is_dropped(a));
+  m_handler.set_sync_timeout(0);
+  m_handler.on_idle();
+  ASSERT_TRUE(m_p2p.is_dropped(a));
+  EXPECT_FALSE(m_p2p.is_dropped(b));
+
+  cryptonote_connection_context c = AUTO_VAL_INIT(c);
+  connect(c);
+  send_chain_entry(c);
+  NOTIFY_REQUEST_GET_OBJECTS::request c_req;
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_REQUEST_GET_OBJECTS>(c, c_req));
+  EXPECT_EQ(a_req.blocks, c_req.blocks);
+  send_blocks(c, c_req);
+  wait_for_spans();
+  ASSERT_EQ(m_remote_ids.size(), m_core.get_current_blockchain_height());
+  EXPECT_EQ(0, m_core.get_orphans());
+  EXPECT_FALSE(m_p2p.is_dropped(b));
+}
+
+TEST_F(sync_spans, unlinkable_span_is_dropped)
+{
+  make_remote_chain(10);
+  cryptonote_connection_context a = AUTO_VAL_INIT(a);
+  cryptonote_connection_context b = AUTO_VAL_INIT(b);
+  connect(a);
+  connect(b);
+
+  //b announces a block on top of a parent nobody has
+  block unlinkable = unit_test::make_test_block(crypto::cn_fast_hash("unknown parent", 14), 1);
+  m_remote_blobs[get_block_hash(unlinkable)] = block_to_blob(unlinkable);
+  NOTIFY_RESPONSE_CHAIN_ENTRY::request chain = AUTO_VAL_INIT(chain);
+  chain.start_height = 0;
+  chain.total_height = 2;
+  chain.m_block_ids.push_back(m_remote_ids[0]);
+  chain.m_block_ids.push_back(get_block_hash(unlinkable));
+  notify(chain, b, NOTIFY_RESPONSE_CHAIN_ENTRY::ID);
+  NOTIFY_REQUEST_GET_OBJECTS::request b_req;
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_REQUEST_GET_OBJECTS>(b, b_req));
+  send_blocks(b, b_req);
+  wait_for_spans();
+
+  //a brings the whole chain, but waits on the span still claiming its block
+  send_chain_entry(a);
+  NOTIFY_REQUEST_GET_OBJECTS::request a_req;
+  ASSERT_TRUE(m_p2p.take_notify<NOTIFY_REQUEST_GET_OBJECTS>(a, a_req));
+  send_blocks(a, a_req);
+  wait_for_spans();
+  ASSERT_EQ(m_remote_ids.size(), m_core.get_current_blockchain_height());
+  EXPECT_EQ(cryptonote_connection_context::state_synchronizing, a.m_state);
+
+  m_handler.set_sync_timeout(0);
+  m_handler.on_idle();
+  ASSERT_TRUE(m_p2p.is_dropped(b));
+  EXPECT_FALSE(m_p2p.is_dropped(a));
+
+  //woken up, a finds it is synchronized
+  ASSERT_EQ(1, a.m_callback_request_count.load());
+  m_handler.on_callback(a);
+  send_chain_entry(a);
+  EXPECT_EQ(cryptonote_connection_context::state_normal, a.m_state);
+}
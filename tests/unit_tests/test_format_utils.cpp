@@ -160,6 +160,66 @@ TEST(parse_and_validate_tx_extra, fails_on_wrong_size_in_extra_nonce)
   std::vector<cryptonote::tx_extra_field> tx_extra_fields;
   ASSERT_FALSE(cryptonote::parse_tx_extra(tx.extra, tx_extra_fields));
 }
+TEST(lookup_acc_outs, finds_all_miner_tx_outs)
+{
+  cryptonote::transaction tx = AUTO_VAL_INIT(tx);
+  cryptonote::account_base acc;
+  acc.generate();
+  ASSERT_TRUE(cryptonote::construct_miner_tx(0, 0, 10000000000000, 1000, TEST_FEE, acc.get_keys().m_account_address, tx, "", 11));
+  std::vector<size_t> outs;
+  uint64_t money = 0;
+  ASSERT_TRUE(cryptonote::lookup_acc_outs(acc.get_keys(), tx, outs, money));
+  ASSERT_EQ(tx.vout.size(), outs.size());
+  ASSERT_EQ(cryptonote::get_outs_money_amount(tx), money);
+  for (size_t i = 0; i < outs.size(); ++i)
+  {
+    ASSERT_EQ(i, outs[i]);
+    ASSERT_TRUE(cryptonote::is_out_to_acc(acc.get_keys(), boost::get<cryptonote::txout_to_key>(tx.vout[i].target), cryptonote::get_tx_pub_key_from_extra(tx), i));
+  }
+}
+TEST(lookup_acc_outs, finds_only_own_outs)
+{
+  cryptonote::account_base alice, bob;
+  alice.generate();
+  bob.generate();
+  cryptonote::transaction tx = AUTO_VAL_INIT(tx);
+  ASSERT_TRUE(cryptonote::construct_miner_tx(0, 0, 10000000000000, 1000, TEST_FEE, alice.get_keys().m_account_address, tx, "", 11));
+  crypto::public_key tx_pub_key = cryptonote::get_tx_pub_key_from_extra(tx);
+
+  std::vector<crypto::public_key> out_keys;
+  for (size_t i = 0; i < 300; ++i)
+  {
+    const cryptonote::tx_out& o = tx.vout[i % tx.vout.size()];
+    out_keys.push_back(boost::get<cryptonote::txout_to_key>(o.target).key);
+  }
+  std::vector<size_t> outs;
+  ASSERT_TRUE(cryptonote::find_outs_to_acc(alice.get_keys(), tx_pub_key, out_keys, outs));
+  ASSERT_EQ(tx.vout.size(), outs.size());
+  for (size_t i = 0; i < outs.size(); ++i)
+    ASSERT_EQ(i, outs[i]);
+
+  outs.clear();
+  ASSERT_TRUE(cryptonote::find_outs_to_acc(bob.get_keys(), tx_pub_key, out_keys, outs));
+  ASSERT_TRUE(outs.empty());
+}
+TEST(lookup_acc_outs, finds_no_outs_with_invalid_tx_pub_key)
+{
+  cryptonote::account_base acc;
+  acc.generate();
+  cryptonote::transaction tx = AUTO_VAL_INIT(tx);
+  ASSERT_TRUE(cryptonote::construct_miner_tx(0, 0, 10000000000000, 1000, TEST_FEE, acc.get_keys().m_account_address, tx, "", 11));
+  crypto::public_key bad_key;
+  do
+    bad_key = crypto::rand<crypto::public_key>();
+  while (crypto::check_key(bad_key));
+
+  std::vector<size_t> outs;
+  uint64_t money = 0;
+  ASSERT_TRUE(cryptonote::lookup_acc_outs(acc.get_keys(), tx, bad_key, outs, money));
+  ASSERT_TRUE(outs.empty());
+  ASSERT_EQ(0, money);
+  ASSERT_FALSE(cryptonote::is_out_to_acc(acc.get_keys(), boost::get<cryptonote::txout_to_key>(tx.vout[0].target), bad_key, 0));
+}
 TEST(validate_parse_amount_case, validate_parse_amount)
 {
   uint64_t res = 0;
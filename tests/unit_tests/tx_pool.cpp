@@ -0,0 +1,186 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include "blockchain_tests_utils.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  tx_memory_pool::fee_rate_entry make_entry(uint64_t fee, size_t blob_size)
+  {
+    tx_memory_pool::fee_rate_entry e = AUTO_VAL_INIT(e);
+    e.fee = fee;
+    e.blob_size = blob_size;
+    return e;
+  }
+
+  class tx_pool_test : public ::testing::Test
+  {
+  protected:
+    virtual void SetUp()
+    {
+      m_miner.generate();
+      m_to.generate();
+    }
+
+    const account_public_address& miner_address() const { return m_miner.get_keys().m_account_address; }
+
+    //! Mines count rewards of the miner's and the blocks which unlock them
+    std::vector<transaction> mine_spendable_rewards(unit_test::test_blockchain& chain, size_t count)
+    {
+      std::vector<transaction> rewards;
+      block b;
+      for(size_t i = 0; i != count; i++)
+      {
+        EXPECT_TRUE(chain.mine_block(miner_address(), b));
+        rewards.push_back(b.miner_tx);
+      }
+      EXPECT_TRUE(chain.mine_blocks(miner_address(), CRYPTONOTE_MINED_MONEY_UNLOCK_WINDOW));
+      return rewards;
+    }
+
+    account_base m_miner;
+    account_base m_to;
+  };
+}
+
+TEST(tx_pool, fee_rate_greater_compares_full_products)
+{
+  tx_memory_pool::fee_rate_greater greater;
+  EXPECT_TRUE(greater(make_entry(300, 100), make_entry(200, 100)));
+  EXPECT_TRUE(greater(make_entry(200, 100), make_entry(300, 200)));
+  EXPECT_FALSE(greater(make_entry(300, 200), make_entry(200, 100)));
+
+  //the same rate either way
+  EXPECT_FALSE(greater(make_entry(600, 200), make_entry(300, 100)));
+  EXPECT_FALSE(greater(make_entry(300, 100), make_entry(600, 200)));
+
+  //2^63 * 3 wraps to 2^63 in 64 bits, which would make both rates look the same
+  const uint64_t two_63 = uint64_t(1) << 63;
+  EXPECT_TRUE(greater(make_entry(two_63, 2), make_entry(two_63 / 2, 3)));
+  EXPECT_FALSE(greater(make_entry(two_63 / 2, 3), make_entry(two_63, 2)));
+  EXPECT_TRUE(greater(make_entry(std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint32_t>::max() - 1),
+    make_entry(std::numeric_limits<uint64_t>::max(), std::numeric_limits<uint32_t>::max())));
+}
+
+TEST_F(tx_pool_test, block_template_takes_best_paying_transactions_first)
+{
+  unit_test::test_blockchain chain;
+  ASSERT_TRUE(chain.init());
+  const std::vector<transaction> rewards = mine_spendable_rewards(chain, 4);
+
+  //a second chain sharing the blocks so far
+  unit_test::test_blockchain other;
+  ASSERT_TRUE(other.init());
+  std::list<block> blocks;
+  ASSERT_TRUE(chain.storage().get_blocks(1, chain.storage().get_current_blockchain_height(), blocks));
+  BOOST_FOREACH(const block& b, blocks)
+  {
+    block_verification_context bvc = AUTO_VAL_INIT(bvc);
+    ASSERT_TRUE(other.storage().add_new_block(b, bvc));
+    ASSERT_TRUE(bvc.m_added_to_main_chain);
+  }
+
+  //transactions of about the same size, in an order unrelated to their fees
+  const uint64_t fees[] = {100000000000, 400000000000, 200000000000, 300000000000};
+  std::vector<crypto::hash> tx_ids;
+  for(size_t i = 0; i != rewards.size(); i++)
+  {
+    transaction tx = chain.make_transfer(m_miner.get_keys(), rewards[i], m_to.get_keys().m_account_address, 1000000000000, fees[i]);
+    tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+    ASSERT_TRUE(chain.pool().add_tx(tx, tvc, false));
+    tx_ids.push_back(get_transaction_hash(tx));
+  }
+  std::vector<crypto::hash> expected;
+  expected.push_back(tx_ids[1]);
+  expected.push_back(tx_ids[3]);
+  expected.push_back(tx_ids[2]);
+  expected.push_back(tx_ids[0]);
+
+  block b;
+  ASSERT_TRUE(chain.make_block(miner_address(), b));
+  EXPECT_EQ(expected, b.tx_hashes);
+
+  //the mined transactions leave the index along with the pool
+  ASSERT_TRUE(chain.add_block(b));
+  EXPECT_EQ(0, chain.pool().get_transactions_count());
+  block next;
+  ASSERT_TRUE(chain.make_block(miner_address(), next));
+  EXPECT_TRUE(next.tx_hashes.empty());
+
+  //and come back with their block popped by a reorganization
+  ASSERT_TRUE(other.mine_blocks(miner_address(), 2));
+  blocks.clear();
+  ASSERT_TRUE(other.storage().get_blocks(chain.storage().get_current_blockchain_height() - 1, 2, blocks));
+  BOOST_FOREACH(const block& ob, blocks)
+  {
+    block_verification_context bvc = AUTO_VAL_INIT(bvc);
+    ASSERT_TRUE(chain.storage().add_new_block(ob, bvc));
+    ASSERT_FALSE(bvc.m_verifivation_failed);
+  }
+  ASSERT_EQ(other.storage().get_tail_id(), chain.storage().get_tail_id());
+  EXPECT_EQ(tx_ids.size(), chain.pool().get_transactions_count());
+  ASSERT_TRUE(chain.make_block(miner_address(), next));
+  EXPECT_EQ(expected, next.tx_hashes);
+}
+
+TEST_F(tx_pool_test, block_template_with_limited_space_takes_best_paying_transactions)
+{
+  unit_test::test_blockchain chain;
+  ASSERT_TRUE(chain.init());
+  const std::vector<transaction> rewards = mine_spendable_rewards(chain, 4);
+
+  const uint64_t fees[] = {100000000000, 400000000000, 200000000000, 300000000000};
+  std::vector<crypto::hash> tx_ids;
+  std::vector<size_t> sizes;
+  for(size_t i = 0; i != rewards.size(); i++)
+  {
+    transaction tx = chain.make_transfer(m_miner.get_keys(), rewards[i], m_to.get_keys().m_account_address, 1000000000000, fees[i]);
+    tx_verification_context tvc = AUTO_VAL_INIT(tvc);
+    ASSERT_TRUE(chain.pool().add_tx(tx, tvc, false));
+    tx_ids.push_back(get_transaction_hash(tx));
+    sizes.push_back(get_object_blobsize(tx));
+  }
+
+  //room for the two best paying ones, and half of the smallest one
+  const size_t room = sizes[1] + sizes[3] + *std::min_element(sizes.begin(), sizes.end()) / 2;
+  const size_t median_size = ((room + CRYPTONOTE_COINBASE_BLOB_RESERVED_SIZE) * 100 + 129) / 130;
+  block b = AUTO_VAL_INIT(b);
+  size_t total_size = 0;
+  uint64_t fee = 0;
+  ASSERT_TRUE(chain.pool().fill_block_template(b, median_size, 0, total_size, fee));
+  std::vector<crypto::hash> expected;
+  expected.push_back(tx_ids[1]);
+  expected.push_back(tx_ids[3]);
+  EXPECT_EQ(expected, b.tx_hashes);
+  EXPECT_EQ(sizes[1] + sizes[3], total_size);
+  EXPECT_EQ(fees[1] + fees[3], fee);
+}
@@ -0,0 +1,261 @@
+// Copyright (c) 2014-2015, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include "include_base_utils.h"
+#include "common/boost_serialization_helper.h"
+#include "cryptonote_core/blob_log.h"
+#include "wallet_tests_utils.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  //! transfer_details as caches stored it before class version 1, with the whole transaction
+  struct transfer_details_v0
+  {
+    uint64_t m_block_height;
+    cryptonote::transaction m_tx;
+    size_t m_internal_output_index;
+    uint64_t m_global_output_index;
+    bool m_spent;
+    crypto::key_image m_key_image;
+  };
+
+  class wallet_cache : public unit_test::wallet_test
+  {
+  protected:
+    std::string cache_path(const std::string& name) const
+    {
+      return (m_dir / name).string();
+    }
+
+    //! Count of the deltas appended to the cache of the wallet stored under name
+    uint64_t deltas_count(const std::string& name) const
+    {
+      cryptonote::blob_log deltas;
+      if(!deltas.open(cache_path(name) + ".deltas", true))
+        return 0;
+      return deltas.size();
+    }
+
+    //! Cuts the data of the last delta short, as an append which didn't reach the disk in full
+    void tear_last_delta(const std::string& name)
+    {
+      //the records lie back to back in the data file
+      uint64_t begin = 0;
+      blobdata blob;
+      {
+        cryptonote::blob_log deltas;
+        ASSERT_TRUE(deltas.open(cache_path(name) + ".deltas", true));
+        ASSERT_LT(0, deltas.size());
+        for(uint64_t i = 0; i != deltas.size(); ++i)
+        {
+          begin += blob.size();
+          ASSERT_TRUE(deltas.get(i, blob));
+        }
+      }
+      //half of it, as its tail may well be zeros already
+      boost::filesystem::resize_file(cache_path(name) + ".deltas.dat", begin + blob.size() / 2);
+    }
+  };
+}
+
+namespace boost
+{
+  namespace serialization
+  {
+    template <class Archive>
+    inline void serialize(Archive &a, transfer_details_v0 &x, const boost::serialization::version_type ver)
+    {
+      a & x.m_block_height;
+      a & x.m_global_output_index;
+      a & x.m_internal_output_index;
+      a & x.m_tx;
+      a & x.m_spent;
+      a & x.m_key_image;
+    }
+  }
+}
+
+TEST_F(wallet_cache, deltas_round_trip)
+{
+  tools::wallet2 alice, bob;
+  make_wallet(alice, "alice");
+  make_wallet(bob, "bob");
+  const account_keys& alice_keys = alice.get_account().get_keys();
+  const account_keys& bob_keys = bob.get_account().get_keys();
+
+  unit_test::test_chain chain;
+  const transaction alice_reward = chain.mine_block(alice_keys.m_account_address);
+  chain.mine_blocks(alice_keys.m_account_address, 4);
+  const transaction to_bob = chain.make_transfer(alice_keys, alice_reward, bob_keys.m_account_address, 3000000000000, 10000000000);
+  chain.mine_block(alice_keys.m_account_address, std::list<transaction>(1, to_bob));
+  chain.mine_blocks(alice_keys.m_account_address, 3);
+  m_daemon.set_chain(chain);
+  refresh(alice, 4);
+  alice.store();
+
+  //alice's change, received before the previous store, gets spent
+  const transaction change_spend = chain.make_transfer(alice_keys, to_bob, bob_keys.m_account_address, 1000000000000, 10000000000);
+  chain.mine_block(alice_keys.m_account_address, std::list<transaction>(1, change_spend));
+  chain.mine_blocks(alice_keys.m_account_address, 3);
+  m_daemon.set_chain(chain);
+  refresh(alice, 4);
+  alice.store();
+  EXPECT_EQ(2, deltas_count("alice"));
+
+  tools::wallet2 loaded;
+  load_wallet(loaded, "alice");
+  ASSERT_EQ(chain.height(), loaded.get_blockchain_current_height());
+  unit_test::expect_same_wallets(alice, loaded);
+  tools::wallet2::transfer_container transfers;
+  loaded.get_transfers(transfers);
+  EXPECT_EQ(2, std::count_if(transfers.begin(), transfers.end(), [](const tools::wallet2::transfer_details& td) { return td.m_spent; }));
+}
+
+TEST_F(wallet_cache, drops_deltas_of_another_cache_file)
+{
+  tools::wallet2 alice;
+  make_wallet(alice, "alice");
+  const account_public_address& alice_address = alice.get_account().get_keys().m_account_address;
+
+  unit_test::test_chain chain;
+  chain.mine_blocks(alice_address, 5);
+  const unit_test::test_chain old_chain = chain;
+  m_daemon.set_chain(chain);
+  refresh(alice, 4);
+  //without a cache file, the whole cache is stored, under a new generation
+  boost::filesystem::remove(cache_path("alice"));
+  alice.store();
+  EXPECT_EQ(0, deltas_count("alice"));
+  boost::filesystem::copy_file(cache_path("alice"), cache_path("alice.old"));
+
+  chain.mine_blocks(alice_address, 5);
+  m_daemon.set_chain(chain);
+  refresh(alice, 4);
+  boost::filesystem::remove(cache_path("alice"));
+  alice.store();
+  chain.mine_blocks(alice_address, 5);
+  m_daemon.set_chain(chain);
+  refresh(alice, 4);
+  alice.store();
+  EXPECT_EQ(1, deltas_count("alice"));
+
+  //the cache file goes back to an older one, the deltas of the newer one must not be applied to it
+  boost::filesystem::copy_file(cache_path("alice.old"), cache_path("alice"), boost::filesystem::copy_option::overwrite_if_exists);
+  tools::wallet2 loaded;
+  load_wallet(loaded, "alice");
+  EXPECT_EQ(0, deltas_count("alice"));
+  m_daemon.set_chain(old_chain);
+  tools::wallet2 old_alice;
+  make_wallet(old_alice, "old_alice", &alice);
+  refresh(old_alice, 4);
+  ASSERT_EQ(old_chain.height(), loaded.get_blockchain_current_height());
+  unit_test::expect_same_wallets(old_alice, loaded);
+
+  //and it goes on storing deltas from there
+  m_daemon.set_chain(chain);
+  refresh(loaded, 4);
+  loaded.store();
+  EXPECT_EQ(1, deltas_count("alice"));
+  tools::wallet2 reloaded;
+  load_wallet(reloaded, "alice");
+  unit_test::expect_same_wallets(alice, reloaded);
+}
+
+TEST_F(wallet_cache, drops_torn_trailing_delta)
+{
+  tools::wallet2 alice;
+  make_wallet(alice, "alice");
+  const account_public_address& alice_address = alice.get_account().get_keys().m_account_address;
+
+  unit_test::test_chain chain;
+  chain.mine_blocks(alice_address, 5);
+  const unit_test::test_chain old_chain = chain;
+  m_daemon.set_chain(chain);
+  refresh(alice, 4);
+  alice.store();
+  chain.mine_blocks(alice_address, 5);
+  m_daemon.set_chain(chain);
+  refresh(alice, 4);
+  alice.store();
+  ASSERT_EQ(2, deltas_count("alice"));
+
+  tear_last_delta("alice");
+  tools::wallet2 loaded;
+  load_wallet(loaded, "alice");
+  EXPECT_EQ(1, deltas_count("alice"));
+  m_daemon.set_chain(old_chain);
+  tools::wallet2 old_alice;
+  make_wallet(old_alice, "old_alice", &alice);
+  refresh(old_alice, 4);
+  ASSERT_EQ(old_chain.height(), loaded.get_blockchain_current_height());
+  unit_test::expect_same_wallets(old_alice, loaded);
+
+  m_daemon.set_chain(chain);
+  refresh(loaded, 4);
+  loaded.store();
+  tools::wallet2 reloaded;
+  load_wallet(reloaded, "alice");
+  unit_test::expect_same_wallets(alice, reloaded);
+}
+
+TEST_F(wallet_cache, migrates_transfer_details_v0)
+{
+  account_base miner;
+  miner.generate();
+  unit_test::test_chain chain;
+  const transaction tx = chain.mine_block(miner.get_keys().m_account_address);
+  ASSERT_LT(0, tx.unlock_time);
+
+  transfer_details_v0 old_td = AUTO_VAL_INIT(old_td);
+  old_td.m_block_height = 1;
+  old_td.m_tx = tx;
+  old_td.m_internal_output_index = tx.vout.size() - 1;
+  old_td.m_global_output_index = 7;
+  old_td.m_spent = true;
+  old_td.m_key_image = crypto::rand<crypto::key_image>();
+  std::string blob;
+  ASSERT_TRUE(tools::serialize_obj_to_blob(old_td, blob));
+
+  tools::wallet2::transfer_details td = AUTO_VAL_INIT(td);
+  ASSERT_TRUE(tools::unserialize_obj_from_blob(td, blob));
+  EXPECT_EQ(old_td.m_block_height, td.m_block_height);
+  EXPECT_EQ(old_td.m_internal_output_index, td.m_internal_output_index);
+  EXPECT_EQ(old_td.m_global_output_index, td.m_global_output_index);
+  EXPECT_EQ(old_td.m_spent, td.m_spent);
+  EXPECT_EQ(old_td.m_key_image, td.m_key_image);
+  EXPECT_EQ(get_transaction_hash(tx), td.m_txid);
+  EXPECT_EQ(get_tx_pub_key_from_extra(tx), td.m_tx_pub_key);
+  EXPECT_EQ(boost::get<txout_to_key>(tx.vout.back().target).key, td.m_output_key);
+  EXPECT_EQ(tx.vout.back().amount, td.amount());
+  EXPECT_EQ(tx.unlock_time, td.m_unlock_time);
+  EXPECT_EQ(get_object_blobsize(tx), td.m_tx_size);
+}
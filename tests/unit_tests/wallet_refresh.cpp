@@ -0,0 +1,181 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include "wallet_tests_utils.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  class wallet_refresh : public unit_test::wallet_test
+  {
+  };
+}
+
+TEST_F(wallet_refresh, pipelined_matches_sequential)
+{
+  tools::wallet2 alice, bob;
+  make_wallet(alice, "alice");
+  make_wallet(bob, "bob");
+  const account_keys& alice_keys = alice.get_account().get_keys();
+  const account_keys& bob_keys = bob.get_account().get_keys();
+
+  unit_test::test_chain chain;
+  const transaction alice_reward = chain.mine_block(alice_keys.m_account_address);
+  chain.mine_blocks(alice_keys.m_account_address, 4);
+  //bob gets paid, and alice spends her change right in the next block, so within the same batch
+  const transaction to_bob = chain.make_transfer(alice_keys, alice_reward, bob_keys.m_account_address, 3000000000000, 10000000000);
+  chain.mine_block(alice_keys.m_account_address, std::list<transaction>(1, to_bob));
+  const transaction change_spend = chain.make_transfer(alice_keys, to_bob, bob_keys.m_account_address, 1000000000000, 10000000000);
+  chain.mine_block(bob_keys.m_account_address, std::list<transaction>(1, change_spend));
+  chain.mine_blocks(alice_keys.m_account_address, 3);
+  const transaction to_alice = chain.make_transfer(bob_keys, to_bob, alice_keys.m_account_address, 2000000000000, 10000000000);
+  chain.mine_block(bob_keys.m_account_address, std::list<transaction>(1, to_alice));
+  chain.mine_blocks(alice_keys.m_account_address, 10);
+  m_daemon.set_chain(chain);
+
+  //with one new block per batch, every block is scanned and applied before the next one comes in
+  tools::wallet2 alice_sequential, bob_sequential;
+  make_wallet(alice_sequential, "alice_sequential", &alice);
+  make_wallet(bob_sequential, "bob_sequential", &bob);
+  refresh(alice_sequential, 2);
+  refresh(bob_sequential, 2);
+  ASSERT_EQ(chain.height(), alice_sequential.get_blockchain_current_height());
+  ASSERT_EQ(chain.height(), bob_sequential.get_blockchain_current_height());
+
+  //batches of several blocks, each scanned in parallel while the next one is prefetched
+  refresh(alice, 7);
+  refresh(bob, 7);
+  unit_test::expect_same_wallets(alice_sequential, alice);
+  unit_test::expect_same_wallets(bob_sequential, bob);
+
+  //the whole chain in one batch
+  tools::wallet2 alice_one_batch;
+  make_wallet(alice_one_batch, "alice_one_batch", &alice);
+  refresh(alice_one_batch, COMMAND_RPC_GET_BLOCKS_FAST_MAX_COUNT);
+  unit_test::expect_same_wallets(alice_sequential, alice_one_batch);
+
+  //the money went where it should have
+  tools::wallet2::transfer_container transfers;
+  bob.get_transfers(transfers);
+  uint64_t bob_unspent = 0;
+  BOOST_FOREACH(const tools::wallet2::transfer_details& td, transfers)
+    bob_unspent += td.m_spent ? 0 : td.amount();
+  EXPECT_EQ(bob_unspent, bob.balance());
+  EXPECT_LT(0, bob.balance());
+  alice.get_transfers(transfers);
+  size_t alice_spent = std::count_if(transfers.begin(), transfers.end(), [](const tools::wallet2::transfer_details& td) { return td.m_spent; });
+  EXPECT_LT(0, alice_spent);
+}
+
+TEST_F(wallet_refresh, falls_back_to_full_blocks)
+{
+  tools::wallet2 alice, bob;
+  make_wallet(alice, "alice");
+  make_wallet(bob, "bob");
+  const account_keys& alice_keys = alice.get_account().get_keys();
+  const account_keys& bob_keys = bob.get_account().get_keys();
+
+  unit_test::test_chain chain;
+  const transaction alice_reward = chain.mine_block(alice_keys.m_account_address);
+  chain.mine_blocks(alice_keys.m_account_address, 4);
+  const transaction to_bob = chain.make_transfer(alice_keys, alice_reward, bob_keys.m_account_address, 3000000000000, 10000000000);
+  chain.mine_block(alice_keys.m_account_address, std::list<transaction>(1, to_bob));
+  chain.mine_blocks(alice_keys.m_account_address, 3);
+  m_daemon.set_chain(chain);
+  refresh(alice, 4);
+  refresh(bob, 4);
+
+  //a daemon without getblocks_compact.bin, global output indexes then come from get_o_indexes.bin
+  m_daemon.set_compact_blocks(false);
+  tools::wallet2 alice_full, bob_full;
+  make_wallet(alice_full, "alice_full", &alice);
+  make_wallet(bob_full, "bob_full", &bob);
+  refresh(alice_full, 4);
+  refresh(bob_full, 4);
+  ASSERT_EQ(chain.height(), alice_full.get_blockchain_current_height());
+  unit_test::expect_same_wallets(alice, alice_full);
+  unit_test::expect_same_wallets(bob, bob_full);
+  EXPECT_LT(0, bob_full.balance());
+}
+
+TEST_F(wallet_refresh, rejects_blocks_not_matching_their_ids)
+{
+  tools::wallet2 alice;
+  make_wallet(alice, "alice");
+  unit_test::test_chain chain;
+  chain.mine_blocks(alice.get_account().get_keys().m_account_address, 10);
+  m_daemon.set_chain(chain);
+
+  m_daemon.set_forged_height(6);
+  EXPECT_THROW(refresh(alice, 4), tools::error::wallet_internal_error);
+  //the batch holding the forged block is dropped as a whole
+  EXPECT_GE(6, alice.get_blockchain_current_height());
+
+  //the same block served honestly is taken
+  m_daemon.set_forged_height(std::numeric_limits<uint64_t>::max());
+  refresh(alice, 4);
+  EXPECT_EQ(chain.height(), alice.get_blockchain_current_height());
+}
+
+TEST_F(wallet_refresh, skips_transactions_with_an_invalid_public_key)
+{
+  tools::wallet2 alice, bob;
+  make_wallet(alice, "alice");
+  make_wallet(bob, "bob");
+  const account_keys& alice_keys = alice.get_account().get_keys();
+  const account_keys& bob_keys = bob.get_account().get_keys();
+
+  unit_test::test_chain chain;
+  const transaction alice_reward = chain.mine_block(alice_keys.m_account_address);
+  chain.mine_blocks(alice_keys.m_account_address, 4);
+  //the daemon doesn't check the public key in tx extra, so nothing keeps such a transaction out of a block
+  transaction bad_key_tx = chain.make_transfer(alice_keys, alice_reward, bob_keys.m_account_address, 3000000000000, 10000000000);
+  crypto::public_key bad_key;
+  do
+    bad_key = crypto::rand<crypto::public_key>();
+  while (crypto::check_key(bad_key));
+  bad_key_tx.extra.clear();
+  ASSERT_TRUE(add_tx_pub_key_to_extra(bad_key_tx, bad_key));
+  chain.mine_block(alice_keys.m_account_address, std::list<transaction>(1, bad_key_tx));
+  chain.mine_blocks(alice_keys.m_account_address, 3);
+  m_daemon.set_chain(chain);
+
+  refresh(bob, 4);
+  EXPECT_EQ(chain.height(), bob.get_blockchain_current_height());
+  EXPECT_EQ(0, bob.balance());
+
+  m_daemon.set_compact_blocks(false);
+  tools::wallet2 bob_full;
+  make_wallet(bob_full, "bob_full", &bob);
+  refresh(bob_full, 4);
+  EXPECT_EQ(chain.height(), bob_full.get_blockchain_current_height());
+  EXPECT_EQ(0, bob_full.balance());
+}
@@ -0,0 +1,135 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include "wallet/wallet_scanner.h"
+#include "wallet_tests_utils.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  class wallet_scanner : public unit_test::wallet_test
+  {
+  protected:
+    //! Checks w against a wallet with its keys refreshed alone from the current chain
+    void expect_same_as_alone(tools::wallet2& w, const std::string& name)
+    {
+      tools::wallet2 alone;
+      make_wallet(alone, name, &w);
+      refresh(alone, 4);
+      unit_test::expect_same_wallets(alone, w);
+    }
+  };
+}
+
+TEST_F(wallet_scanner, refreshes_wallets_on_diverging_branches)
+{
+  tools::wallet2 alice, bob, carol;
+  make_wallet(alice, "alice");
+  make_wallet(bob, "bob");
+  make_wallet(carol, "carol");
+  const account_public_address& alice_address = alice.get_account().get_keys().m_account_address;
+  const account_public_address& bob_address = bob.get_account().get_keys().m_account_address;
+  const account_public_address& carol_address = carol.get_account().get_keys().m_account_address;
+
+  unit_test::test_chain chain;
+  chain.mine_block(alice_address);
+  //bob follows a branch leaving the main chain below the height carol starts from
+  unit_test::test_chain low_branch = chain;
+  low_branch.mine_blocks(bob_address, 8);
+  chain.mine_blocks(carol_address, 2);
+  const unit_test::test_chain carol_chain = chain;
+  chain.mine_blocks(bob_address, 3);
+  //alice follows a branch leaving the main chain above it
+  unit_test::test_chain high_branch = chain;
+  high_branch.mine_blocks(alice_address, 6);
+  for(size_t i = 0; i != 5; i++)
+  {
+    chain.mine_block(alice_address);
+    chain.mine_block(bob_address);
+    chain.mine_block(carol_address);
+  }
+
+  m_daemon.set_chain(low_branch);
+  refresh(bob, 4);
+  m_daemon.set_chain(carol_chain);
+  refresh(carol, 4);
+  m_daemon.set_chain(high_branch);
+  refresh(alice, 4);
+  ASSERT_EQ(high_branch.height(), alice.get_blockchain_current_height());
+  ASSERT_EQ(low_branch.height(), bob.get_blockchain_current_height());
+  ASSERT_EQ(carol_chain.height(), carol.get_blockchain_current_height());
+
+  m_daemon.set_chain(chain);
+  m_daemon.set_max_blocks(4);
+  tools::wallet_scanner scanner;
+  scanner.init(m_daemon.address());
+  scanner.add_wallet(alice);
+  scanner.add_wallet(bob);
+  scanner.add_wallet(carol);
+  EXPECT_LT(0, scanner.refresh());
+  ASSERT_EQ(chain.height(), alice.get_blockchain_current_height());
+  ASSERT_EQ(chain.height(), bob.get_blockchain_current_height());
+  ASSERT_EQ(chain.height(), carol.get_blockchain_current_height());
+  expect_same_as_alone(alice, "alice_alone");
+  expect_same_as_alone(bob, "bob_alone");
+  expect_same_as_alone(carol, "carol_alone");
+  EXPECT_LT(0, alice.balance());
+  EXPECT_LT(0, bob.balance());
+  EXPECT_LT(0, carol.balance());
+
+  //nothing new, nothing fetched
+  EXPECT_EQ(0, scanner.refresh());
+}
+
+TEST_F(wallet_scanner, stored_wallets_load_refreshed)
+{
+  tools::wallet2 alice, bob;
+  make_wallet(alice, "alice");
+  make_wallet(bob, "bob");
+  unit_test::test_chain chain;
+  chain.mine_blocks(alice.get_account().get_keys().m_account_address, 3);
+  chain.mine_blocks(bob.get_account().get_keys().m_account_address, 3);
+
+  m_daemon.set_chain(chain);
+  m_daemon.set_max_blocks(4);
+  tools::wallet_scanner scanner;
+  scanner.init(m_daemon.address());
+  scanner.add_wallet(alice);
+  scanner.add_wallet(bob);
+  EXPECT_LT(0, scanner.refresh());
+  scanner.store();
+
+  tools::wallet2 loaded_alice, loaded_bob;
+  load_wallet(loaded_alice, "alice");
+  load_wallet(loaded_bob, "bob");
+  unit_test::expect_same_wallets(alice, loaded_alice);
+  unit_test::expect_same_wallets(bob, loaded_bob);
+}
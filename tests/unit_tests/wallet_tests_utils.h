@@ -0,0 +1,409 @@
+// Copyright (c) 2014-2015, The Monero Project
+// 
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+// 
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+// 
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+// 
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <map>
+#include <unordered_map>
+#include <boost/filesystem.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "gtest/gtest.h"
+
+#include "include_base_utils.h"
+#include "blockchain_tests_utils.h"
+#include "cryptonote_config.h"
+#include "cryptonote_core/cryptonote_format_utils.h"
+#include "net/http_server_impl_base.h"
+#include "rpc/core_rpc_server_utils.h"
+#include "wallet/wallet2.h"
+
+namespace unit_test
+{
+  // epee's uri map macros call misc_utils without its namespace
+  using namespace epee;
+
+  /*! \brief A main chain built in memory, without proofs of work, for wallets to refresh from
+   *
+   * \details A copy grows independently of the original, which makes a branch.
+   */
+  class test_chain
+  {
+  public:
+    test_chain()
+      : m_nonce(0)
+    {
+      cryptonote::block genesis;
+      cryptonote::generate_genesis_block(genesis, config::GENESIS_TX, config::GENESIS_NONCE);
+      add_block(genesis, std::list<cryptonote::transaction>());
+    }
+
+    size_t height() const { return m_blocks.size(); }
+    const cryptonote::block& get_block(size_t height) const { return m_blocks[height]; }
+    const crypto::hash& get_block_id(size_t height) const { return m_ids[height]; }
+
+    //! Adds a block paying its reward to miner, returns its miner transaction
+    const cryptonote::transaction& mine_block(const cryptonote::account_public_address& miner, const std::list<cryptonote::transaction>& txs = std::list<cryptonote::transaction>())
+    {
+      cryptonote::block b = AUTO_VAL_INIT(b);
+      b.major_version = CURRENT_BLOCK_MAJOR_VERSION;
+      b.minor_version = CURRENT_BLOCK_MINOR_VERSION;
+      b.timestamp = time(NULL);
+      b.prev_id = m_ids.back();
+      //the nonce tells apart blocks of different branches mined to the same address at the same time
+      b.nonce = m_nonce++;
+      uint64_t fee = 0;
+      BOOST_FOREACH(const cryptonote::transaction& tx, txs)
+        fee += cryptonote::get_tx_fee(tx);
+      bool r = cryptonote::construct_miner_tx(height(), 0, 0, 0, fee, miner, b.miner_tx);
+      CHECK_AND_ASSERT_THROW_MES(r, "failed to construct miner tx");
+      add_block(b, txs);
+      return m_blocks.back().miner_tx;
+    }
+
+    void mine_blocks(const cryptonote::account_public_address& miner, size_t count)
+    {
+      for(size_t i = 0; i != count; i++)
+        mine_block(miner);
+    }
+
+    //! Builds a transaction spending the outputs of source that belong to from, see construct_transfer
+    cryptonote::transaction make_transfer(const cryptonote::account_keys& from, const cryptonote::transaction& source, const cryptonote::account_public_address& to,
+      uint64_t amount, uint64_t fee = 0, uint64_t unlock_time = 0) const
+    {
+      auto gi = m_global_indexes.find(cryptonote::get_transaction_hash(source));
+      CHECK_AND_ASSERT_THROW_MES(gi != m_global_indexes.end(), "the source transaction is not in the chain");
+      return construct_transfer(from, source, gi->second, to, amount, fee, unlock_time);
+    }
+
+    const cryptonote::transaction* find_transaction(const crypto::hash& id) const
+    {
+      auto it = m_txs.find(id);
+      return it == m_txs.end() ? NULL : &it->second;
+    }
+
+    const std::vector<uint64_t>* find_global_indexes(const crypto::hash& tx_id) const
+    {
+      auto it = m_global_indexes.find(tx_id);
+      return it == m_global_indexes.end() ? NULL : &it->second;
+    }
+
+    //! Height of the newest block of ids found in the chain, ids being ordered newest first
+    bool find_supplement(const std::list<crypto::hash>& ids, uint64_t& start_height) const
+    {
+      BOOST_FOREACH(const crypto::hash& id, ids)
+      {
+        auto it = std::find(m_ids.begin(), m_ids.end(), id);
+        if(it != m_ids.end())
+        {
+          start_height = it - m_ids.begin();
+          return true;
+        }
+      }
+      return false;
+    }
+
+  private:
+    void add_block(const cryptonote::block& b, const std::list<cryptonote::transaction>& txs)
+    {
+      cryptonote::block bl = b;
+      add_transaction(bl.miner_tx);
+      BOOST_FOREACH(const cryptonote::transaction& tx, txs)
+      {
+        bl.tx_hashes.push_back(cryptonote::get_transaction_hash(tx));
+        add_transaction(tx);
+      }
+      m_blocks.push_back(bl);
+      m_ids.push_back(cryptonote::get_block_hash(bl));
+    }
+
+    void add_transaction(const cryptonote::transaction& tx)
+    {
+      crypto::hash id = cryptonote::get_transaction_hash(tx);
+      m_txs[id] = tx;
+      std::vector<uint64_t>& indexes = m_global_indexes[id];
+      BOOST_FOREACH(const cryptonote::tx_out& out, tx.vout)
+        indexes.push_back(m_outputs_count[out.amount]++);
+    }
+
+    std::vector<cryptonote::block> m_blocks;
+    std::vector<crypto::hash> m_ids;
+    std::unordered_map<crypto::hash, cryptonote::transaction> m_txs;
+    std::unordered_map<crypto::hash, std::vector<uint64_t>> m_global_indexes;
+    std::map<uint64_t, uint64_t> m_outputs_count;
+    uint32_t m_nonce;
+  };
+
+  /*! \brief Serves a test_chain over the daemon RPC calls a wallet refreshes and sends through
+   */
+  class test_daemon: public epee::http_server_impl_base<test_daemon>
+  {
+  public:
+    typedef epee::net_utils::connection_context_base connection_context;
+
+    test_daemon()
+      : m_max_blocks(COMMAND_RPC_GET_BLOCKS_FAST_MAX_COUNT)
+      , m_compact_blocks(true)
+      , m_forged_height(std::numeric_limits<uint64_t>::max())
+    {
+    }
+
+    ~test_daemon()
+    {
+      send_stop_signal();
+      deinit();
+    }
+
+    bool start()
+    {
+      return init("0", "127.0.0.1") && run(2, false);
+    }
+
+    std::string address()
+    {
+      return "http://127.0.0.1:" + std::to_string(get_binded_port());
+    }
+
+    void set_chain(const test_chain& chain)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      m_chain = chain;
+    }
+
+    //! Most blocks served per getblocks call
+    void set_max_blocks(size_t max_blocks) { m_max_blocks = max_blocks; }
+    //! Without compact blocks, getblocks_compact.bin is not found, like on older daemons
+    void set_compact_blocks(bool compact_blocks) { m_compact_blocks = compact_blocks; }
+    //! The compact entry of the block at height gets a timestamp its id doesn't commit to
+    void set_forged_height(uint64_t height) { m_forged_height = height; }
+
+    std::list<cryptonote::transaction> get_sent_transactions()
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      return m_sent_txs;
+    }
+
+    CHAIN_HTTP_TO_MAP2(connection_context);
+
+    BEGIN_URI_MAP2()
+      else if(!m_compact_blocks && query_info.m_URI == "/getblocks_compact.bin") return false;
+      MAP_URI_AUTO_BIN2("/getblocks.bin", on_get_blocks, cryptonote::COMMAND_RPC_GET_BLOCKS_FAST)
+      MAP_URI_AUTO_BIN2("/getblocks_compact.bin", on_get_blocks_compact, cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT)
+      MAP_URI_AUTO_BIN2("/get_o_indexes.bin", on_get_indexes, cryptonote::COMMAND_RPC_GET_TX_GLOBAL_OUTPUTS_INDEXES)
+      MAP_URI_AUTO_JON2("/gettransactions", on_get_transactions, cryptonote::COMMAND_RPC_GET_TRANSACTIONS)
+      MAP_URI_AUTO_JON2("/sendrawtransaction", on_send_raw_tx, cryptonote::COMMAND_RPC_SEND_RAW_TX)
+    END_URI_MAP2()
+
+  private:
+    bool on_get_blocks(const cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::request& req, cryptonote::COMMAND_RPC_GET_BLOCKS_FAST::response& res)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      if(!m_chain.find_supplement(req.block_ids, res.start_height))
+        return false;
+      for(size_t h = res.start_height; h < m_chain.height() && h - res.start_height < m_max_blocks; h++)
+      {
+        const cryptonote::block& b = m_chain.get_block(h);
+        res.blocks.push_back(cryptonote::block_complete_entry());
+        res.blocks.back().block = cryptonote::block_to_blob(b);
+        BOOST_FOREACH(const crypto::hash& tx_id, b.tx_hashes)
+          res.blocks.back().txs.push_back(cryptonote::tx_to_blob(*m_chain.find_transaction(tx_id)));
+      }
+      res.current_height = m_chain.height();
+      res.status = CORE_RPC_STATUS_OK;
+      return true;
+    }
+
+    bool on_get_blocks_compact(const cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::request& req, cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::response& res)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      if(!m_chain.find_supplement(req.block_ids, res.start_height))
+        return false;
+      for(size_t h = res.start_height; h < m_chain.height() && h - res.start_height < m_max_blocks; h++)
+      {
+        const cryptonote::block& b = m_chain.get_block(h);
+        res.blocks.push_back(cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::block_entry());
+        cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::block_entry& e = res.blocks.back();
+        cryptonote::get_compact_block_header(b, m_chain.get_block_id(h), e);
+        if(h == m_forged_height)
+          ++e.timestamp;
+        e.txs.resize(b.tx_hashes.size() + 1);
+        add_compact_tx_entry(cryptonote::get_transaction_hash(b.miner_tx), e.txs[0]);
+        for(size_t i = 0; i != b.tx_hashes.size(); i++)
+          add_compact_tx_entry(b.tx_hashes[i], e.txs[i + 1]);
+      }
+      res.current_height = m_chain.height();
+      res.status = CORE_RPC_STATUS_OK;
+      return true;
+    }
+
+    void add_compact_tx_entry(const crypto::hash& tx_id, cryptonote::COMMAND_RPC_GET_BLOCKS_COMPACT::tx_entry& e)
+    {
+      cryptonote::get_compact_tx_entry(*m_chain.find_transaction(tx_id), tx_id, *m_chain.find_global_indexes(tx_id), e);
+    }
+
+    bool on_get_indexes(const cryptonote::COMMAND_RPC_GET_TX_GLOBAL_OUTPUTS_INDEXES::request& req, cryptonote::COMMAND_RPC_GET_TX_GLOBAL_OUTPUTS_INDEXES::response& res)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      const std::vector<uint64_t>* indexes = m_chain.find_global_indexes(req.txid);
+      if(!indexes)
+        return false;
+      res.o_indexes = *indexes;
+      res.status = CORE_RPC_STATUS_OK;
+      return true;
+    }
+
+    bool on_get_transactions(const cryptonote::COMMAND_RPC_GET_TRANSACTIONS::request& req, cryptonote::COMMAND_RPC_GET_TRANSACTIONS::response& res)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      BOOST_FOREACH(const std::string& tx_hex, req.txs_hashes)
+      {
+        crypto::hash tx_id;
+        const cryptonote::transaction* tx = epee::string_tools::hex_to_pod(tx_hex, tx_id) ? m_chain.find_transaction(tx_id) : NULL;
+        if(tx)
+          res.txs_as_hex.push_back(epee::string_tools::buff_to_hex_nodelimer(cryptonote::tx_to_blob(*tx)));
+        else
+          res.missed_tx.push_back(tx_hex);
+      }
+      res.status = CORE_RPC_STATUS_OK;
+      return true;
+    }
+
+    bool on_send_raw_tx(const cryptonote::COMMAND_RPC_SEND_RAW_TX::request& req, cryptonote::COMMAND_RPC_SEND_RAW_TX::response& res)
+    {
+      boost::unique_lock<boost::mutex> lock(m_lock);
+      cryptonote::blobdata tx_blob;
+      m_sent_txs.push_back(cryptonote::transaction());
+      if(!epee::string_tools::parse_hexstr_to_binbuff(req.tx_as_hex, tx_blob) || !cryptonote::parse_and_validate_tx_from_blob(tx_blob, m_sent_txs.back()))
+      {
+        m_sent_txs.pop_back();
+        return false;
+      }
+      res.status = CORE_RPC_STATUS_OK;
+      return true;
+    }
+
+    boost::mutex m_lock;
+    test_chain m_chain;
+    std::list<cryptonote::transaction> m_sent_txs;
+    std::atomic<size_t> m_max_blocks;
+    std::atomic<bool> m_compact_blocks;
+    std::atomic<uint64_t> m_forged_height;
+  };
+
+  /*! \brief Wallets in a temporary directory, refreshing from a test_daemon
+   */
+  class wallet_test : public ::testing::Test
+  {
+  protected:
+    virtual void SetUp()
+    {
+      m_dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("wallet_test-%%%%-%%%%-%%%%");
+      boost::filesystem::create_directories(m_dir);
+      ASSERT_TRUE(m_daemon.start());
+    }
+
+    virtual void TearDown()
+    {
+      boost::system::error_code ec;
+      boost::filesystem::remove_all(m_dir, ec);
+    }
+
+    //! Makes a wallet talking to m_daemon, with the keys of keys_of if given
+    void make_wallet(tools::wallet2& w, const std::string& name, tools::wallet2* keys_of = NULL)
+    {
+      std::string path = (m_dir / name).string();
+      if(keys_of)
+        w.generate(path, "x", keys_of->get_account().get_keys().m_spend_secret_key, true);
+      else
+        w.generate(path, "x");
+      w.init(m_daemon.address());
+    }
+
+    //! Loads the wallet stored under name, talking to m_daemon
+    void load_wallet(tools::wallet2& w, const std::string& name)
+    {
+      w.load((m_dir / name).string(), "x");
+      w.init(m_daemon.address());
+    }
+
+    void refresh(tools::wallet2& w, size_t max_blocks)
+    {
+      m_daemon.set_max_blocks(max_blocks);
+      size_t blocks_fetched = 0;
+      w.refresh(0, blocks_fetched);
+    }
+
+    boost::filesystem::path m_dir;
+    test_daemon m_daemon;
+  };
+
+  inline void expect_same_wallets(tools::wallet2& a, tools::wallet2& b)
+  {
+    EXPECT_EQ(a.get_blockchain_current_height(), b.get_blockchain_current_height());
+    EXPECT_EQ(a.balance(), b.balance());
+    EXPECT_EQ(a.unlocked_balance(), b.unlocked_balance());
+
+    tools::wallet2::transfer_container transfers_a, transfers_b;
+    a.get_transfers(transfers_a);
+    b.get_transfers(transfers_b);
+    ASSERT_EQ(transfers_a.size(), transfers_b.size());
+    for(size_t i = 0; i != transfers_a.size(); i++)
+    {
+      EXPECT_EQ(transfers_a[i].m_block_height, transfers_b[i].m_block_height);
+      EXPECT_EQ(transfers_a[i].m_txid, transfers_b[i].m_txid);
+      EXPECT_EQ(transfers_a[i].m_internal_output_index, transfers_b[i].m_internal_output_index);
+      EXPECT_EQ(transfers_a[i].m_global_output_index, transfers_b[i].m_global_output_index);
+      EXPECT_EQ(transfers_a[i].amount(), transfers_b[i].amount());
+      EXPECT_EQ(transfers_a[i].m_spent, transfers_b[i].m_spent);
+      EXPECT_EQ(transfers_a[i].m_key_image, transfers_b[i].m_key_image);
+    }
+
+    std::list<std::pair<crypto::hash, tools::wallet2::payment_details>> payments_a, payments_b;
+    a.get_payments(payments_a, 0);
+    b.get_payments(payments_b, 0);
+    ASSERT_EQ(payments_a.size(), payments_b.size());
+    //payments sharing a payment id come in no particular order
+    auto payment_less = [](const std::pair<crypto::hash, tools::wallet2::payment_details>& l, const std::pair<crypto::hash, tools::wallet2::payment_details>& r)
+    {
+      if(l.second.m_block_height != r.second.m_block_height)
+        return l.second.m_block_height < r.second.m_block_height;
+      return memcmp(&l.second.m_tx_hash, &r.second.m_tx_hash, sizeof(crypto::hash)) < 0;
+    };
+    payments_a.sort(payment_less);
+    payments_b.sort(payment_less);
+    for(auto ia = payments_a.begin(), ib = payments_b.begin(); ia != payments_a.end(); ++ia, ++ib)
+    {
+      EXPECT_EQ(ia->second.m_tx_hash, ib->second.m_tx_hash);
+      EXPECT_EQ(ia->second.m_amount, ib->second.m_amount);
+      EXPECT_EQ(ia->second.m_block_height, ib->second.m_block_height);
+    }
+  }
+}
@@ -0,0 +1,202 @@
+// Copyright (c) 2014-2015, The Monero Project
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are
+// permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this list of
+//    conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice, this list
+//    of conditions and the following disclaimer in the documentation and/or other
+//    materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors may be
+//    used to endorse or promote products derived from this software without specific
+//    prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+// MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+// THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+// THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "gtest/gtest.h"
+
+#include <unordered_set>
+
+#include "wallet_tests_utils.h"
+
+using namespace cryptonote;
+
+namespace
+{
+  const uint64_t FEE = 10000000000;
+
+  class wallet_transfers : public unit_test::wallet_test
+  {
+  protected:
+    virtual void SetUp()
+    {
+      unit_test::wallet_test::SetUp();
+      make_wallet(m_alice, "alice");
+      make_wallet(m_bob, "bob");
+    }
+
+    //! Pays each of amounts to bob in its own transaction, all of them in one new block
+    void pay_bob(unit_test::test_chain& chain, const std::vector<uint64_t>& amounts, uint64_t unlock_time = 0)
+    {
+      const account_keys& alice_keys = m_alice.get_account().get_keys();
+      std::list<transaction> sources;
+      for(size_t i = 0; i != amounts.size(); i++)
+        sources.push_back(chain.mine_block(alice_keys.m_account_address));
+      std::list<transaction> txs;
+      BOOST_FOREACH(const transaction& source, sources)
+      {
+        txs.push_back(chain.make_transfer(alice_keys, source, m_bob.get_account().get_keys().m_account_address, amounts[txs.size()], FEE, unlock_time));
+      }
+      chain.mine_block(alice_keys.m_account_address, txs);
+    }
+
+    void update(const unit_test::test_chain& chain)
+    {
+      m_daemon.set_chain(chain);
+      refresh(m_bob, 4);
+    }
+
+    //! The transfers of bob the inputs of tx spend
+    std::vector<tools::wallet2::transfer_details> get_inputs(const transaction& tx)
+    {
+      tools::wallet2::transfer_container transfers;
+      m_bob.get_transfers(transfers);
+      std::vector<tools::wallet2::transfer_details> inputs;
+      BOOST_FOREACH(const txin_v& in, tx.vin)
+      {
+        const crypto::key_image& k_image = boost::get<txin_to_key>(in).k_image;
+        auto it = std::find_if(transfers.begin(), transfers.end(), [&](const tools::wallet2::transfer_details& td) { return td.m_key_image == k_image; });
+        EXPECT_TRUE(it != transfers.end());
+        if(it != transfers.end())
+          inputs.push_back(*it);
+      }
+      return inputs;
+    }
+
+    tools::wallet2 m_alice;
+    tools::wallet2 m_bob;
+  };
+
+  size_t count_at_most(const std::vector<tools::wallet2::transfer_details>& transfers, uint64_t amount)
+  {
+    return std::count_if(transfers.begin(), transfers.end(), [amount](const tools::wallet2::transfer_details& td) { return td.amount() <= amount; });
+  }
+}
+
+TEST_F(wallet_transfers, unlock_by_age_height_and_time)
+{
+  unit_test::test_chain chain;
+  pay_bob(chain, std::vector<uint64_t>(1, 1000000000000));
+  const uint64_t height_lock = chain.height() + 2 * DEFAULT_TX_SPENDABLE_AGE;
+  pay_bob(chain, std::vector<uint64_t>(1, 2000000000000), height_lock);
+  //time locks long past and far ahead, whenever the test runs
+  pay_bob(chain, std::vector<uint64_t>(1, 4000000000000), CRYPTONOTE_MAX_BLOCK_NUMBER);
+  pay_bob(chain, std::vector<uint64_t>(1, 8000000000000), std::numeric_limits<uint32_t>::max());
+  update(chain);
+  EXPECT_EQ(15000000000000, m_bob.balance());
+  EXPECT_EQ(0, m_bob.unlocked_balance());
+
+  //past the spendable age of all of them, the past time lock doesn't hold its transfer back
+  chain.mine_blocks(m_alice.get_account().get_keys().m_account_address, DEFAULT_TX_SPENDABLE_AGE);
+  update(chain);
+  EXPECT_EQ(5000000000000, m_bob.unlocked_balance());
+
+  //the height lock comes next, the time lock ahead is never reached
+  while(chain.height() + CRYPTONOTE_LOCKED_TX_ALLOWED_DELTA_BLOCKS <= height_lock)
+  {
+    EXPECT_EQ(5000000000000, m_bob.unlocked_balance());
+    chain.mine_block(m_alice.get_account().get_keys().m_account_address);
+    update(chain);
+  }
+  EXPECT_EQ(7000000000000, m_bob.unlocked_balance());
+  EXPECT_EQ(15000000000000, m_bob.balance());
+}
+
+TEST_F(wallet_transfers, spent_transfers_leave_and_rejoin_balances)
+{
+  const account_public_address& alice_address = m_alice.get_account().get_keys().m_account_address;
+  unit_test::test_chain chain;
+  const uint64_t amounts[] = {3000000000000, 2000000000000};
+  pay_bob(chain, std::vector<uint64_t>(amounts, amounts + 2));
+  chain.mine_blocks(alice_address, DEFAULT_TX_SPENDABLE_AGE);
+  update(chain);
+  EXPECT_EQ(5000000000000, m_bob.balance());
+  EXPECT_EQ(5000000000000, m_bob.unlocked_balance());
+
+  //the transfers picked are marked spent while the transactions are made, and unspent again once they are
+  std::vector<tx_destination_entry> dsts(1, tx_destination_entry(1000000000000, alice_address));
+  std::vector<tools::wallet2::pending_tx> ptxs = m_bob.create_transactions(dsts, 0, 0, 0, std::vector<uint8_t>());
+  ASSERT_EQ(1, ptxs.size());
+  EXPECT_EQ(5000000000000, m_bob.balance());
+  EXPECT_EQ(5000000000000, m_bob.unlocked_balance());
+  uint64_t inputs_amount = 0;
+  BOOST_FOREACH(const tools::wallet2::transfer_details& td, get_inputs(ptxs[0].tx))
+    inputs_amount += td.amount();
+
+  //sent, the change counts in the balance until it is received
+  m_bob.commit_tx(ptxs);
+  const uint64_t balance = 5000000000000 - 1000000000000 - ptxs[0].fee;
+  EXPECT_EQ(balance, m_bob.balance());
+  EXPECT_EQ(5000000000000 - inputs_amount, m_bob.unlocked_balance());
+  chain.mine_block(alice_address, std::list<transaction>(1, ptxs[0].tx));
+  update(chain);
+  EXPECT_EQ(balance, m_bob.balance());
+  EXPECT_EQ(5000000000000 - inputs_amount, m_bob.unlocked_balance());
+  chain.mine_blocks(alice_address, DEFAULT_TX_SPENDABLE_AGE);
+  update(chain);
+  EXPECT_EQ(balance, m_bob.balance());
+  EXPECT_EQ(balance, m_bob.unlocked_balance());
+}
+
+TEST_F(wallet_transfers, transfer_picks_each_output_once)
+{
+  unit_test::test_chain chain;
+  const uint64_t amounts[] = {5000000000, 7000000000, 300000000000, 2000000000000, 4000000000000, 6000000000000};
+  pay_bob(chain, std::vector<uint64_t>(amounts, amounts + sizeof(amounts) / sizeof(amounts[0])));
+  chain.mine_blocks(m_alice.get_account().get_keys().m_account_address, DEFAULT_TX_SPENDABLE_AGE);
+  update(chain);
+  const uint64_t total = 12312000000000;
+  ASSERT_EQ(total, m_bob.unlocked_balance());
+
+  std::vector<tx_destination_entry> dsts(1, tx_destination_entry(1000000000000, m_alice.get_account().get_keys().m_account_address));
+  std::unordered_set<crypto::key_image> spent;
+  uint64_t unlocked = total;
+  uint64_t balance = total;
+  for(size_t i = 0; i != 2; i++)
+  {
+    //without mixins, a single output at or below the dust threshold goes along
+    const uint64_t dust = i ? 1000000000000 : ::config::DEFAULT_DUST_THRESHOLD;
+    transaction tx;
+    tools::wallet2::pending_tx ptx;
+    m_bob.transfer(dsts, 0, 0, FEE, std::vector<uint8_t>(), tools::detail::digit_split_strategy, tools::tx_dust_policy(dust), tx, ptx);
+    std::vector<tools::wallet2::transfer_details> inputs = get_inputs(tx);
+    ASSERT_EQ(tx.vin.size(), inputs.size());
+    EXPECT_EQ(1, count_at_most(inputs, dust));
+    uint64_t inputs_amount = 0;
+    BOOST_FOREACH(const tools::wallet2::transfer_details& td, inputs)
+    {
+      EXPECT_FALSE(td.m_spent);
+      EXPECT_TRUE(spent.insert(td.m_key_image).second);
+      inputs_amount += td.amount();
+    }
+
+    m_bob.commit_tx(ptx);
+    unlocked -= inputs_amount;
+    balance -= FEE + 1000000000000;
+    EXPECT_EQ(unlocked, m_bob.unlocked_balance());
+    EXPECT_EQ(balance, m_bob.balance());
+  }
+}